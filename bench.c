@@ -0,0 +1,542 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * End-to-end throughput benchmark. Generates synthetic sequence in memory,
+ * encodes it capturing the bitstream in memory as well, then decodes the
+ * bitstream back. No files are involved so the numbers reflect the
+ * pipelines only. Results are printed as JSON for regression tracking
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "rockchip/rk_mpi.h"
+#include "rockchip/mpp_buffer.h"
+
+#include "yuv_reader.h"
+#include "synth.h"
+#include "cpu_affinity.h"
+#include "metrics.h"
+#include "video_codec.h"
+#include "h264_encoder_mpp.h"
+#include "h264_decoder_mpp.h"
+
+/* Distinct frames generated up front, the sequence cycles through them */
+#define SYNTH_FRAMES        16
+/* Largest chunk h264_decoder_mpp_submit_packet accepts */
+#define SUBMIT_CHUNK_SIZE   (4*1024)
+/* Decoder is considered drained if EOS never shows up for that many polls */
+#define DRAIN_IDLE_POLLS    300
+
+#define UP_TO_16(x) (((x) + 0xf) & ~0xf)
+
+struct bench
+{
+    int                 width;
+    int                 height;
+    int                 frames;
+    int                 motion;
+    int                 nv12;
+    int                 bps;
+    enum video_codec    codec;
+
+    /* Encoded bitstream */
+    uint8_t             *stream;
+    size_t              stream_size;
+    size_t              stream_alloc;
+    /* Offset of every frame in the bitstream, -1 until its packet shows up */
+    ssize_t             *offsets;
+    int                 current;
+
+    /* Per-frame latency, nanoseconds */
+    uint64_t            *submitted;
+    uint64_t            *latency;
+    int                 decoded;
+};
+
+struct result
+{
+    const char          *name;
+    int                 frames;
+    double              seconds;
+    size_t              raw_bytes;
+    size_t              stream_bytes;
+    uint64_t            *latency;
+};
+
+static int
+compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x < y) ? -1 : (x > y);
+}
+
+/* Nearest-rank percentile of sorted @values, in milliseconds */
+static double
+percentile(const uint64_t *values, int count, int pct)
+{
+    int rank;
+
+    if (count == 0)
+        return (0);
+
+    rank = (count * pct + 99) / 100;
+    if (rank < 1)
+        rank = 1;
+
+    return (values[rank - 1] / 1e6);
+}
+
+/* Standard deviation of @values in milliseconds, how uneven frames are */
+static double
+stddev(const uint64_t *values, int count)
+{
+    double mean = 0, var = 0;
+
+    if (count == 0)
+        return (0);
+
+    for (int i = 0; i < count; i++)
+        mean += values[i];
+    mean /= count;
+    for (int i = 0; i < count; i++)
+        var += (values[i] - mean) * (values[i] - mean);
+
+    return (sqrt(var / count) / 1e6);
+}
+
+/*
+ * Called for every encoded packet, appends it to the in-memory bitstream
+ */
+static void
+bench_encoder_callback(void *ptr, uint8_t *data, ssize_t len)
+{
+    struct bench *bench = (struct bench *)ptr;
+
+    if (bench->stream_size + len > bench->stream_alloc) {
+        size_t alloc = bench->stream_alloc ? bench->stream_alloc * 2 : SUBMIT_CHUNK_SIZE;
+        uint8_t *stream;
+
+        while (alloc < bench->stream_size + len)
+            alloc *= 2;
+        stream = realloc(bench->stream, alloc);
+        if (stream == NULL) {
+            fprintf(stderr, "failed to grow bitstream buffer\n");
+            exit(1);
+        }
+        bench->stream = stream;
+        bench->stream_alloc = alloc;
+    }
+
+    /* Parameter sets come before any frame */
+    if ((bench->current >= 0) && (bench->current < bench->frames) &&
+        (bench->offsets[bench->current] < 0) && (len > 0))
+        bench->offsets[bench->current] = bench->stream_size;
+
+    memcpy(bench->stream + bench->stream_size, data, len);
+    bench->stream_size += len;
+}
+
+/*
+ * Called for every decoded frame. The frame format is NV12
+ */
+static void
+bench_decoder_callback(void *ptr, uint8_t *yplane, uint8_t *uvplane,
+    int width, int height, int h_stride, int v_stride)
+{
+    struct bench *bench = (struct bench *)ptr;
+
+    if (bench->decoded < bench->frames)
+        bench->latency[bench->decoded] = metrics_now_ns() - bench->submitted[bench->decoded];
+    bench->decoded++;
+}
+
+static int
+bench_encode_i420(struct bench *bench, struct h264_encoder_mpp *encoder)
+{
+    yuv_frame_t frames[SYNTH_FRAMES] = { NULL };
+    int count = (bench->frames < SYNTH_FRAMES) ? bench->frames : SYNTH_FRAMES;
+    int ret = 0;
+
+    for (int i = 0; i < count; i++) {
+        frames[i] = yuv_alloc_frame_size(bench->width, bench->height);
+        if (frames[i] == NULL) {
+            fprintf(stderr, "failed to allocate frame\n");
+            exit(1);
+        }
+        synth_fill_i420(frames[i], i, bench->motion);
+    }
+
+    for (int i = 0; (i < bench->frames) && (ret == 0); i++) {
+        uint64_t begin = metrics_now_ns();
+
+        bench->current = i;
+        ret = h264_mpp_encoder_submit_frame(encoder, frames[i % count], 0);
+        bench->latency[i] = metrics_now_ns() - begin;
+    }
+
+    bench->current = -1;
+    if (ret == 0)
+        ret = h264_mpp_encoder_submit_frame(encoder, frames[0], 1);
+
+    for (int i = 0; i < count; i++)
+        yuv_free_frame(frames[i]);
+
+    return (ret < 0 ? -1 : 0);
+}
+
+static int
+bench_encode_nv12(struct bench *bench, struct h264_encoder_mpp *encoder)
+{
+    MppBufferGroup group = NULL;
+    MppBuffer buffers[SYNTH_FRAMES];
+    int count = (bench->frames < SYNTH_FRAMES) ? bench->frames : SYNTH_FRAMES;
+    int h_stride = UP_TO_16(bench->width);
+    int v_stride = UP_TO_16(bench->height);
+    int ret = 0;
+
+    if (mpp_buffer_group_get_internal(&group, MPP_BUFFER_TYPE_ION)) {
+        fprintf(stderr, "failed to get buffer group\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < count; i++) {
+        uint8_t *ptr;
+
+        if (mpp_buffer_get(group, &buffers[i], h_stride * v_stride * 3 / 2)) {
+            fprintf(stderr, "failed to allocate MPP buffer\n");
+            exit(1);
+        }
+        ptr = mpp_buffer_get_ptr(buffers[i]);
+        synth_fill_nv12(ptr, ptr + h_stride * v_stride, bench->width, bench->height,
+            h_stride, i, bench->motion);
+    }
+
+    for (int i = 0; (i < bench->frames) && (ret == 0); i++) {
+        uint64_t begin = metrics_now_ns();
+
+        bench->current = i;
+        ret = h264_mpp_encoder_submit_buffer(encoder, buffers[i % count], 0);
+        bench->latency[i] = metrics_now_ns() - begin;
+    }
+
+    bench->current = -1;
+    if (ret == 0)
+        ret = h264_mpp_encoder_submit_buffer(encoder, NULL, 1);
+
+    for (int i = 0; i < count; i++)
+        mpp_buffer_put(buffers[i]);
+    mpp_buffer_group_put(group);
+
+    return (ret < 0 ? -1 : 0);
+}
+
+static int
+bench_encode(struct bench *bench, struct result *result)
+{
+    struct h264_encoder_params params;
+    struct h264_encoder_mpp *encoder;
+    uint64_t begin;
+    int ret;
+
+    h264_mpp_encoder_default_params(&params, bench->width, bench->height);
+    params.bps = bench->bps;
+    params.codec = bench->codec;
+    if (bench->nv12) {
+        params.input = H264_ENCODER_INPUT_NV12;
+        params.h_stride = UP_TO_16(bench->width);
+        params.v_stride = UP_TO_16(bench->height);
+    }
+
+    bench->current = -1;
+    encoder = h264_mpp_encoder_create_with_params(&params, bench_encoder_callback, bench);
+    if (encoder == NULL) {
+        fprintf(stderr, "failed to create encoder\n");
+        return (-1);
+    }
+
+    begin = metrics_now_ns();
+    if (bench->nv12)
+        ret = bench_encode_nv12(bench, encoder);
+    else
+        ret = bench_encode_i420(bench, encoder);
+    result->seconds = (metrics_now_ns() - begin) / 1e9;
+
+    h264_mpp_encoder_destroy(encoder);
+
+    result->name = "encode";
+    result->frames = bench->frames;
+    result->raw_bytes = (size_t)bench->frames * bench->width * bench->height * 3 / 2;
+    result->stream_bytes = bench->stream_size;
+    result->latency = bench->latency;
+
+    return (ret);
+}
+
+static int
+bench_decode(struct bench *bench, struct result *result)
+{
+    struct h264_decoder_mpp *decoder;
+    size_t pos = 0;
+    int next = 0;
+    int ret = 0, idle = 0;
+    uint64_t begin;
+
+    decoder = h264_mpp_decoder_create_codec(bench->codec, bench_decoder_callback, bench);
+    if (decoder == NULL) {
+        fprintf(stderr, "failed to create decoder\n");
+        return (-1);
+    }
+
+    begin = metrics_now_ns();
+    while ((pos < bench->stream_size) && (ret >= 0)) {
+        size_t len = bench->stream_size - pos;
+        int decoded;
+
+        if (len > SUBMIT_CHUNK_SIZE)
+            len = SUBMIT_CHUNK_SIZE;
+
+        ret = h264_decoder_mpp_submit_packet(decoder, bench->stream + pos, len);
+        if (ret == 0) {
+            /* Latency of the frame counts from submission of its first byte */
+            uint64_t now = metrics_now_ns();
+            while ((next < bench->frames) && (bench->offsets[next] >= 0) &&
+                   (bench->offsets[next] < pos + len))
+                bench->submitted[next++] = now;
+            pos += len;
+        }
+        else if (ret != EAGAIN)
+            break;
+
+        do {
+            decoded = bench->decoded;
+            ret = h264_decoder_mpp_get_frame(decoder);
+        } while ((ret == 0) && (bench->decoded != decoded));
+    }
+
+    if (ret >= 0) {
+        while (h264_decoder_mpp_submit_eos(decoder) == EAGAIN)
+            h264_decoder_mpp_get_frame(decoder);
+
+        while (idle < DRAIN_IDLE_POLLS) {
+            int decoded = bench->decoded;
+
+            ret = h264_decoder_mpp_get_frame(decoder);
+            if ((ret == 1) || (ret < 0))
+                break;
+            if (bench->decoded == decoded) {
+                idle++;
+                usleep(1000);
+            }
+            else
+                idle = 0;
+        }
+    }
+    result->seconds = (metrics_now_ns() - begin) / 1e9;
+
+    h264_decoder_mpp_destroy(decoder);
+
+    if (bench->decoded != bench->frames)
+        fprintf(stderr, "decoded %d frames out of %d\n", bench->decoded, bench->frames);
+
+    result->name = "decode";
+    result->frames = (bench->decoded < bench->frames) ? bench->decoded : bench->frames;
+    result->raw_bytes = (size_t)result->frames * bench->width * bench->height * 3 / 2;
+    result->stream_bytes = bench->stream_size;
+    result->latency = bench->latency;
+
+    return (ret < 0 ? -1 : 0);
+}
+
+static void
+report_result(FILE *out, struct result *result)
+{
+    qsort(result->latency, result->frames, sizeof(uint64_t), compare_u64);
+
+    fprintf(out, "  \"%s\": {\n", result->name);
+    fprintf(out, "    \"frames\": %d,\n", result->frames);
+    fprintf(out, "    \"seconds\": %.6f,\n", result->seconds);
+    fprintf(out, "    \"fps\": %.2f,\n",
+        result->seconds > 0 ? result->frames / result->seconds : 0.0);
+    fprintf(out, "    \"raw_mb_per_s\": %.2f,\n",
+        result->seconds > 0 ? result->raw_bytes / result->seconds / (1024*1024) : 0.0);
+    fprintf(out, "    \"stream_bytes\": %zu,\n", result->stream_bytes);
+    fprintf(out, "    \"latency_ms\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"stddev\": %.3f}\n",
+        percentile(result->latency, result->frames, 50),
+        percentile(result->latency, result->frames, 99),
+        percentile(result->latency, result->frames, 100),
+        stddev(result->latency, result->frames));
+    fprintf(out, "  },\n");
+}
+
+static void
+usage(const char *exe)
+{
+    fprintf(stderr, "Usage: %s [-c h264|hevc] [-w width] [-h height] [-n frames] [-m motion] [-b kbps]\n"
+        "    [-f i420|nv12] [-a cpus] [-o report.json]\n", exe);
+    exit(1);
+}
+
+int
+main(int argc, char * const *argv)
+{
+    struct bench bench;
+    struct result encode, decode;
+    struct rusage usage_info;
+    const char *exe, *report = NULL;
+    char cpus[256];
+    FILE *out = stdout;
+    int ch;
+
+    exe = argv[0];
+    memset(&bench, 0, sizeof(bench));
+    bench.width = 1280;
+    bench.height = 720;
+    bench.frames = 300;
+    bench.motion = 4;
+    bench.bps = 4000*1000;
+    bench.codec = VIDEO_CODEC_H264;
+
+    while ((ch = getopt(argc, argv, "a:b:c:f:h:m:n:o:w:")) != -1) {
+        switch (ch) {
+            case 'a':
+                     if (cpu_affinity_config(optarg) < 0)
+                         usage(exe);
+                     break;
+            case 'b':
+                     bench.bps = atoi(optarg) * 1000;
+                     break;
+            case 'c':
+                     if (strcmp(optarg, "hevc") == 0)
+                         bench.codec = VIDEO_CODEC_HEVC;
+                     else if (strcmp(optarg, "h264") != 0)
+                         usage(exe);
+                     break;
+            case 'f':
+                     if (strcmp(optarg, "nv12") == 0)
+                         bench.nv12 = 1;
+                     else if (strcmp(optarg, "i420") != 0)
+                         usage(exe);
+                     break;
+            case 'h':
+                     bench.height = atoi(optarg);
+                     break;
+            case 'm':
+                     bench.motion = atoi(optarg);
+                     break;
+            case 'n':
+                     bench.frames = atoi(optarg);
+                     break;
+            case 'o':
+                     report = optarg;
+                     break;
+            case 'w':
+                     bench.width = atoi(optarg);
+                     break;
+            case '?':
+            default:
+                     usage(exe);
+        }
+    }
+
+    if ((bench.width <= 0) || (bench.height <= 0) || (bench.width % 2) || (bench.height % 2))
+        usage(exe);
+    if ((bench.frames <= 0) || (bench.bps <= 0))
+        usage(exe);
+
+    bench.offsets = malloc(bench.frames * sizeof(ssize_t));
+    bench.submitted = calloc(bench.frames, sizeof(uint64_t));
+    bench.latency = calloc(bench.frames, sizeof(uint64_t));
+    if (!bench.offsets || !bench.submitted || !bench.latency) {
+        fprintf(stderr, "failed to allocate frame tables\n");
+        exit(1);
+    }
+    for (int i = 0; i < bench.frames; i++)
+        bench.offsets[i] = -1;
+
+    /* Same placement as encoder/decoder get, to compare -a settings */
+    cpu_affinity_apply(CPU_ROLE_FEEDER);
+    if (cpu_affinity_current(cpus, sizeof(cpus)) < 0)
+        strcpy(cpus, "?");
+
+    fprintf(stderr, "Benchmarking %s %dx%d %s, %d frames\n",
+        (bench.codec == VIDEO_CODEC_HEVC) ? "HEVC" : "H264", bench.width, bench.height,
+        bench.nv12 ? "NV12" : "I420", bench.frames);
+
+    if (bench_encode(&bench, &encode) < 0) {
+        fprintf(stderr, "encoding failed\n");
+        exit(1);
+    }
+
+    if (report) {
+        out = fopen(report, "w");
+        if (out == NULL) {
+            fprintf(stderr, "failed to open '%s' for writing: %s\n", report, strerror(errno));
+            exit(1);
+        }
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"codec\": \"%s\",\n", (bench.codec == VIDEO_CODEC_HEVC) ? "hevc" : "h264");
+    fprintf(out, "  \"width\": %d,\n", bench.width);
+    fprintf(out, "  \"height\": %d,\n", bench.height);
+    fprintf(out, "  \"format\": \"%s\",\n", bench.nv12 ? "nv12" : "i420");
+    fprintf(out, "  \"motion\": %d,\n", bench.motion);
+    fprintf(out, "  \"bitrate_kbps\": %d,\n", bench.bps / 1000);
+    fprintf(out, "  \"cpus\": \"%s\",\n", cpus);
+    report_result(out, &encode);
+
+    /* Encoding latencies are already reported, table is reused */
+    memset(bench.latency, 0, bench.frames * sizeof(uint64_t));
+    if (bench_decode(&bench, &decode) < 0)
+        fprintf(stderr, "decoding failed\n");
+    report_result(out, &decode);
+
+    getrusage(RUSAGE_SELF, &usage_info);
+    /* ru_maxrss is in kilobytes on Linux */
+    fprintf(out, "  \"peak_rss_kb\": %ld\n", usage_info.ru_maxrss);
+    fprintf(out, "}\n");
+
+    if (out != stdout)
+        fclose(out);
+
+    free(bench.stream);
+    free(bench.offsets);
+    free(bench.submitted);
+    free(bench.latency);
+
+    return (0);
+}
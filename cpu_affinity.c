@@ -0,0 +1,321 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "cpu_affinity.h"
+
+#define PRIO_NONE       0
+#define PRIO_NICE       1
+#define PRIO_FIFO       2
+
+struct role_setting {
+    int         valid;
+    cpu_set_t   cpus;
+    int         prio_kind;
+    int         prio;
+};
+
+static const char *role_names[CPU_ROLE_MAX] = {
+    [CPU_ROLE_FEEDER] = "feeder",
+    [CPU_ROLE_READER] = "reader",
+};
+
+static struct role_setting settings[CPU_ROLE_MAX];
+static int auto_policy = 1;
+
+static long
+read_sysfs_long(int cpu, const char *name)
+{
+    char path[128];
+    FILE *f;
+    long value = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, name);
+    f = fopen(path, "r");
+    if (f == NULL)
+        return (0);
+    if (fscanf(f, "%ld", &value) != 1)
+        value = 0;
+    fclose(f);
+
+    return (value);
+}
+
+/*
+ * Split CPUs into big (the fastest ones) and LITTLE (the rest). Speed is
+ * cpu_capacity where kernel exports it, otherwise maximum frequency:
+ * 4.4 kernels for RK3399 have only the latter, A72 cores go up to 1.8GHz
+ * and A53 to 1.4GHz. Returns 1 if there are both kinds
+ */
+static int
+cpu_clusters(cpu_set_t *big, cpu_set_t *little)
+{
+    static const char *sources[] = { "cpu_capacity", "cpufreq/cpuinfo_max_freq" };
+    long perf[CPU_SETSIZE], best;
+    int ncpus, cpu;
+
+    CPU_ZERO(big);
+    CPU_ZERO(little);
+
+    ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (ncpus > CPU_SETSIZE)
+        ncpus = CPU_SETSIZE;
+
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        best = 0;
+        for (cpu = 0; cpu < ncpus; cpu++) {
+            perf[cpu] = read_sysfs_long(cpu, sources[i]);
+            if (perf[cpu] <= 0)
+                break;
+            if (perf[cpu] > best)
+                best = perf[cpu];
+        }
+
+        if (cpu < ncpus)
+            continue;
+
+        for (cpu = 0; cpu < ncpus; cpu++) {
+            if (perf[cpu] == best)
+                CPU_SET(cpu, big);
+            else
+                CPU_SET(cpu, little);
+        }
+
+        return (CPU_COUNT(little) > 0);
+    }
+
+    return (0);
+}
+
+/*
+ * CPU list in the kernel's format (0-3,5) or big/little
+ */
+static int
+parse_cpus(const char *str, cpu_set_t *set)
+{
+    cpu_set_t big, little;
+    char *end;
+    long first, last;
+
+    if ((strcmp(str, "big") == 0) || (strcmp(str, "little") == 0)) {
+        if (!cpu_clusters(&big, &little)) {
+            fprintf(stderr, "all CPUs are the same, no %s ones\n", str);
+            return (-1);
+        }
+        *set = (str[0] == 'b') ? big : little;
+        return (0);
+    }
+
+    CPU_ZERO(set);
+    while (*str) {
+        first = strtol(str, &end, 10);
+        if ((end == str) || (first < 0) || (first >= CPU_SETSIZE))
+            return (-1);
+        last = first;
+        if (*end == '-') {
+            str = end + 1;
+            last = strtol(str, &end, 10);
+            if ((end == str) || (last < first) || (last >= CPU_SETSIZE))
+                return (-1);
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return (-1);
+        str = end;
+    }
+
+    return (CPU_COUNT(set) > 0 ? 0 : -1);
+}
+
+static int
+parse_prio(const char *str, struct role_setting *setting)
+{
+    char *end;
+    long prio;
+
+    if (str[0] == 'f') {
+        prio = strtol(str + 1, &end, 10);
+        if ((end == str + 1) || *end || (prio < 1) || (prio > 99))
+            return (-1);
+        setting->prio_kind = PRIO_FIFO;
+    } else {
+        prio = strtol(str, &end, 10);
+        if ((end == str) || *end || (prio < -20) || (prio > 19))
+            return (-1);
+        setting->prio_kind = PRIO_NICE;
+    }
+    setting->prio = prio;
+
+    return (0);
+}
+
+/*
+ * Take one -a argument, see cpu_affinity.h for the syntax
+ */
+int
+cpu_affinity_config(const char *spec)
+{
+    struct role_setting setting;
+    char buf[128], *cpus, *prio;
+    int role;
+
+    if (strcmp(spec, "none") == 0) {
+        auto_policy = 0;
+        memset(settings, 0, sizeof(settings));
+        return (0);
+    }
+
+    if (strcmp(spec, "auto") == 0) {
+        auto_policy = 1;
+        return (0);
+    }
+
+    if (strlen(spec) >= sizeof(buf))
+        goto bad;
+    strcpy(buf, spec);
+
+    cpus = strchr(buf, '=');
+    if (cpus == NULL)
+        goto bad;
+    *cpus++ = '\0';
+
+    for (role = 0; role < CPU_ROLE_MAX; role++)
+        if (strcmp(buf, role_names[role]) == 0)
+            break;
+    if (role == CPU_ROLE_MAX)
+        goto bad;
+
+    memset(&setting, 0, sizeof(setting));
+    prio = strchr(cpus, '@');
+    if (prio) {
+        *prio++ = '\0';
+        if (parse_prio(prio, &setting) < 0)
+            goto bad;
+    }
+
+    if (parse_cpus(cpus, &setting.cpus) < 0)
+        goto bad;
+
+    setting.valid = 1;
+    settings[role] = setting;
+
+    return (0);
+
+bad:
+    fprintf(stderr, "bad CPU setting '%s'\n", spec);
+    return (-1);
+}
+
+/*
+ * Move calling thread to CPUs of @role and set its priority. Failures
+ * are reported but not fatal, thread just runs where it did
+ */
+int
+cpu_affinity_apply(enum cpu_role role)
+{
+    struct role_setting *setting = &settings[role];
+    struct sched_param param;
+    cpu_set_t big, little;
+    const cpu_set_t *cpus = NULL;
+    int err, ret = 0;
+
+    if (setting->valid)
+        cpus = &setting->cpus;
+    else if (auto_policy && cpu_clusters(&big, &little))
+        cpus = (role == CPU_ROLE_READER) ? &little : &big;
+
+    if (cpus && (err = pthread_setaffinity_np(pthread_self(), sizeof(*cpus), cpus))) {
+        fprintf(stderr, "failed to move %s thread to its CPUs: %s\n",
+            role_names[role], strerror(err));
+        ret = -1;
+    }
+
+    switch (setting->prio_kind) {
+        case PRIO_NICE:
+            /* Linux keeps nice value per thread */
+            if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), setting->prio) < 0) {
+                fprintf(stderr, "failed to set nice %d for %s thread: %s\n",
+                    setting->prio, role_names[role], strerror(errno));
+                ret = -1;
+            }
+            break;
+        case PRIO_FIFO:
+            param.sched_priority = setting->prio;
+            if ((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))) {
+                fprintf(stderr, "failed to set SCHED_FIFO %d for %s thread: %s\n",
+                    setting->prio, role_names[role], strerror(err));
+                ret = -1;
+            }
+            break;
+    }
+
+    return (ret);
+}
+
+/*
+ * CPUs calling thread may run on, as a list like 4-5
+ */
+int
+cpu_affinity_current(char *buf, size_t len)
+{
+    cpu_set_t set;
+    size_t off = 0;
+    int cpu, last;
+
+    if ((len == 0) || (sched_getaffinity(0, sizeof(set), &set) < 0))
+        return (-1);
+
+    buf[0] = '\0';
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set))
+            continue;
+        for (last = cpu; (last + 1 < CPU_SETSIZE) && CPU_ISSET(last + 1, &set); last++)
+            ;
+        if (last > cpu)
+            off += snprintf(buf + off, len - off, "%s%d-%d", off ? "," : "", cpu, last);
+        else
+            off += snprintf(buf + off, len - off, "%s%d", off ? "," : "", cpu);
+        /* Truncated, buf + off would point past the buffer */
+        if (off >= len)
+            return (-1);
+        cpu = last;
+    }
+
+    return (0);
+}
@@ -0,0 +1,55 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __CPU_AFFINITY_H__
+#define __CPU_AFFINITY_H__
+
+/*
+ * Placement of pipeline threads on CPUs. RK3399 has two Cortex-A72 and
+ * four Cortex-A53 cores, a thread that polls MPP and copies frames runs
+ * noticeably slower and less evenly when the scheduler parks it on
+ * a LITTLE core. Each thread calls cpu_affinity_apply() with its role
+ * once it starts; threads (MPP's own included) inherit settings of
+ * the thread that created them until they apply their own.
+ *
+ * Setting is given as -a argument, may be repeated:
+ *   auto               feeder on big cores, reader on LITTLE ones (default,
+ *                      does nothing when all cores are the same)
+ *   none               leave all threads to the scheduler
+ *   role=cpus[@prio]   role is feeder or reader, cpus is a list like 0-3,5
+ *                      or big/little; prio is nice value or fN for SCHED_FIFO
+ */
+
+enum cpu_role {
+    CPU_ROLE_FEEDER = 0,        /* feeds MPP and takes results from it */
+    CPU_ROLE_READER,            /* reads input ahead, see yuv_prefetch.h */
+    CPU_ROLE_MAX
+};
+
+int cpu_affinity_config(const char *spec);
+int cpu_affinity_apply(enum cpu_role role);
+int cpu_affinity_current(char *buf, size_t len);
+
+#endif /* __CPU_AFFINITY_H__ */
@@ -0,0 +1,139 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM
+#elif defined(__SSE4_2__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_SSE42
+#endif
+
+#include "crc32c.h"
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY         0x82f63b78
+
+#if defined(CRC32C_ARM) || defined(CRC32C_SSE42)
+
+static inline uint32_t
+crc32c_u8(uint32_t crc, uint8_t v)
+{
+#if defined(CRC32C_ARM)
+    return (__crc32cb(crc, v));
+#else
+    return (_mm_crc32_u8(crc, v));
+#endif
+}
+
+static inline uint32_t
+crc32c_u64(uint32_t crc, uint64_t v)
+{
+#if defined(CRC32C_ARM)
+    return (__crc32cd(crc, v));
+#else
+    return (_mm_crc32_u64(crc, v));
+#endif
+}
+
+uint32_t
+crc32c_update(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    crc = ~crc;
+
+    for (; len && ((uintptr_t)p & 7); len--)
+        crc = crc32c_u8(crc, *p++);
+
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+
+        memcpy(&v, p, sizeof(v));
+        crc = crc32c_u64(crc, v);
+    }
+
+    for (; len; len--)
+        crc = crc32c_u8(crc, *p++);
+
+    return (~crc);
+}
+
+#else
+
+/* Slicing-by-8: table[k][b] is CRC of byte b followed by k zero bytes */
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void
+crc32c_init(void)
+{
+    for (int b = 0; b < 256; b++) {
+        uint32_t crc = b;
+
+        for (int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        crc32c_table[0][b] = crc;
+    }
+
+    for (int b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t crc = crc32c_table[k - 1][b];
+
+            crc32c_table[k][b] = (crc >> 8) ^ crc32c_table[0][crc & 0xff];
+        }
+    }
+}
+
+uint32_t
+crc32c_update(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    pthread_once(&crc32c_once, crc32c_init);
+
+    crc = ~crc;
+
+    for (; len >= 8; len -= 8, p += 8) {
+        uint32_t lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+
+        crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+            crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^
+            crc32c_table[3][p[4]] ^ crc32c_table[2][p[5]] ^
+            crc32c_table[1][p[6]] ^ crc32c_table[0][p[7]];
+    }
+
+    for (; len; len--)
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+
+    return (~crc);
+}
+
+#endif
@@ -0,0 +1,421 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "frame_writer.h"
+#include "video_codec.h"
+#include "h264_decoder_mpp.h"
+
+/* Largest chunk h264_decoder_mpp_submit_packet accepts */
+#define SUBMIT_CHUNK_SIZE   (4*1024)
+/* Chunks submitted to one stream before it goes back to the queue */
+#define QUANTUM_CHUNKS      16
+/* Frames fetched from one stream per turn at most */
+#define QUANTUM_FRAMES      4
+/* Stream is considered finished if EOS never shows up for that many turns */
+#define DRAIN_IDLE_TURNS    1000
+#define MAX_WORKERS         16
+
+enum stream_state {
+    STREAM_READING,
+    STREAM_DRAINING,
+    STREAM_DONE,
+};
+
+struct stream
+{
+    int                 index;
+    const char          *input;
+    int                 in_fd;
+    int                 out_fd;
+    enum stream_state   state;
+
+    struct h264_decoder_mpp *decoder;
+
+    /* Bitstream chunk not yet accepted by the decoder */
+    uint8_t             buf[SUBMIT_CHUNK_SIZE];
+    ssize_t             pending;
+    int                 eos_sent;
+    int                 idle_turns;
+
+    /* Statistics, updated only by the worker that owns the stream */
+    uint64_t            bytes;
+    int                 frames;
+    struct timespec     start;
+    struct timespec     end;
+
+    /* Run queue link */
+    struct stream       *next;
+};
+
+/*
+ * Streams wait in FIFO run queue. A worker takes the stream from the head,
+ * gives it a fixed quantum of work and puts it back at the tail, so every
+ * stream gets its turn and each decoder is used by one thread at a time
+ */
+struct server
+{
+    pthread_mutex_t     lock;
+    pthread_cond_t      ready;
+    pthread_cond_t      finished;
+    struct stream       *head;
+    struct stream       *tail;
+    int                 queued;
+    int                 active;
+
+    struct stream       *streams;
+    int                 count;
+};
+
+static double
+elapsed_since(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Called for every decoded frame. The frame format is NV12
+ */
+static void
+stream_frame_callback(void *ptr, uint8_t *yplane, uint8_t *uvplane,
+    int width, int height, int h_stride, int v_stride)
+{
+    struct stream *stream = (struct stream *)ptr;
+
+    stream->frames++;
+    frame_write_nv12(stream->out_fd, yplane, uvplane, width, height, h_stride);
+}
+
+static void
+queue_push(struct server *server, struct stream *stream)
+{
+    stream->next = NULL;
+    if (server->tail)
+        server->tail->next = stream;
+    else
+        server->head = stream;
+    server->tail = stream;
+    server->queued++;
+    metrics_gauge(METRIC_RUN_QUEUE, server->queued);
+    pthread_cond_signal(&server->ready);
+}
+
+static struct stream *
+queue_pop(struct server *server)
+{
+    struct stream *stream = server->head;
+
+    if (stream) {
+        server->head = stream->next;
+        if (server->head == NULL)
+            server->tail = NULL;
+        server->queued--;
+        metrics_gauge(METRIC_RUN_QUEUE, server->queued);
+    }
+
+    return (stream);
+}
+
+/*
+ * One turn of the stream. Returns non-zero if anything was done,
+ * i.e. data submitted or frame produced
+ */
+static int
+stream_run(struct stream *stream)
+{
+    int frames = stream->frames;
+    int progress = 0;
+    int ret;
+
+    if (stream->state == STREAM_READING) {
+        for (int i = 0; i < QUANTUM_CHUNKS; i++) {
+            if (stream->pending == 0) {
+                stream->pending = read(stream->in_fd, stream->buf, sizeof(stream->buf));
+                if (stream->pending <= 0) {
+                    stream->pending = 0;
+                    stream->state = STREAM_DRAINING;
+                    break;
+                }
+            }
+
+            ret = h264_decoder_mpp_submit_packet(stream->decoder, stream->buf, stream->pending);
+            if (ret == EAGAIN)
+                break;
+            if (ret < 0) {
+                stream->state = STREAM_DONE;
+                break;
+            }
+            stream->bytes += stream->pending;
+            stream->pending = 0;
+            progress = 1;
+        }
+    }
+
+    if ((stream->state == STREAM_DRAINING) && !stream->eos_sent) {
+        ret = h264_decoder_mpp_submit_eos(stream->decoder);
+        if (ret == 0)
+            stream->eos_sent = 1;
+        else if (ret < 0)
+            stream->state = STREAM_DONE;
+    }
+
+    for (int i = 0; (i < QUANTUM_FRAMES) && (stream->state != STREAM_DONE); i++) {
+        int before = stream->frames;
+
+        ret = h264_decoder_mpp_get_frame(stream->decoder);
+        if ((ret == 1) || (ret < 0))
+            stream->state = STREAM_DONE;
+        if (stream->frames == before)
+            break;
+    }
+
+    if (stream->frames != frames)
+        progress = 1;
+
+    if (stream->eos_sent && (stream->state == STREAM_DRAINING)) {
+        if (progress)
+            stream->idle_turns = 0;
+        else if (++stream->idle_turns > DRAIN_IDLE_TURNS)
+            stream->state = STREAM_DONE;
+    }
+
+    return (progress);
+}
+
+static void *
+worker_thread(void *arg)
+{
+    struct server *server = (struct server *)arg;
+    struct stream *stream;
+    int progress;
+
+    pthread_mutex_lock(&server->lock);
+    while (server->active > 0) {
+        stream = queue_pop(server);
+        if (stream == NULL) {
+            pthread_cond_wait(&server->ready, &server->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        progress = stream_run(stream);
+
+        /* Nothing to do for the stream right now, don't spin on it */
+        if (!progress && (stream->state != STREAM_DONE))
+            usleep(1000);
+
+        pthread_mutex_lock(&server->lock);
+        if (stream->state == STREAM_DONE) {
+            clock_gettime(CLOCK_MONOTONIC, &stream->end);
+            server->active--;
+            pthread_cond_broadcast(&server->ready);
+            pthread_cond_signal(&server->finished);
+        }
+        else
+            queue_push(server, stream);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    return (NULL);
+}
+
+static void
+report(struct server *server, int final)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (int i = 0; i < server->count; i++) {
+        struct stream *stream = &server->streams[i];
+        /* Stats are read without the owner's lock, good enough for a report */
+        double elapsed = elapsed_since(&stream->start,
+            (stream->state == STREAM_DONE) ? &stream->end : &now);
+
+        fprintf(stderr, "%sstream %d %s: %d frames, %.1f fps, %.2f MB/s%s\n",
+            final ? "" : "  ", stream->index, stream->input, stream->frames,
+            elapsed > 0 ? stream->frames / elapsed : 0.0,
+            elapsed > 0 ? stream->bytes / elapsed / (1024*1024) : 0.0,
+            (stream->state == STREAM_DONE) ? " (done)" : "");
+    }
+}
+
+static void
+usage(const char *exe)
+{
+    fprintf(stderr, "Usage: %s [-c h264|hevc] [-t threads] [-i report_seconds] in1.h264 out1.nv12 [in2.h264 out2.nv12 ...]\n", exe);
+    exit(1);
+}
+
+int
+main(int argc, char * const *argv)
+{
+    struct server *server;
+    struct stream *stream;
+    pthread_t workers[MAX_WORKERS];
+    const char *exe;
+    enum video_codec codec;
+    int threads, interval;
+    int ch;
+
+    exe = argv[0];
+    threads = 2;
+    interval = 0;
+    codec = VIDEO_CODEC_H264;
+
+    while ((ch = getopt(argc, argv, "c:i:t:")) != -1) {
+        switch (ch) {
+            case 'c':
+                     if (strcmp(optarg, "hevc") == 0)
+                         codec = VIDEO_CODEC_HEVC;
+                     else if (strcmp(optarg, "h264") != 0)
+                         usage(exe);
+                     break;
+            case 'i':
+                     interval = atoi(optarg);
+                     break;
+            case 't':
+                     threads = atoi(optarg);
+                     break;
+            case '?':
+            default:
+                     usage(exe);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if ((argc == 0) || (argc % 2) || (threads < 1) || (threads > MAX_WORKERS))
+        usage(exe);
+
+    server = calloc(1, sizeof(struct server));
+    if (server == NULL) {
+        fprintf(stderr, "failed to allocate server context\n");
+        exit(1);
+    }
+
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->ready, NULL);
+    pthread_cond_init(&server->finished, NULL);
+
+    server->count = argc / 2;
+    server->streams = calloc(server->count, sizeof(struct stream));
+    if (server->streams == NULL) {
+        fprintf(stderr, "failed to allocate streams\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < server->count; i++) {
+        stream = &server->streams[i];
+        stream->index = i;
+        stream->input = argv[i*2];
+
+        stream->in_fd = open(argv[i*2], O_RDONLY);
+        if (stream->in_fd < 0) {
+            fprintf(stderr, "failed to open input file %s: %s\n", argv[i*2], strerror(errno));
+            exit(1);
+        }
+
+        stream->out_fd = open(argv[i*2 + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (stream->out_fd < 0) {
+            fprintf(stderr, "failed to open '%s' for writing: %s\n", argv[i*2 + 1], strerror(errno));
+            exit(1);
+        }
+
+        stream->decoder = h264_mpp_decoder_create_codec(codec, stream_frame_callback, stream);
+        if (stream->decoder == NULL) {
+            fprintf(stderr, "failed to create %s decoder for %s\n",
+                (codec == VIDEO_CODEC_HEVC) ? "HEVC" : "H264", argv[i*2]);
+            exit(1);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &stream->start);
+        stream->state = STREAM_READING;
+        queue_push(server, stream);
+    }
+    server->active = server->count;
+
+    fprintf(stderr, "Decoding %d streams with %d worker threads\n", server->count, threads);
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, worker_thread, server)) {
+            fprintf(stderr, "failed to start worker thread\n");
+            exit(1);
+        }
+    }
+
+    /*
+     * Wait for all streams, reporting progress periodically
+     */
+    pthread_mutex_lock(&server->lock);
+    while (server->active > 0) {
+        if (interval > 0) {
+            struct timespec deadline;
+
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += interval;
+            if (pthread_cond_timedwait(&server->finished, &server->lock, &deadline) == ETIMEDOUT) {
+                pthread_mutex_unlock(&server->lock);
+                report(server, 0);
+                pthread_mutex_lock(&server->lock);
+            }
+        }
+        else
+            pthread_cond_wait(&server->finished, &server->lock);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    for (int i = 0; i < threads; i++)
+        pthread_join(workers[i], NULL);
+
+    report(server, 1);
+
+    for (int i = 0; i < server->count; i++) {
+        stream = &server->streams[i];
+        h264_decoder_mpp_destroy(stream->decoder);
+        close(stream->in_fd);
+        close(stream->out_fd);
+    }
+
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->ready);
+    pthread_cond_destroy(&server->finished);
+    free(server->streams);
+    free(server);
+
+    return 0;
+}
@@ -29,125 +29,440 @@
 #include <sys/errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include "video_codec.h"
+#include "h264_reader.h"
+#include "h264_avcc.h"
+#include "h264_sps.h"
+#include "pipe_io.h"
+#include "metrics.h"
+#include "trace.h"
+#include "frame_writer.h"
+#include "quality.h"
+#include "frame_ring.h"
+#include "cpu_affinity.h"
 #include "h264_decoder_mpp.h"
 
+/* Largest chunk h264_decoder_mpp_submit_packet accepts */
+#define SUBMIT_CHUNK_SIZE   (4*1024)
+/* Mapped input is submitted in chunks so MPP doesn't queue the whole file */
+#define MAPPED_CHUNK_SIZE   (256*1024)
+/* Room for SPS/PPS from avcC record */
+#define AVCC_PARAMS_SIZE    (4*1024)
+/* Give up flushing if decoder produced nothing for ~1 second */
+#define DRAIN_IDLE_POLLS    300
+/* Decoded frames in flight to -O shm consumer */
+#define RING_SLOTS          4
+
 /*
- * Context for writer callback
+ * Reference I420 video (encoder input) decoded frames are scored
+ * against with -r. Set up when the first frame comes out
  */
-struct frame_writer
+struct reference
 {
-    int fd;
+    const char          *path;
+    int                 fd;
+    uint8_t             *frame;
+    size_t              frame_size;
+    int                 width;
+    int                 height;
+    quality_t           quality;
 };
 
-/*
- * Writes @len bytes of buffer @data ensuring that all of them are written
- */
+/* Callback context: writer, optional reference and shared memory ring */
+struct decode_output
+{
+    struct frame_writer *writer;
+    struct reference    *reference;
+    frame_ring_t        ring;
+};
+
+void
+usage(const char *exe)
+{
+    fprintf(stderr, "Usage: %s [-c h264|hevc] [-k] [-s factor] [-O file|hash|null|shm|y4m] [-r reference.yuv] [-m metrics.json]\n"
+                    "       [-M interval_ms] [-t trace.json] [-a cpus] in.h264 [out.nv12|socket]\n", exe);
+    fprintf(stderr, "  -c  input codec (h264), AVCC input is H.264 only\n");
+    fprintf(stderr, "  -k  decode only IDR frames, one frame per GOP\n");
+    fprintf(stderr, "  -s  downscale output frames by factor\n");
+    fprintf(stderr, "  -O  write frames (default), CRC32C per frame or nothing, out.nv12\n"
+                    "      becomes text file with checksums or can be omitted for null\n"
+                    "      shm: publish frames to shared memory ring, consumer connects to socket\n"
+                    "      y4m: write Y4M stream of I420 frames instead of raw NV12\n");
+    fprintf(stderr, "  in.h264 and output file can be - for stdin/stdout\n");
+    fprintf(stderr, "  -r  report PSNR/SSIM of decoded frames against reference I420 file\n");
+    fprintf(stderr, "  -a  CPUs and priority of the decoding thread: auto (big cores), none or\n"
+                    "      feeder=cpus[@nice|@fN], see cpu_affinity.h\n");
+    fprintf(stderr, "  -m  dump pipeline metrics as JSON to the file every -M ms (1000)\n");
+    fprintf(stderr, "  -t  record Chrome trace-event timeline of pipeline stages\n");
+    exit(1);
+}
+
 static int
-write_buffer(int fd, uint8_t *data, ssize_t len)
+reference_setup(struct reference *reference, int width, int height)
 {
-    ssize_t bytes, total;
+    reference->fd = open(reference->path, O_RDONLY);
+    if (reference->fd < 0) {
+        fprintf(stderr, "failed to open reference file %s: %s\n", reference->path, strerror(errno));
+        return (-1);
+    }
 
-    total = bytes = 0;
-    while (total < len) {
-        bytes = write(fd, data + total, len - total);
-        if (bytes < 0) {
-            fprintf(stderr, "failed to write data in write_buffer: %s\n", strerror(errno));
-            return (-1);
-        }
-        else
-            total += bytes;
+    reference->width = width;
+    reference->height = height;
+    reference->frame_size = (size_t)width * height + (size_t)((width + 1) / 2) * ((height + 1) / 2) * 2;
+    reference->frame = malloc(reference->frame_size);
+    reference->quality = quality_create(width, height, sysconf(_SC_NPROCESSORS_ONLN));
+    if ((reference->frame == NULL) || (reference->quality == NULL)) {
+        fprintf(stderr, "failed to set up quality measurement\n");
+        return (-1);
     }
 
     return (0);
 }
 
 /*
- * Called for every decoded frame. The frame format is NV12
+ * Score decoded NV12 frame against the next reference frame. Comparison
+ * stops at the end of reference or when the resolution changes
  */
-void
-frame_writer_callback(void *ptr, uint8_t *yplane, uint8_t *uvplane,
-    int width, int height, int h_stride, int v_stride)
+static void
+reference_compare(struct reference *reference, uint8_t *yplane, uint8_t *uvplane,
+    int width, int height, int h_stride)
 {
-    struct frame_writer *writer = (struct frame_writer *)ptr;
+    struct quality_image ref, dist;
+    struct quality_score score;
+    size_t done = 0;
+    int cwidth = (width + 1) / 2, cheight = (height + 1) / 2;
 
-    /* Y plane */
-    for (int i = 0; i < height; i++) {
-        if (write_buffer(writer->fd, yplane + i*h_stride, width) < 0)
+    if (reference->quality == NULL) {
+        if (reference_setup(reference, width, height) < 0) {
+            reference->path = NULL;
             return;
+        }
+    }
+
+    if ((width != reference->width) || (height != reference->height)) {
+        fprintf(stderr, "resolution changed, comparison with reference stopped\n");
+        reference->path = NULL;
+        return;
     }
 
-    /* UV plane */
-    for (int i = 0; i < height/2; i++) {
-        if (write_buffer(writer->fd, uvplane + i*h_stride, width) < 0)
+    while (done < reference->frame_size) {
+        ssize_t bytes = read(reference->fd, reference->frame + done, reference->frame_size - done);
+
+        if (bytes <= 0) {
+            fprintf(stderr, "end of reference, comparison stopped\n");
+            reference->path = NULL;
             return;
+        }
+        done += bytes;
     }
+
+    ref.format = QUALITY_I420;
+    ref.plane[0] = reference->frame;
+    ref.stride[0] = width;
+    ref.plane[1] = reference->frame + (size_t)width * height;
+    ref.stride[1] = cwidth;
+    ref.plane[2] = ref.plane[1] + (size_t)cwidth * cheight;
+    ref.stride[2] = cwidth;
+
+    dist.format = QUALITY_NV12;
+    dist.plane[0] = yplane;
+    dist.stride[0] = h_stride;
+    dist.plane[1] = uvplane;
+    dist.stride[1] = h_stride;
+    dist.plane[2] = NULL;
+    dist.stride[2] = 0;
+
+    quality_compare(reference->quality, &ref, &dist, 1, &score);
 }
 
-void
-usage(const char *exe)
+static void
+decode_frame_callback(void *ptr, uint8_t *yplane, uint8_t *uvplane,
+    int width, int height, int h_stride, int v_stride)
 {
-    fprintf(stderr, "Usage: %s in.h264 out.nv12\n", exe);
-    exit(1);
+    struct decode_output *output = (struct decode_output *)ptr;
+
+    frame_writer_callback(output->writer, yplane, uvplane, width, height, h_stride, v_stride);
+    if (output->ring)
+        frame_ring_publish(output->ring, yplane, uvplane, width, height, h_stride);
+
+    if (output->reference->path)
+        reference_compare(output->reference, yplane, uvplane, width, height, h_stride);
 }
 
-int
-main(int argc, const char *argv[])
+/*
+ * Y4M header needs frame rate: it comes from VUI timing of the first
+ * SPS on its way to the decoder, frames come out only after their SPS
+ * went in. H.265 SPS is not parsed that far, such output gets
+ * FRAME_Y4M_FPS. NULL unless output is Y4M
+ */
+static struct frame_writer *rate_writer;
+static enum video_codec rate_codec;
+
+static void
+find_frame_rate(const uint8_t *data, size_t len)
 {
-    struct h264_decoder_mpp *decoder;
-    struct frame_writer *writer;
-    uint8_t *buf;
-    int buf_size;
-    ssize_t bytes;
-    int fd;
+    struct frame_writer *writer = rate_writer;
+    struct h264_sps sps;
+    ssize_t pos, next;
+    uint64_t num, den, a, b, t;
 
-    if (argc != 3)
-        usage(argv[0]);
+    for (pos = h264_find_start_code(data, len); pos >= 0; pos = next) {
+        const uint8_t *nal = data + pos + 4;
+        size_t nal_len = len - pos - 4;
 
-    /*
-     * Open input (h264) file
-     */
-    fd = open(argv[1], O_RDONLY);
-    if (fd < 0) {
-        fprintf(stderr, "failed to open input file %s: %s\n", argv[1], strerror(errno));
-        exit(1);
+        next = h264_find_start_code(nal, nal_len);
+        if (next >= 0) {
+            nal_len = next;
+            next += pos + 4;
+        }
+
+        if (h264_nal_kind(rate_codec, nal, nal_len) != NAL_KIND_SPS)
+            continue;
+
+        /* Only the first SPS counts, with or without timing */
+        rate_writer = NULL;
+        if ((rate_codec != VIDEO_CODEC_H264) || h264_parse_sps(nal, nal_len, &sps) ||
+                (sps.num_units_in_tick == 0) || (sps.time_scale == 0))
+            return;
+
+        /* Tick is a field, frame takes two */
+        num = sps.time_scale;
+        den = 2 * sps.num_units_in_tick;
+        for (a = num, b = den; b != 0; a = b, b = t)
+            t = a % b;
+        writer->y4m_fps_num = num / a;
+        writer->y4m_fps_den = den / a;
+        return;
     }
+}
 
-    /*
-     * Create decoder callback context
-     */
-    writer = (struct frame_writer *)malloc(sizeof(struct frame_writer));
-    if (writer == NULL) {
-        fprintf(stderr, "failed to allocate frame writer context\n");
-        exit(1);
+/*
+ * Feed @len bytes of caller's memory to the decoder without copying,
+ * handling decoded frames while the decoder is busy. @release is called
+ * with @arg once the decoder is done with the memory
+ */
+static int
+submit_data(struct h264_decoder_mpp *decoder, uint8_t *data, size_t len,
+    decoder_release_t release, void *arg)
+{
+    int ret;
+
+    if (rate_writer)
+        find_frame_rate(data, len);
+
+    while ((ret = h264_decoder_mpp_submit_data(decoder, data, len, release, arg)) == EAGAIN) {
+        h264_decoder_mpp_get_frame(decoder);
+        usleep(3000);
     }
 
-    /*
-     * Open output (raw) file and 
-     */
-    writer->fd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (writer->fd < 0) {
-        fprintf(stderr, "failed to open '%s' for writing: %s\n", argv[2], strerror(errno));
-        exit(1);
+    h264_decoder_mpp_get_frame(decoder);
+
+    return (ret);
+}
+
+static void
+release_nal(void *arg)
+{
+    h264_free_nal((h264_nal_t)arg);
+}
+
+/*
+ * Decode only parameter sets and IDR slices (IRAP pictures for H.265),
+ * everything else is dropped before it reaches the decoder
+ */
+static int
+decode_keyframes(struct h264_decoder_mpp *decoder, enum video_codec codec, const char *path)
+{
+    h264_reader_t reader;
+    h264_nal_t nal;
+    int submitted, dropped, ret;
+
+    reader = h264_reader_open(path);
+    if (reader == NULL) {
+        fprintf(stderr, "failed to open input file %s: %s\n", path, strerror(errno));
+        return (-1);
     }
 
+    ret = submitted = dropped = 0;
+    while (h264_read_nal(reader, &nal) == 0) {
+        /* Start code is 4 bytes, see h264_read_nal() */
+        switch (h264_nal_kind(codec, nal->data + 4, nal->size - 4)) {
+            case NAL_KIND_SPS:
+            case NAL_KIND_PARAM_SET:
+            case NAL_KIND_KEYFRAME:
+                /* NAL is handed over as is and freed once submitted */
+                ret = submit_data(decoder, nal->data, nal->size, release_nal, nal);
+                if (ret < 0)
+                    h264_free_nal(nal);
+                submitted++;
+                break;
+            default:
+                h264_free_nal(nal);
+                dropped++;
+                break;
+        }
+        if (ret < 0)
+            break;
+    }
+
+    fprintf(stderr, "%d NAL units submitted, %d dropped\n", submitted, dropped);
+    h264_reader_close(reader);
+
+    return (ret);
+}
+
+/*
+ * AVCC input starts with avcC record: submit its SPS/PPS in Annex B
+ * form and set up @stream to convert NAL units that follow.
+ * Returns size of the record, 0 if @len bytes do not hold all of it,
+ * -1 on error
+ */
+static ssize_t
+start_avcc(struct h264_decoder_mpp *decoder, const uint8_t *data, size_t len,
+    struct h264_avcc_stream *stream)
+{
+    uint8_t params[AVCC_PARAMS_SIZE];
+    size_t params_len = sizeof(params);
+    ssize_t config_len;
+    int length_size;
+
+    config_len = h264_avcc_parse_config(data, len, &length_size, params, &params_len);
+    if (config_len < 0)
+        fprintf(stderr, "malformed avcC record\n");
+    if (config_len <= 0)
+        return (config_len);
+
+    if (h264_avcc_stream_init(stream, length_size) < 0) {
+        fprintf(stderr, "%d-byte NAL unit sizes are not supported\n", length_size);
+        return (-1);
+    }
+
+    if (submit_data(decoder, params, params_len, NULL, NULL) < 0)
+        return (-1);
+
+    return (config_len);
+}
+
+/*
+ * Decode file mapped to memory: the bitstream goes from page cache
+ * to the decoder without intermediate copies. AVCC sizes are rewritten
+ * to start codes in the private mapping, only the pages holding them
+ * get copied
+ */
+static int
+decode_mapped(struct h264_decoder_mpp *decoder, enum video_codec codec, int fd, size_t size)
+{
+    struct h264_avcc_stream stream;
+    uint8_t *data;
+    ssize_t start;
+    int avcc, ret = 0;
+
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return (-1);
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    start = 0;
+    avcc = (codec == VIDEO_CODEC_H264) && (data[0] == H264_AVCC_VERSION);
+    if (avcc) {
+        start = start_avcc(decoder, data, size, &stream);
+        if (start == 0)
+            fprintf(stderr, "truncated avcC record\n");
+        if ((start <= 0) || (mprotect(data, size, PROT_READ | PROT_WRITE) < 0)) {
+            munmap(data, size);
+            return (-1);
+        }
+    }
+
+    for (size_t pos = start; (pos < size) && (ret == 0); pos += MAPPED_CHUNK_SIZE) {
+        size_t len = (size - pos > MAPPED_CHUNK_SIZE) ? MAPPED_CHUNK_SIZE : size - pos;
+
+        if (avcc)
+            h264_avcc_stream_convert(&stream, data + pos, len);
+        ret = submit_data(decoder, data + pos, len, NULL, NULL);
+    }
+
+    munmap(data, size);
+
+    return (ret);
+}
+
+/*
+ * Reads the rest of avcC record at the head of @buf (holding @*bytes out
+ * of @buf_size) from @fd and submits its parameter sets.
+ * Returns size of the record, -1 on error
+ */
+static ssize_t
+read_avcc_config(struct h264_decoder_mpp *decoder, int fd, uint8_t *buf, size_t buf_size,
+    ssize_t *bytes, struct h264_avcc_stream *stream)
+{
+    ssize_t start, n;
+
+    while ((start = start_avcc(decoder, buf, *bytes, stream)) == 0) {
+        if ((size_t)*bytes == buf_size) {
+            fprintf(stderr, "avcC record is too large\n");
+            return (-1);
+        }
+        n = read(fd, buf + *bytes, buf_size - *bytes);
+        if (n <= 0) {
+            fprintf(stderr, "truncated avcC record\n");
+            return (-1);
+        }
+        *bytes += n;
+    }
+
+    return (start);
+}
+
+static int
+decode_stream(struct h264_decoder_mpp *decoder, enum video_codec codec, const char *path)
+{
+    struct h264_avcc_stream stream;
+    struct stat st;
+    uint8_t *buf, *chunk;
+    int buf_size;
+    ssize_t bytes, start;
+    int fd, first, avcc, ret;
+
     /*
-     * Create H264 decoder
+     * Open input (h264) file
      */
-    decoder = h264_mpp_decoder_create(frame_writer_callback, writer);
-    if (decoder == NULL) {
-        fprintf(stderr, "failed to create H264 decoder\n");
-        exit(1);
+    fd = pipe_io_open_input(path);
+    if (fd < 0) {
+        fprintf(stderr, "failed to open input file %s: %s\n", path, strerror(errno));
+        return (-1);
+    }
+
+    /* Regular files are mapped, pipes and such are read chunk by chunk */
+    if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0)) {
+        int ret = decode_mapped(decoder, codec, fd, st.st_size);
+
+        close(fd);
+        return (ret);
     }
 
     /*
      * Create a buffer to read H264 bitstream into
      */
-    buf_size = 4*1024;;
+    buf_size = SUBMIT_CHUNK_SIZE;
     buf = malloc(buf_size);
+    if (buf == NULL) {
+        close(fd);
+        return (-1);
+    }
 
     int ready_for_new_buffer = 1;
+    bytes = 0;
+    chunk = buf;
+    first = 1;
+    avcc = 0;
+    ret = 0;
     while (1) {
         /*
          * Load new chunk of the bitstream if the decoder is ready for it
@@ -159,13 +474,34 @@ main(int argc, const char *argv[])
              */
             if (bytes <= 0)
                 break;
+            chunk = buf;
+
+            /* AVCC input is told apart by its avcC record */
+            if (first && (codec == VIDEO_CODEC_H264) && (buf[0] == H264_AVCC_VERSION)) {
+                start = read_avcc_config(decoder, fd, buf, buf_size, &bytes, &stream);
+                if (start < 0) {
+                    ret = -1;
+                    break;
+                }
+                avcc = 1;
+                chunk += start;
+                bytes -= start;
+            }
+            first = 0;
+
+            if (avcc)
+                h264_avcc_stream_convert(&stream, chunk, bytes);
+            if (bytes == 0)
+                continue;
+            if (rate_writer)
+                find_frame_rate(chunk, bytes);
         } else
             usleep(3000);
 
         /*
          * Feed bitstrem to decoder until it's full
          */
-        if (h264_decoder_mpp_submit_packet(decoder, buf, bytes) == EAGAIN)
+        if (h264_decoder_mpp_submit_packet(decoder, chunk, bytes) == EAGAIN)
             ready_for_new_buffer = 0;
         else
             ready_for_new_buffer = 1;
@@ -177,12 +513,224 @@ main(int argc, const char *argv[])
         h264_decoder_mpp_get_frame(decoder);
     }
 
+    free(buf);
+    close(fd);
+
+    return (ret);
+}
+
+/*
+ * Signal EOS and collect frames still held by the decoder
+ */
+static void
+drain_decoder(struct h264_decoder_mpp *decoder, struct frame_writer *writer)
+{
+    int ret, idle;
+
+    while ((ret = h264_decoder_mpp_submit_eos(decoder)) == EAGAIN) {
+        h264_decoder_mpp_get_frame(decoder);
+        usleep(3000);
+    }
+    if (ret < 0)
+        return;
+
+    idle = 0;
+    while (idle < DRAIN_IDLE_POLLS) {
+        int frames = writer->frames;
+
+        ret = h264_decoder_mpp_get_frame(decoder);
+        if ((ret == 1) || (ret < 0))
+            break;
+        if (writer->frames == frames) {
+            idle++;
+            usleep(3000);
+        }
+        else
+            idle = 0;
+    }
+}
+
+int
+main(int argc, char * const *argv)
+{
+    struct h264_decoder_mpp *decoder;
+    struct frame_writer *writer;
+    struct reference reference;
+    struct decode_output output;
+    struct quality_score score;
+    struct timespec start, end;
+    const char *exe, *metrics_path;
+    double elapsed;
+    int keyframes, scale, metrics_interval;
+    enum frame_sink sink;
+    enum video_codec codec;
+    int shm;
+    int ch, ret;
+
+    exe = argv[0];
+    keyframes = 0;
+    scale = 1;
+    sink = FRAME_SINK_FILE;
+    shm = 0;
+    codec = VIDEO_CODEC_H264;
+    metrics_path = NULL;
+    metrics_interval = 1000;
+    memset(&reference, 0, sizeof(reference));
+    reference.fd = -1;
+
+    while ((ch = getopt(argc, argv, "a:c:km:M:O:r:s:t:")) != -1) {
+        switch (ch) {
+            case 't':
+                     if (trace_enable(optarg) < 0) {
+                         fprintf(stderr, "failed to enable tracing\n");
+                         exit(1);
+                     }
+                     break;
+            case 'm':
+                     metrics_path = optarg;
+                     break;
+            case 'a':
+                     if (cpu_affinity_config(optarg) < 0)
+                         usage(exe);
+                     break;
+            case 'M':
+                     metrics_interval = atoi(optarg);
+                     break;
+            case 'c':
+                     if (strcmp(optarg, "hevc") == 0)
+                         codec = VIDEO_CODEC_HEVC;
+                     else if (strcmp(optarg, "h264") != 0)
+                         usage(exe);
+                     break;
+            case 'k':
+                     keyframes = 1;
+                     break;
+            case 'O':
+                     if (strcmp(optarg, "hash") == 0)
+                         sink = FRAME_SINK_HASH;
+                     else if (strcmp(optarg, "null") == 0)
+                         sink = FRAME_SINK_NULL;
+                     else if (strcmp(optarg, "y4m") == 0)
+                         sink = FRAME_SINK_Y4M;
+                     else if (strcmp(optarg, "shm") == 0) {
+                         /* Writer only counts frames */
+                         sink = FRAME_SINK_NULL;
+                         shm = 1;
+                     }
+                     else if (strcmp(optarg, "file") != 0)
+                         usage(exe);
+                     break;
+            case 'r':
+                     reference.path = optarg;
+                     break;
+            case 's':
+                     scale = atoi(optarg);
+                     break;
+            case '?':
+            default:
+                     usage(exe);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (((argc != 2) && ((argc != 1) || (sink != FRAME_SINK_NULL) || shm)) || (scale < 1))
+        usage(exe);
+
+    /*
+     * Create decoder callback context
+     */
+    writer = (struct frame_writer *)calloc(1, sizeof(struct frame_writer));
+    if (writer == NULL) {
+        fprintf(stderr, "failed to allocate frame writer context\n");
+        exit(1);
+    }
+    writer->scale = scale;
+    writer->sink = sink;
+    writer->fd = -1;
+
+    /*
+     * Open output (raw) file and 
+     */
+    output.ring = NULL;
+    if (shm) {
+        output.ring = frame_ring_create(argv[1], RING_SLOTS);
+        if (output.ring == NULL) {
+            fprintf(stderr, "failed to set up frame ring on %s\n", argv[1]);
+            exit(1);
+        }
+    }
+    else if (argc > 1) {
+        writer->fd = pipe_io_open_output(argv[1]);
+        if (writer->fd < 0) {
+            fprintf(stderr, "failed to open '%s' for writing: %s\n", argv[1], strerror(errno));
+            exit(1);
+        }
+    }
+
+    /*
+     * Create H264 or HEVC decoder
+     */
+    output.writer = writer;
+    if (sink == FRAME_SINK_Y4M) {
+        rate_writer = writer;
+        rate_codec = codec;
+    }
+    output.reference = &reference;
+    /* Before MPP starts its threads, they stay with this one */
+    cpu_affinity_apply(CPU_ROLE_FEEDER);
+    decoder = h264_mpp_decoder_create_codec(codec, decode_frame_callback, &output);
+    if (decoder == NULL) {
+        fprintf(stderr, "failed to create %s decoder\n",
+            (codec == VIDEO_CODEC_HEVC) ? "HEVC" : "H264");
+        exit(1);
+    }
+
+    if (metrics_path && (metrics_start_export(metrics_path, metrics_interval) < 0)) {
+        fprintf(stderr, "failed to start metrics export to %s\n", metrics_path);
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (keyframes)
+        ret = decode_keyframes(decoder, codec, argv[0]);
+    else
+        ret = decode_stream(decoder, codec, argv[0]);
+
+    if (ret == 0)
+        drain_decoder(decoder, writer);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%d frames decoded in %.2f s\n", writer->frames, elapsed);
+    if (sink == FRAME_SINK_HASH)
+        fprintf(stderr, "stream checksum %08x\n", writer->crc);
+
+    if (reference.quality && (quality_summary(reference.quality, &score) > 0)) {
+        fprintf(stderr, "PSNR Y %.3f U %.3f V %.3f all %.3f  SSIM Y %.5f U %.5f V %.5f all %.5f\n",
+            score.psnr[0], score.psnr[1], score.psnr[2], score.psnr_all,
+            score.ssim[0], score.ssim[1], score.ssim[2], score.ssim_all);
+    }
+
     /*
      * Clean-up after ourselves
      */
     h264_decoder_mpp_destroy(decoder);
-    close(writer->fd);
+    metrics_stop_export();
+    if (writer->fd >= 0)
+        close(writer->fd);
+    if (output.ring)
+        frame_ring_close(output.ring);
+    free(writer->scaled);
+    free(writer->chroma);
     free(writer);
+    if (reference.quality)
+        quality_destroy(reference.quality);
+    if (reference.fd >= 0)
+        close(reference.fd);
+    free(reference.frame);
 
-    return 0;
+    return (ret < 0 ? 1 : 0);
 }
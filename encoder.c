@@ -31,43 +31,183 @@
 #include <string.h>
 #include <getopt.h>
 #include <stdint.h>
+#include <limits.h>
+#include <time.h>
 
 #include "yuv_reader.h"
+#include "frame_pool.h"
+#include "yuv_prefetch.h"
+#include "frame_diff.h"
+#include "scene_detect.h"
+#include "cpu_affinity.h"
+#include "metrics.h"
+#include "trace.h"
+#include "video_codec.h"
+#include "rtp_sender.h"
+#include "segment_writer.h"
+#include "h264_avcc.h"
+#include "pipe_io.h"
 #include "h264_encoder_mpp.h"
 
+/* Playlist written next to the segments unless -p is given */
+#define DEFAULT_PLAYLIST    "index.m3u8"
+
+/* Room for avcC record built from encoder's SPS/PPS */
+#define AVCC_CONFIG_SIZE    4096
+
+#define MAX_LOOKAHEAD       32
+/* Scene cuts closer than that to the last IDR don't get one */
+#define MIN_IDR_DISTANCE    8
+
+/*
+ * Frames read ahead of the one being encoded, each marked if it starts
+ * a new scene
+ */
+struct lookahead
+{
+    yuv_frame_t         frames[MAX_LOOKAHEAD + 1];
+    int                 cuts[MAX_LOOKAHEAD + 1];
+    int                 first;
+    int                 count;
+    int                 size;
+    int                 eof;
+};
+
 /*
  * Argument for encoder callback
  */
 struct h264_writer
 {
     int fd;
+    /* Write AVCC instead of Annex B */
+    int avcc;
+    int avcc_started;
 };
 
-/*
- * Called for every encoded packet. Writes h264 bitstream
- * to the output file
- */
-void h264_writer_callback(void *ptr, uint8_t *data, ssize_t len)
+static void
+write_data(int fd, const uint8_t *data, ssize_t len)
 {
     ssize_t bytes, total;
+    uint64_t begin = metrics_stage_begin();
 
-    struct h264_writer *writer = (struct h264_writer *)ptr;
     total = bytes = 0;
     while (total < len) {
-        bytes = write(writer->fd, data + total, len - total);
+        bytes = write(fd, data + total, len - total);
         if (bytes < 0) {
             if (errno != EAGAIN)
                 break;
+            metrics_count(METRIC_EAGAIN, 1);
         }
         else
             total += bytes;
     }
+
+    metrics_stage_end(METRIC_STAGE_WRITE, begin);
+    metrics_count(METRIC_BYTES_WRITTEN, total);
+}
+
+/*
+ * Called for every encoded packet. Writes h264 bitstream
+ * to the output file
+ */
+void h264_writer_callback(void *ptr, uint8_t *data, ssize_t len)
+{
+    struct h264_writer *writer = (struct h264_writer *)ptr;
+    uint8_t config[AVCC_CONFIG_SIZE];
+    ssize_t config_len;
+
+    if (writer->avcc) {
+        /* First packet has SPS/PPS, they make avcC record at the head of the file */
+        if (!writer->avcc_started) {
+            writer->avcc_started = 1;
+            config_len = h264_avcc_build_config(data, len, config, sizeof(config));
+            if (config_len > 0) {
+                write_data(writer->fd, config, config_len);
+                return;
+            }
+            fprintf(stderr, "no parameter sets for avcC record in the first packet\n");
+        }
+        /* Packet is ours until we return, sizes replace start codes in place */
+        h264_annexb_to_avcc(data, len);
+    }
+
+    write_data(writer->fd, data, len);
+}
+
+/*
+ * Next frame to encode, NULL at the end of input. The window is topped
+ * up first, so up to la->size - 1 frames after it are known
+ */
+static yuv_frame_t
+lookahead_next(struct lookahead *la, yuv_prefetch_t input, scene_detect_t scene, int *cut)
+{
+    yuv_frame_t frame;
+    int slot;
+
+    while (!la->eof && (la->count < la->size)) {
+        frame = yuv_prefetch_next(input);
+        if (frame == NULL) {
+            la->eof = 1;
+            break;
+        }
+        slot = (la->first + la->count) % la->size;
+        la->frames[slot] = frame;
+        la->cuts[slot] = scene ? scene_detect_frame(scene, frame, NULL) : 0;
+        la->count++;
+    }
+
+    if (la->count == 0)
+        return (NULL);
+
+    frame = la->frames[la->first];
+    *cut = la->cuts[la->first];
+    la->first = (la->first + 1) % la->size;
+    la->count--;
+
+    return (frame);
+}
+
+/* Scene cut coming within the window */
+static int
+lookahead_has_cut(struct lookahead *la)
+{
+    for (int i = 0; i < la->count; i++) {
+        if (la->cuts[(la->first + i) % la->size])
+            return (1);
+    }
+
+    return (0);
 }
 
 void
 usage(const char *exe)
 {
-    fprintf(stderr, "Usage: %s [-w width] [-h height] in.yuv out.yuv\n", exe);
+    fprintf(stderr, "Usage: %s [-c h264|hevc] [-w width] [-h height] [-s threshold] [-S max_skip]\n"
+                    "       [-u host:port] [-U mtu] [-d seconds] [-p playlist.m3u8] [-m metrics.json] [-M interval_ms] [-t trace.json]\n"
+                    "       [-A] [-H] [-P frames] [-L frames] [-a cpus] in.yuv [out.h264]\n", exe);
+    fprintf(stderr, "  in.yuv is raw I420 of -w x -h or Y4M stream (frame size and rate\n"
+                    "  from its header), in.yuv and out.h264 can be - for stdin/stdout\n");
+    fprintf(stderr, "  -c  output codec (h264), hevc needs a VPU with H.265 encoder\n");
+    fprintf(stderr, "  -s  skip frames whose 16x16 luma blocks all differ from the last\n"
+                    "      encoded frame by at most threshold (mean absolute difference),\n"
+                    "      needs -u or -d: plain bitstream has no timestamps to keep the gap\n");
+    fprintf(stderr, "  -S  encode at least every max_skip+1 frame, 0 means no limit\n");
+    fprintf(stderr, "  -u  send RTP stream (payload type %d) to host:port instead of the file\n"
+                    "  -U  MTU of the RTP path (%d), H.264 only\n", RTP_PAYLOAD_TYPE, RTP_DEFAULT_MTU);
+    fprintf(stderr, "  -d  cut output into segments of about given duration starting with IDR,\n"
+                    "      out.h264 is then file name pattern, e.g. seg%%05d.h264\n"
+                    "  -p  playlist of the segments (%s in the segment directory)\n", DEFAULT_PLAYLIST);
+    fprintf(stderr, "  -A  write AVCC: avcC record followed by size-prefixed NAL units (H.264 only)\n");
+    fprintf(stderr, "  -L  look that many frames (up to %d) ahead for scene cuts, IDR frames\n"
+                    "      go on cuts and the periodic one is put off if a cut is coming\n",
+                    MAX_LOOKAHEAD);
+    fprintf(stderr, "  -H  keep input frames in huge pages\n");
+    fprintf(stderr, "  -P  frames read ahead on background thread (%d), 0 reads in line\n",
+        YUV_PREFETCH_DEPTH);
+    fprintf(stderr, "  -a  CPUs and priority of threads: auto (big cores feed MPP), none or\n"
+                    "      feeder|reader=cpus[@nice|@fN], may be repeated, see cpu_affinity.h\n");
+    fprintf(stderr, "  -m  dump pipeline metrics as JSON to the file every -M ms (1000)\n");
+    fprintf(stderr, "  -t  record Chrome trace-event timeline of pipeline stages\n");
     exit(1);
 }
 
@@ -76,25 +216,110 @@ main(int argc, char * const*argv)
 {
     yuv_reader_t yuv;
     yuv_frame_t frame;
+    yuv_prefetch_t input;
+    struct lookahead lookahead;
+    scene_detect_t scene;
     struct h264_encoder_mpp *encoder;
     int width, height;
     struct h264_writer *writer;
-    const char *exe;
+    struct h264_encoder_params params;
+    rtp_sender_t rtp;
+    segment_writer_t segments;
+    frame_diff_t diff;
+    struct timespec start, end;
+    double skip_threshold, encode_time, segment_duration;
+    int max_skip, skip_run, skipped, encoded;
+    int gop, since_idr, idr, cut, cuts, deferred, deferrals;
+    const char *exe, *metrics_path, *rtp_dest, *playlist;
+    char playlist_path[PATH_MAX];
+    int metrics_interval, mtu, index, avcc, pool_flags, prefetch;
+    enum video_codec codec;
     int ch;
 
     exe = argv[0];
 
     width = 1920;
     height = 1080;
+    skip_threshold = -1;
+    max_skip = 0;
+    metrics_path = NULL;
+    metrics_interval = 1000;
+    rtp_dest = NULL;
+    rtp = NULL;
+    mtu = RTP_DEFAULT_MTU;
+    segments = NULL;
+    segment_duration = 0;
+    avcc = 0;
+    playlist = NULL;
+    codec = VIDEO_CODEC_H264;
+    pool_flags = 0;
+    prefetch = YUV_PREFETCH_DEPTH;
+    memset(&lookahead, 0, sizeof(lookahead));
 
-    while ((ch = getopt(argc, argv, "h:w:")) != -1) {
+    while ((ch = getopt(argc, argv, "a:Ac:d:h:HL:m:M:p:P:s:S:t:u:U:w:")) != -1) {
         switch (ch) {
+            case 't':
+                     if (trace_enable(optarg) < 0) {
+                         fprintf(stderr, "failed to enable tracing\n");
+                         exit(1);
+                     }
+                     break;
+            case 'm':
+                     metrics_path = optarg;
+                     break;
+            case 'M':
+                     metrics_interval = atoi(optarg);
+                     break;
+            case 's':
+                     skip_threshold = atof(optarg);
+                     break;
+            case 'S':
+                     max_skip = atoi(optarg);
+                     break;
+            case 'A':
+                     avcc = 1;
+                     break;
+            case 'c':
+                     if (strcmp(optarg, "hevc") == 0)
+                         codec = VIDEO_CODEC_HEVC;
+                     else if (strcmp(optarg, "h264") != 0)
+                         usage(exe);
+                     break;
+            case 'd':
+                     segment_duration = atof(optarg);
+                     break;
+            case 'p':
+                     playlist = optarg;
+                     break;
+            case 'P':
+                     prefetch = atoi(optarg);
+                     if (prefetch < 0)
+                         usage(exe);
+                     break;
+            case 'u':
+                     rtp_dest = optarg;
+                     break;
+            case 'U':
+                     mtu = atoi(optarg);
+                     break;
             case 'w':
                      width = atoi(optarg);
                      break;
             case 'h':
                      height = atoi(optarg);
                      break;
+            case 'H':
+                     pool_flags |= FRAME_POOL_HUGEPAGES;
+                     break;
+            case 'a':
+                     if (cpu_affinity_config(optarg) < 0)
+                         usage(exe);
+                     break;
+            case 'L':
+                     lookahead.size = atoi(optarg);
+                     if ((lookahead.size < 0) || (lookahead.size > MAX_LOOKAHEAD))
+                         usage(exe);
+                     break;
              case '?':
              default:
                      usage(exe);
@@ -104,48 +329,231 @@ main(int argc, char * const*argv)
      argc -= optind;
      argv += optind;
 
-    if (argc != 2)
+    if ((argc != 2) && ((argc != 1) || (rtp_dest == NULL)))
+        usage(exe);
+    /* Only plain file output can be AVCC */
+    if (avcc && (rtp_dest || (segment_duration > 0)))
+        usage(exe);
+    /* Skipped frames only leave a gap in timestamped output */
+    if ((skip_threshold >= 0) && (rtp_dest == NULL) && (segment_duration <= 0)) {
+        fprintf(stderr, "-s needs RTP (-u) or segmented (-d) output, in a plain stream skipped frames would just be lost\n");
         usage(exe);
+    }
+    /* RTP packetization and avcC are H.264 specific */
+    if ((codec == VIDEO_CODEC_HEVC) && (avcc || rtp_dest))
+        usage(exe);
+
+    /* Y4M input brings its own frame size */
+    yuv = yuv_reader_open(argv[0], width, height);
+    if (yuv == NULL) {
+        fprintf(stderr, "failed to open input file %s\n", argv[0]);
+        exit(1);
+    }
+    width = yuv->width;
+    height = yuv->height;
 
     fprintf(stderr, "Input resolution: %dx%d\n", width, height);
 
+    if (metrics_path && (metrics_start_export(metrics_path, metrics_interval) < 0)) {
+        fprintf(stderr, "failed to start metrics export to %s\n", metrics_path);
+        exit(1);
+    }
+
     writer = (struct h264_writer *)malloc(sizeof(struct h264_writer));
     if (writer == NULL) {
         fprintf(stderr, "failed to allocate H264 writer context\n");
         exit(1);
     }
 
-    writer->fd = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (writer->fd < 0) {
-        fprintf(stderr, "failed to open '%s' for writing: %s\n", argv[1], strerror(errno));
-        exit(1);
+    /* Frame rate the encoder is configured for, to derive timestamps */
+    h264_mpp_encoder_default_params(&params, width, height);
+    params.codec = codec;
+    /* With lookahead IDR frames are placed here, MPP only makes the first one */
+    gop = params.gop;
+    if (lookahead.size > 0)
+        params.gop = 0;
+    if (yuv->fps_num > 0)
+        params.fps = (yuv->fps_num + yuv->fps_den / 2) / yuv->fps_den;
+    if (params.fps < 1)
+        params.fps = 1;
+
+    writer->fd = -1;
+    writer->avcc = avcc;
+    writer->avcc_started = 0;
+    if (rtp_dest) {
+        rtp = rtp_sender_open(rtp_dest, mtu);
+        if (rtp == NULL) {
+            fprintf(stderr, "failed to set up RTP output to %s\n", rtp_dest);
+            exit(1);
+        }
     }
+    else if (segment_duration > 0) {
+        if (playlist == NULL) {
+            const char *slash = strrchr(argv[1], '/');
 
-    yuv = yuv_reader_open(argv[0], width, height);
-    if (yuv == NULL) {
-        fprintf(stderr, "failed to open input file %s\n", argv[0]);
-        exit(1);
+            snprintf(playlist_path, sizeof(playlist_path), "%.*s%s",
+                slash ? (int)(slash - argv[1] + 1) : 0, argv[1], DEFAULT_PLAYLIST);
+            playlist = playlist_path;
+        }
+        /* Twice the average segment size, the rest is trimmed */
+        segments = segment_writer_open(argv[1], playlist, codec, segment_duration, params.fps,
+            (size_t)(params.bps / 8 * segment_duration * 2));
+        if (segments == NULL) {
+            fprintf(stderr, "failed to set up segment output %s\n", argv[1]);
+            exit(1);
+        }
     }
+    else {
+        writer->fd = pipe_io_open_output(argv[1]);
+        if (writer->fd < 0) {
+            fprintf(stderr, "failed to open '%s' for writing: %s\n", argv[1], strerror(errno));
+            exit(1);
+        }
+    }
+
+    /* Before MPP starts its threads, they stay with this one */
+    cpu_affinity_apply(CPU_ROLE_FEEDER);
 
-    frame = yuv_alloc_frame(yuv);
-    encoder = h264_mpp_encoder_create(width, height, h264_writer_callback, writer);
+    if (rtp)
+        encoder = h264_mpp_encoder_create_with_params(&params, rtp_sender_callback, rtp);
+    else if (segments)
+        encoder = h264_mpp_encoder_create_with_params(&params, segment_writer_callback, segments);
+    else
+        encoder = h264_mpp_encoder_create_with_params(&params, h264_writer_callback, writer);
     if (encoder == NULL) {
         fprintf(stderr, "failed to create H264 encoder\n");
         exit(1);
     }
 
-    while (yuv_read_frame(yuv, frame) == 0) {
+    diff = NULL;
+    if (skip_threshold >= 0) {
+        diff = frame_diff_create(width, height);
+        if (diff == NULL) {
+            fprintf(stderr, "failed to create frame analyzer\n");
+            exit(1);
+        }
+    }
+
+    scene = NULL;
+    if (lookahead.size > 0) {
+        scene = scene_detect_create(width, height);
+        if (scene == NULL) {
+            fprintf(stderr, "failed to create scene detector\n");
+            exit(1);
+        }
+    }
+    /* Window holds the frame being encoded and the ones after it */
+    lookahead.size++;
+
+    /* Started last, so the encoder is ready by the time frames are */
+    input = yuv_prefetch_start(yuv, prefetch, lookahead.size, pool_flags);
+    if (input == NULL) {
+        fprintf(stderr, "failed to set up input frames\n");
+        exit(1);
+    }
+    if ((pool_flags & FRAME_POOL_HUGEPAGES) &&
+            (frame_pool_backing(yuv_prefetch_pool(input)) == FRAME_POOL_PAGES))
+        fprintf(stderr, "no huge pages available, input frames use normal pages\n");
+
+    skip_run = skipped = encoded = 0;
+    since_idr = cuts = deferred = deferrals = 0;
+    encode_time = 0;
+    for (index = 0; (frame = lookahead_next(&lookahead, input, scene, &cut)) != NULL; index++) {
+        /*
+         * IDR on scene cut, periodic one waits if a cut is in sight
+         */
+        idr = 0;
+        if (scene && (index > 0)) {
+            if (cut && (since_idr >= MIN_IDR_DISTANCE))
+                idr = 1;
+            else if (since_idr >= gop) {
+                if (!lookahead_has_cut(&lookahead))
+                    idr = 1;
+                else if (!deferred) {
+                    deferred = 1;
+                    deferrals++;
+                }
+            }
+        }
+
+        /*
+         * Static frame: nothing changed since the last encoded one
+         */
+        if (!idr && diff && frame_diff_has_reference(diff) &&
+                ((max_skip == 0) || (skip_run < max_skip)) &&
+                (frame_diff_max_block(diff, frame) <= skip_threshold)) {
+            skip_run++;
+            skipped++;
+            /* IDR spacing is in input frames, static or not */
+            since_idr++;
+            yuv_prefetch_release(input, frame);
+            continue;
+        }
+
+        /* Skipped frames still advance the clock */
+        if (rtp)
+            rtp_sender_set_timestamp(rtp, (uint64_t)index * RTP_CLOCK_RATE / params.fps);
+        if (segments)
+            segment_writer_set_frame(segments, index);
+
+        /* If MPP refuses, following frames ask again */
+        if (idr && (h264_mpp_encoder_force_idr(encoder) == 0)) {
+            since_idr = 0;
+            deferred = 0;
+            if (cut)
+                cuts++;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
         h264_mpp_encoder_submit_frame(encoder, frame, 0);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        encode_time += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        encoded++;
+        since_idr++;
+
+        if (diff) {
+            frame_diff_set_reference(diff, frame);
+            skip_run = 0;
+        }
+        yuv_prefetch_release(input, frame);
+    }
+
+    if (prefetch > 0)
+        fprintf(stderr, "Encoder waited for input %llu times in %d frames\n",
+            (unsigned long long)yuv_prefetch_stalls(input), index);
+
+    if (scene) {
+        fprintf(stderr, "%d scene cuts got IDR frames, periodic IDR put off %d times\n",
+            cuts, deferrals);
+        scene_detect_destroy(scene);
+    }
+
+    if (diff) {
+        fprintf(stderr, "Skipped %d static frames of %d, saved ~%.3f s of encoder time\n",
+            skipped, skipped + encoded, encoded ? encode_time * skipped / encoded : 0.0);
+        frame_diff_destroy(diff);
     }
 
     /* Generate EOS packet */
-    h264_mpp_encoder_submit_frame(encoder, frame, 1);
+    h264_mpp_encoder_submit_frame(encoder, NULL, 1);
 
     /* Cleanup encoder things */
-    yuv_free_frame(frame);
+    yuv_prefetch_stop(input);
     h264_mpp_encoder_destroy(encoder);
+    metrics_stop_export();
+
+    if (rtp) {
+        uint64_t packets, bytes;
 
-    close(writer->fd);
+        rtp_sender_stats(rtp, &packets, &bytes);
+        fprintf(stderr, "Sent %llu RTP packets, %llu bytes\n",
+            (unsigned long long)packets, (unsigned long long)bytes);
+        rtp_sender_close(rtp);
+    }
+    if (segments && (segment_writer_close(segments, index) < 0))
+        fprintf(stderr, "failed to finish segments\n");
+    if (writer->fd >= 0)
+        close(writer->fd);
     free(writer);
 
     return 0;
@@ -0,0 +1,123 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "yuv_reader.h"
+#include "yuv_ops.h"
+#include "frame_diff.h"
+
+#define BLOCK_SIZE      16
+/* Only every other row is compared, plenty to detect motion */
+#define ROW_STEP        2
+
+struct frame_diff {
+    int                 width;
+    int                 height;
+    int                 has_reference;
+    /* Copy of the reference luma plane */
+    uint8_t             *reference;
+    /* Per-block SAD for the current row of blocks */
+    uint32_t            *sad;
+    int                 blocks;
+};
+
+frame_diff_t
+frame_diff_create(int width, int height)
+{
+    frame_diff_t diff = calloc(1, sizeof(struct frame_diff));
+
+    if (diff == NULL)
+        return (NULL);
+
+    diff->width = width;
+    diff->height = height;
+    diff->blocks = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    diff->reference = malloc((size_t)width * height);
+    diff->sad = malloc(sizeof(uint32_t) * diff->blocks);
+    if ((diff->reference == NULL) || (diff->sad == NULL)) {
+        frame_diff_destroy(diff);
+        return (NULL);
+    }
+
+    return (diff);
+}
+
+/*
+ * Returns the largest mean absolute luma difference of a 16x16 block
+ * between @frame and the reference
+ */
+double
+frame_diff_max_block(frame_diff_t diff, yuv_frame_t frame)
+{
+    double worst = 0;
+
+    for (int by = 0; by < diff->height; by += BLOCK_SIZE) {
+        int rows = 0;
+
+        memset(diff->sad, 0, sizeof(uint32_t) * diff->blocks);
+        for (int y = by; (y < by + BLOCK_SIZE) && (y < diff->height); y += ROW_STEP) {
+            size_t off = (size_t)y * diff->width;
+            yuv_sad_blocks16(frame->Y + off, diff->reference + off, diff->width, diff->sad);
+            rows++;
+        }
+
+        for (int bx = 0; bx < diff->blocks; bx++) {
+            int cols = diff->width - bx * BLOCK_SIZE;
+            double mad;
+
+            if (cols > BLOCK_SIZE)
+                cols = BLOCK_SIZE;
+            mad = (double)diff->sad[bx] / (rows * cols);
+            if (mad > worst)
+                worst = mad;
+        }
+    }
+
+    return (worst);
+}
+
+void
+frame_diff_set_reference(frame_diff_t diff, yuv_frame_t frame)
+{
+    memcpy(diff->reference, frame->Y, (size_t)diff->width * diff->height);
+    diff->has_reference = 1;
+}
+
+int
+frame_diff_has_reference(frame_diff_t diff)
+{
+    return (diff->has_reference);
+}
+
+void
+frame_diff_destroy(frame_diff_t diff)
+{
+    free(diff->reference);
+    free(diff->sad);
+    free(diff);
+}
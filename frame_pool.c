@@ -0,0 +1,186 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "yuv_reader.h"
+#include "frame_pool.h"
+
+/* Huge page size of ARMv8 and x86 with 4K base pages */
+#define HUGE_PAGE_SIZE          (2*1024*1024)
+
+#define ROUND_UP(x, a)          (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+struct frame_pool
+{
+    struct yuv_frame    *frames;
+    int                 count;
+
+    /* Stack of free frames */
+    yuv_frame_t         *free;
+    int                 nfree;
+    pthread_mutex_t     lock;
+
+    /* Mapping and the part of it the slots are carved from */
+    void                *map;
+    size_t              map_size;
+    enum frame_pool_backing backing;
+};
+
+/*
+ * Map @size bytes for the pool. hugetlbfs pages are tried first, then
+ * 2M aligned region is asked to be collapsed into transparent huge
+ * pages. Returns pointer to usable memory
+ */
+static uint8_t *
+pool_map(struct frame_pool *pool, size_t size, int flags)
+{
+    uint8_t *mem;
+
+    pool->backing = FRAME_POOL_PAGES;
+    if (flags & FRAME_POOL_HUGEPAGES) {
+        pool->map_size = ROUND_UP(size, HUGE_PAGE_SIZE);
+        pool->map = mmap(NULL, pool->map_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (pool->map != MAP_FAILED) {
+            pool->backing = FRAME_POOL_HUGETLB;
+            return (pool->map);
+        }
+
+        /* THP only covers 2M aligned ranges, over-allocate to align */
+        pool->map_size = ROUND_UP(size, HUGE_PAGE_SIZE) + HUGE_PAGE_SIZE;
+        pool->map = mmap(NULL, pool->map_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pool->map == MAP_FAILED)
+            return (NULL);
+        mem = (uint8_t *)ROUND_UP((uintptr_t)pool->map, HUGE_PAGE_SIZE);
+        if (madvise(mem, ROUND_UP(size, HUGE_PAGE_SIZE), MADV_HUGEPAGE) == 0)
+            pool->backing = FRAME_POOL_THP;
+        return (mem);
+    }
+
+    pool->map_size = size;
+    pool->map = mmap(NULL, pool->map_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return ((pool->map == MAP_FAILED) ? NULL : pool->map);
+}
+
+/*
+ * Create pool of @frames I420 frames of @width x @height, planes aligned
+ * to @alignment (power of two, 0 for FRAME_POOL_ALIGNMENT)
+ */
+frame_pool_t
+frame_pool_create(int width, int height, int frames, size_t alignment, int flags)
+{
+    struct frame_pool *pool;
+    size_t slot_size;
+    uint8_t *mem;
+
+    if (alignment == 0)
+        alignment = FRAME_POOL_ALIGNMENT;
+    if ((frames < 1) || (alignment & (alignment - 1)))
+        return (NULL);
+
+    pool = calloc(1, sizeof(struct frame_pool));
+    if (pool == NULL)
+        return (NULL);
+    pool->frames = calloc(frames, sizeof(struct yuv_frame));
+    pool->free = calloc(frames, sizeof(yuv_frame_t));
+    if ((pool->frames == NULL) || (pool->free == NULL))
+        goto fail;
+
+    slot_size = ROUND_UP(yuv_frame_layout(NULL, NULL, width, height, alignment), alignment);
+    mem = pool_map(pool, slot_size * frames, flags);
+    if (mem == NULL) {
+        pool->map = NULL;
+        goto fail;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->count = frames;
+    /* First frame on top of the stack */
+    for (int i = 0; i < frames; i++) {
+        yuv_frame_layout(&pool->frames[i], mem + slot_size * i, width, height, alignment);
+        pool->free[frames - 1 - i] = &pool->frames[i];
+    }
+    pool->nfree = frames;
+
+    return (pool);
+
+fail:
+    free(pool->frames);
+    free(pool->free);
+    free(pool);
+    return (NULL);
+}
+
+/*
+ * Take a free frame, NULL if all of them are in use
+ */
+yuv_frame_t
+frame_pool_get(frame_pool_t pool)
+{
+    yuv_frame_t frame = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->nfree > 0)
+        frame = pool->free[--pool->nfree];
+    pthread_mutex_unlock(&pool->lock);
+
+    return (frame);
+}
+
+void
+frame_pool_put(frame_pool_t pool, yuv_frame_t frame)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->free[pool->nfree++] = frame;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+enum frame_pool_backing
+frame_pool_backing(frame_pool_t pool)
+{
+    return (pool->backing);
+}
+
+/*
+ * Frames handed out by the pool are invalid after this
+ */
+void
+frame_pool_destroy(frame_pool_t pool)
+{
+    munmap(pool->map, pool->map_size);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->frames);
+    free(pool->free);
+    free(pool);
+}
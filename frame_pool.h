@@ -0,0 +1,62 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __FRAME_POOL_H__
+#define __FRAME_POOL_H__
+
+/*
+ * Fixed set of I420 frames of one size. Planes of every frame are
+ * carved from a single contiguous slot, each plane starting at the
+ * pool alignment (cache line by default), all slots come from one
+ * mapping. Free frames are kept on a LIFO list, so the most recently
+ * released (cache-warm) frame is handed out first. Get/put are safe
+ * to call from different threads
+ *
+ * With FRAME_POOL_HUGEPAGES the mapping is backed by hugetlbfs pages
+ * if the system has them reserved (vm.nr_hugepages), transparent huge
+ * pages otherwise. A 4K I420 frame spans ~3000 4K pages and only six
+ * 2M ones
+ */
+
+#define FRAME_POOL_ALIGNMENT    64
+#define FRAME_POOL_HUGEPAGES    0x1
+
+/* How the pool memory ended up being backed */
+enum frame_pool_backing {
+    FRAME_POOL_PAGES,
+    FRAME_POOL_HUGETLB,
+    FRAME_POOL_THP,
+};
+
+struct frame_pool;
+typedef struct frame_pool * frame_pool_t;
+
+frame_pool_t frame_pool_create(int width, int height, int frames, size_t alignment, int flags);
+yuv_frame_t frame_pool_get(frame_pool_t pool);
+void frame_pool_put(frame_pool_t pool, yuv_frame_t frame);
+enum frame_pool_backing frame_pool_backing(frame_pool_t pool);
+void frame_pool_destroy(frame_pool_t pool);
+
+#endif /* __FRAME_POOL_H__ */
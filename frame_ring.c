@@ -0,0 +1,433 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "metrics.h"
+#include "frame_ring.h"
+
+#define FRAME_RING_MAGIC        "FRMRING1"
+/* Header and slot descriptors, frame data starts on the next page */
+#define FRAME_RING_HEADER_SIZE  4096
+
+/* Descriptors passed to the consumer */
+enum {
+    RING_FD_MEMORY,
+    RING_FD_READY,
+    RING_FD_FREE,
+    RING_FDS
+};
+
+struct frame_ring_header
+{
+    char                magic[8];
+    uint32_t            slots;
+    uint32_t            slot_size;
+    /* Frames published by the producer and released by the consumer */
+    uint64_t            head;
+    uint64_t            tail;
+    /* Side about to sleep on its eventfd, the other one has to wake it */
+    uint32_t            consumer_waiting;
+    uint32_t            producer_waiting;
+    uint32_t            closed;
+    struct frame_ring_slot slot[FRAME_RING_MAX_SLOTS];
+};
+
+struct frame_ring
+{
+    int                 producer;
+    /* Connection to the other side, hangup means it's gone */
+    int                 sock;
+    int                 fds[RING_FDS];
+    struct frame_ring_header *header;
+    uint8_t             *data;
+    size_t              size;
+    /* Consumer gone, frames are dropped */
+    int                 broken;
+};
+
+static void
+frame_ring_free(frame_ring_t ring)
+{
+    if (ring->header)
+        munmap(ring->header, ring->size);
+    for (int i = 0; i < RING_FDS; i++) {
+        if (ring->fds[i] >= 0)
+            close(ring->fds[i]);
+    }
+    if (ring->sock >= 0)
+        close(ring->sock);
+    free(ring);
+}
+
+static frame_ring_t
+frame_ring_alloc(int producer)
+{
+    frame_ring_t ring = calloc(1, sizeof(struct frame_ring));
+
+    if (ring == NULL)
+        return (NULL);
+
+    ring->producer = producer;
+    ring->sock = -1;
+    for (int i = 0; i < RING_FDS; i++)
+        ring->fds[i] = -1;
+
+    return (ring);
+}
+
+static int
+frame_ring_map(frame_ring_t ring)
+{
+    ring->header = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        ring->fds[RING_FD_MEMORY], 0);
+    if (ring->header == MAP_FAILED) {
+        ring->header = NULL;
+        return (-1);
+    }
+    ring->data = (uint8_t *)ring->header + FRAME_RING_HEADER_SIZE;
+
+    return (0);
+}
+
+static int
+unix_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "socket path %s is too long\n", path);
+        return (-1);
+    }
+    strcpy(addr->sun_path, path);
+
+    return (0);
+}
+
+/*
+ * Create the ring and wait until a consumer connects to @path
+ */
+frame_ring_t
+frame_ring_create(const char *path, int slots)
+{
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    union {
+        char            buf[CMSG_SPACE(sizeof(int) * RING_FDS)];
+        struct cmsghdr  align;
+    } control;
+    frame_ring_t ring;
+    int listen_fd;
+    char byte = 0;
+
+    if ((slots < 2) || (slots > FRAME_RING_MAX_SLOTS) || (unix_address(path, &addr) < 0))
+        return (NULL);
+
+    ring = frame_ring_alloc(1);
+    if (ring == NULL)
+        return (NULL);
+
+    ring->size = FRAME_RING_HEADER_SIZE + (size_t)slots * FRAME_RING_SLOT_SIZE;
+    ring->fds[RING_FD_MEMORY] = memfd_create("frame_ring", MFD_CLOEXEC);
+    ring->fds[RING_FD_READY] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    ring->fds[RING_FD_FREE] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if ((ring->fds[RING_FD_MEMORY] < 0) || (ring->fds[RING_FD_READY] < 0) ||
+            (ring->fds[RING_FD_FREE] < 0) ||
+            (ftruncate(ring->fds[RING_FD_MEMORY], ring->size) < 0) ||
+            (frame_ring_map(ring) < 0)) {
+        fprintf(stderr, "failed to create shared memory ring: %s\n", strerror(errno));
+        frame_ring_free(ring);
+        return (NULL);
+    }
+
+    memcpy(ring->header->magic, FRAME_RING_MAGIC, sizeof(ring->header->magic));
+    ring->header->slots = slots;
+    ring->header->slot_size = FRAME_RING_SLOT_SIZE;
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if ((listen_fd < 0) || (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+            (listen(listen_fd, 1) < 0)) {
+        fprintf(stderr, "failed to listen on %s: %s\n", path, strerror(errno));
+        if (listen_fd >= 0)
+            close(listen_fd);
+        frame_ring_free(ring);
+        return (NULL);
+    }
+
+    fprintf(stderr, "waiting for frame ring consumer on %s\n", path);
+    ring->sock = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    unlink(path);
+    if (ring->sock < 0) {
+        fprintf(stderr, "failed to accept consumer: %s\n", strerror(errno));
+        frame_ring_free(ring);
+        return (NULL);
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * RING_FDS);
+    memcpy(CMSG_DATA(cmsg), ring->fds, sizeof(int) * RING_FDS);
+
+    if (sendmsg(ring->sock, &msg, 0) != 1) {
+        fprintf(stderr, "failed to pass ring to consumer: %s\n", strerror(errno));
+        frame_ring_free(ring);
+        return (NULL);
+    }
+
+    return (ring);
+}
+
+/*
+ * Sleep until the other side signals @fd, returns -1 if it has gone.
+ * Caller announces itself as waiting and re-checks the ring before
+ * calling this, so a wakeup can't be lost
+ */
+static int
+frame_ring_wait(frame_ring_t ring, int fd)
+{
+    struct pollfd pfd[2];
+    eventfd_t value;
+
+    pfd[0].fd = fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = ring->sock;
+    pfd[1].events = POLLIN;
+
+    while (poll(pfd, 2, -1) < 0) {
+        if (errno != EINTR)
+            return (-1);
+    }
+
+    if (pfd[0].revents & POLLIN) {
+        eventfd_read(fd, &value);
+        return (0);
+    }
+
+    /* The only thing on the socket can be hangup */
+    return ((pfd[1].revents) ? -1 : 0);
+}
+
+/*
+ * Copy NV12 frame to the next slot, blocks while the ring is full.
+ * Returns -1 if the frame doesn't fit or the consumer is gone
+ */
+int
+frame_ring_publish(frame_ring_t ring, uint8_t *yplane, uint8_t *uvplane,
+    int width, int height, int h_stride)
+{
+    struct frame_ring_header *header = ring->header;
+    struct frame_ring_slot *slot;
+    size_t ysize = (size_t)h_stride * height;
+    size_t uvsize = (size_t)h_stride * (height / 2);
+    uint64_t head = header->head;
+    uint8_t *data;
+
+    if (ring->broken)
+        return (-1);
+
+    if (ysize + uvsize > header->slot_size) {
+        fprintf(stderr, "%dx%d frame doesn't fit in ring slot\n", width, height);
+        return (-1);
+    }
+
+    while (head - __atomic_load_n(&header->tail, __ATOMIC_SEQ_CST) == header->slots) {
+        __atomic_store_n(&header->producer_waiting, 1, __ATOMIC_SEQ_CST);
+        if ((head - __atomic_load_n(&header->tail, __ATOMIC_SEQ_CST) == header->slots) &&
+                (frame_ring_wait(ring, ring->fds[RING_FD_FREE]) < 0)) {
+            fprintf(stderr, "frame ring consumer has gone\n");
+            ring->broken = 1;
+            return (-1);
+        }
+        __atomic_store_n(&header->producer_waiting, 0, __ATOMIC_SEQ_CST);
+        metrics_count(METRIC_EAGAIN, 1);
+    }
+
+    slot = &header->slot[head % header->slots];
+    data = ring->data + (head % header->slots) * (size_t)header->slot_size;
+
+    /* Padding columns go along, so each plane is a single copy */
+    memcpy(data, yplane, ysize);
+    memcpy(data + ysize, uvplane, uvsize);
+    slot->seq = head;
+    slot->width = width;
+    slot->height = height;
+    slot->stride = h_stride;
+    slot->uv_offset = ysize;
+
+    __atomic_store_n(&header->head, head + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->consumer_waiting, __ATOMIC_SEQ_CST))
+        eventfd_write(ring->fds[RING_FD_READY], 1);
+
+    metrics_count(METRIC_BYTES_WRITTEN, ysize + uvsize);
+
+    return (0);
+}
+
+frame_ring_t
+frame_ring_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    union {
+        char            buf[CMSG_SPACE(sizeof(int) * RING_FDS)];
+        struct cmsghdr  align;
+    } control;
+    struct stat st;
+    frame_ring_t ring;
+    char byte;
+
+    if (unix_address(path, &addr) < 0)
+        return (NULL);
+
+    ring = frame_ring_alloc(0);
+    if (ring == NULL)
+        return (NULL);
+
+    ring->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ((ring->sock < 0) || (connect(ring->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)) {
+        fprintf(stderr, "failed to connect to %s: %s\n", path, strerror(errno));
+        frame_ring_free(ring);
+        return (NULL);
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if (recvmsg(ring->sock, &msg, MSG_CMSG_CLOEXEC) != 1) {
+        fprintf(stderr, "failed to receive frame ring from %s\n", path);
+        frame_ring_free(ring);
+        return (NULL);
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if ((cmsg == NULL) || (cmsg->cmsg_type != SCM_RIGHTS) ||
+            (cmsg->cmsg_len != CMSG_LEN(sizeof(int) * RING_FDS))) {
+        fprintf(stderr, "unexpected message from %s\n", path);
+        frame_ring_free(ring);
+        return (NULL);
+    }
+    memcpy(ring->fds, CMSG_DATA(cmsg), sizeof(int) * RING_FDS);
+
+    if ((fstat(ring->fds[RING_FD_MEMORY], &st) < 0) || (st.st_size < FRAME_RING_HEADER_SIZE)) {
+        frame_ring_free(ring);
+        return (NULL);
+    }
+    ring->size = st.st_size;
+    if ((frame_ring_map(ring) < 0) ||
+            memcmp(ring->header->magic, FRAME_RING_MAGIC, sizeof(ring->header->magic)) ||
+            (ring->size < FRAME_RING_HEADER_SIZE + (size_t)ring->header->slots * ring->header->slot_size)) {
+        fprintf(stderr, "invalid frame ring from %s\n", path);
+        frame_ring_free(ring);
+        return (NULL);
+    }
+
+    return (ring);
+}
+
+/*
+ * Wait for the next frame. Returns its descriptor and sets @data to the
+ * start of Y plane, NULL once the producer is done. The slot stays valid
+ * until frame_ring_release
+ */
+const struct frame_ring_slot *
+frame_ring_acquire(frame_ring_t ring, uint8_t **data)
+{
+    struct frame_ring_header *header = ring->header;
+    uint64_t tail = header->tail;
+
+    while (__atomic_load_n(&header->head, __ATOMIC_SEQ_CST) == tail) {
+        if (__atomic_load_n(&header->closed, __ATOMIC_SEQ_CST))
+            return (NULL);
+        __atomic_store_n(&header->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+        if ((__atomic_load_n(&header->head, __ATOMIC_SEQ_CST) == tail) &&
+                !__atomic_load_n(&header->closed, __ATOMIC_SEQ_CST) &&
+                (frame_ring_wait(ring, ring->fds[RING_FD_READY]) < 0)) {
+            /* Producer died without closing the ring */
+            if (__atomic_load_n(&header->head, __ATOMIC_SEQ_CST) == tail)
+                return (NULL);
+        }
+        __atomic_store_n(&header->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+    }
+
+    *data = ring->data + (tail % header->slots) * (size_t)header->slot_size;
+
+    return (&header->slot[tail % header->slots]);
+}
+
+void
+frame_ring_release(frame_ring_t ring)
+{
+    struct frame_ring_header *header = ring->header;
+
+    __atomic_store_n(&header->tail, header->tail + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->producer_waiting, __ATOMIC_SEQ_CST))
+        eventfd_write(ring->fds[RING_FD_FREE], 1);
+}
+
+/*
+ * Producer marks the ring finished, the consumer gets remaining frames
+ * and then NULL. Memory lives until both sides close
+ */
+void
+frame_ring_close(frame_ring_t ring)
+{
+    if (ring->producer) {
+        __atomic_store_n(&ring->header->closed, 1, __ATOMIC_SEQ_CST);
+        eventfd_write(ring->fds[RING_FD_READY], 1);
+    }
+
+    frame_ring_free(ring);
+}
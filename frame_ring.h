@@ -0,0 +1,64 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __FRAME_RING_H__
+#define __FRAME_RING_H__
+
+/*
+ * Ring of decoded NV12 frames in memfd shared with a consumer process.
+ * Producer listens on unix socket, the consumer connects and gets memfd
+ * and two eventfds (frame ready, slot free) over it. Head/tail counters
+ * live in shared memory, eventfds are only written when the other side
+ * sleeps, so steady state costs one copy of each plane per frame and no
+ * syscalls. Full ring blocks the producer
+ */
+
+#define FRAME_RING_MAX_SLOTS    64
+/* Slot fits 4096x2304 NV12, pages are only allocated when touched */
+#define FRAME_RING_SLOT_SIZE    (4096 * 2304 * 3 / 2)
+
+struct frame_ring_slot
+{
+    /* Frame number, equals ring tail when the consumer gets it */
+    uint64_t            seq;
+    uint32_t            width;
+    uint32_t            height;
+    /* Both planes have the same stride, UV plane follows Y */
+    uint32_t            stride;
+    uint32_t            uv_offset;
+};
+
+struct frame_ring;
+typedef struct frame_ring * frame_ring_t;
+
+frame_ring_t frame_ring_create(const char *path, int slots);
+int frame_ring_publish(frame_ring_t ring, uint8_t *yplane, uint8_t *uvplane,
+    int width, int height, int h_stride);
+frame_ring_t frame_ring_connect(const char *path);
+const struct frame_ring_slot *frame_ring_acquire(frame_ring_t ring, uint8_t **data);
+void frame_ring_release(frame_ring_t ring);
+void frame_ring_close(frame_ring_t ring);
+
+#endif /* __FRAME_RING_H__ */
@@ -0,0 +1,274 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "yuv_ops.h"
+#include "crc32c.h"
+#include "metrics.h"
+#include "frame_writer.h"
+
+/* Rows passed to single writev(2) */
+#define WRITE_BATCH_ROWS    64
+
+/*
+ * Writes @len bytes of buffer @data ensuring that all of them are written
+ */
+int
+frame_write_buffer(int fd, uint8_t *data, ssize_t len)
+{
+    ssize_t bytes, total;
+
+    total = bytes = 0;
+    while (total < len) {
+        bytes = write(fd, data + total, len - total);
+        if (bytes < 0) {
+            fprintf(stderr, "failed to write data in write_buffer: %s\n", strerror(errno));
+            return (-1);
+        }
+        else
+            total += bytes;
+    }
+
+    metrics_count(METRIC_BYTES_WRITTEN, total);
+
+    return (0);
+}
+
+/*
+ * Writes @rows rows of @width bytes from the plane with @stride. Rows are
+ * gathered into batches so there is one system call per batch, not per row
+ */
+static int
+write_rows(int fd, uint8_t *plane, int stride, int width, int rows)
+{
+    struct iovec iov[WRITE_BATCH_ROWS];
+
+    if (stride == width)
+        return frame_write_buffer(fd, plane, (ssize_t)width * rows);
+
+    for (int row = 0; row < rows; ) {
+        int count = (rows - row > WRITE_BATCH_ROWS) ? WRITE_BATCH_ROWS : rows - row;
+        ssize_t bytes;
+        int i;
+
+        for (i = 0; i < count; i++) {
+            iov[i].iov_base = plane + (size_t)(row + i) * stride;
+            iov[i].iov_len = width;
+        }
+
+        bytes = writev(fd, iov, count);
+        if (bytes < 0) {
+            fprintf(stderr, "failed to write data in write_rows: %s\n", strerror(errno));
+            return (-1);
+        }
+        metrics_count(METRIC_BYTES_WRITTEN, bytes);
+
+        /* Short write, finish the batch row by row */
+        if (bytes < (ssize_t)width * count) {
+            i = bytes / width;
+            if (frame_write_buffer(fd, (uint8_t *)iov[i].iov_base + bytes % width,
+                        width - bytes % width) < 0)
+                return (-1);
+            for (i++; i < count; i++) {
+                if (frame_write_buffer(fd, iov[i].iov_base, width) < 0)
+                    return (-1);
+            }
+        }
+
+        row += count;
+    }
+
+    return (0);
+}
+
+/*
+ * Writes NV12 frame without padding
+ */
+int
+frame_write_nv12(int fd, uint8_t *yplane, uint8_t *uvplane,
+    int width, int height, int h_stride)
+{
+    if (write_rows(fd, yplane, h_stride, width, height) < 0)
+        return (-1);
+
+    return write_rows(fd, uvplane, h_stride, width, height / 2);
+}
+
+/*
+ * Writes NV12 frame as the next frame of Y4M stream: header goes before
+ * the first frame, chroma is split into U and V planes on the way. Y4M
+ * has no way to change frame size, frames of other size are dropped
+ */
+int
+frame_write_y4m(struct frame_writer *writer, uint8_t *yplane, uint8_t *uvplane,
+    int width, int height, int h_stride)
+{
+    static const char frame_header[] = "FRAME\n";
+    int cw = width / 2, ch = height / 2;
+    size_t size = (size_t)cw * ch * 2;
+
+    if (writer->y4m_width == 0) {
+        if (writer->y4m_fps_num == 0) {
+            writer->y4m_fps_num = FRAME_Y4M_FPS;
+            writer->y4m_fps_den = 1;
+        }
+        if (dprintf(writer->fd, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n",
+                    width, height, writer->y4m_fps_num, writer->y4m_fps_den) < 0)
+            return (-1);
+        writer->y4m_width = width;
+        writer->y4m_height = height;
+    }
+
+    if ((width != writer->y4m_width) || (height != writer->y4m_height)) {
+        if (writer->y4m_dropped++ == 0)
+            fprintf(stderr, "Y4M output is %dx%d, dropping %dx%d frames\n",
+                writer->y4m_width, writer->y4m_height, width, height);
+        return (-1);
+    }
+
+    if (size > writer->chroma_size) {
+        free(writer->chroma);
+        writer->chroma = malloc(size);
+        if (writer->chroma == NULL) {
+            writer->chroma_size = 0;
+            fprintf(stderr, "failed to allocate chroma buffer\n");
+            return (-1);
+        }
+        writer->chroma_size = size;
+    }
+
+    for (int y = 0; y < ch; y++)
+        yuv_split_uv(writer->chroma + (size_t)y * cw, writer->chroma + (size_t)(ch + y) * cw,
+            uvplane + (size_t)y * h_stride, cw);
+
+    if ((frame_write_buffer(writer->fd, (uint8_t *)frame_header, sizeof(frame_header) - 1) < 0)
+            || (write_rows(writer->fd, yplane, h_stride, width, height) < 0))
+        return (-1);
+
+    return frame_write_buffer(writer->fd, writer->chroma, size);
+}
+
+/*
+ * CRC32C of NV12 frame without padding, same bytes frame_write_nv12
+ * would write, continuing from @crc
+ */
+uint32_t
+frame_hash_nv12(uint32_t crc, uint8_t *yplane, uint8_t *uvplane,
+    int width, int height, int h_stride)
+{
+    if (h_stride == width)
+        return crc32c_update(crc32c_update(crc, yplane, (size_t)width * height),
+            uvplane, (size_t)width * (height / 2));
+
+    for (int y = 0; y < height; y++)
+        crc = crc32c_update(crc, yplane + (size_t)y * h_stride, width);
+    for (int y = 0; y < height / 2; y++)
+        crc = crc32c_update(crc, uvplane + (size_t)y * h_stride, width);
+
+    return (crc);
+}
+
+/*
+ * Box-downscale NV12 frame by writer->scale into writer->scaled,
+ * @width and @height are updated to the thumbnail size
+ */
+static int
+thumbnail_scale(struct frame_writer *writer, uint8_t *yplane, uint8_t *uvplane,
+    int *width, int *height, int h_stride)
+{
+    /* Keep dimensions even so the result is valid NV12 */
+    int tw = (*width / writer->scale) & ~1;
+    int th = (*height / writer->scale) & ~1;
+    size_t size = (size_t)tw * th * 3 / 2;
+
+    if (size > writer->scaled_size) {
+        free(writer->scaled);
+        writer->scaled = malloc(size);
+        if (writer->scaled == NULL) {
+            writer->scaled_size = 0;
+            fprintf(stderr, "failed to allocate thumbnail buffer\n");
+            return (-1);
+        }
+        writer->scaled_size = size;
+    }
+
+    yuv_decimate_plane(writer->scaled, tw, yplane, h_stride, tw, th, writer->scale, 1);
+    yuv_decimate_plane(writer->scaled + tw * th, tw, uvplane, h_stride, tw / 2, th / 2,
+        writer->scale, 2);
+    *width = tw;
+    *height = th;
+
+    return (0);
+}
+
+/*
+ * Called for every decoded frame. The frame format is NV12
+ */
+void
+frame_writer_callback(void *ptr, uint8_t *yplane, uint8_t *uvplane,
+    int width, int height, int h_stride, int v_stride)
+{
+    struct frame_writer *writer = (struct frame_writer *)ptr;
+    uint64_t begin = metrics_stage_begin();
+    uint32_t crc;
+    uint8_t crc_bytes[4];
+
+    writer->frames++;
+
+    switch (writer->sink) {
+        case FRAME_SINK_HASH:
+            crc = frame_hash_nv12(0, yplane, uvplane, width, height, h_stride);
+            /* Stream checksum is taken over frame checksums, not pixels again */
+            for (int i = 0; i < 4; i++)
+                crc_bytes[i] = crc >> (i * 8);
+            writer->crc = crc32c_update(writer->crc, crc_bytes, sizeof(crc_bytes));
+            dprintf(writer->fd, "%d %dx%d %08x\n", writer->frames - 1, width, height, crc);
+            break;
+        case FRAME_SINK_NULL:
+            break;
+        default:
+            if (writer->scale > 1) {
+                if (thumbnail_scale(writer, yplane, uvplane, &width, &height, h_stride) < 0)
+                    break;
+                yplane = writer->scaled;
+                uvplane = writer->scaled + (size_t)width * height;
+                h_stride = width;
+            }
+            if (writer->sink == FRAME_SINK_Y4M)
+                frame_write_y4m(writer, yplane, uvplane, width, height, h_stride);
+            else
+                frame_write_nv12(writer->fd, yplane, uvplane, width, height, h_stride);
+            break;
+    }
+
+    metrics_stage_end(METRIC_STAGE_WRITE, begin);
+}
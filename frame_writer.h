@@ -0,0 +1,82 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __FRAME_WRITER_H__
+#define __FRAME_WRITER_H__
+
+enum frame_sink {
+    /* Raw NV12 frames */
+    FRAME_SINK_FILE,
+    /* Line with CRC32C of the cropped planes per frame */
+    FRAME_SINK_HASH,
+    /* Nothing, decoded frames are dropped */
+    FRAME_SINK_NULL,
+    /* Y4M stream of I420 frames */
+    FRAME_SINK_Y4M,
+};
+
+/*
+ * Y4M frame rate when the stream doesn't carry one (no VUI timing in
+ * SPS, or H.265). Same as encoder default
+ */
+#define FRAME_Y4M_FPS       30
+
+/*
+ * Context for writer callback
+ */
+struct frame_writer
+{
+    int fd;
+    int frames;
+    enum frame_sink sink;
+    /* Downscale factor for thumbnails, 1 means full size */
+    int scale;
+    uint8_t *scaled;
+    size_t scaled_size;
+    /* CRC32C of frame checksums so far, FRAME_SINK_HASH only */
+    uint32_t crc;
+    /* Frame size in Y4M header, 0 until the first frame. FRAME_SINK_Y4M only */
+    int y4m_width;
+    int y4m_height;
+    int y4m_dropped;
+    /* Frame rate for Y4M header, FRAME_Y4M_FPS if 0 */
+    int y4m_fps_num;
+    int y4m_fps_den;
+    /* Planar chroma of the frame being written */
+    uint8_t *chroma;
+    size_t chroma_size;
+};
+
+int frame_write_buffer(int fd, uint8_t *data, ssize_t len);
+int frame_write_nv12(int fd, uint8_t *yplane, uint8_t *uvplane,
+    int width, int height, int h_stride);
+int frame_write_y4m(struct frame_writer *writer, uint8_t *yplane, uint8_t *uvplane,
+    int width, int height, int h_stride);
+uint32_t frame_hash_nv12(uint32_t crc, uint8_t *yplane, uint8_t *uvplane,
+    int width, int height, int h_stride);
+void frame_writer_callback(void *ptr, uint8_t *yplane, uint8_t *uvplane,
+    int width, int height, int h_stride, int v_stride);
+
+#endif /* __FRAME_WRITER_H__ */
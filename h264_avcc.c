@@ -0,0 +1,298 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "video_codec.h"
+#include "h264_reader.h"
+#include "h264_sps.h"
+#include "h264_avcc.h"
+
+/* numOfSequenceParameterSets is 5 bits wide */
+#define MAX_SPS_COUNT       31
+#define MAX_PPS_COUNT       255
+
+/*
+ * Returns NAL unit at @*pos (after its start code) in @len bytes of
+ * Annex B @data and advances @*pos to the next start code, NULL at the end
+ */
+static const uint8_t *
+next_nal(const uint8_t *data, size_t len, size_t *pos, size_t *nal_len)
+{
+    ssize_t start, next;
+
+    if (*pos >= len)
+        return (NULL);
+
+    start = h264_find_start_code(data + *pos, len - *pos);
+    if (start < 0) {
+        *pos = len;
+        return (NULL);
+    }
+    start += *pos + 4;
+
+    next = h264_find_start_code(data + start, len - start);
+    *pos = (next < 0) ? len : start + next;
+    *nal_len = *pos - start;
+
+    return (data + start);
+}
+
+/* Profiles whose avcC carries chroma format and bit depths */
+static int
+high_profile(int profile_idc)
+{
+
+    return ((profile_idc == 100) || (profile_idc == 110)
+        || (profile_idc == 122) || (profile_idc == 144));
+}
+
+/*
+ * Replaces every 4-byte start code in @len bytes of @data with big
+ * endian size of the NAL unit that follows, leaving the rest untouched.
+ * Returns length of the converted data (always @len), -1 if @data does
+ * not start with a start code
+ */
+ssize_t
+h264_annexb_to_avcc(uint8_t *data, size_t len)
+{
+    ssize_t pos, next;
+    size_t size;
+
+    if (h264_find_start_code(data, len) != 0)
+        return (-1);
+
+    for (pos = 0; pos >= 0; pos = next) {
+        /* Start codes are looked up ahead of the rewritten sizes */
+        next = h264_find_start_code(data + pos + 4, len - pos - 4);
+        if (next >= 0)
+            next += pos + 4;
+        size = ((next < 0) ? (ssize_t)len : next) - pos - 4;
+
+        data[pos] = size >> 24;
+        data[pos + 1] = size >> 16;
+        data[pos + 2] = size >> 8;
+        data[pos + 3] = size;
+    }
+
+    return (len);
+}
+
+/*
+ * Writes AVCDecoderConfigurationRecord for SPS and PPS units found in
+ * @len bytes of Annex B @annexb (e.g. encoder extra data) to @config.
+ * NAL size field is H264_AVCC_LENGTH_SIZE bytes.
+ * Returns size of the record, -1 if there is no SPS or @size is too small
+ */
+ssize_t
+h264_avcc_build_config(const uint8_t *annexb, size_t len, uint8_t *config, size_t size)
+{
+    const uint8_t *nal, *sps_nal;
+    struct h264_sps sps;
+    size_t pos, nal_len, sps_len, out;
+    int count[2];
+
+    if (size < 7)
+        return (-1);
+
+    /* SPS list goes first, then PPS list, each needs its own pass */
+    sps_nal = NULL;
+    sps_len = 0;
+    out = 5;
+    for (int list = 0; list < 2; list++) {
+        size_t count_pos = out++;
+
+        count[list] = 0;
+        pos = 0;
+        while ((nal = next_nal(annexb, len, &pos, &nal_len)) != NULL) {
+            if ((nal_len == 0) || ((nal[0] & 0x1f) != (list ? H264_NAL_PPS : H264_NAL_SPS)))
+                continue;
+            if ((out + 2 + nal_len + 1 > size) || (nal_len > 0xffff))
+                return (-1);
+            config[out] = nal_len >> 8;
+            config[out + 1] = nal_len;
+            memcpy(config + out + 2, nal, nal_len);
+            out += 2 + nal_len;
+            count[list]++;
+            if ((list == 0) && (sps_nal == NULL)) {
+                sps_nal = nal;
+                sps_len = nal_len;
+            }
+        }
+        if (list == 0)
+            config[count_pos] = 0xe0 | count[list];
+        else
+            config[count_pos] = count[list];
+    }
+
+    if ((count[0] == 0) || (sps_len < 4) || (count[0] > MAX_SPS_COUNT)
+            || (count[1] > MAX_PPS_COUNT))
+        return (-1);
+
+    config[0] = H264_AVCC_VERSION;
+    /* profile_idc, constraint flags, level_idc */
+    config[1] = sps_nal[1];
+    config[2] = sps_nal[2];
+    config[3] = sps_nal[3];
+    config[4] = 0xfc | (H264_AVCC_LENGTH_SIZE - 1);
+
+    if (high_profile(sps_nal[1])) {
+        if ((out + 4 > size) || h264_parse_sps(sps_nal, sps_len, &sps))
+            return (-1);
+        config[out++] = 0xfc | sps.chroma_format_idc;
+        config[out++] = 0xf8 | (sps.bit_depth_luma - 8);
+        config[out++] = 0xf8 | (sps.bit_depth_chroma - 8);
+        /* numOfSequenceParameterSetExt */
+        config[out++] = 0;
+    }
+
+    return (out);
+}
+
+/*
+ * Parses AVCDecoderConfigurationRecord at @config and writes its SPS and
+ * PPS units to @annexb (@*annexb_len bytes long) with start codes, so
+ * they can be fed to the decoder ahead of the stream. Stores the size
+ * of the record's NAL size field in @length_size and the number of bytes
+ * written in @*annexb_len.
+ * Returns size of the record, 0 if @len bytes are not enough to hold it,
+ * -1 if the record is malformed or does not fit to @annexb
+ */
+ssize_t
+h264_avcc_parse_config(const uint8_t *config, size_t len, int *length_size,
+    uint8_t *annexb, size_t *annexb_len)
+{
+    size_t pos, out, nal_len;
+    int count;
+
+    if (len < 7)
+        return (0);
+    if (config[0] != H264_AVCC_VERSION)
+        return (-1);
+
+    *length_size = (config[4] & 3) + 1;
+
+    pos = 5;
+    out = 0;
+    for (int list = 0; list < 2; list++) {
+        if (pos >= len)
+            return (0);
+        count = list ? config[pos] : (config[pos] & 0x1f);
+        pos++;
+        for (int i = 0; i < count; i++) {
+            if (pos + 2 > len)
+                return (0);
+            nal_len = (config[pos] << 8) | config[pos + 1];
+            if (pos + 2 + nal_len > len)
+                return (0);
+            if (out + 4 + nal_len > *annexb_len)
+                return (-1);
+            annexb[out] = annexb[out + 1] = annexb[out + 2] = 0;
+            annexb[out + 3] = 1;
+            memcpy(annexb + out + 4, config + pos + 2, nal_len);
+            out += 4 + nal_len;
+            pos += 2 + nal_len;
+        }
+    }
+
+    /*
+     * High profile extension is mandatory, but older muxers leave it out.
+     * Without a box around the record tell it by the reserved bits: the
+     * size of the first NAL that would follow instead starts with zeros
+     */
+    if (high_profile(config[1]) && (pos == len))
+        return (0);
+    if (high_profile(config[1]) && ((config[pos] & 0xfc) == 0xfc)) {
+        if (pos + 4 > len)
+            return (0);
+        count = config[pos + 3];
+        pos += 4;
+        for (int i = 0; i < count; i++) {
+            if (pos + 2 > len)
+                return (0);
+            pos += 2 + ((config[pos] << 8) | config[pos + 1]);
+        }
+        if (pos > len)
+            return (0);
+    }
+
+    *annexb_len = out;
+
+    return (pos);
+}
+
+/*
+ * Prepares @stream for conversion of NAL units prefixed with
+ * @length_size bytes of size. Conversion is in place, so only sizes
+ * that are as wide as a start code can be handled: 4 bytes become
+ * 00 00 00 01, 3 bytes 00 00 01.
+ * Returns 0 on success, -1 if @length_size is not supported
+ */
+int
+h264_avcc_stream_init(struct h264_avcc_stream *stream, int length_size)
+{
+
+    if ((length_size != 3) && (length_size != 4))
+        return (-1);
+
+    memset(stream, 0, sizeof(*stream));
+    stream->length_size = length_size;
+
+    return (0);
+}
+
+/*
+ * Rewrites NAL size fields in the next @len bytes of the stream at
+ * @data into start codes. Chunks may be split anywhere, including
+ * inside the size field: its bytes at the end of the previous chunk
+ * have already been replaced with zeros
+ */
+void
+h264_avcc_stream_convert(struct h264_avcc_stream *stream, uint8_t *data, size_t len)
+{
+    size_t pos, n;
+
+    pos = 0;
+    while (pos < len) {
+        /* Skip over the payload, most of the data */
+        if (stream->remaining) {
+            n = (len - pos < stream->remaining) ? len - pos : stream->remaining;
+            stream->remaining -= n;
+            pos += n;
+            continue;
+        }
+
+        stream->length = (stream->length << 8) | data[pos];
+        stream->have++;
+        data[pos++] = (stream->have == stream->length_size) ? 1 : 0;
+        if (stream->have == stream->length_size) {
+            stream->remaining = stream->length;
+            stream->length = 0;
+            stream->have = 0;
+        }
+    }
+}
@@ -0,0 +1,63 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __H264_AVCC_H__
+#define __H264_AVCC_H__
+
+/*
+ * Conversion between Annex B byte stream (start code before every NAL)
+ * and AVCC/avc1 form used by MP4 and most network layers (NAL size in
+ * big endian before every NAL, SPS/PPS out of band in avcC record,
+ * ISO/IEC 14496-15 5.3.3.1). Both directions rewrite the buffer in place:
+ * 4-byte start code and 4-byte size take the same room
+ */
+
+/* NAL size field written by the converters */
+#define H264_AVCC_LENGTH_SIZE   4
+
+/* avcC record starts with configurationVersion 1, Annex B with zero */
+#define H264_AVCC_VERSION       1
+
+/*
+ * State of AVCC to Annex B conversion of a stream that arrives in
+ * arbitrary chunks: NAL size may be split between two chunks
+ */
+struct h264_avcc_stream {
+    int             length_size;
+    /* Bytes of the current NAL not seen yet */
+    size_t          remaining;
+    /* Bytes of the NAL size field collected so far */
+    int             have;
+    uint32_t        length;
+};
+
+ssize_t h264_annexb_to_avcc(uint8_t *data, size_t len);
+ssize_t h264_avcc_build_config(const uint8_t *annexb, size_t len, uint8_t *config, size_t size);
+ssize_t h264_avcc_parse_config(const uint8_t *config, size_t len, int *length_size,
+    uint8_t *annexb, size_t *annexb_len);
+int h264_avcc_stream_init(struct h264_avcc_stream *stream, int length_size);
+void h264_avcc_stream_convert(struct h264_avcc_stream *stream, uint8_t *data, size_t len);
+
+#endif /* __H264_AVCC_H__ */
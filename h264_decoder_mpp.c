@@ -36,7 +36,10 @@
 #include "rockchip/mpp_frame.h"
 #include "rockchip/mpp_packet.h"
 
-#include "yuv_reader.h"
+#include "mpp_rec.h"
+#include "metrics.h"
+#include "trace.h"
+#include "video_codec.h"
 #include "h264_decoder_mpp.h"
 
 #define H264_DECODER_ALIGNMENT 32
@@ -48,6 +51,11 @@ struct h264_decoder_mpp {
      */
     decoder_callback_t  callback;
     void                *arg;
+    /*
+     * Optional zero-copy callback, used instead of the one above
+     */
+    decoder_buffer_callback_t buffer_callback;
+    void                *buffer_arg;
 
     MppCtx              ctx;
     MppApi              *mpi;
@@ -62,13 +70,25 @@ struct h264_decoder_mpp {
 };
 
 /*
- * Create decoder context
+ * Create H.264 decoder context
  */
 struct h264_decoder_mpp *
 h264_mpp_decoder_create(decoder_callback_t callback, void *arg)
+{
+
+    return h264_mpp_decoder_create_codec(VIDEO_CODEC_H264, callback, arg);
+}
+
+/*
+ * Create decoder context for @codec bitstream
+ */
+struct h264_decoder_mpp *
+h264_mpp_decoder_create_codec(enum video_codec codec, decoder_callback_t callback, void *arg)
 {
     struct h264_decoder_mpp *decoder;
-    decoder = malloc(sizeof(struct h264_decoder_mpp));
+    decoder = calloc(1, sizeof(struct h264_decoder_mpp));
+    if (decoder == NULL)
+        return (NULL);
 
     MPP_RET ret = MPP_OK;
     ret = mpp_create(&decoder->ctx, &decoder->mpi);
@@ -77,6 +97,8 @@ h264_mpp_decoder_create(decoder_callback_t callback, void *arg)
         free(decoder);
         return NULL;
     }
+    /* No-op unless MPP_RECORD is set */
+    mpp_rec_wrap(decoder->ctx, &decoder->mpi);
 
     decoder->callback = callback;
     decoder->arg = arg;
@@ -94,7 +116,8 @@ h264_mpp_decoder_create(decoder_callback_t callback, void *arg)
         return NULL;
     }
 
-    ret = mpp_init(decoder->ctx, MPP_CTX_DEC, MPP_VIDEO_CodingAVC);
+    ret = mpp_init(decoder->ctx, MPP_CTX_DEC,
+        (codec == VIDEO_CODEC_HEVC) ? MPP_VIDEO_CodingHEVC : MPP_VIDEO_CodingAVC);
     if (MPP_OK != ret) {
         fprintf(stderr, "mpp_init failed\n");
         mpp_destroy(decoder->ctx);
@@ -136,6 +159,17 @@ h264_mpp_decoder_create(decoder_callback_t callback, void *arg)
     return (decoder);
 }
 
+/*
+ * Pass decoded frames to @callback as MPP buffers instead of plane pointers
+ */
+void
+h264_decoder_mpp_set_buffer_callback(struct h264_decoder_mpp *decoder,
+    decoder_buffer_callback_t callback, void *arg)
+{
+    decoder->buffer_callback = callback;
+    decoder->buffer_arg = arg;
+}
+
 /*
  * Cleanup decoder context
  */
@@ -177,7 +211,8 @@ h264_decoder_mpp_destroy(struct h264_decoder_mpp *decoder)
 }
 
 /*
- * Submit chunk of H264 bitstream to the decoder
+ * Submit chunk of H264 bitstream to the decoder. The chunk is copied to
+ * the internal SZ_4K buffer, h264_decoder_mpp_submit_data avoids the copy
  * returns:
  *   0 if data was submitted
  *   EAGAIN if the decoder buffer is full
@@ -200,13 +235,16 @@ h264_decoder_mpp_submit_packet(struct h264_decoder_mpp *decoder, uint8_t *data,
      * EOS will propogate along with the decoded frame where it can be checked 
      * using mpp_frame_get_eos
      */
+    uint64_t tr = trace_begin();
     ret = decoder->mpi->decode_put_packet(decoder->ctx, decoder->packet);
+    trace_end("decode_put_packet", tr);
     if (ret != MPP_OK) {
         if (ret == MPP_ERR_BUFFER_FULL) {
             /* 
              * Buffer is full at the moment. Caller should wait, check
              * available decoded frames and re-submit data later.
              */
+            metrics_count(METRIC_BUFFER_FULL, 1);
             return (EAGAIN);
         }
         else {
@@ -215,19 +253,111 @@ h264_decoder_mpp_submit_packet(struct h264_decoder_mpp *decoder, uint8_t *data,
         }
     }
 
+    metrics_count(METRIC_PACKETS_IN, 1);
+    metrics_count(METRIC_BYTES_IN, len);
+
+    return (0);
+}
+
+/*
+ * Submit @len bytes of bitstream at @data without copying it: caller's
+ * memory (mmap'd file, pooled buffer) is wrapped in MPP packet as is, so
+ * there is no limit on the packet size. The memory must stay valid until
+ * @release (if not NULL) is called with @arg, which happens before the
+ * function returns 0
+ * returns:
+ *   0 if data was submitted
+ *   EAGAIN if the decoder buffer is full, caller still owns the memory
+ *   -1 if there is an error, caller still owns the memory
+ */
+int
+h264_decoder_mpp_submit_data(struct h264_decoder_mpp *decoder, uint8_t *data, size_t len,
+    decoder_release_t release, void *arg)
+{
+    MppPacket packet = NULL;
+    MPP_RET ret;
+
+    ret = mpp_packet_init(&packet, data, len);
+    if (ret != MPP_OK) {
+        fprintf(stderr, "mpp_packet_init failed\n");
+        return (-1);
+    }
+
+    uint64_t tr = trace_begin();
+    ret = decoder->mpi->decode_put_packet(decoder->ctx, packet);
+    trace_end("decode_put_packet", tr);
+    mpp_packet_deinit(&packet);
+
+    if (ret != MPP_OK) {
+        if (ret == MPP_ERR_BUFFER_FULL) {
+            metrics_count(METRIC_BUFFER_FULL, 1);
+            return (EAGAIN);
+        }
+        fprintf(stderr, "decode_put_packet failed: %d\n", ret);
+        return (-1);
+    }
+
+    /* Packet is in MPP stream queue now, caller's memory is not needed */
+    if (release)
+        release(arg);
+
+    metrics_count(METRIC_PACKETS_IN, 1);
+    metrics_count(METRIC_BYTES_IN, len);
+
     return (0);
 }
 
+/*
+ * Signal end of the bitstream. Decoder flushes all pending frames and
+ * marks the last one with EOS flag, see h264_decoder_mpp_get_frame
+ * returns:
+ *   0 if EOS was submitted
+ *   EAGAIN if the decoder buffer is full
+ *   -1 if there is an error
+ */
+int
+h264_decoder_mpp_submit_eos(struct h264_decoder_mpp *decoder)
+{
+    MPP_RET ret;
+
+    mpp_packet_set_pos(decoder->packet, decoder->packet_buf);
+    mpp_packet_set_length(decoder->packet, 0);
+    mpp_packet_set_eos(decoder->packet);
+
+    ret = decoder->mpi->decode_put_packet(decoder->ctx, decoder->packet);
+    mpp_packet_clr_eos(decoder->packet);
+    if (ret != MPP_OK) {
+        if (ret == MPP_ERR_BUFFER_FULL)
+            return (EAGAIN);
+        fprintf(stderr, "decode_put_packet(EOS) failed: %d\n", ret);
+        return (-1);
+    }
+
+    return (0);
+}
 
+/*
+ * Fetch decoded frame if there is any and pass it to the callback
+ * returns:
+ *   0 if there was no frame or the frame has been handled
+ *   1 if the frame was the last one in the stream (EOS)
+ *   EAGAIN if decoder timed out
+ *   -1 if there is an error
+ */
 int
 h264_decoder_mpp_get_frame(struct h264_decoder_mpp *decoder)
 {
     MPP_RET ret;
     MppFrame frame;
+    int eos;
 
+    uint64_t tr = trace_begin();
     ret = decoder->mpi->decode_get_frame(decoder->ctx, &frame);
-    if (ret == MPP_ERR_TIMEOUT)
+    trace_end("decode_get_frame", tr);
+    if (ret == MPP_ERR_TIMEOUT) {
+        metrics_count(METRIC_EAGAIN, 1);
         return (EAGAIN);
+    }
 
     if (ret != MPP_OK){
         fprintf(stderr, "decode_get_frame failed ret %d\n", ret);
@@ -237,6 +367,8 @@ h264_decoder_mpp_get_frame(struct h264_decoder_mpp *decoder)
     if (!frame)
         return (0);
 
+    eos = mpp_frame_get_eos(frame);
+
     if (mpp_frame_get_info_change(frame)) {
         unsigned int width = mpp_frame_get_width(frame);
         unsigned int height = mpp_frame_get_height(frame);
@@ -267,11 +399,19 @@ h264_decoder_mpp_get_frame(struct h264_decoder_mpp *decoder)
         }
         else {
             /*
-             * This is probably due to PPS/SPS in H264, can't handle resultion change for now
+             * Mid-stream resolution change. MPP reports it only after all
+             * frames of the old resolution have been output, so the group
+             * is reused in place: buffers nobody holds are released now,
+             * the ones still referenced downstream (e.g. by the encoder)
+             * go away when their owners put them. Frames that follow come
+             * with the new dimensions
              */
-            fprintf(stderr, "frame group is initialized, can't handle resolution change\n");
-            mpp_frame_deinit(&frame);
-            return (-1);
+            ret = mpp_buffer_group_clear(decoder->frame_group);
+            if (ret) {
+                fprintf(stderr, "mpp_buffer_group_clear failed ret %d\n", ret);
+                mpp_frame_deinit(&frame);
+                return (-1);
+            }
         }
 
         /* Configure group memory limit: 24 buffers */
@@ -284,11 +424,14 @@ h264_decoder_mpp_get_frame(struct h264_decoder_mpp *decoder)
 
         /* Submit the change */
         decoder->mpi->control(decoder->ctx, MPP_DEC_SET_INFO_CHANGE_READY, NULL);
+    } else if (eos && (mpp_frame_get_buffer(frame) == NULL)) {
+        /* Empty frame that only carries EOS flag */
     } else {
         /* Is it erroneous frame? */
         int err_info = mpp_frame_get_errinfo(frame) | mpp_frame_get_discard(frame);
         if (err_info) {
             /* Yes, just drop this frame */
+            metrics_count(METRIC_FRAMES_DROPPED, 1);
             fprintf(stderr, "decoder_get_frame get err info:%d discard:%d.\n",
                     mpp_frame_get_errinfo(frame), mpp_frame_get_discard(frame));
         }
@@ -301,12 +444,26 @@ h264_decoder_mpp_get_frame(struct h264_decoder_mpp *decoder)
 
             MppBuffer mpp_buf = mpp_frame_get_buffer(frame);
             MppFrameFormat fmt = mpp_frame_get_fmt(frame);
-            if (fmt == MPP_FMT_YUV420SP) {
+            uint64_t begin = metrics_stage_begin();
+            tr = trace_begin();
+
+            if (fmt == MPP_FMT_YUV420SP)
+                metrics_count(METRIC_FRAMES_DECODED, 1);
+
+            if ((fmt == MPP_FMT_YUV420SP) && decoder->buffer_callback) {
+                decoder->buffer_callback(decoder->buffer_arg, mpp_buf, width, height,
+                    h_stride, v_stride);
+                trace_end("decoder_callback", tr);
+                metrics_stage_end(METRIC_STAGE_CALLBACK, begin);
+            }
+            else if (fmt == MPP_FMT_YUV420SP) {
                 uint8_t *yplane = mpp_buffer_get_ptr(mpp_buf);
                 uint8_t *uvplane = yplane + h_stride*v_stride;
 
                 decoder->callback(decoder->arg, yplane, uvplane, width, height,
                     h_stride, v_stride);
+                trace_end("decoder_callback", tr);
+                metrics_stage_end(METRIC_STAGE_CALLBACK, begin);
             }
             else {
                 fprintf(stderr, "decoder_get_frame get err info:%d discard:%d.\n",
@@ -315,13 +472,8 @@ h264_decoder_mpp_get_frame(struct h264_decoder_mpp *decoder)
         }
     }
 
-    /*
-     * Here mpp_frame_get_eos can be used to check if it's the last
-     * frame in the decoded stream. Also see mpp_packet_set_eos
-     */
-
     /* release frame */
     mpp_frame_deinit(&frame);
 
-    return (0);
+    return (eos ? 1 : 0);
 }
@@ -26,12 +26,36 @@
 #ifndef __H264_DECODER_MPP_H__
 #define __H264_DECODER_MPP_H__
 
+/*
+ * Called for every decoded frame. Dimensions may change mid-stream when
+ * the bitstream switches resolution, callee should check them every time
+ */
 typedef void (*decoder_callback_t)(void *arg, uint8_t *yplane, uint8_t *uvplane,
     int width, int height, int h_stride, int v_stride);
 
+/*
+ * Same as decoder_callback_t but passes MppBuffer holding the NV12 frame
+ * instead of plane pointers. The buffer is valid only for the duration of
+ * the call unless callee takes its own reference
+ */
+typedef void (*decoder_buffer_callback_t)(void *arg, void *buffer,
+    int width, int height, int h_stride, int v_stride);
+
+/*
+ * Releases caller's memory passed to h264_decoder_mpp_submit_data
+ */
+typedef void (*decoder_release_t)(void *arg);
+
 struct h264_decoder_mpp * h264_mpp_decoder_create(decoder_callback_t callback, void *arg);
+struct h264_decoder_mpp * h264_mpp_decoder_create_codec(enum video_codec codec,
+    decoder_callback_t callback, void *arg);
+void h264_decoder_mpp_set_buffer_callback(struct h264_decoder_mpp * decoder,
+    decoder_buffer_callback_t callback, void *arg);
 int h264_decoder_mpp_destroy(struct h264_decoder_mpp * decoder);
 int h264_decoder_mpp_submit_packet(struct h264_decoder_mpp * decoder, uint8_t *packet, ssize_t len);
+int h264_decoder_mpp_submit_data(struct h264_decoder_mpp * decoder, uint8_t *data, size_t len,
+    decoder_release_t release, void *arg);
+int h264_decoder_mpp_submit_eos(struct h264_decoder_mpp * decoder);
 int h264_decoder_mpp_get_frame(struct h264_decoder_mpp * decoder);
 
 #endif /* __H264_DECODER_MPP_H__ */
@@ -35,6 +35,11 @@
 #include "rockchip/mpp_packet.h"
 
 #include "yuv_reader.h"
+#include "yuv_ops.h"
+#include "video_codec.h"
+#include "mpp_rec.h"
+#include "metrics.h"
+#include "trace.h"
 #include "h264_encoder_mpp.h"
 
 /*
@@ -45,11 +50,22 @@
 #define UP_TO_16(x) (((x) + 0xf) & ~0xf)
 #define MPP_MAX_BUFFERS                 4
 
+#define DEFAULT_FPS                     30
+#define DEFAULT_GOP                     30
+#define DEFAULT_BPS                     (1024*1024)
+
 struct h264_encoder_mpp {
+    enum video_codec    codec;
     int                 width;
     int                 height;
     int                 h_stride;
     int                 v_stride;
+    enum h264_encoder_input input;
+    MppFrameFormat      format;
+
+    int                 fps;
+    int                 gop;
+    int                 bps;
 
     encoder_callback_t  callback;
     void                *arg;
@@ -76,9 +92,9 @@ h264_mpp_setup_format(struct h264_encoder_mpp *encoder)
             MPP_ENC_PREP_CFG_CHANGE_FORMAT;
     prep_cfg.width = encoder->width;
     prep_cfg.height = encoder->height;
-    prep_cfg.format = MPP_FMT_YUV420P;
-    prep_cfg.hor_stride = UP_TO_16(encoder->width);
-    prep_cfg.ver_stride = UP_TO_16(encoder->height);
+    prep_cfg.format = encoder->format;
+    prep_cfg.hor_stride = encoder->h_stride;
+    prep_cfg.ver_stride = encoder->v_stride;
 
     if (encoder->mpi->control(encoder->ctx, MPP_ENC_SET_PREP_CFG, &prep_cfg)) {
         fprintf (stderr, "Setting input format for rockchip mpp failed\n");
@@ -108,8 +124,14 @@ h264_mpp_alloc_frames(struct h264_encoder_mpp *encoder)
 
     for (int i = 0; i < MPP_MAX_BUFFERS; i++) {
         int frame_size = encoder->h_stride*encoder->v_stride*3/2;
-        if (mpp_buffer_get(encoder->input_group, &encoder->input_buffer[i], frame_size))
-            goto failed;
+        /*
+         * Imported NV12 buffers come from the caller, the only internal
+         * input buffer needed is the one carrying EOS flag
+         */
+        if ((i == 0) || (encoder->input == H264_ENCODER_INPUT_I420)) {
+            if (mpp_buffer_get(encoder->input_group, &encoder->input_buffer[i], frame_size))
+                goto failed;
+        }
         /* 
          * More than enough to fit encoded frame. Should be significantly less
          */
@@ -171,16 +193,105 @@ h264_mpp_free_frames(struct h264_encoder_mpp *encoder)
     }
 }
 
+/*
+ * H.264 High profile, level 4.0, CABAC and 8x8 transform
+ */
+static void
+h264_mpp_codec_cfg_avc(struct h264_encoder_mpp *encoder, MppEncCodecCfg *codec_cfg)
+{
+    codec_cfg->coding = MPP_VIDEO_CodingAVC;
+    codec_cfg->h264.change = MPP_ENC_H264_CFG_CHANGE_PROFILE |
+            MPP_ENC_H264_CFG_CHANGE_ENTROPY |
+            MPP_ENC_H264_CFG_CHANGE_TRANS_8x8 | MPP_ENC_H264_CFG_CHANGE_QP_LIMIT;
+    codec_cfg->h264.profile = 100;
+    codec_cfg->h264.level = 40;
+    codec_cfg->h264.entropy_coding_mode = 1;
+    codec_cfg->h264.cabac_init_idc = 0;
+    codec_cfg->h264.transform8x8_mode = 1;
+
+    codec_cfg->h264.qp_init = 26;
+
+    /* CBR-specific setup */
+    codec_cfg->h264.qp_max = 28;
+    codec_cfg->h264.qp_min = 4;
+    codec_cfg->h264.qp_max_step = 8;
+}
+
+/*
+ * H.265 Main profile, Main tier, level 4.0. QP range is the same as for
+ * H.264, QP scales of the two standards match
+ */
+static void
+h264_mpp_codec_cfg_hevc(struct h264_encoder_mpp *encoder, MppEncCodecCfg *codec_cfg)
+{
+    codec_cfg->coding = MPP_VIDEO_CodingHEVC;
+    codec_cfg->h265.change = MPP_ENC_H265_CFG_PROFILE_LEVEL_TILER_CHANGE |
+            MPP_ENC_H265_CFG_INTRA_QP_CHANGE | MPP_ENC_H265_CFG_RC_QP_CHANGE;
+    codec_cfg->h265.profile = 1;
+    /* general_level_idc is 30 times the level number */
+    codec_cfg->h265.level = 120;
+    codec_cfg->h265.tier = 0;
+
+    codec_cfg->h265.qp_init = 26;
+    codec_cfg->h265.intra_qp = 26;
+
+    /* CBR-specific setup */
+    codec_cfg->h265.max_qp = 28;
+    codec_cfg->h265.min_qp = 4;
+    codec_cfg->h265.max_i_qp = 28;
+    codec_cfg->h265.min_i_qp = 4;
+    codec_cfg->h265.qp_max_step = 8;
+}
+
+/*
+ * Fill @params with the defaults: H.264, I420 input, 30 fps, GOP of 30
+ * and 1Mbit/s
+ */
+void
+h264_mpp_encoder_default_params(struct h264_encoder_params *params, int width, int height)
+{
+    memset(params, 0, sizeof(*params));
+    params->codec = VIDEO_CODEC_H264;
+    params->width = width;
+    params->height = height;
+    params->input = H264_ENCODER_INPUT_I420;
+    params->fps = DEFAULT_FPS;
+    params->gop = DEFAULT_GOP;
+    params->bps = DEFAULT_BPS;
+}
+
 struct h264_encoder_mpp *
 h264_mpp_encoder_create(int width, int height, encoder_callback_t callback, void *arg)
 {
-    struct h264_encoder_mpp *encoder;
-    encoder = malloc(sizeof(struct h264_encoder_mpp));
+    struct h264_encoder_params params;
+
+    h264_mpp_encoder_default_params(&params, width, height);
 
-    encoder->width = width;
-    encoder->height = height;
-    encoder->h_stride = UP_TO_16(width);
-    encoder->v_stride = UP_TO_16(height);
+    return h264_mpp_encoder_create_with_params(&params, callback, arg);
+}
+
+struct h264_encoder_mpp *
+h264_mpp_encoder_create_with_params(const struct h264_encoder_params *params,
+    encoder_callback_t callback, void *arg)
+{
+    struct h264_encoder_mpp *encoder;
+    encoder = calloc(1, sizeof(struct h264_encoder_mpp));
+    if (encoder == NULL)
+        return (NULL);
+
+    encoder->codec = params->codec;
+    encoder->width = params->width;
+    encoder->height = params->height;
+    encoder->h_stride = params->h_stride ? params->h_stride : UP_TO_16(params->width);
+    encoder->v_stride = params->v_stride ? params->v_stride : UP_TO_16(params->height);
+    encoder->input = params->input;
+    if (encoder->input == H264_ENCODER_INPUT_NV12)
+        encoder->format = MPP_FMT_YUV420SP;
+    else
+        encoder->format = MPP_FMT_YUV420P;
+    encoder->fps = params->fps;
+    encoder->gop = params->gop;
+    encoder->bps = params->bps;
     encoder->callback = callback;
     encoder->arg = arg;
     
@@ -191,10 +302,16 @@ h264_mpp_encoder_create(int width, int height, encoder_callback_t callback, void
         free(encoder);
         return NULL;
     }
+    /* No-op unless MPP_RECORD is set */
+    mpp_rec_wrap(encoder->ctx, &encoder->mpi);
 
-    ret = mpp_init(encoder->ctx, MPP_CTX_ENC, MPP_VIDEO_CodingAVC);
+    ret = mpp_init(encoder->ctx, MPP_CTX_ENC,
+        (encoder->codec == VIDEO_CODEC_HEVC) ? MPP_VIDEO_CodingHEVC : MPP_VIDEO_CodingAVC);
     if (MPP_OK != ret) {
-        fprintf(stderr, "mpp_init failed\n");
+        if (encoder->codec == VIDEO_CODEC_HEVC)
+            fprintf(stderr, "mpp_init failed, this VPU might have no HEVC encoder\n");
+        else
+            fprintf(stderr, "mpp_init failed\n");
         mpp_destroy(encoder->ctx);
         free(encoder);
         return NULL;
@@ -211,25 +328,17 @@ h264_mpp_encoder_create(int width, int height, encoder_callback_t callback, void
     rc_cfg.rc_mode = MPP_ENC_RC_MODE_CBR;
     rc_cfg.quality = MPP_ENC_RC_QUALITY_MEDIUM;
 
-    /* 30 fps */
     rc_cfg.fps_in_flex = 0;
-    rc_cfg.fps_in_num = 30;
+    rc_cfg.fps_in_num = encoder->fps;
     rc_cfg.fps_in_denorm = 1;
     rc_cfg.fps_out_flex = 0;
-    rc_cfg.fps_out_num = 30;
+    rc_cfg.fps_out_num = encoder->fps;
     rc_cfg.fps_out_denorm = 1;
-    rc_cfg.gop = 30;
+    rc_cfg.gop = encoder->gop;
     rc_cfg.skip_cnt = 0;
 
-    codec_cfg.h264.qp_init = 26;
-
-    /* CBR-specific setup */
-    codec_cfg.h264.qp_max = 28;
-    codec_cfg.h264.qp_min = 4;
-    codec_cfg.h264.qp_max_step = 8;
-
     /* Bits of a GOP */
-    rc_cfg.bps_target = 1024*1024; /* 1Mbit per second */
+    rc_cfg.bps_target = encoder->bps;
     rc_cfg.bps_max = rc_cfg.bps_target * 17 / 16;
     rc_cfg.bps_min = rc_cfg.bps_target * 15 / 16;
 
@@ -240,15 +349,10 @@ h264_mpp_encoder_create(int width, int height, encoder_callback_t callback, void
         return NULL;
     }
 
-    codec_cfg.coding = MPP_VIDEO_CodingAVC;
-    codec_cfg.h264.change = MPP_ENC_H264_CFG_CHANGE_PROFILE |
-            MPP_ENC_H264_CFG_CHANGE_ENTROPY |
-            MPP_ENC_H264_CFG_CHANGE_TRANS_8x8 | MPP_ENC_H264_CFG_CHANGE_QP_LIMIT;
-    codec_cfg.h264.profile = 100;
-    codec_cfg.h264.level = 40;
-    codec_cfg.h264.entropy_coding_mode = 1;
-    codec_cfg.h264.cabac_init_idc = 0;
-    codec_cfg.h264.transform8x8_mode = 1;
+    if (encoder->codec == VIDEO_CODEC_HEVC)
+        h264_mpp_codec_cfg_hevc(encoder, &codec_cfg);
+    else
+        h264_mpp_codec_cfg_avc(encoder, &codec_cfg);
 
     if (encoder->mpi->control(encoder->ctx, MPP_ENC_SET_CODEC_CFG, &codec_cfg)) {
         fprintf (stderr, "Setting codec info for rockchip mpp failed\n");
@@ -291,40 +395,37 @@ h264_mpp_encoder_destroy(struct h264_encoder_mpp *encoder)
     return 0;
 }
 
-int
-h264_mpp_encoder_submit_frame(struct h264_encoder_mpp *encoder, yuv_frame_t frame, int eos)
+/*
+ * Run single encoding task for the frame in MPP buffer @frame_in and
+ * pass resulting packet to the callback
+ */
+static int
+h264_mpp_encode(struct h264_encoder_mpp *encoder, MppBuffer frame_in, int eos)
 {
     MppTask task = NULL;
-    MppBuffer frame_in = encoder->input_buffer[encoder->current_index];
     MppBuffer pkt_buf_out = encoder->output_buffer[encoder->current_index];
     MppPacket packet = NULL;
-	void *ptr;
 	int ret = 0;
-    int frame_size;
+    MPP_RET mpp_ret;
+    uint64_t hw_begin, cb_begin, tr;
 
     mpp_frame_set_buffer(encoder->mpp_frame, frame_in);
+    mpp_frame_set_eos(encoder->mpp_frame, eos ? 1 : 0);
 
-    /* Eos buffer */
-    if (eos)
-        mpp_frame_set_eos(encoder->mpp_frame, 1);
-    else {
-        ptr = mpp_buffer_get_ptr(frame_in);
-        /* Y plane */
-		memcpy(ptr, frame->Y, frame->Ysize);
-        /* UV planes */
-        frame_size = encoder->h_stride * encoder->v_stride;
-		memcpy(ptr + frame_size, frame->U, frame->Usize);
-		memcpy(ptr + frame_size + frame_size/4, frame->V, frame->Vsize);
-        mpp_frame_set_eos(encoder->mpp_frame, 0);
-    }
+    /* Hardware stage: from task submission to the encoded packet */
+    hw_begin = metrics_stage_begin();
 
     do {
-        if (encoder->mpi->dequeue(encoder->ctx, MPP_PORT_INPUT, &task)) {
+        tr = trace_begin();
+        mpp_ret = encoder->mpi->dequeue(encoder->ctx, MPP_PORT_INPUT, &task);
+        trace_end("mpi_dequeue_input", tr);
+        if (mpp_ret) {
             fprintf (stderr, "mpp task input dequeue failed\n");
             return -1;
         }
         if (NULL == task) {
             fprintf (stderr, "mpp input failed, try again\n");
+            metrics_count(METRIC_DEQUEUE_RETRIES, 1);
             usleep (2);
         } else {
             break;
@@ -335,20 +436,31 @@ h264_mpp_encoder_submit_frame(struct h264_encoder_mpp *encoder, yuv_frame_t fram
     mpp_packet_init_with_buffer(&packet, pkt_buf_out);
     mpp_task_meta_set_packet(task, KEY_OUTPUT_PACKET, packet);
 
-    if (encoder->mpi->enqueue(encoder->ctx, MPP_PORT_INPUT, task)) {
+    tr = trace_begin();
+    mpp_ret = encoder->mpi->enqueue(encoder->ctx, MPP_PORT_INPUT, task);
+    trace_end("mpi_enqueue_input", tr);
+    if (mpp_ret) {
         fprintf (stderr, "mpp task input enqueu failed\n");
     }
+    metrics_gauge(METRIC_ENCODER_TASKS, 1);
 
     do {
         MppFrame packet_out = NULL;
         ret = 0;
 
-        if (encoder->mpi->dequeue (encoder->ctx, MPP_PORT_OUTPUT, &task)) {
+        tr = trace_begin();
+        mpp_ret = encoder->mpi->dequeue (encoder->ctx, MPP_PORT_OUTPUT, &task);
+        trace_end("mpi_dequeue_output", tr);
+        if (mpp_ret) {
+            metrics_count(METRIC_DEQUEUE_RETRIES, 1);
             usleep (2);
             continue;
         }
 
         if (task) {
+            metrics_stage_end(METRIC_STAGE_HARDWARE, hw_begin);
+            metrics_gauge(METRIC_ENCODER_TASKS, 0);
+
             mpp_task_meta_get_packet(task, KEY_OUTPUT_PACKET, &packet_out);
 
             /* Get result */
@@ -362,12 +474,24 @@ h264_mpp_encoder_submit_frame(struct h264_encoder_mpp *encoder, yuv_frame_t fram
 
                 mpp_task_meta_get_s32(task, KEY_OUTPUT_INTRA, &intra_flag, 0);
 
+                metrics_count(METRIC_PACKETS_OUT, 1);
+                metrics_count(METRIC_BYTES_OUT, len);
+                if (!eos)
+                    metrics_count(METRIC_FRAMES_ENCODED, 1);
+
+                cb_begin = metrics_stage_begin();
+                tr = trace_begin();
                 encoder->callback(encoder->arg, ptr, len);
+                trace_end("encoder_callback", tr);
+                metrics_stage_end(METRIC_STAGE_CALLBACK, cb_begin);
 
                 mpp_packet_deinit(&packet);
             }
 
-            if (encoder->mpi->enqueue(encoder->ctx, MPP_PORT_OUTPUT, task)) {
+            tr = trace_begin();
+            mpp_ret = encoder->mpi->enqueue(encoder->ctx, MPP_PORT_OUTPUT, task);
+            trace_end("mpi_enqueue_output", tr);
+            if (mpp_ret) {
                 fprintf (stderr, "mpp task output enqueue failed\n");
                 ret = -1;
             }
@@ -380,3 +504,93 @@ h264_mpp_encoder_submit_frame(struct h264_encoder_mpp *encoder, yuv_frame_t fram
 
     return (ret);
 }
+
+int
+h264_mpp_encoder_submit_frame(struct h264_encoder_mpp *encoder, yuv_frame_t frame, int eos)
+{
+    MppBuffer frame_in = encoder->input_buffer[encoder->current_index];
+	void *ptr;
+    int frame_size;
+    uint64_t begin, tr;
+
+    if (encoder->input != H264_ENCODER_INPUT_I420) {
+        fprintf (stderr, "encoder expects imported buffers, not I420 frames\n");
+        return (-1);
+    }
+
+    /* Eos buffer carries no data */
+    if (!eos) {
+        begin = metrics_stage_begin();
+        tr = trace_begin();
+        ptr = mpp_buffer_get_ptr(frame_in);
+        /*
+         * Planes are copied row by row unless width is already aligned
+         * to the MPP buffer stride
+         */
+        frame_size = encoder->h_stride * encoder->v_stride;
+        /* Y plane */
+        yuv_copy_plane(ptr, encoder->h_stride, frame->Y, encoder->width,
+            encoder->width, encoder->height);
+        /* UV planes */
+        yuv_copy_plane(ptr + frame_size, encoder->h_stride/2, frame->U, encoder->width/2,
+            encoder->width/2, encoder->height/2);
+        yuv_copy_plane(ptr + frame_size + frame_size/4, encoder->h_stride/2, frame->V,
+            encoder->width/2, encoder->width/2, encoder->height/2);
+        trace_end("copy_to_mpp_buffer", tr);
+        metrics_stage_end(METRIC_STAGE_COPY, begin);
+    }
+
+    return h264_mpp_encode(encoder, frame_in, eos);
+}
+
+/*
+ * Encode NV12 frame that already resides in MPP buffer @buffer (MppBuffer),
+ * e.g. decoder output. No pixel data is copied: the buffer is referenced for
+ * the duration of the encoding task so the owner can release it right after
+ * the call. @buffer can be NULL for EOS
+ */
+int
+h264_mpp_encoder_submit_buffer(struct h264_encoder_mpp *encoder, void *buffer, int eos)
+{
+    MppBuffer frame_in = (MppBuffer)buffer;
+    int ret;
+
+    if (encoder->input != H264_ENCODER_INPUT_NV12) {
+        fprintf (stderr, "encoder expects I420 frames, not imported buffers\n");
+        return (-1);
+    }
+
+    if (frame_in == NULL) {
+        if (!eos)
+            return (-1);
+        return h264_mpp_encode(encoder, encoder->input_buffer[0], eos);
+    }
+
+    if (mpp_buffer_get_size(frame_in) < encoder->h_stride*encoder->v_stride*3/2) {
+        fprintf (stderr, "imported buffer is too small for %dx%d frame\n",
+            encoder->h_stride, encoder->v_stride);
+        return (-1);
+    }
+
+    mpp_buffer_inc_ref(frame_in);
+    ret = h264_mpp_encode(encoder, frame_in, eos);
+    mpp_buffer_put(frame_in);
+
+    return (ret);
+}
+
+/*
+ * Make the next submitted frame an IDR frame, e.g. on a scene cut. With
+ * params->gop set to 0 MPP places no IDR frames of its own after the
+ * first one and the caller is in full control
+ */
+int
+h264_mpp_encoder_force_idr(struct h264_encoder_mpp *encoder)
+{
+    if (encoder->mpi->control(encoder->ctx, MPP_ENC_SET_IDR_FRAME, NULL)) {
+        fprintf(stderr, "failed to request IDR frame\n");
+        return (-1);
+    }
+
+    return (0);
+}
@@ -28,8 +28,37 @@
 
 typedef void (*encoder_callback_t)(void *arg, uint8_t *data, ssize_t len);
 
+/*
+ * Layout of the frames submitted to the encoder
+ */
+enum h264_encoder_input {
+    H264_ENCODER_INPUT_I420,    /* yuv_frame_t planes, copied to MPP buffer */
+    H264_ENCODER_INPUT_NV12,    /* MPP buffer imported as is, e.g. from decoder */
+};
+
+struct h264_encoder_params {
+    enum video_codec    codec;
+    int                 width;
+    int                 height;
+    /* Strides of the input buffer, 0 means width/height aligned to 16 */
+    int                 h_stride;
+    int                 v_stride;
+    enum h264_encoder_input input;
+
+    int                 fps;
+    /* Distance between IDR frames, 0 for the first frame only */
+    int                 gop;
+    /* Target bitrate in bits per second */
+    int                 bps;
+};
+
+void h264_mpp_encoder_default_params(struct h264_encoder_params *params, int width, int height);
 struct h264_encoder_mpp *h264_mpp_encoder_create(int width, int height, encoder_callback_t callback, void *arg);
+struct h264_encoder_mpp *h264_mpp_encoder_create_with_params(const struct h264_encoder_params *params,
+    encoder_callback_t callback, void *arg);
 int h264_mpp_encoder_destroy(struct h264_encoder_mpp *encoder);
 int h264_mpp_encoder_submit_frame(struct h264_encoder_mpp *encoder, yuv_frame_t frame, int eos);
+int h264_mpp_encoder_submit_buffer(struct h264_encoder_mpp *encoder, void *buffer, int eos);
+int h264_mpp_encoder_force_idr(struct h264_encoder_mpp *encoder);
 
 #endif /* __H264_ENCODER_MPP_H__ */
@@ -23,19 +23,24 @@
  * SUCH DAMAGE.
  */
 
+#include <stdio.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/errno.h>
 
+#include "video_codec.h"
 #include "h264_reader.h"
+#include "pipe_io.h"
+#include "metrics.h"
 
 #define	DEFAULT_BUFFER_SIZE (64*1024*1024)
 
 /**
- * Opens H264 file at path @path and returns opaque reader pointer
+ * Opens H264 file at path @path ("-" is stdin) and returns opaque reader pointer
  */
 h264_reader_t
 h264_reader_open(const char *path)
@@ -43,7 +48,7 @@ h264_reader_open(const char *path)
     h264_reader_t reader = malloc(sizeof(struct h264_reader));
     ssize_t bytes;
 
-    reader->fd = open(path, O_RDONLY);
+    reader->fd = pipe_io_open_input(path);
     if (reader->fd < 0) {
         free(reader);
         return (NULL);
@@ -57,7 +62,11 @@ h264_reader_open(const char *path)
     }
 
     /* Pre-fill the buffer */
+    uint64_t begin = metrics_stage_begin();
     bytes = read(reader->fd, reader->buffer, reader->size);
+    metrics_stage_end(METRIC_STAGE_READ, begin);
+    if (bytes > 0)
+        metrics_count(METRIC_BYTES_READ, bytes);
     if (bytes < 0) {
         free(reader->buffer);
         free(reader);
@@ -71,11 +80,48 @@ h264_reader_open(const char *path)
     return (reader);
 }
 
+void
+h264_reader_close(h264_reader_t reader)
+{
+    close(reader->fd);
+    free(reader->buffer);
+    free(reader);
+}
+
+/**
+ * Returns offset of the first 00 00 00 01 start code in @len bytes
+ * of @data, -1 if there is none. memchr(3) is vectorized in libc, so
+ * rather than testing every byte look for 01 and check preceding zeros
+ */
+ssize_t
+h264_find_start_code(const uint8_t *data, size_t len)
+{
+    const uint8_t *p, *end;
+
+    if (len < 4)
+        return (-1);
+
+    p = data + 3;
+    end = data + len;
+    while ((p = memchr(p, 1, end - p)) != NULL) {
+        if ((p[-1] == 0) && (p[-2] == 0) && (p[-3] == 0))
+            return (p - 3 - data);
+        p++;
+    }
+
+    return (-1);
+}
+
+/**
+ * Reads next NAL unit (including start code) into newly allocated @nalp
+ * Returns 0 on success, EINVAL at the end of the stream or if the stream
+ * does not start with a start code
+ */
 int
 h264_read_nal(h264_reader_t reader, h264_nal_t *nalp)
 {
-    size_t size;
-    ssize_t toread, bytes;
+    ssize_t bytes;
+    off_t scan_from;
 
     if (nalp == NULL)
         return (EINVAL);
@@ -94,8 +140,10 @@ h264_read_nal(h264_reader_t reader, h264_nal_t *nalp)
     /*
      * Not enough for full NAL
      */
-    if (reader->end < 4)
+    if (reader->end - reader->pos < 4) {
+        free(nal);
         return (EINVAL);
+    }
 
     if ((reader->buffer[start] != 0)
             || (reader->buffer[start+1] != 0)
@@ -106,48 +154,30 @@ h264_read_nal(h264_reader_t reader, h264_nal_t *nalp)
         return (EINVAL);
     }
 
+    /* Skip start code of this NAL */
+    scan_from = reader->pos + 4;
+
     do {
-        /* We should be at the NAL start */
-        start = reader->pos;
         off_t next_nal = -1;
 
         /* Check if NAL ends in this buffer */
-        start += 4;
-        while (start < reader->end - 4) {
-            if ((reader->buffer[start] == 0)
-                    && (reader->buffer[start+1] == 0)
-                    && (reader->buffer[start+2] == 0)
-                    && (reader->buffer[start+3] == 1))
-            {
-                next_nal = start;
-                break;
-            }
-            start++;
+        start = h264_find_start_code(reader->buffer + scan_from, reader->end - scan_from);
+        if (start >= 0) {
+            next_nal = scan_from + start;
+            start = next_nal;
         }
-
-        /*
-         * The temporary buffer contains whole NAL, copy it,
-         * update pointers and return
-         */
-        if (next_nal != -1) {
-            nal->size = next_nal - reader->pos;
-            nal->data = malloc(nal->size);
-            if (nal->data == NULL) {
-                free(nal);
-                return (ENOMEM);
-            }
-            memcpy(nal->data, reader->buffer + reader->pos, nal->size);
-            reader->pos = next_nal;
-            break; /* Done searching for NAL */
+        else {
+            /* Last three bytes may be the beginning of the next start code */
+            start = (scan_from > reader->end - 3) ? scan_from : reader->end - 3;
         }
 
         /* If there is nothing to read any more, use up whole buffer */
-        if (reader->eof)
+        if ((next_nal == -1) && reader->eof)
             start = reader->end;
 
         /* 
-         * Only part of the NAL is in the current buffer copy it and
-         * read more data from the file
+         * Copy the NAL (or the part of it that is in the current buffer)
+         * appending to what was collected from the previous reads
          */
         off_t new_size = nal->size + start - reader->pos;
         if (nal->data) {
@@ -169,6 +199,14 @@ h264_read_nal(h264_reader_t reader, h264_nal_t *nalp)
         }
         nal->size = new_size;
 
+        /*
+         * The rest of the NAL was in the buffer, update pointers and return
+         */
+        if (next_nal != -1) {
+            reader->pos = next_nal;
+            break; /* Done searching for NAL */
+        }
+
         /*
          * copy last three bytes (if available) to the beginning of the
          * buffer and read more data unless it's EOF
@@ -179,21 +217,93 @@ h264_read_nal(h264_reader_t reader, h264_nal_t *nalp)
         if (!reader->eof) {
             reader->pos = 0;
             reader->end = reader->end - start;
+            /* Start code might begin in the bytes kept from the previous read */
+            scan_from = 0;
+            uint64_t begin = metrics_stage_begin();
             bytes = read(reader->fd, reader->buffer + reader->end, reader->size - reader->end);
-            if (bytes > 0)
+            metrics_stage_end(METRIC_STAGE_READ, begin);
+            if (bytes > 0) {
                 reader->end += bytes;
+                metrics_count(METRIC_BYTES_READ, bytes);
+            }
             else if (bytes == 0)
                 reader->eof = true;
         }
-        else
+        else {
+            reader->pos = reader->end;
             break; /* Done searching for NAL */
+        }
     } while (1);
 
     *nalp = nal;
+    metrics_count(METRIC_NALS_READ, 1);
 
     return (0);
 }
 
+/**
+ * Returns type of the NAL unit (nal_unit_type), -1 if NAL is truncated
+ */
+int
+h264_nal_type(h264_nal_t nal)
+{
+    if (nal->size < 5)
+        return (-1);
+
+    return (nal->data[4] & 0x1f);
+}
+
+/**
+ * Returns type of H.265 NAL unit (nal_unit_type), -1 if NAL is truncated
+ */
+int
+h265_nal_type(h264_nal_t nal)
+{
+    if (nal->size < 6)
+        return (-1);
+
+    return ((nal->data[4] >> 1) & 0x3f);
+}
+
+/**
+ * Classifies NAL unit of @codec by its header at @header (@len bytes
+ * of NAL after the start code)
+ */
+enum nal_kind
+h264_nal_kind(enum video_codec codec, const uint8_t *header, size_t len)
+{
+    int type;
+
+    if (codec == VIDEO_CODEC_HEVC) {
+        if (len < 2)
+            return (NAL_KIND_OTHER);
+        type = (header[0] >> 1) & 0x3f;
+        if ((type >= H265_NAL_BLA_W_LP) && (type <= H265_NAL_CRA))
+            return (NAL_KIND_KEYFRAME);
+        if (type < H265_NAL_BLA_W_LP)
+            return (NAL_KIND_SLICE);
+        if (type == H265_NAL_SPS)
+            return (NAL_KIND_SPS);
+        if ((type == H265_NAL_VPS) || (type == H265_NAL_PPS))
+            return (NAL_KIND_PARAM_SET);
+        return (NAL_KIND_OTHER);
+    }
+
+    if (len < 1)
+        return (NAL_KIND_OTHER);
+    type = header[0] & 0x1f;
+    if (type == H264_NAL_IDR)
+        return (NAL_KIND_KEYFRAME);
+    if ((type >= H264_NAL_SLICE) && (type < H264_NAL_IDR))
+        return (NAL_KIND_SLICE);
+    if (type == H264_NAL_SPS)
+        return (NAL_KIND_SPS);
+    if (type == H264_NAL_PPS)
+        return (NAL_KIND_PARAM_SET);
+
+    return (NAL_KIND_OTHER);
+}
+
 void
 h264_free_nal(h264_nal_t nal)
 {
@@ -40,11 +40,54 @@ struct h264_nal {
     unsigned char   *data;
 };
 
+/*
+ * nal_unit_type values, ITU-T H.264 Table 7-1
+ */
+#define H264_NAL_SLICE      1
+#define H264_NAL_IDR        5
+#define H264_NAL_SEI        6
+#define H264_NAL_SPS        7
+#define H264_NAL_PPS        8
+#define H264_NAL_AUD        9
+
+/*
+ * nal_unit_type values, ITU-T H.265 Table 7-1. NAL header is two bytes,
+ * the type is in bits 1-6 of the first one
+ */
+#define H265_NAL_BLA_W_LP   16
+#define H265_NAL_IDR_W_RADL 19
+#define H265_NAL_IDR_N_LP   20
+#define H265_NAL_CRA        21
+#define H265_NAL_VPS        32
+#define H265_NAL_SPS        33
+#define H265_NAL_PPS        34
+#define H265_NAL_AUD        35
+#define H265_NAL_SEI_PREFIX 39
+
+/*
+ * What NAL unit carries, the same for H.264 and H.265
+ */
+enum nal_kind {
+    NAL_KIND_OTHER,
+    /* Slice of a picture that depends on others */
+    NAL_KIND_SLICE,
+    /* Slice of random access picture: IDR, or any IRAP for H.265 */
+    NAL_KIND_KEYFRAME,
+    NAL_KIND_SPS,
+    /* PPS, H.265 VPS */
+    NAL_KIND_PARAM_SET,
+};
+
 typedef struct h264_reader* h264_reader_t;
 typedef struct h264_nal* h264_nal_t;
 
 h264_reader_t h264_reader_open(const char *path);
+void h264_reader_close(h264_reader_t reader);
 int h264_read_nal(h264_reader_t reader, h264_nal_t *pnal);
+ssize_t h264_find_start_code(const uint8_t *data, size_t len);
+int h264_nal_type(h264_nal_t nal);
+int h265_nal_type(h264_nal_t nal);
+enum nal_kind h264_nal_kind(enum video_codec codec, const uint8_t *header, size_t len);
 void h264_free_nal(h264_nal_t nal);
 
 #endif /* __H264_READER_H__ */
@@ -0,0 +1,460 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/errno.h>
+
+#include "h264_sps.h"
+
+/* SPS is tiny, anything larger is not a valid SPS */
+#define MAX_SPS_SIZE    1024
+
+struct bit_reader {
+    const uint8_t       *data;
+    size_t              size;
+    size_t              pos;        /* in bits */
+    int                 overrun;
+};
+
+static uint32_t
+read_bits(struct bit_reader *br, int n)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (br->pos >= br->size * 8) {
+            br->overrun = 1;
+            return (0);
+        }
+        value = (value << 1) | ((br->data[br->pos / 8] >> (7 - br->pos % 8)) & 1);
+        br->pos++;
+    }
+
+    return (value);
+}
+
+/* Exp-Golomb ue(v) */
+static uint32_t
+read_ue(struct bit_reader *br)
+{
+    int zeros = 0;
+
+    while (!br->overrun && (read_bits(br, 1) == 0)) {
+        if (++zeros > 31) {
+            br->overrun = 1;
+            return (0);
+        }
+    }
+
+    return ((1u << zeros) - 1 + read_bits(br, zeros));
+}
+
+/* Exp-Golomb se(v) */
+static int32_t
+read_se(struct bit_reader *br)
+{
+    uint32_t v = read_ue(br);
+
+    return ((v & 1) ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2));
+}
+
+static void
+skip_scaling_list(struct bit_reader *br, int size)
+{
+    int last = 8, next = 8;
+
+    for (int i = 0; i < size; i++) {
+        if (next != 0)
+            next = (last + read_se(br) + 256) % 256;
+        last = (next == 0) ? last : next;
+    }
+}
+
+static void
+parse_vui_timing(struct bit_reader *br, struct h264_sps *sps)
+{
+    /* aspect_ratio_info_present_flag */
+    if (read_bits(br, 1)) {
+        /* Extended_SAR */
+        if (read_bits(br, 8) == 255)
+            read_bits(br, 32);
+    }
+    /* overscan_info_present_flag */
+    if (read_bits(br, 1))
+        read_bits(br, 1);
+    /* video_signal_type_present_flag */
+    if (read_bits(br, 1)) {
+        read_bits(br, 4);
+        if (read_bits(br, 1))
+            read_bits(br, 24);
+    }
+    /* chroma_loc_info_present_flag */
+    if (read_bits(br, 1)) {
+        read_ue(br);
+        read_ue(br);
+    }
+    /* timing_info_present_flag */
+    if (read_bits(br, 1)) {
+        sps->num_units_in_tick = read_bits(br, 32);
+        sps->time_scale = read_bits(br, 32);
+    }
+}
+
+/*
+ * Copy payload of @nal after @header_len bytes of NAL header to @rbsp
+ * stripping emulation prevention bytes, returns length of the result
+ */
+static size_t
+nal_to_rbsp(const uint8_t *nal, size_t len, size_t header_len, uint8_t *rbsp, size_t size)
+{
+    size_t rbsp_len = 0;
+    int zeros = 0;
+
+    for (size_t i = header_len; (i < len) && (rbsp_len < size); i++) {
+        if ((zeros >= 2) && (nal[i] == 3)) {
+            zeros = 0;
+            continue;
+        }
+        zeros = (nal[i] == 0) ? zeros + 1 : 0;
+        rbsp[rbsp_len++] = nal[i];
+    }
+
+    return (rbsp_len);
+}
+
+/*
+ * Parse SPS NAL unit @nal (starting with NAL header byte, no start code)
+ * Returns 0 on success, EINVAL if SPS is malformed
+ */
+int
+h264_parse_sps(const uint8_t *nal, size_t len, struct h264_sps *sps)
+{
+    uint8_t rbsp[MAX_SPS_SIZE];
+    struct bit_reader br;
+    int crop_left, crop_right, crop_top, crop_bottom;
+    int crop_x, crop_y;
+
+    if ((len < 4) || ((nal[0] & 0x1f) != 7))
+        return (EINVAL);
+
+    memset(sps, 0, sizeof(*sps));
+    memset(&br, 0, sizeof(br));
+    br.data = rbsp;
+    br.size = nal_to_rbsp(nal, len, 1, rbsp, sizeof(rbsp));
+
+    sps->profile_idc = read_bits(&br, 8);
+    sps->constraint_flags = read_bits(&br, 8);
+    sps->level_idc = read_bits(&br, 8);
+    sps->sps_id = read_ue(&br);
+    sps->chroma_format_idc = 1;
+    sps->bit_depth_luma = 8;
+    sps->bit_depth_chroma = 8;
+
+    switch (sps->profile_idc) {
+        case 100: case 110: case 122: case 244: case 44:
+        case 83: case 86: case 118: case 128: case 138:
+        case 139: case 134: case 135:
+            sps->chroma_format_idc = read_ue(&br);
+            if (sps->chroma_format_idc == 3)
+                read_bits(&br, 1);  /* separate_colour_plane_flag */
+            sps->bit_depth_luma = read_ue(&br) + 8;
+            sps->bit_depth_chroma = read_ue(&br) + 8;
+            read_bits(&br, 1);  /* qpprime_y_zero_transform_bypass_flag */
+            /* seq_scaling_matrix_present_flag */
+            if (read_bits(&br, 1)) {
+                int lists = (sps->chroma_format_idc != 3) ? 8 : 12;
+                for (int i = 0; i < lists; i++) {
+                    if (read_bits(&br, 1))
+                        skip_scaling_list(&br, (i < 6) ? 16 : 64);
+                }
+            }
+            break;
+    }
+
+    sps->log2_max_frame_num = read_ue(&br) + 4;
+    sps->poc_type = read_ue(&br);
+    if (sps->poc_type == 0)
+        read_ue(&br);   /* log2_max_pic_order_cnt_lsb_minus4 */
+    else if (sps->poc_type == 1) {
+        uint32_t cycle;
+
+        read_bits(&br, 1);
+        read_se(&br);
+        read_se(&br);
+        cycle = read_ue(&br);
+        for (uint32_t i = 0; (i < cycle) && !br.overrun; i++)
+            read_se(&br);
+    }
+
+    sps->max_num_ref_frames = read_ue(&br);
+    read_bits(&br, 1);  /* gaps_in_frame_num_value_allowed_flag */
+    sps->mb_width = read_ue(&br) + 1;
+    sps->mb_height = read_ue(&br) + 1;
+    sps->frame_mbs_only = read_bits(&br, 1);
+    if (!sps->frame_mbs_only) {
+        read_bits(&br, 1);  /* mb_adaptive_frame_field_flag */
+        sps->mb_height *= 2;
+    }
+    read_bits(&br, 1);  /* direct_8x8_inference_flag */
+
+    crop_left = crop_right = crop_top = crop_bottom = 0;
+    if (read_bits(&br, 1)) {
+        crop_left = read_ue(&br);
+        crop_right = read_ue(&br);
+        crop_top = read_ue(&br);
+        crop_bottom = read_ue(&br);
+    }
+
+    if (read_bits(&br, 1))
+        parse_vui_timing(&br, sps);
+
+    if (br.overrun)
+        return (EINVAL);
+
+    /* Crop units, 7.4.2.1.1 */
+    crop_x = (sps->chroma_format_idc == 1 || sps->chroma_format_idc == 2) ? 2 : 1;
+    crop_y = (sps->chroma_format_idc == 1) ? 2 : 1;
+    crop_y *= 2 - sps->frame_mbs_only;
+
+    sps->width = sps->mb_width * 16 - crop_x * (crop_left + crop_right);
+    sps->height = sps->mb_height * 16 - crop_y * (crop_top + crop_bottom);
+
+    if ((sps->width <= 0) || (sps->height <= 0))
+        return (EINVAL);
+
+    return (0);
+}
+
+/* more_rbsp_data(), 7.2: anything left before rbsp_stop_one_bit */
+static int
+more_rbsp_data(struct bit_reader *br)
+{
+    size_t last = br->size;
+
+    while ((last > 0) && (br->data[last - 1] == 0))
+        last--;
+    if (last == 0)
+        return (0);
+
+    /* Position of the stop bit */
+    last = last * 8 - 1 - __builtin_ctz(br->data[last - 1]);
+
+    return (br->pos < last);
+}
+
+/*
+ * Parse PPS NAL unit @nal (starting with NAL header byte, no start code)
+ * Returns 0 on success, EINVAL if PPS is malformed. With FMO only the
+ * fields before slice group map are filled in
+ */
+int
+h264_parse_pps(const uint8_t *nal, size_t len, struct h264_pps *pps)
+{
+    uint8_t rbsp[MAX_SPS_SIZE];
+    struct bit_reader br;
+
+    if ((len < 2) || ((nal[0] & 0x1f) != 8))
+        return (EINVAL);
+
+    memset(pps, 0, sizeof(*pps));
+    memset(&br, 0, sizeof(br));
+    br.data = rbsp;
+    br.size = nal_to_rbsp(nal, len, 1, rbsp, sizeof(rbsp));
+
+    pps->pps_id = read_ue(&br);
+    pps->sps_id = read_ue(&br);
+    pps->entropy_coding_mode = read_bits(&br, 1);
+    read_bits(&br, 1);  /* bottom_field_pic_order_in_frame_present_flag */
+    pps->num_slice_groups = read_ue(&br) + 1;
+    if (pps->num_slice_groups > 1)
+        return (br.overrun ? EINVAL : 0);
+
+    pps->num_ref_idx_l0_default = read_ue(&br) + 1;
+    pps->num_ref_idx_l1_default = read_ue(&br) + 1;
+    pps->weighted_pred = read_bits(&br, 1);
+    pps->weighted_bipred_idc = read_bits(&br, 2);
+    pps->pic_init_qp = read_se(&br) + 26;
+    read_se(&br);       /* pic_init_qs_minus26 */
+    pps->chroma_qp_index_offset = read_se(&br);
+    pps->deblocking_filter_control = read_bits(&br, 1);
+    pps->constrained_intra_pred = read_bits(&br, 1);
+    read_bits(&br, 1);  /* redundant_pic_cnt_present_flag */
+
+    if (br.overrun)
+        return (EINVAL);
+
+    /* High profile extension */
+    if (more_rbsp_data(&br))
+        pps->transform_8x8_mode = read_bits(&br, 1);
+
+    return (0);
+}
+
+/*
+ * Parse the beginning of slice NAL unit @nal: first_mb_in_slice,
+ * slice_type (modulo 5) and pic_parameter_set_id
+ * Returns 0 on success, EINVAL if NAL is not a slice or is truncated
+ */
+int
+h264_parse_slice_header(const uint8_t *nal, size_t len, struct h264_slice_header *slice)
+{
+    /* Three ue(v) of realistic values fit into a few bytes */
+    uint8_t rbsp[16];
+    struct bit_reader br;
+    int type;
+
+    if (len < 2)
+        return (EINVAL);
+    type = nal[0] & 0x1f;
+    if ((type != 1) && (type != 5))
+        return (EINVAL);
+
+    memset(&br, 0, sizeof(br));
+    br.data = rbsp;
+    br.size = nal_to_rbsp(nal, len, 1, rbsp, sizeof(rbsp));
+
+    slice->first_mb = read_ue(&br);
+    slice->slice_type = read_ue(&br) % 5;
+    slice->pps_id = read_ue(&br);
+
+    return (br.overrun ? EINVAL : 0);
+}
+
+/*
+ * profile_tier_level() of H.265 7.3.3, only general profile and level
+ * are kept
+ */
+static void
+parse_profile_tier_level(struct bit_reader *br, int max_sub_layers_minus1,
+    struct h264_sps *sps)
+{
+    int profile_present[8], level_present[8];
+
+    read_bits(br, 2);   /* general_profile_space */
+    sps->constraint_flags = read_bits(br, 1);   /* general_tier_flag */
+    sps->profile_idc = read_bits(br, 5);
+    read_bits(br, 32);  /* general_profile_compatibility_flag[] */
+    /* progressive, interlaced, non-packed, frame-only and 44 more bits */
+    read_bits(br, 32);
+    read_bits(br, 16);
+    sps->level_idc = read_bits(br, 8);
+
+    for (int i = 0; i < max_sub_layers_minus1; i++) {
+        profile_present[i] = read_bits(br, 1);
+        level_present[i] = read_bits(br, 1);
+    }
+    if (max_sub_layers_minus1 > 0) {
+        for (int i = max_sub_layers_minus1; i < 8; i++)
+            read_bits(br, 2);
+    }
+    for (int i = 0; i < max_sub_layers_minus1; i++) {
+        if (profile_present[i]) {
+            read_bits(br, 32);
+            read_bits(br, 32);
+            read_bits(br, 24);
+        }
+        if (level_present[i])
+            read_bits(br, 8);
+    }
+}
+
+/*
+ * Parse H.265 SPS NAL unit @nal (starting with 2-byte NAL header, no
+ * start code) up to the fields that have H.264 counterparts: profile
+ * (tier in constraint_flags), level, chroma format, bit depths, size
+ * and DPB size. mb_width/mb_height are in 16x16 units for comparison,
+ * frame rate is not parsed
+ * Returns 0 on success, EINVAL if SPS is malformed
+ */
+int
+h265_parse_sps(const uint8_t *nal, size_t len, struct h264_sps *sps)
+{
+    uint8_t rbsp[MAX_SPS_SIZE];
+    struct bit_reader br;
+    int max_sub_layers_minus1, pic_width, pic_height;
+    int crop_left, crop_right, crop_top, crop_bottom;
+    int crop_x, crop_y;
+
+    if ((len < 4) || (((nal[0] >> 1) & 0x3f) != 33))
+        return (EINVAL);
+
+    memset(sps, 0, sizeof(*sps));
+    memset(&br, 0, sizeof(br));
+    br.data = rbsp;
+    br.size = nal_to_rbsp(nal, len, 2, rbsp, sizeof(rbsp));
+
+    read_bits(&br, 4);  /* sps_video_parameter_set_id */
+    max_sub_layers_minus1 = read_bits(&br, 3);
+    read_bits(&br, 1);  /* sps_temporal_id_nesting_flag */
+    parse_profile_tier_level(&br, max_sub_layers_minus1, sps);
+
+    sps->sps_id = read_ue(&br);
+    sps->chroma_format_idc = read_ue(&br);
+    if (sps->chroma_format_idc == 3)
+        read_bits(&br, 1);  /* separate_colour_plane_flag */
+    pic_width = read_ue(&br);
+    pic_height = read_ue(&br);
+
+    crop_left = crop_right = crop_top = crop_bottom = 0;
+    /* conformance_window_flag */
+    if (read_bits(&br, 1)) {
+        crop_left = read_ue(&br);
+        crop_right = read_ue(&br);
+        crop_top = read_ue(&br);
+        crop_bottom = read_ue(&br);
+    }
+
+    sps->bit_depth_luma = read_ue(&br) + 8;
+    sps->bit_depth_chroma = read_ue(&br) + 8;
+    sps->log2_max_frame_num = read_ue(&br) + 4;    /* log2_max_pic_order_cnt_lsb */
+
+    /* sps_sub_layer_ordering_info_present_flag, highest sub-layer counts */
+    for (int i = read_bits(&br, 1) ? 0 : max_sub_layers_minus1;
+            i <= max_sub_layers_minus1; i++) {
+        sps->max_num_ref_frames = read_ue(&br);  /* sps_max_dec_pic_buffering_minus1 */
+        read_ue(&br);   /* sps_max_num_reorder_pics */
+        read_ue(&br);   /* sps_max_latency_increase_plus1 */
+    }
+    sps->frame_mbs_only = 1;
+
+    if (br.overrun)
+        return (EINVAL);
+
+    /* Conformance window units, 7.4.3.2.1 */
+    crop_x = (sps->chroma_format_idc == 1 || sps->chroma_format_idc == 2) ? 2 : 1;
+    crop_y = (sps->chroma_format_idc == 1) ? 2 : 1;
+
+    sps->mb_width = (pic_width + 15) / 16;
+    sps->mb_height = (pic_height + 15) / 16;
+    sps->width = pic_width - crop_x * (crop_left + crop_right);
+    sps->height = pic_height - crop_y * (crop_top + crop_bottom);
+
+    if ((sps->width <= 0) || (sps->height <= 0))
+        return (EINVAL);
+
+    return (0);
+}
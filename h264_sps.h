@@ -0,0 +1,98 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __H264_SPS_H__
+#define __H264_SPS_H__
+
+/*
+ * Fields of H.264 sequence parameter set (ITU-T H.264 7.3.2.1.1)
+ * needed to describe the stream. H.265 SPS fills the ones it has
+ * equivalents for
+ */
+struct h264_sps {
+    int                 profile_idc;
+    int                 constraint_flags;
+    int                 level_idc;
+    int                 sps_id;
+    int                 chroma_format_idc;
+    int                 bit_depth_luma;
+    int                 bit_depth_chroma;
+    int                 log2_max_frame_num;
+    int                 poc_type;
+    int                 max_num_ref_frames;
+    int                 frame_mbs_only;
+    int                 mb_width;
+    int                 mb_height;
+    /* Dimensions after cropping */
+    int                 width;
+    int                 height;
+    /* From VUI timing info, 0 if not present */
+    uint32_t            num_units_in_tick;
+    uint32_t            time_scale;
+};
+
+/*
+ * Fields of H.264 picture parameter set (7.3.2.2), slice group map
+ * details of FMO are skipped
+ */
+struct h264_pps {
+    int                 pps_id;
+    int                 sps_id;
+    int                 entropy_coding_mode;
+    int                 num_slice_groups;
+    int                 num_ref_idx_l0_default;
+    int                 num_ref_idx_l1_default;
+    int                 weighted_pred;
+    int                 weighted_bipred_idc;
+    int                 pic_init_qp;
+    int                 chroma_qp_index_offset;
+    int                 deblocking_filter_control;
+    int                 constrained_intra_pred;
+    int                 transform_8x8_mode;
+};
+
+/* slice_type values modulo 5, 7.4.3 */
+#define H264_SLICE_P        0
+#define H264_SLICE_B        1
+#define H264_SLICE_I        2
+#define H264_SLICE_SP       3
+#define H264_SLICE_SI       4
+
+/*
+ * Leading fields of slice header, enough to find picture boundaries
+ * and picture types
+ */
+struct h264_slice_header {
+    int                 first_mb;
+    int                 slice_type;
+    int                 pps_id;
+};
+
+int h264_parse_sps(const uint8_t *nal, size_t len, struct h264_sps *sps);
+int h264_parse_pps(const uint8_t *nal, size_t len, struct h264_pps *pps);
+int h264_parse_slice_header(const uint8_t *nal, size_t len, struct h264_slice_header *slice);
+int h265_parse_sps(const uint8_t *nal, size_t len, struct h264_sps *sps);
+
+#endif /* __H264_SPS_H__ */
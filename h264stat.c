@@ -0,0 +1,730 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * H.264 bitstream statistics: NAL type histogram, per-second bitrate,
+ * GOP structure, frame size distribution and parameter sets. Regular
+ * files are mapped and scanned in place, nothing is copied, so the
+ * speed is that of memchr(3) over the page cache
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "video_codec.h"
+#include "h264_reader.h"
+#include "h264_sps.h"
+#include "pipe_io.h"
+
+/* Frame rate if the stream has no VUI timing and -f is not given */
+#define DEFAULT_FPS         30.0
+/* Picture types printed for the first GOP */
+#define GOP_PATTERN_MAX     64
+
+enum frame_type {
+    FRAME_IDR,
+    FRAME_I,
+    FRAME_P,
+    FRAME_B,
+    FRAME_TYPES
+};
+
+static const char frame_type_chars[FRAME_TYPES] = { 'I', 'i', 'P', 'B' };
+static const char *frame_type_names[FRAME_TYPES] = { "IDR", "I", "P", "B" };
+
+struct stream_stats
+{
+    uint64_t            bytes;
+    uint64_t            nal_count[32];
+    uint64_t            nal_bytes[32];
+
+    /* Size and type of every picture */
+    uint32_t            *frame_sizes;
+    uint8_t             *frame_types;
+    size_t              frames;
+    size_t              frames_alloc;
+
+    /* Picture being collected, parameter sets and SEI ahead of it */
+    int                 in_frame;
+    uint64_t            frame_bytes;
+    enum frame_type     frame_type;
+    uint64_t            pending_bytes;
+
+    struct h264_sps     sps;
+    struct h264_pps     pps;
+    int                 sps_valid;
+    int                 pps_valid;
+    int                 sps_changes;
+    int                 pps_changes;
+    int                 bad_nals;
+    int                 verbose;
+};
+
+static void
+usage(const char *exe)
+{
+    fprintf(stderr, "Usage: %s [-f fps] [-v] [-o report.json] in.h264 ...\n"
+        "  -f  frame rate for bitrate, from SPS VUI timing or %.0f by default\n"
+        "  -v  print bitrate of every second and parameter set changes\n"
+        "  -o  write summary of the last file as JSON\n"
+        "  in.h264 can be - for stdin\n", exe, DEFAULT_FPS);
+    exit(1);
+}
+
+static int
+frame_close(struct stream_stats *st)
+{
+    if (!st->in_frame)
+        return (0);
+
+    if (st->frames == st->frames_alloc) {
+        size_t alloc = st->frames_alloc ? st->frames_alloc * 2 : 4096;
+        uint32_t *sizes = realloc(st->frame_sizes, alloc * sizeof(*sizes));
+        uint8_t *types;
+
+        if (sizes == NULL)
+            return (-1);
+        st->frame_sizes = sizes;
+        types = realloc(st->frame_types, alloc);
+        if (types == NULL)
+            return (-1);
+        st->frame_types = types;
+        st->frames_alloc = alloc;
+    }
+
+    st->frame_sizes[st->frames] = (st->frame_bytes > UINT32_MAX) ? UINT32_MAX : st->frame_bytes;
+    st->frame_types[st->frames] = st->frame_type;
+    st->frames++;
+    st->in_frame = 0;
+
+    return (0);
+}
+
+static enum frame_type
+slice_frame_type(int nal_type, int slice_type)
+{
+    if (nal_type == H264_NAL_IDR)
+        return (FRAME_IDR);
+
+    switch (slice_type) {
+        case H264_SLICE_I:
+        case H264_SLICE_SI:
+            return (FRAME_I);
+        case H264_SLICE_B:
+            return (FRAME_B);
+        default:
+            return (FRAME_P);
+    }
+}
+
+static void
+print_sps(const struct h264_sps *sps)
+{
+    printf("SPS %d: profile %d level %d.%d, %dx%d (%dx%d MB), chroma format %d, %d/%d bit\n",
+        sps->sps_id, sps->profile_idc, sps->level_idc / 10, sps->level_idc % 10,
+        sps->width, sps->height, sps->mb_width, sps->mb_height, sps->chroma_format_idc,
+        sps->bit_depth_luma, sps->bit_depth_chroma);
+    printf("    %d ref frames, POC type %d, %s", sps->max_num_ref_frames, sps->poc_type,
+        sps->frame_mbs_only ? "progressive" : "interlaced");
+    if (sps->num_units_in_tick && sps->time_scale)
+        printf(", timing %u/%u", sps->time_scale, sps->num_units_in_tick);
+    printf("\n");
+}
+
+static void
+print_pps(const struct h264_pps *pps)
+{
+    printf("PPS %d: SPS %d, %s, %d/%d default refs, init QP %d, chroma QP offset %d\n",
+        pps->pps_id, pps->sps_id, pps->entropy_coding_mode ? "CABAC" : "CAVLC",
+        pps->num_ref_idx_l0_default, pps->num_ref_idx_l1_default, pps->pic_init_qp,
+        pps->chroma_qp_index_offset);
+    printf("    weighted pred %d/%d, deblocking control %d, constrained intra %d, 8x8 transform %d",
+        pps->weighted_pred, pps->weighted_bipred_idc, pps->deblocking_filter_control,
+        pps->constrained_intra_pred, pps->transform_8x8_mode);
+    if (pps->num_slice_groups > 1)
+        printf(", %d slice groups", pps->num_slice_groups);
+    printf("\n");
+}
+
+/*
+ * Account NAL unit @nal of @len bytes (header byte on, trailing zeros
+ * stripped) taking @bytes in the stream including start code
+ */
+static int
+stat_nal(struct stream_stats *st, const uint8_t *nal, size_t len, size_t bytes)
+{
+    struct h264_slice_header slice;
+    int type;
+
+    st->bytes += bytes;
+    if ((len < 1) || (nal[0] & 0x80)) {
+        st->bad_nals++;
+        st->pending_bytes += bytes;
+        return (0);
+    }
+
+    type = nal[0] & 0x1f;
+    st->nal_count[type]++;
+    st->nal_bytes[type] += bytes;
+
+    switch (type) {
+        case H264_NAL_SLICE:
+        case H264_NAL_IDR:
+            if (h264_parse_slice_header(nal, len, &slice)) {
+                st->bad_nals++;
+                slice.first_mb = st->in_frame ? 1 : 0;
+                slice.slice_type = H264_SLICE_P;
+            }
+            /* first_mb_in_slice 0 starts a picture */
+            if ((slice.first_mb == 0) || !st->in_frame) {
+                if (frame_close(st) < 0)
+                    return (-1);
+                st->in_frame = 1;
+                st->frame_bytes = st->pending_bytes;
+                st->frame_type = slice_frame_type(type, slice.slice_type);
+                st->pending_bytes = 0;
+            }
+            st->frame_bytes += bytes;
+            break;
+        case H264_NAL_SPS: {
+            struct h264_sps sps;
+
+            if (h264_parse_sps(nal, len, &sps))
+                st->bad_nals++;
+            else if (!st->sps_valid || memcmp(&sps, &st->sps, sizeof(sps))) {
+                if (st->sps_valid)
+                    st->sps_changes++;
+                if (st->verbose && st->sps_valid) {
+                    printf("frame %zu: ", st->frames + st->in_frame);
+                    print_sps(&sps);
+                }
+                st->sps = sps;
+                st->sps_valid = 1;
+            }
+            st->pending_bytes += bytes;
+            break;
+        }
+        case H264_NAL_PPS: {
+            struct h264_pps pps;
+
+            if (h264_parse_pps(nal, len, &pps))
+                st->bad_nals++;
+            else if (!st->pps_valid || memcmp(&pps, &st->pps, sizeof(pps))) {
+                if (st->pps_valid)
+                    st->pps_changes++;
+                if (st->verbose && st->pps_valid) {
+                    printf("frame %zu: ", st->frames + st->in_frame);
+                    print_pps(&pps);
+                }
+                st->pps = pps;
+                st->pps_valid = 1;
+            }
+            st->pending_bytes += bytes;
+            break;
+        }
+        case H264_NAL_SEI:
+        case H264_NAL_AUD:
+        case 14: case 15: case 16: case 17: case 18:
+            /* Belongs to the next picture, 7.4.1.2.3 */
+            st->pending_bytes += bytes;
+            break;
+        default:
+            /* End of sequence/stream, filler data: the current picture */
+            if (st->in_frame)
+                st->frame_bytes += bytes;
+            else
+                st->pending_bytes += bytes;
+            break;
+    }
+
+    return (0);
+}
+
+/*
+ * Offset of 01 of the next 00 00 01 at or after @from, @len if there is
+ * none. Start codes of three and four bytes are both found this way
+ */
+static size_t
+next_start_code(const uint8_t *data, size_t from, size_t len)
+{
+    const uint8_t *p;
+
+    if (from < 2)
+        from = 2;
+    while ((from < len) && ((p = memchr(data + from, 1, len - from)) != NULL)) {
+        from = p - data;
+        if ((p[-1] == 0) && (p[-2] == 0))
+            return (from);
+        from++;
+    }
+
+    return (len);
+}
+
+/*
+ * Split @len bytes of Annex B @data into NAL units. Bytes ahead of the
+ * first start code count as a broken NAL
+ */
+static int
+stat_buffer(struct stream_stats *st, const uint8_t *data, size_t len)
+{
+    size_t sc, begin, next, next_begin, end;
+
+    sc = next_start_code(data, 0, len);
+    begin = 0;
+    if ((sc < len) && (sc >= 2))
+        begin = ((sc >= 3) && (data[sc - 3] == 0)) ? sc - 3 : sc - 2;
+    if (begin > 0) {
+        st->bytes += begin;
+        st->bad_nals++;
+    }
+
+    while (sc < len) {
+        next = next_start_code(data, sc + 1, len);
+        if (next < len)
+            next_begin = ((data[next - 3] == 0) && (next - 3 > sc)) ? next - 3 : next - 2;
+        else
+            next_begin = len;
+
+        /* trailing_zero_8bits */
+        end = next_begin;
+        while ((end > sc + 1) && (data[end - 1] == 0))
+            end--;
+
+        if (stat_nal(st, data + sc + 1, end - sc - 1, next_begin - begin) < 0)
+            return (-1);
+
+        sc = next;
+        begin = next_begin;
+    }
+
+    return (0);
+}
+
+static int
+stat_file(struct stream_stats *st, const char *path)
+{
+    struct stat sb;
+    h264_reader_t reader;
+    h264_nal_t nal;
+    uint8_t *data;
+    int fd, ret;
+
+    fd = pipe_io_open_input(path);
+    if (fd < 0) {
+        fprintf(stderr, "failed to open input file %s: %s\n", path, strerror(errno));
+        return (-1);
+    }
+
+    if ((fstat(fd, &sb) == 0) && S_ISREG(sb.st_mode) && (sb.st_size > 0)) {
+        data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "failed to map %s: %s\n", path, strerror(errno));
+            return (-1);
+        }
+        madvise(data, sb.st_size, MADV_SEQUENTIAL);
+        ret = stat_buffer(st, data, sb.st_size);
+        munmap(data, sb.st_size);
+        return (ret);
+    }
+
+    /*
+     * Pipes go through the reader, it splits at four-byte start codes
+     * only, NAL units it returns are split further
+     */
+    if (fd != STDIN_FILENO)
+        close(fd);
+    reader = h264_reader_open(path);
+    if (reader == NULL) {
+        fprintf(stderr, "failed to open input file %s: %s\n", path, strerror(errno));
+        return (-1);
+    }
+
+    ret = 0;
+    while ((ret == 0) && (h264_read_nal(reader, &nal) == 0)) {
+        ret = stat_buffer(st, nal->data, nal->size);
+        h264_free_nal(nal);
+    }
+    h264_reader_close(reader);
+
+    return (ret);
+}
+
+static int
+compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return ((x > y) - (x < y));
+}
+
+struct size_summary
+{
+    size_t              count;
+    uint32_t            min;
+    uint32_t            p50;
+    uint32_t            p90;
+    uint32_t            p99;
+    uint32_t            max;
+    double              avg;
+};
+
+/* Distribution of frame sizes of @type, all frames if @type is FRAME_TYPES */
+static int
+summarize_sizes(const struct stream_stats *st, int type, struct size_summary *sum)
+{
+    uint32_t *sizes;
+    uint64_t total = 0;
+    size_t n = 0;
+
+    memset(sum, 0, sizeof(*sum));
+    sizes = malloc((st->frames ? st->frames : 1) * sizeof(*sizes));
+    if (sizes == NULL)
+        return (-1);
+
+    for (size_t i = 0; i < st->frames; i++) {
+        if ((type == FRAME_TYPES) || (st->frame_types[i] == type)) {
+            sizes[n++] = st->frame_sizes[i];
+            total += st->frame_sizes[i];
+        }
+    }
+
+    if (n > 0) {
+        qsort(sizes, n, sizeof(*sizes), compare_u32);
+        sum->count = n;
+        sum->min = sizes[0];
+        sum->p50 = sizes[n / 2];
+        sum->p90 = sizes[n * 90 / 100];
+        sum->p99 = sizes[n * 99 / 100];
+        sum->max = sizes[n - 1];
+        sum->avg = (double)total / n;
+    }
+    free(sizes);
+
+    return (0);
+}
+
+struct gop_summary
+{
+    size_t              count;
+    size_t              min;
+    size_t              max;
+    double              avg;
+    /* Non-IDR I pictures, open GOP or intra refresh */
+    size_t              i_frames;
+    char                pattern[GOP_PATTERN_MAX + 4];
+};
+
+/* GOP is IDR and everything up to the next one */
+static void
+summarize_gops(const struct stream_stats *st, struct gop_summary *gop)
+{
+    size_t start = 0, len, n;
+
+    memset(gop, 0, sizeof(*gop));
+    for (size_t i = 0; i <= st->frames; i++) {
+        if ((i < st->frames) && (st->frame_types[i] == FRAME_I))
+            gop->i_frames++;
+        if ((i < st->frames) && ((st->frame_types[i] != FRAME_IDR) || (i == 0)))
+            continue;
+        len = i - start;
+        if (len > 0) {
+            if ((gop->count == 0) || (len < gop->min))
+                gop->min = len;
+            if (len > gop->max)
+                gop->max = len;
+            gop->count++;
+        }
+        start = i;
+    }
+    if (gop->count)
+        gop->avg = (double)st->frames / gop->count;
+
+    /* Picture types of the first GOP */
+    for (n = 0; (n < st->frames) && (n < GOP_PATTERN_MAX); n++) {
+        if ((n > 0) && (st->frame_types[n] == FRAME_IDR))
+            break;
+        gop->pattern[n] = frame_type_chars[st->frame_types[n]];
+    }
+    if ((n == GOP_PATTERN_MAX) && (n < st->frames) && (st->frame_types[n] != FRAME_IDR))
+        strcpy(gop->pattern + n, "...");
+}
+
+struct rate_summary
+{
+    double              fps;
+    double              duration;
+    double              avg_kbps;
+    double              min_kbps;
+    double              max_kbps;
+    size_t              peak_second;
+};
+
+/*
+ * Bitrate of every whole second of the stream, frames are assumed
+ * to be evenly spaced at @fps. A trailing partial second is left out
+ * of min/max unless it is all there is
+ */
+static int
+summarize_rate(const struct stream_stats *st, double fps, int verbose, struct rate_summary *rate)
+{
+    uint64_t *seconds;
+    size_t count, full;
+
+    memset(rate, 0, sizeof(*rate));
+    rate->fps = fps;
+    rate->duration = st->frames / fps;
+    if (st->frames == 0)
+        return (0);
+    rate->avg_kbps = st->bytes * 8 / rate->duration / 1000;
+
+    count = (size_t)((st->frames - 1) / fps) + 1;
+    seconds = calloc(count, sizeof(*seconds));
+    if (seconds == NULL)
+        return (-1);
+    for (size_t i = 0; i < st->frames; i++)
+        seconds[(size_t)(i / fps)] += st->frame_sizes[i];
+
+    full = (size_t)(st->frames / fps);
+    if (full == 0)
+        full = count;
+    for (size_t s = 0; s < count; s++) {
+        double kbps = seconds[s] * 8 / 1000.0;
+
+        if (verbose)
+            printf("second %zu: %.1f kbps\n", s, kbps);
+        if (s >= full)
+            continue;
+        if ((s == 0) || (kbps < rate->min_kbps))
+            rate->min_kbps = kbps;
+        if (kbps > rate->max_kbps) {
+            rate->max_kbps = kbps;
+            rate->peak_second = s;
+        }
+    }
+    free(seconds);
+
+    return (0);
+}
+
+static void
+print_sizes(const char *label, const struct size_summary *sum)
+{
+    if (sum->count == 0)
+        return;
+    printf("  %-4s %8zu  avg %9.0f  min %8u  p50 %8u  p90 %8u  p99 %8u  max %8u\n",
+        label, sum->count, sum->avg, sum->min, sum->p50, sum->p90, sum->p99, sum->max);
+}
+
+static void
+report_sizes(FILE *out, const char *label, const struct size_summary *sum, int last)
+{
+    fprintf(out, "    \"%s\": { \"count\": %zu, \"avg\": %.1f, \"min\": %u, \"p50\": %u, "
+        "\"p90\": %u, \"p99\": %u, \"max\": %u }%s\n", label, sum->count, sum->avg,
+        sum->min, sum->p50, sum->p90, sum->p99, sum->max, last ? "" : ",");
+}
+
+static int
+report(const struct stream_stats *st, const char *path, double fps, const char *json)
+{
+    struct size_summary sizes[FRAME_TYPES + 1];
+    struct gop_summary gop;
+    struct rate_summary rate;
+    FILE *out;
+    int first;
+
+    if (fps <= 0) {
+        fps = DEFAULT_FPS;
+        /* Two fields per frame, E.2.1 */
+        if (st->sps_valid && st->sps.num_units_in_tick && st->sps.time_scale)
+            fps = st->sps.time_scale / (2.0 * st->sps.num_units_in_tick);
+    }
+
+    for (int t = 0; t <= FRAME_TYPES; t++) {
+        if (summarize_sizes(st, t, &sizes[t]) < 0)
+            return (-1);
+    }
+    summarize_gops(st, &gop);
+    if (summarize_rate(st, fps, st->verbose, &rate) < 0)
+        return (-1);
+
+    printf("%s: %llu bytes, %zu frames, %.2f s at %.3f fps\n", path, (unsigned long long)st->bytes,
+        st->frames, rate.duration, rate.fps);
+    if (st->sps_valid)
+        print_sps(&st->sps);
+    if (st->pps_valid)
+        print_pps(&st->pps);
+    if (st->sps_changes || st->pps_changes)
+        printf("parameter set changes: SPS %d, PPS %d\n", st->sps_changes, st->pps_changes);
+    if (st->bad_nals)
+        printf("malformed NAL units: %d\n", st->bad_nals);
+
+    printf("NAL units:\n");
+    for (int t = 0; t < 32; t++) {
+        if (st->nal_count[t] == 0)
+            continue;
+        printf("  type %2d  %10llu  %14llu bytes  %5.1f%%\n", t,
+            (unsigned long long)st->nal_count[t], (unsigned long long)st->nal_bytes[t],
+            100.0 * st->nal_bytes[t] / st->bytes);
+    }
+
+    printf("bitrate: avg %.1f kbps, per second min %.1f max %.1f (second %zu)\n",
+        rate.avg_kbps, rate.min_kbps, rate.max_kbps, rate.peak_second);
+    printf("GOP: %zu, length avg %.1f min %zu max %zu, %zu non-IDR I frames\n",
+        gop.count, gop.avg, gop.min, gop.max, gop.i_frames);
+    printf("  %s\n", gop.pattern);
+    printf("frame sizes, bytes:\n");
+    for (int t = 0; t < FRAME_TYPES; t++)
+        print_sizes(frame_type_names[t], &sizes[t]);
+    print_sizes("all", &sizes[FRAME_TYPES]);
+
+    if (json == NULL)
+        return (0);
+
+    out = fopen(json, "w");
+    if (out == NULL) {
+        fprintf(stderr, "failed to open '%s' for writing: %s\n", json, strerror(errno));
+        return (-1);
+    }
+    fprintf(out, "{\n");
+    fprintf(out, "  \"bytes\": %llu,\n", (unsigned long long)st->bytes);
+    fprintf(out, "  \"frames\": %zu,\n", st->frames);
+    fprintf(out, "  \"fps\": %.3f,\n", rate.fps);
+    if (st->sps_valid) {
+        fprintf(out, "  \"width\": %d,\n", st->sps.width);
+        fprintf(out, "  \"height\": %d,\n", st->sps.height);
+        fprintf(out, "  \"profile\": %d,\n", st->sps.profile_idc);
+        fprintf(out, "  \"level\": %d,\n", st->sps.level_idc);
+    }
+    if (st->pps_valid)
+        fprintf(out, "  \"cabac\": %d,\n", st->pps.entropy_coding_mode);
+    fprintf(out, "  \"sps_changes\": %d,\n", st->sps_changes);
+    fprintf(out, "  \"pps_changes\": %d,\n", st->pps_changes);
+    fprintf(out, "  \"malformed_nals\": %d,\n", st->bad_nals);
+    fprintf(out, "  \"nal_types\": {");
+    first = 1;
+    for (int t = 0; t < 32; t++) {
+        if (st->nal_count[t] == 0)
+            continue;
+        fprintf(out, "%s\n    \"%d\": { \"count\": %llu, \"bytes\": %llu }",
+            first ? "" : ",", t, (unsigned long long)st->nal_count[t],
+            (unsigned long long)st->nal_bytes[t]);
+        first = 0;
+    }
+    fprintf(out, "\n  },\n");
+    fprintf(out, "  \"bitrate_kbps\": { \"avg\": %.1f, \"min\": %.1f, \"max\": %.1f, "
+        "\"peak_second\": %zu },\n", rate.avg_kbps, rate.min_kbps, rate.max_kbps,
+        rate.peak_second);
+    fprintf(out, "  \"gop\": { \"count\": %zu, \"avg\": %.1f, \"min\": %zu, \"max\": %zu, "
+        "\"i_frames\": %zu, \"pattern\": \"%s\" },\n", gop.count, gop.avg, gop.min, gop.max,
+        gop.i_frames, gop.pattern);
+    fprintf(out, "  \"frame_sizes\": {\n");
+    for (int t = 0; t < FRAME_TYPES; t++)
+        report_sizes(out, frame_type_names[t], &sizes[t], 0);
+    report_sizes(out, "all", &sizes[FRAME_TYPES], 1);
+    fprintf(out, "  }\n}\n");
+    fclose(out);
+
+    return (0);
+}
+
+int
+main(int argc, char * const *argv)
+{
+    struct stream_stats st;
+    struct timespec start, end;
+    const char *exe, *json;
+    double fps, elapsed;
+    int verbose, ret;
+    int ch;
+
+    exe = argv[0];
+    fps = 0;
+    verbose = 0;
+    json = NULL;
+
+    while ((ch = getopt(argc, argv, "f:o:v")) != -1) {
+        switch (ch) {
+            case 'f':
+                     fps = atof(optarg);
+                     if (fps <= 0)
+                         usage(exe);
+                     break;
+            case 'o':
+                     json = optarg;
+                     break;
+            case 'v':
+                     verbose = 1;
+                     break;
+            case '?':
+            default:
+                     usage(exe);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1)
+        usage(exe);
+
+    ret = 0;
+    for (int i = 0; i < argc; i++) {
+        int failed = 0;
+
+        memset(&st, 0, sizeof(st));
+        st.verbose = verbose;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if ((stat_file(&st, argv[i]) < 0) || (frame_close(&st) < 0)) {
+            fprintf(stderr, "failed to analyze %s\n", argv[i]);
+            failed = 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        /* A bad file doesn't stop the others from being reported */
+        if (failed || (report(&st, argv[i], fps, json) < 0))
+            ret = 1;
+        fprintf(stderr, "%.1f MB scanned in %.3f s, %.0f MB/s\n", st.bytes / 1e6, elapsed,
+            elapsed > 0 ? st.bytes / 1e6 / elapsed : 0);
+
+        free(st.frame_sizes);
+        free(st.frame_types);
+        if (i + 1 < argc)
+            printf("\n");
+    }
+
+    return (ret);
+}
@@ -0,0 +1,372 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "yuv_reader.h"
+#include "frame_pool.h"
+#include "yuv_scaler.h"
+#include "video_codec.h"
+#include "h264_encoder_mpp.h"
+
+#define MAX_RENDITIONS      8
+
+struct ladder;
+
+/*
+ * Single output of the ladder: own scaler, encoder and output file
+ */
+struct rendition
+{
+    int                 width;
+    int                 height;
+    int                 bps;
+    int                 fd;
+    int                 frames;
+
+    /* NULL if rendition has source dimensions */
+    yuv_scaler_t        scaler;
+    yuv_frame_t         frame;
+    struct h264_encoder_mpp *encoder;
+
+    pthread_t           thread;
+    struct ladder       *ladder;
+};
+
+/*
+ * Source frames are double-buffered: while renditions encode frame N
+ * the main thread reads frame N+1 into the other slot. All threads
+ * meet at the barrier once per frame
+ */
+struct ladder
+{
+    pthread_barrier_t   barrier;
+    frame_pool_t        pool;
+    yuv_frame_t         src[2];
+    int                 eos[2];
+
+    struct rendition    renditions[MAX_RENDITIONS];
+    int                 count;
+
+    /* Frame rate of Y4M input, 0 for raw input (encoder default) */
+    int                 fps;
+};
+
+static const struct {
+    int width;
+    int height;
+    int kbps;
+} default_ladder[] = {
+    { 1920, 1080, 4000 },
+    { 1280,  720, 2500 },
+    {  854,  480, 1200 },
+    {  640,  360,  700 },
+};
+
+/*
+ * Called for every encoded packet. Writes h264 bitstream
+ * to the rendition's output file
+ */
+static void
+h264_writer_callback(void *ptr, uint8_t *data, ssize_t len)
+{
+    struct rendition *rendition = (struct rendition *)ptr;
+    ssize_t bytes, total;
+
+    total = bytes = 0;
+    while (total < len) {
+        bytes = write(rendition->fd, data + total, len - total);
+        if (bytes < 0) {
+            if (errno != EAGAIN)
+                break;
+        }
+        else
+            total += bytes;
+    }
+}
+
+static void *
+rendition_thread(void *arg)
+{
+    struct rendition *rendition = (struct rendition *)arg;
+    struct ladder *ladder = rendition->ladder;
+    unsigned int round = 0;
+    yuv_frame_t frame;
+
+    while (1) {
+        int slot = round & 1;
+
+        pthread_barrier_wait(&ladder->barrier);
+
+        if (ladder->eos[slot]) {
+            /* Generate EOS packet */
+            h264_mpp_encoder_submit_frame(rendition->encoder, rendition->frame, 1);
+            break;
+        }
+
+        frame = ladder->src[slot];
+        if (rendition->scaler) {
+            yuv_scaler_run(rendition->scaler, frame, rendition->frame);
+            frame = rendition->frame;
+        }
+
+        h264_mpp_encoder_submit_frame(rendition->encoder, frame, 0);
+        rendition->frames++;
+        round++;
+    }
+
+    return (NULL);
+}
+
+static int
+rendition_setup(struct rendition *rendition, const char *prefix,
+    int src_width, int src_height, int threads)
+{
+    char path[1024];
+    struct h264_encoder_params params;
+
+    snprintf(path, sizeof(path), "%s_%dx%d.h264", prefix, rendition->width, rendition->height);
+    rendition->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (rendition->fd < 0) {
+        fprintf(stderr, "failed to open '%s' for writing: %s\n", path, strerror(errno));
+        return (-1);
+    }
+
+    if ((rendition->width != src_width) || (rendition->height != src_height)) {
+        rendition->scaler = yuv_scaler_create(src_width, src_height,
+            rendition->width, rendition->height, threads);
+        if (rendition->scaler == NULL) {
+            fprintf(stderr, "failed to create %dx%d scaler\n", rendition->width, rendition->height);
+            return (-1);
+        }
+    }
+
+    rendition->frame = yuv_alloc_frame_size(rendition->width, rendition->height);
+    if (rendition->frame == NULL) {
+        fprintf(stderr, "failed to allocate %dx%d frame\n", rendition->width, rendition->height);
+        return (-1);
+    }
+
+    h264_mpp_encoder_default_params(&params, rendition->width, rendition->height);
+    params.bps = rendition->bps;
+    if (rendition->ladder->fps > 0)
+        params.fps = rendition->ladder->fps;
+    rendition->encoder = h264_mpp_encoder_create_with_params(&params,
+        h264_writer_callback, rendition);
+    if (rendition->encoder == NULL) {
+        fprintf(stderr, "failed to create %dx%d H264 encoder\n", rendition->width, rendition->height);
+        return (-1);
+    }
+
+    fprintf(stderr, "Rendition %dx%d at %d kbps -> %s\n", rendition->width, rendition->height,
+        rendition->bps / 1024, path);
+
+    return (0);
+}
+
+static void
+usage(const char *exe)
+{
+    fprintf(stderr, "Usage: %s [-w width] [-h height] [-t scaler_threads] [-r WxH:kbps ...] [-H] in.yuv out_prefix\n", exe);
+    fprintf(stderr, "  -H  keep source frames in huge pages\n");
+    exit(1);
+}
+
+int
+main(int argc, char * const*argv)
+{
+    struct ladder *ladder;
+    struct rendition *rendition;
+    struct timespec start, end;
+    yuv_reader_t yuv;
+    const char *exe;
+    int width, height, threads, pool_flags;
+    int ch, w, h, kbps;
+    unsigned int round;
+    double elapsed;
+
+    exe = argv[0];
+
+    width = 1920;
+    height = 1080;
+    threads = 2;
+    pool_flags = 0;
+
+    ladder = calloc(1, sizeof(struct ladder));
+    if (ladder == NULL) {
+        fprintf(stderr, "failed to allocate ladder context\n");
+        exit(1);
+    }
+
+    while ((ch = getopt(argc, argv, "h:Hr:t:w:")) != -1) {
+        switch (ch) {
+            case 'w':
+                     width = atoi(optarg);
+                     break;
+            case 'h':
+                     height = atoi(optarg);
+                     break;
+            case 'H':
+                     pool_flags |= FRAME_POOL_HUGEPAGES;
+                     break;
+            case 't':
+                     threads = atoi(optarg);
+                     break;
+            case 'r':
+                     if (ladder->count >= MAX_RENDITIONS) {
+                         fprintf(stderr, "too many renditions, max is %d\n", MAX_RENDITIONS);
+                         exit(1);
+                     }
+                     if ((sscanf(optarg, "%dx%d:%d", &w, &h, &kbps) != 3) ||
+                             (w <= 0) || (h <= 0) || (kbps <= 0))
+                         usage(exe);
+                     rendition = &ladder->renditions[ladder->count++];
+                     rendition->width = w;
+                     rendition->height = h;
+                     rendition->bps = kbps * 1024;
+                     break;
+            case '?':
+            default:
+                     usage(exe);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 2)
+        usage(exe);
+
+    /* Y4M input brings its own frame size */
+    yuv = yuv_reader_open(argv[0], width, height);
+    if (yuv == NULL) {
+        fprintf(stderr, "failed to open input file %s\n", argv[0]);
+        exit(1);
+    }
+    width = yuv->width;
+    height = yuv->height;
+    if (yuv->fps_num > 0)
+        ladder->fps = (yuv->fps_num + yuv->fps_den / 2) / yuv->fps_den;
+
+    /*
+     * Default ladder, only renditions that are not larger than the source
+     */
+    if (ladder->count == 0) {
+        for (int i = 0; i < sizeof(default_ladder) / sizeof(default_ladder[0]); i++) {
+            if ((default_ladder[i].width > width) || (default_ladder[i].height > height))
+                continue;
+            rendition = &ladder->renditions[ladder->count++];
+            rendition->width = default_ladder[i].width;
+            rendition->height = default_ladder[i].height;
+            rendition->bps = default_ladder[i].kbps * 1024;
+        }
+    }
+
+    if (ladder->count == 0) {
+        fprintf(stderr, "no renditions fit %dx%d input\n", width, height);
+        exit(1);
+    }
+
+    fprintf(stderr, "Input resolution: %dx%d\n", width, height);
+
+    ladder->pool = frame_pool_create(width, height, 2, 0, pool_flags);
+    if (ladder->pool == NULL) {
+        fprintf(stderr, "failed to allocate input frames\n");
+        exit(1);
+    }
+    if ((pool_flags & FRAME_POOL_HUGEPAGES) && (frame_pool_backing(ladder->pool) == FRAME_POOL_PAGES))
+        fprintf(stderr, "no huge pages available, source frames use normal pages\n");
+    ladder->src[0] = frame_pool_get(ladder->pool);
+    ladder->src[1] = frame_pool_get(ladder->pool);
+
+    for (int i = 0; i < ladder->count; i++) {
+        rendition = &ladder->renditions[i];
+        rendition->ladder = ladder;
+        if (rendition_setup(rendition, argv[1], width, height, threads) < 0)
+            exit(1);
+    }
+
+    pthread_barrier_init(&ladder->barrier, NULL, ladder->count + 1);
+
+    for (int i = 0; i < ladder->count; i++) {
+        rendition = &ladder->renditions[i];
+        if (pthread_create(&rendition->thread, NULL, rendition_thread, rendition)) {
+            fprintf(stderr, "failed to start rendition thread\n");
+            exit(1);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /*
+     * Every frame is read once and shared by all renditions
+     */
+    round = 0;
+    ladder->eos[0] = (yuv_read_frame(yuv, ladder->src[0]) != 0);
+    while (1) {
+        int next = (round + 1) & 1;
+
+        /* Let renditions start on the current slot */
+        pthread_barrier_wait(&ladder->barrier);
+        if (ladder->eos[round & 1])
+            break;
+
+        ladder->eos[next] = (yuv_read_frame(yuv, ladder->src[next]) != 0);
+        round++;
+    }
+
+    for (int i = 0; i < ladder->count; i++)
+        pthread_join(ladder->renditions[i].thread, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%u frames, %d renditions in %.2f s (%.1f fps)\n", round, ladder->count,
+        elapsed, elapsed > 0 ? round / elapsed : 0.0);
+
+    /* Cleanup */
+    for (int i = 0; i < ladder->count; i++) {
+        rendition = &ladder->renditions[i];
+        h264_mpp_encoder_destroy(rendition->encoder);
+        if (rendition->scaler)
+            yuv_scaler_destroy(rendition->scaler);
+        yuv_free_frame(rendition->frame);
+        close(rendition->fd);
+    }
+
+    pthread_barrier_destroy(&ladder->barrier);
+    frame_pool_destroy(ladder->pool);
+    free(ladder);
+
+    return 0;
+}
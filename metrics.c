@@ -0,0 +1,299 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/errno.h>
+
+#include "metrics.h"
+
+static const char *counter_names[METRIC_COUNTERS] = {
+    [METRIC_FRAMES_READ] = "frames_read",
+    [METRIC_FRAMES_ENCODED] = "frames_encoded",
+    [METRIC_FRAMES_DECODED] = "frames_decoded",
+    [METRIC_FRAMES_DROPPED] = "frames_dropped",
+    [METRIC_NALS_READ] = "nals_read",
+    [METRIC_PACKETS_IN] = "packets_in",
+    [METRIC_PACKETS_OUT] = "packets_out",
+    [METRIC_BYTES_READ] = "bytes_read",
+    [METRIC_BYTES_IN] = "bytes_in",
+    [METRIC_BYTES_OUT] = "bytes_out",
+    [METRIC_BYTES_WRITTEN] = "bytes_written",
+    [METRIC_EAGAIN] = "eagain",
+    [METRIC_BUFFER_FULL] = "buffer_full",
+    [METRIC_DEQUEUE_RETRIES] = "dequeue_retries",
+};
+
+static const char *gauge_names[METRIC_GAUGES] = {
+    [METRIC_ENCODER_TASKS] = "encoder_tasks",
+    [METRIC_RUN_QUEUE] = "run_queue",
+    [METRIC_PREFETCH_QUEUE] = "prefetch_queue",
+};
+
+static const char *stage_names[METRIC_STAGES] = {
+    [METRIC_STAGE_READ] = "read",
+    [METRIC_STAGE_COPY] = "copy",
+    [METRIC_STAGE_HARDWARE] = "hardware",
+    [METRIC_STAGE_CALLBACK] = "callback",
+    [METRIC_STAGE_WRITE] = "write",
+};
+
+static int enabled;
+static uint64_t counters[METRIC_COUNTERS];
+static int64_t gauges[METRIC_GAUGES];
+static int64_t gauges_max[METRIC_GAUGES];
+static struct metric_stage_stats stages[METRIC_STAGES];
+static uint64_t start_ns;
+
+/* Periodic export */
+static pthread_t export_thread;
+static pthread_mutex_t export_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t export_cond = PTHREAD_COND_INITIALIZER;
+static int export_running;
+static int export_interval_ms;
+static char *export_path;
+
+/*
+ * Monotonic clock in nanoseconds, the one all timings in the tree use
+ */
+uint64_t
+metrics_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+void
+metrics_enable(void)
+{
+    start_ns = metrics_now_ns();
+    __atomic_store_n(&enabled, 1, __ATOMIC_RELEASE);
+}
+
+void
+metrics_count(enum metric_counter counter, uint64_t n)
+{
+    __atomic_fetch_add(&counters[counter], n, __ATOMIC_RELAXED);
+}
+
+void
+metrics_gauge(enum metric_gauge gauge, int64_t value)
+{
+    int64_t max = __atomic_load_n(&gauges_max[gauge], __ATOMIC_RELAXED);
+
+    __atomic_store_n(&gauges[gauge], value, __ATOMIC_RELAXED);
+    while ((value > max) && !__atomic_compare_exchange_n(&gauges_max[gauge], &max, value,
+            1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+ * Returns timestamp to pass to metrics_stage_end, 0 if timing is disabled
+ */
+uint64_t
+metrics_stage_begin(void)
+{
+    if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED))
+        return (0);
+
+    return metrics_now_ns();
+}
+
+void
+metrics_stage_end(enum metric_stage stage, uint64_t begin)
+{
+    struct metric_stage_stats *stats = &stages[stage];
+    uint64_t elapsed, max;
+
+    if (begin == 0)
+        return;
+
+    elapsed = metrics_now_ns() - begin;
+    __atomic_fetch_add(&stats->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->total_ns, elapsed, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&stats->max_ns, __ATOMIC_RELAXED);
+    while ((elapsed > max) && !__atomic_compare_exchange_n(&stats->max_ns, &max, elapsed,
+            1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+uint64_t
+metrics_counter(enum metric_counter counter)
+{
+    return __atomic_load_n(&counters[counter], __ATOMIC_RELAXED);
+}
+
+int64_t
+metrics_gauge_value(enum metric_gauge gauge, int64_t *max)
+{
+    if (max)
+        *max = __atomic_load_n(&gauges_max[gauge], __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&gauges[gauge], __ATOMIC_RELAXED);
+}
+
+void
+metrics_stage_stats(enum metric_stage stage, struct metric_stage_stats *stats)
+{
+    stats->count = __atomic_load_n(&stages[stage].count, __ATOMIC_RELAXED);
+    stats->total_ns = __atomic_load_n(&stages[stage].total_ns, __ATOMIC_RELAXED);
+    stats->max_ns = __atomic_load_n(&stages[stage].max_ns, __ATOMIC_RELAXED);
+}
+
+/*
+ * Write snapshot of all metrics to @f as single JSON object
+ */
+int
+metrics_dump_json(FILE *f)
+{
+    struct metric_stage_stats stats;
+    int64_t value, max;
+
+    fprintf(f, "{\"uptime_ms\": %llu, \"counters\": {",
+        (unsigned long long)(start_ns ? (metrics_now_ns() - start_ns) / 1000000 : 0));
+    for (int i = 0; i < METRIC_COUNTERS; i++)
+        fprintf(f, "%s\"%s\": %llu", i ? ", " : "", counter_names[i],
+            (unsigned long long)metrics_counter(i));
+
+    fprintf(f, "}, \"gauges\": {");
+    for (int i = 0; i < METRIC_GAUGES; i++) {
+        value = metrics_gauge_value(i, &max);
+        fprintf(f, "%s\"%s\": {\"value\": %lld, \"max\": %lld}", i ? ", " : "",
+            gauge_names[i], (long long)value, (long long)max);
+    }
+
+    fprintf(f, "}, \"stages\": {");
+    for (int i = 0; i < METRIC_STAGES; i++) {
+        metrics_stage_stats(i, &stats);
+        fprintf(f, "%s\"%s\": {\"count\": %llu, \"total_us\": %llu, \"avg_us\": %.1f, \"max_us\": %.1f}",
+            i ? ", " : "", stage_names[i], (unsigned long long)stats.count,
+            (unsigned long long)(stats.total_ns / 1000),
+            stats.count ? stats.total_ns / 1000.0 / stats.count : 0.0,
+            stats.max_ns / 1000.0);
+    }
+    fprintf(f, "}}\n");
+
+    return (ferror(f) ? -1 : 0);
+}
+
+/*
+ * Write metrics to temporary file and rename it over @path so readers
+ * never see partial snapshot
+ */
+static int
+metrics_write_file(const char *path)
+{
+    char tmp[1024];
+    FILE *f;
+    int ret;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        fprintf(stderr, "failed to open '%s' for writing: %s\n", tmp, strerror(errno));
+        return (-1);
+    }
+
+    ret = metrics_dump_json(f);
+    if (fclose(f) || ret)
+        return (-1);
+
+    return rename(tmp, path);
+}
+
+static void *
+metrics_export_thread(void *arg)
+{
+    struct timespec deadline;
+
+    pthread_mutex_lock(&export_lock);
+    while (export_running) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += export_interval_ms / 1000;
+        deadline.tv_nsec += (export_interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        if (pthread_cond_timedwait(&export_cond, &export_lock, &deadline) == ETIMEDOUT)
+            metrics_write_file(export_path);
+    }
+    pthread_mutex_unlock(&export_lock);
+
+    return (NULL);
+}
+
+/*
+ * Enable metrics and dump them to @path every @interval_ms
+ */
+int
+metrics_start_export(const char *path, int interval_ms)
+{
+    if (export_running || (interval_ms <= 0))
+        return (-1);
+
+    export_path = strdup(path);
+    if (export_path == NULL)
+        return (-1);
+
+    metrics_enable();
+    export_interval_ms = interval_ms;
+    export_running = 1;
+    if (pthread_create(&export_thread, NULL, metrics_export_thread, NULL)) {
+        export_running = 0;
+        free(export_path);
+        export_path = NULL;
+        return (-1);
+    }
+
+    return (0);
+}
+
+/*
+ * Stop periodic export, writing final snapshot
+ */
+void
+metrics_stop_export(void)
+{
+    if (!export_running)
+        return;
+
+    pthread_mutex_lock(&export_lock);
+    export_running = 0;
+    pthread_cond_signal(&export_cond);
+    pthread_mutex_unlock(&export_lock);
+    pthread_join(export_thread, NULL);
+
+    metrics_write_file(export_path);
+    free(export_path);
+    export_path = NULL;
+}
@@ -0,0 +1,89 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+/*
+ * Process-wide pipeline metrics. Counters are always maintained (relaxed
+ * atomic adds), stage timing is collected only after metrics_enable()
+ */
+
+enum metric_counter {
+    METRIC_FRAMES_READ,         /* raw frames read from input */
+    METRIC_FRAMES_ENCODED,
+    METRIC_FRAMES_DECODED,
+    METRIC_FRAMES_DROPPED,      /* erroneous/discarded decoder output */
+    METRIC_NALS_READ,
+    METRIC_PACKETS_IN,          /* bitstream chunks submitted to decoder */
+    METRIC_PACKETS_OUT,         /* packets produced by encoder */
+    METRIC_BYTES_READ,          /* raw and bitstream input */
+    METRIC_BYTES_IN,            /* bitstream submitted to decoder */
+    METRIC_BYTES_OUT,           /* bitstream produced by encoder */
+    METRIC_BYTES_WRITTEN,       /* output written by writers */
+    METRIC_EAGAIN,              /* decoder output timeouts, short writes */
+    METRIC_BUFFER_FULL,         /* MPP_ERR_BUFFER_FULL on decoder input */
+    METRIC_DEQUEUE_RETRIES,     /* encoder task dequeue retries */
+    METRIC_COUNTERS
+};
+
+enum metric_gauge {
+    METRIC_ENCODER_TASKS,       /* encoder tasks in flight */
+    METRIC_RUN_QUEUE,           /* streams waiting in decode server queue */
+    METRIC_PREFETCH_QUEUE,      /* input frames read ahead of the encoder */
+    METRIC_GAUGES
+};
+
+enum metric_stage {
+    METRIC_STAGE_READ,
+    METRIC_STAGE_COPY,
+    METRIC_STAGE_HARDWARE,
+    METRIC_STAGE_CALLBACK,
+    METRIC_STAGE_WRITE,
+    METRIC_STAGES
+};
+
+struct metric_stage_stats {
+    uint64_t            count;
+    uint64_t            total_ns;
+    uint64_t            max_ns;
+};
+
+uint64_t metrics_now_ns(void);
+void metrics_enable(void);
+void metrics_count(enum metric_counter counter, uint64_t n);
+void metrics_gauge(enum metric_gauge gauge, int64_t value);
+uint64_t metrics_stage_begin(void);
+void metrics_stage_end(enum metric_stage stage, uint64_t begin);
+
+uint64_t metrics_counter(enum metric_counter counter);
+int64_t metrics_gauge_value(enum metric_gauge gauge, int64_t *max);
+void metrics_stage_stats(enum metric_stage stage, struct metric_stage_stats *stats);
+
+int metrics_dump_json(FILE *f);
+int metrics_start_export(const char *path, int interval_ms);
+void metrics_stop_export(void);
+
+#endif /* __METRICS_H__ */
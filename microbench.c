@@ -0,0 +1,574 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmarks for CPU-side hot loops of the pipelines. Every kernel is
+ * calibrated to run for at least MIN_REP_NS per repetition, warmed up and
+ * repeated; median time per byte is reported and optionally compared
+ * against the baseline saved earlier on the same machine
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <sched.h>
+
+#include "video_codec.h"
+#include "h264_reader.h"
+#include "yuv_reader.h"
+#include "frame_pool.h"
+#include "yuv_ops.h"
+#include "frame_writer.h"
+#include "metrics.h"
+
+#define MIN_REP_NS          (20*1000*1000)
+#define MAX_REPS            101
+#define MAX_KERNELS         16
+
+/* 1080p frame, typical case for all the kernels */
+#define FRAME_WIDTH         1920
+#define FRAME_HEIGHT        1080
+/* Odd width forces row-by-row paths */
+#define PADDED_WIDTH        1918
+#define PADDED_STRIDE       2048
+/* Width of the first ladder rendition below 1080p */
+#define SCALED_WIDTH        1280
+/* Bitstream with slice-sized NAL units */
+#define STREAM_SIZE         (1024*1024)
+#define NAL_SIZE            1500
+
+struct kernel
+{
+    const char          *name;
+    /* Bytes processed by single call of run() */
+    size_t              bytes;
+    void                (*setup)(void);
+    void                (*run)(void);
+};
+
+struct measurement
+{
+    const char          *name;
+    double              ns_per_op;
+    double              ns_per_byte;
+    double              min_ns_per_byte;
+};
+
+static uint8_t *stream;
+static uint8_t *plane_src;
+static uint8_t *plane_dst;
+static int32_t (*ssim_sums)[4];
+static struct yuv_hscale *hscale;
+static int null_fd = -1;
+static frame_pool_t pool;
+/* Keeps results alive so compiler can't drop the work */
+static volatile size_t sink;
+
+static void *
+xmalloc(size_t size)
+{
+    void *ptr = malloc(size);
+
+    if (ptr == NULL) {
+        fprintf(stderr, "failed to allocate %zu bytes\n", size);
+        exit(1);
+    }
+
+    return (ptr);
+}
+
+static void
+setup_stream(void)
+{
+    if (stream)
+        return;
+
+    stream = xmalloc(STREAM_SIZE);
+    srand(1);
+    for (size_t i = 0; i < STREAM_SIZE; i++) {
+        if (i % NAL_SIZE == 0) {
+            memcpy(stream + i, "\0\0\0\1", 4);
+            i += 3;
+        }
+        else
+            stream[i] = rand() % 255 + 1;
+    }
+}
+
+/* Start-code search as h264_read_nal does it, over the whole buffer */
+static void
+run_start_code(void)
+{
+    size_t pos = 0, found = 0;
+    ssize_t offset;
+
+    while ((offset = h264_find_start_code(stream + pos, STREAM_SIZE - pos)) >= 0) {
+        pos += offset + 4;
+        found++;
+    }
+    sink = found;
+}
+
+static void
+setup_planes(void)
+{
+    if (plane_src)
+        return;
+
+    plane_src = xmalloc((size_t)PADDED_STRIDE * FRAME_HEIGHT * 3 / 2);
+    plane_dst = xmalloc((size_t)PADDED_STRIDE * FRAME_HEIGHT * 3 / 2);
+    for (size_t i = 0; i < (size_t)PADDED_STRIDE * FRAME_HEIGHT * 3 / 2; i++)
+        plane_src[i] = i;
+    memset(plane_dst, 0, (size_t)PADDED_STRIDE * FRAME_HEIGHT * 3 / 2);
+}
+
+/* Luma copy of h264_mpp_encoder_submit_frame, width equal to stride */
+static void
+run_copy_plane(void)
+{
+    yuv_copy_plane(plane_dst, FRAME_WIDTH, plane_src, FRAME_WIDTH,
+        FRAME_WIDTH, FRAME_HEIGHT);
+}
+
+/* Same with width not aligned to MPP stride */
+static void
+run_copy_plane_padded(void)
+{
+    yuv_copy_plane(plane_dst, PADDED_STRIDE, plane_src, PADDED_WIDTH,
+        PADDED_WIDTH, FRAME_HEIGHT);
+}
+
+static void
+setup_write(void)
+{
+    setup_planes();
+    if (null_fd < 0) {
+        null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd < 0) {
+            fprintf(stderr, "failed to open /dev/null: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+}
+
+/* NV12 frame with padded rows as decoder produces it, to /dev/null */
+static void
+run_write_rows(void)
+{
+    frame_write_nv12(null_fd, plane_src, plane_src + (size_t)PADDED_STRIDE * FRAME_HEIGHT,
+        FRAME_WIDTH, FRAME_HEIGHT, PADDED_STRIDE);
+}
+
+static void
+run_alloc_frame(void)
+{
+    yuv_frame_t frame = yuv_alloc_frame_size(FRAME_WIDTH, FRAME_HEIGHT);
+
+    if (frame == NULL) {
+        fprintf(stderr, "yuv_alloc_frame_size failed\n");
+        exit(1);
+    }
+    sink = (size_t)frame->Y;
+    yuv_free_frame(frame);
+}
+
+/* Recycling pooled frame instead of allocating it */
+static void
+setup_pool(void)
+{
+    pool = frame_pool_create(FRAME_WIDTH, FRAME_HEIGHT, 2, 0, 0);
+    if (pool == NULL) {
+        fprintf(stderr, "frame_pool_create failed\n");
+        exit(1);
+    }
+}
+
+static void
+run_pool_frame(void)
+{
+    yuv_frame_t frame = frame_pool_get(pool);
+
+    sink = (size_t)frame->Y;
+    frame_pool_put(pool, frame);
+}
+
+/* Squared error of 1080p luma, PSNR part of quality_compare */
+static void
+run_sse_plane(void)
+{
+    uint64_t sse = 0;
+
+    for (int y = 0; y < FRAME_HEIGHT; y++)
+        sse += yuv_sse_row(plane_src + (size_t)y * FRAME_WIDTH,
+            plane_dst + (size_t)y * FRAME_WIDTH, FRAME_WIDTH);
+    sink = sse;
+}
+
+static void
+setup_ssim(void)
+{
+    setup_planes();
+    if (ssim_sums == NULL)
+        ssim_sums = xmalloc(FRAME_WIDTH / 4 * sizeof(*ssim_sums));
+}
+
+/* SSIM block statistics of 1080p luma */
+static void
+run_ssim_sums(void)
+{
+    for (int y = 0; y + 4 <= FRAME_HEIGHT; y += 4)
+        yuv_ssim_sums4x4(plane_src + (size_t)y * FRAME_WIDTH, FRAME_WIDTH,
+            plane_dst + (size_t)y * FRAME_WIDTH, FRAME_WIDTH, FRAME_WIDTH / 4, ssim_sums);
+    sink = ssim_sums[0][3];
+}
+
+/* Chroma of 1080p NV12 frame to planar U and V, Y4M sink of decoder */
+static void
+run_split_uv(void)
+{
+    uint8_t *u = plane_dst, *v = plane_dst + FRAME_WIDTH * FRAME_HEIGHT / 4;
+
+    for (int y = 0; y < FRAME_HEIGHT / 2; y++)
+        yuv_split_uv(u + (size_t)y * FRAME_WIDTH / 2, v + (size_t)y * FRAME_WIDTH / 2,
+            plane_src + (size_t)y * FRAME_WIDTH, FRAME_WIDTH / 2);
+}
+
+/* Ladder's 1080p to 720p horizontal pass, center-aligned like yuv_scaler */
+static void
+setup_hscale(void)
+{
+    int off[SCALED_WIDTH];
+    uint8_t weight[SCALED_WIDTH];
+
+    setup_planes();
+    if (hscale)
+        return;
+
+    for (int i = 0; i < SCALED_WIDTH; i++) {
+        int pos = (2*i + 1) * FRAME_WIDTH * YUV_BLEND_ONE / (2 * SCALED_WIDTH) - YUV_BLEND_ONE / 2;
+
+        off[i] = pos / YUV_BLEND_ONE;
+        weight[i] = pos % YUV_BLEND_ONE;
+    }
+    hscale = yuv_hscale_create(off, weight, SCALED_WIDTH, FRAME_WIDTH + 1);
+    if (hscale == NULL) {
+        fprintf(stderr, "failed to set up scaling tables\n");
+        exit(1);
+    }
+}
+
+static void
+run_hscale(void)
+{
+    for (int y = 0; y < FRAME_HEIGHT; y++)
+        yuv_hscale_row(hscale, plane_dst + (size_t)y * SCALED_WIDTH,
+            plane_src + (size_t)y * FRAME_WIDTH);
+}
+
+/* Hash sink of decoder, 1080p NV12 frame with padded rows */
+static void
+run_crc32c(void)
+{
+    sink = frame_hash_nv12(0, plane_src, plane_src + (size_t)PADDED_STRIDE * FRAME_HEIGHT,
+        FRAME_WIDTH, FRAME_HEIGHT, PADDED_STRIDE);
+}
+
+static struct kernel kernels[] = {
+    { "start_code", STREAM_SIZE, setup_stream, run_start_code },
+    { "copy_plane", FRAME_WIDTH * FRAME_HEIGHT, setup_planes, run_copy_plane },
+    { "copy_plane_padded", PADDED_WIDTH * FRAME_HEIGHT, setup_planes, run_copy_plane_padded },
+    { "write_rows", FRAME_WIDTH * FRAME_HEIGHT * 3 / 2, setup_write, run_write_rows },
+    { "alloc_frame", FRAME_WIDTH * FRAME_HEIGHT * 3 / 2, NULL, run_alloc_frame },
+    { "pool_frame", FRAME_WIDTH * FRAME_HEIGHT * 3 / 2, setup_pool, run_pool_frame },
+    { "crc32c", FRAME_WIDTH * FRAME_HEIGHT * 3 / 2, setup_planes, run_crc32c },
+    { "sse_plane", FRAME_WIDTH * FRAME_HEIGHT, setup_planes, run_sse_plane },
+    { "ssim_sums", FRAME_WIDTH * FRAME_HEIGHT, setup_ssim, run_ssim_sums },
+    { "split_uv", FRAME_WIDTH * FRAME_HEIGHT / 2, setup_planes, run_split_uv },
+    { "hscale", FRAME_WIDTH * FRAME_HEIGHT, setup_hscale, run_hscale },
+};
+
+#define NKERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static int
+compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x < y) ? -1 : (x > y);
+}
+
+static void
+measure(struct kernel *kernel, int warmup, int reps, struct measurement *m)
+{
+    double samples[MAX_REPS];
+    uint64_t begin, elapsed;
+    long iters = 1;
+
+    if (kernel->setup)
+        kernel->setup();
+
+    /* Find number of calls that takes at least MIN_REP_NS */
+    do {
+        begin = metrics_now_ns();
+        for (long i = 0; i < iters; i++)
+            kernel->run();
+        elapsed = metrics_now_ns() - begin;
+        if (elapsed < MIN_REP_NS)
+            iters *= 2;
+    } while (elapsed < MIN_REP_NS);
+
+    for (int rep = 0; rep < warmup + reps; rep++) {
+        begin = metrics_now_ns();
+        for (long i = 0; i < iters; i++)
+            kernel->run();
+        elapsed = metrics_now_ns() - begin;
+        if (rep >= warmup)
+            samples[rep - warmup] = (double)elapsed / iters;
+    }
+
+    qsort(samples, reps, sizeof(double), compare_double);
+
+    m->name = kernel->name;
+    m->ns_per_op = samples[reps / 2];
+    m->ns_per_byte = m->ns_per_op / kernel->bytes;
+    m->min_ns_per_byte = samples[0] / kernel->bytes;
+}
+
+/* Maximum frequency of @cpu in GHz, 0 if unknown */
+static double
+cpu_max_ghz(int cpu)
+{
+    char path[128];
+    FILE *f;
+    long khz = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq",
+        cpu < 0 ? 0 : cpu);
+    f = fopen(path, "r");
+    if (f == NULL)
+        return (0);
+    if (fscanf(f, "%ld", &khz) != 1)
+        khz = 0;
+    fclose(f);
+
+    return (khz / 1e6);
+}
+
+/*
+ * Baseline file has one "name ns_per_op" line per kernel, read once.
+ * Lines of kernels this build doesn't have are ignored
+ */
+static int
+baseline_load(const char *path, double *base)
+{
+    char line[256], kernel[128];
+    double value;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "failed to open baseline %s: %s\n", path, strerror(errno));
+        return (-1);
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%127s %lf", kernel, &value) != 2)
+            continue;
+        for (size_t i = 0; i < NKERNELS; i++)
+            if (strcmp(kernel, kernels[i].name) == 0)
+                base[i] = value;
+    }
+    fclose(f);
+
+    return (0);
+}
+
+static int
+baseline_save(const char *path, struct measurement *m, int count)
+{
+    FILE *f;
+
+    f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "failed to open '%s' for writing: %s\n", path, strerror(errno));
+        return (-1);
+    }
+
+    for (int i = 0; i < count; i++)
+        fprintf(f, "%s %.1f\n", m[i].name, m[i].ns_per_op);
+    fclose(f);
+
+    return (0);
+}
+
+static void
+usage(const char *exe)
+{
+    fprintf(stderr, "Usage: %s [-c cpu] [-r repetitions] [-w warmup] [-b baseline] [-s baseline]\n"
+        "    [-t threshold_percent] [kernel ...]\n", exe);
+    fprintf(stderr, "  -b  compare against baseline, exit with 2 if any kernel is slower\n"
+                    "      than baseline by more than threshold (10%%) or not in it\n");
+    fprintf(stderr, "  -s  save results as new baseline\n");
+    fprintf(stderr, "kernels:");
+    for (size_t i = 0; i < NKERNELS; i++)
+        fprintf(stderr, " %s", kernels[i].name);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int
+main(int argc, char * const *argv)
+{
+    struct measurement results[MAX_KERNELS];
+    double base[NKERNELS];
+    const char *exe, *baseline, *save;
+    int cpu, reps, warmup, threshold;
+    int count, regressions, missing;
+    double ghz;
+    int ch;
+
+    exe = argv[0];
+    baseline = save = NULL;
+    cpu = -1;
+    reps = 15;
+    warmup = 3;
+    threshold = 10;
+
+    while ((ch = getopt(argc, argv, "b:c:r:s:t:w:")) != -1) {
+        switch (ch) {
+            case 'b':
+                     baseline = optarg;
+                     break;
+            case 'c':
+                     cpu = atoi(optarg);
+                     break;
+            case 'r':
+                     reps = atoi(optarg);
+                     break;
+            case 's':
+                     save = optarg;
+                     break;
+            case 't':
+                     threshold = atoi(optarg);
+                     break;
+            case 'w':
+                     warmup = atoi(optarg);
+                     break;
+            case '?':
+            default:
+                     usage(exe);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if ((reps < 1) || (reps > MAX_REPS) || (warmup < 0) || (threshold < 0))
+        usage(exe);
+
+    /* Comparing against nothing must not pass the check */
+    memset(base, 0, sizeof(base));
+    if (baseline && (baseline_load(baseline, base) < 0))
+        exit(1);
+
+    /* Migrations between cores (and big/LITTLE clusters) ruin the numbers */
+    if (cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            fprintf(stderr, "failed to pin to CPU %d: %s\n", cpu, strerror(errno));
+            exit(1);
+        }
+    }
+    ghz = cpu_max_ghz(cpu);
+
+    printf("%-20s %12s %10s %10s %10s", "kernel", "ns/op", "ns/byte", "MB/s", "cyc/byte");
+    if (baseline)
+        printf(" %10s %8s", "base ns/op", "delta");
+    printf("\n");
+
+    count = regressions = missing = 0;
+    for (size_t i = 0; i < NKERNELS; i++) {
+        struct measurement *m = &results[count];
+        int selected = (argc == 0);
+
+        for (int j = 0; j < argc; j++)
+            selected |= (strcmp(argv[j], kernels[i].name) == 0);
+        if (!selected)
+            continue;
+
+        measure(&kernels[i], warmup, reps, m);
+        count++;
+
+        printf("%-20s %12.1f %10.4f %10.1f", m->name, m->ns_per_op, m->ns_per_byte,
+            1e3 / m->ns_per_byte / 1.048576);
+        /* Cycles assume the core runs at its maximum frequency */
+        if (ghz > 0)
+            printf(" %10.4f", m->ns_per_byte * ghz);
+        else
+            printf(" %10s", "-");
+
+        if (baseline) {
+            if (base[i] > 0) {
+                double delta = (m->ns_per_op - base[i]) * 100 / base[i];
+                int regression = delta > threshold;
+
+                printf(" %10.1f %+7.1f%%%s", base[i], delta, regression ? " REGRESSION" : "");
+                regressions += regression;
+            }
+            else {
+                printf(" %10s %8s NO BASELINE", "-", "-");
+                missing++;
+            }
+        }
+        printf("\n");
+    }
+
+    if (count == 0)
+        usage(exe);
+
+    if (save && (baseline_save(save, results, count) < 0))
+        exit(1);
+
+    if (regressions || missing) {
+        fflush(stdout);
+        if (regressions)
+            fprintf(stderr, "%d kernel(s) regressed by more than %d%%\n", regressions, threshold);
+        if (missing)
+            fprintf(stderr, "%d kernel(s) missing from the baseline, re-record it\n", missing);
+        exit(2);
+    }
+
+    return (0);
+}
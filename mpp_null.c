@@ -0,0 +1,1604 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Software stand-in for the subset of librockchip_mpp API used by
+ * h264_encoder_mpp.c and h264_decoder_mpp.c. Linked instead of
+ * -lrockchip_mpp it lets the pipelines run on hosts without VPU, e.g.
+ * to benchmark everything around the hardware.
+ *
+ * The encoder produces valid parameter sets and slices of random payload
+ * sized according to the rate control settings. The decoder parses SPS
+ * for frame dimensions and outputs one blank NV12 frame per picture.
+ * Both do H.264 and H.265.
+ *
+ * Time the hardware spends on a frame can be emulated by setting
+ * MPP_NULL_ENC_US and MPP_NULL_DEC_US environment variables (microseconds).
+ * Alternatively MPP_NULL_REPLAY names a log recorded on the device with
+ * MPP_RECORD (see mpp_rec.c): every call then takes as long as it took
+ * on the device and returns the same result, e.g. MPP_ERR_BUFFER_FULL,
+ * no task or no frame, and encoded packets get the recorded sizes
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "rockchip/rk_mpi.h"
+#include "rockchip/mpp_buffer.h"
+#include "rockchip/mpp_frame.h"
+#include "rockchip/mpp_packet.h"
+
+#include "h264_sps.h"
+#include "mpp_rec.h"
+
+#define NULL_ALIGNMENT          64
+#define NULL_EXTRA_SIZE         256
+#define NULL_SPS_SIZE           256
+/* Pictures decoder accepts before returning MPP_ERR_BUFFER_FULL */
+#define NULL_DEC_QUEUE          8
+#define NULL_DEC_CHANGES        16
+/* Shorter waits are spun, nanosleep(2) is not that precise */
+#define NULL_SPIN_NS            (100*1000)
+/* Decoded frame strides alignment */
+#define NULL_DEC_ALIGN(x)       (((x) + 15) & ~15)
+
+struct null_buffer;
+
+struct null_group {
+    pthread_mutex_t     lock;
+    MppBufferType       type;
+    MppBufferMode       mode;
+    size_t              limit_size;
+    int                 limit_count;
+    /* Buffers allocated from the group and not freed yet */
+    int                 count;
+    /* Released buffers, reused by the next allocation */
+    struct null_buffer  *free_list;
+    /* Owner called mpp_buffer_group_put */
+    int                 released;
+};
+
+struct null_buffer {
+    int                 refs;
+    size_t              size;
+    void                *ptr;
+    int                 fd;
+    /* Imported memory is not ours to free */
+    int                 external;
+    struct null_group   *group;
+    struct null_buffer  *next;
+};
+
+struct null_frame {
+    RK_U32              width;
+    RK_U32              height;
+    RK_U32              hor_stride;
+    RK_U32              ver_stride;
+    RK_U32              info_change;
+    RK_U32              eos;
+    RK_U32              errinfo;
+    RK_U32              discard;
+    RK_S64              pts;
+    MppFrameFormat      fmt;
+    MppBuffer           buffer;
+};
+
+struct null_packet {
+    void                *data;
+    size_t              size;
+    void                *pos;
+    size_t              length;
+    RK_S64              pts;
+    RK_U32              eos;
+    MppBuffer           buffer;
+};
+
+struct null_task {
+    MppFrame            frame;
+    MppPacket           packet;
+    RK_S32              intra;
+};
+
+enum null_task_state {
+    NULL_TASK_IDLE,
+    NULL_TASK_INPUT,
+    NULL_TASK_DONE,
+    NULL_TASK_OUTPUT,
+};
+
+enum null_info_state {
+    NULL_INFO_NONE,
+    NULL_INFO_REPORT,
+    NULL_INFO_WAIT,
+    NULL_INFO_READY,
+};
+
+struct null_ctx {
+    MppCtxType          type;
+    MppCodingType       coding;
+    int                 hw_delay_us;
+
+    /* Replay: context number and position of each call in the log */
+    int                 id;
+    size_t              cursor[MPP_REC_CALLS];
+
+    /* Encoder */
+    MppEncPrepCfg       prep;
+    MppEncRcCfg         rc;
+    MppEncCodecCfg      codec;
+    struct null_task    task;
+    enum null_task_state task_state;
+    MppPacket           extra;
+    uint8_t             extra_data[NULL_EXTRA_SIZE];
+    int                 frame_num;
+    int                 force_idr;
+    uint32_t            seed;
+
+    /* Decoder */
+    struct null_group   *ext_group;
+    enum null_info_state info_state;
+    int                 width;
+    int                 height;
+    int                 pending;
+    /*
+     * Resolution changes: pictures still of the old size are output
+     * before the change is reported. One packet may carry several
+     */
+    struct {
+        int             width;
+        int             height;
+        int             at;
+    }                   changes[NULL_DEC_CHANGES];
+    int                 nchanges;
+    int                 pictures;
+    int                 output;
+    int                 eos;
+    RK_S64              pts;
+    /* Start code scanner state, persists between packets */
+    int                 zeros;
+    int                 in_header;
+    int                 nal_type;
+    int                 nal_pos;
+    uint8_t             sps[NULL_SPS_SIZE];
+    size_t              sps_len;
+};
+
+static pthread_once_t replay_once = PTHREAD_ONCE_INIT;
+static struct mpp_rec_event *replay_events;
+static size_t replay_count;
+static int null_contexts;
+
+/*
+ * Buffers
+ */
+
+static void
+null_buffer_free(struct null_buffer *buf)
+{
+    if (!buf->external)
+        free(buf->ptr);
+    free(buf);
+}
+
+static void
+null_group_unref(struct null_group *group)
+{
+    /* Called with group lock held, drops it */
+    if (group->released && (group->count == 0)) {
+        pthread_mutex_unlock(&group->lock);
+        pthread_mutex_destroy(&group->lock);
+        free(group);
+        return;
+    }
+    pthread_mutex_unlock(&group->lock);
+}
+
+MPP_RET
+mpp_buffer_group_get(MppBufferGroup *group, MppBufferType type, MppBufferMode mode,
+    const char *tag, const char *caller)
+{
+    struct null_group *g;
+
+    g = calloc(1, sizeof(*g));
+    if (g == NULL)
+        return (MPP_ERR_MALLOC);
+
+    pthread_mutex_init(&g->lock, NULL);
+    g->type = type;
+    g->mode = mode;
+    *group = g;
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_buffer_group_clear(MppBufferGroup group)
+{
+    struct null_group *g = group;
+    struct null_buffer *buf;
+
+    pthread_mutex_lock(&g->lock);
+    while ((buf = g->free_list) != NULL) {
+        g->free_list = buf->next;
+        g->count--;
+        null_buffer_free(buf);
+    }
+    pthread_mutex_unlock(&g->lock);
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_buffer_group_put(MppBufferGroup group)
+{
+    struct null_group *g = group;
+
+    if (g == NULL)
+        return (MPP_ERR_NULL_PTR);
+
+    mpp_buffer_group_clear(g);
+    pthread_mutex_lock(&g->lock);
+    g->released = 1;
+    /* Buffers still in use free the group when the last one is released */
+    null_group_unref(g);
+
+    return (MPP_OK);
+}
+
+RK_S32
+mpp_buffer_group_unused(MppBufferGroup group)
+{
+    struct null_group *g = group;
+    int unused;
+
+    pthread_mutex_lock(&g->lock);
+    unused = (g->limit_count > 0) ? g->limit_count - g->count : 1;
+    for (struct null_buffer *buf = g->free_list; buf; buf = buf->next)
+        unused++;
+    pthread_mutex_unlock(&g->lock);
+
+    return (unused);
+}
+
+MPP_RET
+mpp_buffer_group_limit_config(MppBufferGroup group, size_t size, RK_S32 count)
+{
+    struct null_group *g = group;
+
+    pthread_mutex_lock(&g->lock);
+    g->limit_size = size;
+    g->limit_count = count;
+    pthread_mutex_unlock(&g->lock);
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_buffer_get_with_tag(MppBufferGroup group, MppBuffer *buffer, size_t size,
+    const char *tag, const char *caller)
+{
+    struct null_group *g = group;
+    struct null_buffer *buf = NULL;
+
+    *buffer = NULL;
+
+    if (g) {
+        pthread_mutex_lock(&g->lock);
+        if (g->free_list && (g->free_list->size >= size)) {
+            buf = g->free_list;
+            g->free_list = buf->next;
+        }
+        else if ((g->limit_count > 0) && (g->count >= g->limit_count)) {
+            pthread_mutex_unlock(&g->lock);
+            return (MPP_NOK);
+        }
+        else
+            g->count++;
+        pthread_mutex_unlock(&g->lock);
+    }
+
+    if (buf == NULL) {
+        buf = calloc(1, sizeof(*buf));
+        if (buf && posix_memalign(&buf->ptr, NULL_ALIGNMENT, size)) {
+            free(buf);
+            buf = NULL;
+        }
+        if (buf == NULL) {
+            if (g) {
+                pthread_mutex_lock(&g->lock);
+                g->count--;
+                null_group_unref(g);
+            }
+            return (MPP_ERR_MALLOC);
+        }
+        buf->size = size;
+        buf->fd = -1;
+        buf->group = g;
+    }
+
+    buf->refs = 1;
+    buf->next = NULL;
+    *buffer = buf;
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_buffer_import_with_tag(MppBufferGroup group, MppBuffer *buffer, MppBufferInfo *info,
+    const char *tag, const char *caller)
+{
+    struct null_buffer *buf;
+
+    if (info->ptr == NULL)
+        return (MPP_ERR_NULL_PTR);
+
+    buf = calloc(1, sizeof(*buf));
+    if (buf == NULL)
+        return (MPP_ERR_MALLOC);
+
+    buf->refs = 1;
+    buf->size = info->size;
+    buf->ptr = info->ptr;
+    buf->fd = info->fd;
+    buf->external = 1;
+    *buffer = buf;
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_buffer_inc_ref_with_caller(MppBuffer buffer, const char *caller)
+{
+    struct null_buffer *buf = buffer;
+
+    if (buf == NULL)
+        return (MPP_ERR_NULL_PTR);
+    __atomic_add_fetch(&buf->refs, 1, __ATOMIC_RELAXED);
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_buffer_put_with_caller(MppBuffer buffer, const char *caller)
+{
+    struct null_buffer *buf = buffer;
+    struct null_group *g;
+
+    if (buf == NULL)
+        return (MPP_ERR_NULL_PTR);
+    if (__atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return (MPP_OK);
+
+    g = buf->group;
+    if (g == NULL) {
+        null_buffer_free(buf);
+        return (MPP_OK);
+    }
+
+    pthread_mutex_lock(&g->lock);
+    if (g->released) {
+        g->count--;
+        null_buffer_free(buf);
+    }
+    else {
+        buf->next = g->free_list;
+        g->free_list = buf;
+    }
+    null_group_unref(g);
+
+    return (MPP_OK);
+}
+
+void *
+mpp_buffer_get_ptr_with_caller(MppBuffer buffer, const char *caller)
+{
+    return (buffer ? ((struct null_buffer *)buffer)->ptr : NULL);
+}
+
+int
+mpp_buffer_get_fd_with_caller(MppBuffer buffer, const char *caller)
+{
+    return (buffer ? ((struct null_buffer *)buffer)->fd : -1);
+}
+
+size_t
+mpp_buffer_get_size_with_caller(MppBuffer buffer, const char *caller)
+{
+    return (buffer ? ((struct null_buffer *)buffer)->size : 0);
+}
+
+/*
+ * Frames
+ */
+
+MPP_RET
+mpp_frame_init(MppFrame *frame)
+{
+    struct null_frame *f;
+
+    f = calloc(1, sizeof(*f));
+    if (f == NULL)
+        return (MPP_ERR_MALLOC);
+    *frame = f;
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_frame_deinit(MppFrame *frame)
+{
+    struct null_frame *f;
+
+    if ((frame == NULL) || (*frame == NULL))
+        return (MPP_ERR_NULL_PTR);
+
+    f = *frame;
+    if (f->buffer)
+        mpp_buffer_put(f->buffer);
+    free(f);
+    *frame = NULL;
+
+    return (MPP_OK);
+}
+
+#define NULL_FRAME_ACCESSORS(type, field)                               \
+type mpp_frame_get_##field(const MppFrame frame)                        \
+{                                                                       \
+    return (((struct null_frame *)frame)->field);                       \
+}                                                                       \
+void mpp_frame_set_##field(MppFrame frame, type v)                      \
+{                                                                       \
+    ((struct null_frame *)frame)->field = v;                            \
+}
+
+NULL_FRAME_ACCESSORS(RK_U32, width)
+NULL_FRAME_ACCESSORS(RK_U32, height)
+NULL_FRAME_ACCESSORS(RK_U32, hor_stride)
+NULL_FRAME_ACCESSORS(RK_U32, ver_stride)
+NULL_FRAME_ACCESSORS(RK_U32, info_change)
+NULL_FRAME_ACCESSORS(RK_U32, eos)
+NULL_FRAME_ACCESSORS(RK_U32, errinfo)
+NULL_FRAME_ACCESSORS(RK_U32, discard)
+NULL_FRAME_ACCESSORS(RK_S64, pts)
+
+MppFrameFormat
+mpp_frame_get_fmt(MppFrame frame)
+{
+    return (((struct null_frame *)frame)->fmt);
+}
+
+void
+mpp_frame_set_fmt(MppFrame frame, MppFrameFormat fmt)
+{
+    ((struct null_frame *)frame)->fmt = fmt;
+}
+
+MppBuffer
+mpp_frame_get_buffer(const MppFrame frame)
+{
+    return (((struct null_frame *)frame)->buffer);
+}
+
+/* Frame holds its own reference to the buffer, same as MPP does */
+void
+mpp_frame_set_buffer(MppFrame frame, MppBuffer buffer)
+{
+    struct null_frame *f = frame;
+
+    if (f->buffer == buffer)
+        return;
+    if (buffer)
+        mpp_buffer_inc_ref(buffer);
+    if (f->buffer)
+        mpp_buffer_put(f->buffer);
+    f->buffer = buffer;
+}
+
+size_t
+mpp_frame_get_buf_size(const MppFrame frame)
+{
+    struct null_frame *f = frame;
+
+    return (f->hor_stride * f->ver_stride * 3 / 2);
+}
+
+/*
+ * Packets
+ */
+
+MPP_RET
+mpp_packet_new(MppPacket *packet)
+{
+    struct null_packet *p;
+
+    p = calloc(1, sizeof(*p));
+    if (p == NULL)
+        return (MPP_ERR_MALLOC);
+    *packet = p;
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_packet_init(MppPacket *packet, void *data, size_t size)
+{
+    struct null_packet *p;
+
+    if (mpp_packet_new(packet))
+        return (MPP_ERR_MALLOC);
+
+    p = *packet;
+    p->data = p->pos = data;
+    p->size = p->length = size;
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_packet_init_with_buffer(MppPacket *packet, MppBuffer buffer)
+{
+    struct null_packet *p;
+
+    if (mpp_packet_new(packet))
+        return (MPP_ERR_MALLOC);
+
+    p = *packet;
+    p->data = p->pos = mpp_buffer_get_ptr(buffer);
+    p->size = mpp_buffer_get_size(buffer);
+    p->buffer = buffer;
+    mpp_buffer_inc_ref(buffer);
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_packet_deinit(MppPacket *packet)
+{
+    struct null_packet *p;
+
+    if ((packet == NULL) || (*packet == NULL))
+        return (MPP_ERR_NULL_PTR);
+
+    p = *packet;
+    if (p->buffer)
+        mpp_buffer_put(p->buffer);
+    free(p);
+    *packet = NULL;
+
+    return (MPP_OK);
+}
+
+#define NULL_PACKET_ACCESSORS(type, field)                              \
+type mpp_packet_get_##field(const MppPacket packet)                     \
+{                                                                       \
+    return (((struct null_packet *)packet)->field);                     \
+}                                                                       \
+void mpp_packet_set_##field(MppPacket packet, type v)                   \
+{                                                                       \
+    ((struct null_packet *)packet)->field = v;                          \
+}
+
+NULL_PACKET_ACCESSORS(void *, data)
+NULL_PACKET_ACCESSORS(size_t, size)
+NULL_PACKET_ACCESSORS(void *, pos)
+NULL_PACKET_ACCESSORS(size_t, length)
+NULL_PACKET_ACCESSORS(RK_S64, pts)
+
+void
+mpp_packet_set_eos(MppPacket packet)
+{
+    ((struct null_packet *)packet)->eos = 1;
+}
+
+void
+mpp_packet_clr_eos(MppPacket packet)
+{
+    ((struct null_packet *)packet)->eos = 0;
+}
+
+RK_U32
+mpp_packet_get_eos(MppPacket packet)
+{
+    return (((struct null_packet *)packet)->eos);
+}
+
+MPP_RET
+mpp_packet_write(MppPacket packet, size_t offset, void *data, size_t size)
+{
+    struct null_packet *p = packet;
+
+    if (offset + size > p->size)
+        return (MPP_ERR_VALUE);
+    memcpy((uint8_t *)p->data + offset, data, size);
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_packet_read(MppPacket packet, size_t offset, void *data, size_t size)
+{
+    struct null_packet *p = packet;
+
+    if (offset + size > p->size)
+        return (MPP_ERR_VALUE);
+    memcpy(data, (uint8_t *)p->data + offset, size);
+
+    return (MPP_OK);
+}
+
+/*
+ * Task meta data
+ */
+
+MPP_RET
+mpp_task_meta_set_s32(MppTask task, MppMetaKey key, RK_S32 val)
+{
+    if (key != KEY_OUTPUT_INTRA)
+        return (MPP_NOK);
+    ((struct null_task *)task)->intra = val;
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_task_meta_get_s32(MppTask task, MppMetaKey key, RK_S32 *val, RK_S32 default_val)
+{
+    *val = (key == KEY_OUTPUT_INTRA) ? ((struct null_task *)task)->intra : default_val;
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_task_meta_set_frame(MppTask task, MppMetaKey key, MppFrame frame)
+{
+    ((struct null_task *)task)->frame = frame;
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_task_meta_get_frame(MppTask task, MppMetaKey key, MppFrame *frame)
+{
+    *frame = ((struct null_task *)task)->frame;
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_task_meta_set_packet(MppTask task, MppMetaKey key, MppPacket packet)
+{
+    ((struct null_task *)task)->packet = packet;
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_task_meta_get_packet(MppTask task, MppMetaKey key, MppPacket *packet)
+{
+    *packet = ((struct null_task *)task)->packet;
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_task_meta_set_buffer(MppTask task, MppMetaKey key, MppBuffer buffer)
+{
+    return (MPP_NOK);
+}
+
+MPP_RET
+mpp_task_meta_get_buffer(MppTask task, MppMetaKey key, MppBuffer *buffer)
+{
+    *buffer = NULL;
+
+    return (MPP_NOK);
+}
+
+/*
+ * Bitstream writer for parameter sets
+ */
+
+struct bit_writer {
+    uint8_t             buf[NULL_EXTRA_SIZE];
+    size_t              bits;
+};
+
+static void
+put_bits(struct bit_writer *bw, uint32_t value, int n)
+{
+    for (int i = n - 1; i >= 0; i--) {
+        size_t byte = bw->bits / 8;
+
+        if (byte >= sizeof(bw->buf))
+            return;
+        if (bw->bits % 8 == 0)
+            bw->buf[byte] = 0;
+        if ((value >> i) & 1)
+            bw->buf[byte] |= 0x80 >> (bw->bits % 8);
+        bw->bits++;
+    }
+}
+
+static void
+put_ue(struct bit_writer *bw, uint32_t value)
+{
+    int len = 0;
+
+    while ((value + 1) >> (len + 1))
+        len++;
+    put_bits(bw, 0, len);
+    put_bits(bw, value + 1, len + 1);
+}
+
+static void
+put_se(struct bit_writer *bw, int32_t value)
+{
+    put_ue(bw, (value > 0) ? 2 * value - 1 : -2 * value);
+}
+
+/*
+ * Terminate RBSP and append it as NAL unit with start code to @out,
+ * inserting emulation prevention bytes
+ */
+static size_t
+put_nal(uint8_t *out, size_t size, struct bit_writer *bw)
+{
+    size_t len = 0;
+    int zeros = 0;
+
+    put_bits(bw, 1, 1);
+    while (bw->bits % 8)
+        put_bits(bw, 0, 1);
+
+    if (size < 4)
+        return (0);
+    out[len++] = 0;
+    out[len++] = 0;
+    out[len++] = 0;
+    out[len++] = 1;
+
+    for (size_t i = 0; i < bw->bits / 8; i++) {
+        /* Header byte is never escaped */
+        if ((i > 0) && (zeros >= 2) && (bw->buf[i] <= 3)) {
+            if (len == size)
+                return (0);
+            out[len++] = 3;
+            zeros = 0;
+        }
+        if (len == size)
+            return (0);
+        out[len++] = bw->buf[i];
+        zeros = (bw->buf[i] == 0) ? zeros + 1 : 0;
+    }
+
+    return (len);
+}
+
+static size_t
+null_enc_parameter_sets(struct null_ctx *ctx, uint8_t *out, size_t size)
+{
+    struct bit_writer bw;
+    int profile = ctx->codec.h264.profile ? ctx->codec.h264.profile : 100;
+    int level = ctx->codec.h264.level ? ctx->codec.h264.level : 40;
+    int mb_width = (ctx->prep.width + 15) / 16;
+    int mb_height = (ctx->prep.height + 15) / 16;
+    int crop_right = (mb_width * 16 - ctx->prep.width) / 2;
+    int crop_bottom = (mb_height * 16 - ctx->prep.height) / 2;
+    int fps = ctx->rc.fps_out_num ? ctx->rc.fps_out_num : 30;
+    int fps_denom = ctx->rc.fps_out_denorm ? ctx->rc.fps_out_denorm : 1;
+    size_t len;
+
+    /* SPS */
+    memset(&bw, 0, sizeof(bw));
+    put_bits(&bw, 0x67, 8);
+    put_bits(&bw, profile, 8);
+    put_bits(&bw, 0, 8);
+    put_bits(&bw, level, 8);
+    put_ue(&bw, 0);
+    if (profile >= 100) {
+        put_ue(&bw, 1);         /* chroma_format_idc */
+        put_ue(&bw, 0);         /* bit_depth_luma_minus8 */
+        put_ue(&bw, 0);         /* bit_depth_chroma_minus8 */
+        put_bits(&bw, 0, 1);    /* qpprime_y_zero_transform_bypass_flag */
+        put_bits(&bw, 0, 1);    /* seq_scaling_matrix_present_flag */
+    }
+    put_ue(&bw, 0);             /* log2_max_frame_num_minus4 */
+    put_ue(&bw, 2);             /* pic_order_cnt_type */
+    put_ue(&bw, 1);             /* max_num_ref_frames */
+    put_bits(&bw, 0, 1);        /* gaps_in_frame_num_value_allowed_flag */
+    put_ue(&bw, mb_width - 1);
+    put_ue(&bw, mb_height - 1);
+    put_bits(&bw, 1, 1);        /* frame_mbs_only_flag */
+    put_bits(&bw, 1, 1);        /* direct_8x8_inference_flag */
+    if (crop_right || crop_bottom) {
+        put_bits(&bw, 1, 1);
+        put_ue(&bw, 0);
+        put_ue(&bw, crop_right);
+        put_ue(&bw, 0);
+        put_ue(&bw, crop_bottom);
+    }
+    else
+        put_bits(&bw, 0, 1);
+    put_bits(&bw, 1, 1);        /* vui_parameters_present_flag */
+    put_bits(&bw, 0, 4);        /* aspect ratio, overscan, video signal, chroma loc */
+    put_bits(&bw, 1, 1);        /* timing_info_present_flag */
+    put_bits(&bw, fps_denom, 32);
+    put_bits(&bw, fps * 2, 32);
+    put_bits(&bw, 1, 1);        /* fixed_frame_rate_flag */
+    put_bits(&bw, 0, 5);        /* HRD, pic_struct, bitstream_restriction */
+    len = put_nal(out, size, &bw);
+
+    /* PPS */
+    memset(&bw, 0, sizeof(bw));
+    put_bits(&bw, 0x68, 8);
+    put_ue(&bw, 0);             /* pic_parameter_set_id */
+    put_ue(&bw, 0);             /* seq_parameter_set_id */
+    put_bits(&bw, ctx->codec.h264.entropy_coding_mode ? 1 : 0, 1);
+    put_bits(&bw, 0, 1);        /* bottom_field_pic_order_in_frame_present_flag */
+    put_ue(&bw, 0);             /* num_slice_groups_minus1 */
+    put_ue(&bw, 0);             /* num_ref_idx_l0_default_active_minus1 */
+    put_ue(&bw, 0);             /* num_ref_idx_l1_default_active_minus1 */
+    put_bits(&bw, 0, 3);        /* weighted_pred_flag, weighted_bipred_idc */
+    put_se(&bw, ctx->codec.h264.qp_init ? ctx->codec.h264.qp_init - 26 : 0);
+    put_se(&bw, 0);             /* pic_init_qs_minus26 */
+    put_se(&bw, 0);             /* chroma_qp_index_offset */
+    put_bits(&bw, 1, 1);        /* deblocking_filter_control_present_flag */
+    put_bits(&bw, 0, 2);        /* constrained_intra_pred, redundant_pic_cnt */
+    if (profile >= 100) {
+        put_bits(&bw, ctx->codec.h264.transform8x8_mode ? 1 : 0, 1);
+        put_bits(&bw, 0, 1);    /* pic_scaling_matrix_present_flag */
+        put_se(&bw, 0);         /* second_chroma_qp_index_offset */
+    }
+    len += put_nal(out + len, size - len, &bw);
+
+    return (len);
+}
+
+/* profile_tier_level() of H.265 VPS and SPS, no sub-layers */
+static void
+put_profile_tier_level(struct bit_writer *bw, int profile, int tier, int level)
+{
+    put_bits(bw, 0, 2);         /* general_profile_space */
+    put_bits(bw, tier, 1);
+    put_bits(bw, profile, 5);
+    /* general_profile_compatibility_flag[]: Main is compatible with Main 10 */
+    put_bits(bw, (profile == 1) ? 0x60000000 : (0x80000000u >> profile), 32);
+    put_bits(bw, 1, 1);         /* general_progressive_source_flag */
+    put_bits(bw, 0, 2);         /* interlaced, non-packed constraint */
+    put_bits(bw, 1, 1);         /* general_frame_only_constraint_flag */
+    put_bits(bw, 0, 32);        /* 43 reserved bits and general_inbld_flag */
+    put_bits(bw, 0, 12);
+    put_bits(bw, level, 8);
+}
+
+/*
+ * H.265 VPS, SPS and PPS: 64x64 CTB, one reference frame, POC
+ * lsb of 8 bits. Frame size is rounded up to 8 (minimal coding block)
+ * and cropped back with conformance window
+ */
+static size_t
+null_enc_parameter_sets_hevc(struct null_ctx *ctx, uint8_t *out, size_t size)
+{
+    struct bit_writer bw;
+    int profile = ctx->codec.h265.profile ? ctx->codec.h265.profile : 1;
+    int level = ctx->codec.h265.level ? ctx->codec.h265.level : 120;
+    int tier = ctx->codec.h265.tier;
+    int width = (ctx->prep.width + 7) & ~7;
+    int height = (ctx->prep.height + 7) & ~7;
+    int crop_right = (width - ctx->prep.width) / 2;
+    int crop_bottom = (height - ctx->prep.height) / 2;
+    int fps = ctx->rc.fps_out_num ? ctx->rc.fps_out_num : 30;
+    int fps_denom = ctx->rc.fps_out_denorm ? ctx->rc.fps_out_denorm : 1;
+    size_t len;
+
+    /* VPS */
+    memset(&bw, 0, sizeof(bw));
+    put_bits(&bw, 0x4001, 16);
+    put_bits(&bw, 0, 4);        /* vps_video_parameter_set_id */
+    put_bits(&bw, 3, 2);        /* base layer internal and available */
+    put_bits(&bw, 0, 6);        /* vps_max_layers_minus1 */
+    put_bits(&bw, 0, 3);        /* vps_max_sub_layers_minus1 */
+    put_bits(&bw, 1, 1);        /* vps_temporal_id_nesting_flag */
+    put_bits(&bw, 0xffff, 16);
+    put_profile_tier_level(&bw, profile, tier, level);
+    put_bits(&bw, 1, 1);        /* vps_sub_layer_ordering_info_present_flag */
+    put_ue(&bw, 1);             /* vps_max_dec_pic_buffering_minus1 */
+    put_ue(&bw, 0);             /* vps_max_num_reorder_pics */
+    put_ue(&bw, 0);             /* vps_max_latency_increase_plus1 */
+    put_bits(&bw, 0, 6);        /* vps_max_layer_id */
+    put_ue(&bw, 0);             /* vps_num_layer_sets_minus1 */
+    put_bits(&bw, 1, 1);        /* vps_timing_info_present_flag */
+    put_bits(&bw, fps_denom, 32);
+    put_bits(&bw, fps, 32);
+    put_bits(&bw, 0, 1);        /* vps_poc_proportional_to_timing_flag */
+    put_ue(&bw, 0);             /* vps_num_hrd_parameters */
+    put_bits(&bw, 0, 1);        /* vps_extension_flag */
+    len = put_nal(out, size, &bw);
+
+    /* SPS */
+    memset(&bw, 0, sizeof(bw));
+    put_bits(&bw, 0x4201, 16);
+    put_bits(&bw, 0, 4);        /* sps_video_parameter_set_id */
+    put_bits(&bw, 0, 3);        /* sps_max_sub_layers_minus1 */
+    put_bits(&bw, 1, 1);        /* sps_temporal_id_nesting_flag */
+    put_profile_tier_level(&bw, profile, tier, level);
+    put_ue(&bw, 0);             /* sps_seq_parameter_set_id */
+    put_ue(&bw, 1);             /* chroma_format_idc */
+    put_ue(&bw, width);
+    put_ue(&bw, height);
+    if (crop_right || crop_bottom) {
+        put_bits(&bw, 1, 1);
+        put_ue(&bw, 0);
+        put_ue(&bw, crop_right);
+        put_ue(&bw, 0);
+        put_ue(&bw, crop_bottom);
+    }
+    else
+        put_bits(&bw, 0, 1);
+    put_ue(&bw, 0);             /* bit_depth_luma_minus8 */
+    put_ue(&bw, 0);             /* bit_depth_chroma_minus8 */
+    put_ue(&bw, 4);             /* log2_max_pic_order_cnt_lsb_minus4 */
+    put_bits(&bw, 1, 1);        /* sps_sub_layer_ordering_info_present_flag */
+    put_ue(&bw, 1);             /* sps_max_dec_pic_buffering_minus1 */
+    put_ue(&bw, 0);             /* sps_max_num_reorder_pics */
+    put_ue(&bw, 0);             /* sps_max_latency_increase_plus1 */
+    put_ue(&bw, 0);             /* log2_min_luma_coding_block_size_minus3 */
+    put_ue(&bw, 3);             /* log2_diff_max_min_luma_coding_block_size */
+    put_ue(&bw, 0);             /* log2_min_luma_transform_block_size_minus2 */
+    put_ue(&bw, 3);             /* log2_diff_max_min_luma_transform_block_size */
+    put_ue(&bw, 1);             /* max_transform_hierarchy_depth_inter */
+    put_ue(&bw, 1);             /* max_transform_hierarchy_depth_intra */
+    put_bits(&bw, 0, 2);        /* scaling_list_enabled_flag, amp_enabled_flag */
+    put_bits(&bw, 1, 1);        /* sample_adaptive_offset_enabled_flag */
+    put_bits(&bw, 0, 1);        /* pcm_enabled_flag */
+    put_ue(&bw, 0);             /* num_short_term_ref_pic_sets */
+    put_bits(&bw, 0, 1);        /* long_term_ref_pics_present_flag */
+    put_bits(&bw, 1, 1);        /* sps_temporal_mvp_enabled_flag */
+    put_bits(&bw, 1, 1);        /* strong_intra_smoothing_enabled_flag */
+    put_bits(&bw, 1, 1);        /* vui_parameters_present_flag */
+    put_bits(&bw, 0, 8);        /* aspect ratio ... default display window */
+    put_bits(&bw, 1, 1);        /* vui_timing_info_present_flag */
+    put_bits(&bw, fps_denom, 32);
+    put_bits(&bw, fps, 32);
+    put_bits(&bw, 0, 2);        /* POC proportional to timing, HRD */
+    put_bits(&bw, 0, 1);        /* bitstream_restriction_flag */
+    put_bits(&bw, 0, 1);        /* sps_extension_present_flag */
+    len += put_nal(out + len, size - len, &bw);
+
+    /* PPS */
+    memset(&bw, 0, sizeof(bw));
+    put_bits(&bw, 0x4401, 16);
+    put_ue(&bw, 0);             /* pps_pic_parameter_set_id */
+    put_ue(&bw, 0);             /* pps_seq_parameter_set_id */
+    put_bits(&bw, 0, 7);        /* dependent slices, output flag, extra bits, sign hiding */
+    put_bits(&bw, 0, 1);        /* cabac_init_present_flag */
+    put_ue(&bw, 0);             /* num_ref_idx_l0_default_active_minus1 */
+    put_ue(&bw, 0);             /* num_ref_idx_l1_default_active_minus1 */
+    put_se(&bw, ctx->codec.h265.qp_init ? ctx->codec.h265.qp_init - 26 : 0);
+    put_bits(&bw, 0, 2);        /* constrained_intra_pred, transform_skip */
+    put_bits(&bw, 1, 1);        /* cu_qp_delta_enabled_flag */
+    put_ue(&bw, 0);             /* diff_cu_qp_delta_depth */
+    put_se(&bw, 0);             /* pps_cb_qp_offset */
+    put_se(&bw, 0);             /* pps_cr_qp_offset */
+    put_bits(&bw, 0, 9);        /* chroma offsets ... scaling list, lists modification */
+    put_ue(&bw, 0);             /* log2_parallel_merge_level_minus2 */
+    put_bits(&bw, 0, 2);        /* slice header extension, pps extension */
+    len += put_nal(out + len, size - len, &bw);
+
+    return (len);
+}
+
+/*
+ * Replay
+ */
+
+static void
+null_replay_load(void)
+{
+    const char *path = getenv("MPP_NULL_REPLAY");
+
+    if ((path == NULL) || (*path == 0))
+        return;
+
+    replay_events = mpp_rec_load(path, &replay_count);
+    if (replay_events == NULL)
+        fprintf(stderr, "failed to load MPP record log %s\n", path);
+}
+
+static void
+null_wait_ns(uint64_t ns)
+{
+    struct timespec now, deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (deadline.tv_nsec + ns) / 1000000000;
+    deadline.tv_nsec = (deadline.tv_nsec + ns) % 1000000000;
+
+    if (ns > NULL_SPIN_NS) {
+        struct timespec sleep = {
+            .tv_sec = (ns - NULL_SPIN_NS) / 1000000000,
+            .tv_nsec = (ns - NULL_SPIN_NS) % 1000000000,
+        };
+        nanosleep(&sleep, NULL);
+    }
+
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec < deadline.tv_sec) ||
+             ((now.tv_sec == deadline.tv_sec) && (now.tv_nsec < deadline.tv_nsec)));
+}
+
+/*
+ * Next recorded @call of the context, after waiting as long as it took
+ * on the device. NULL if not replaying or the log has no more such calls
+ */
+static const struct mpp_rec_event *
+null_replay_next(struct null_ctx *ctx, int call)
+{
+    size_t i;
+
+    if (replay_events == NULL)
+        return (NULL);
+
+    for (i = ctx->cursor[call]; i < replay_count; i++) {
+        if ((replay_events[i].ctx == ctx->id) && (replay_events[i].call == call))
+            break;
+    }
+
+    if (i == replay_count) {
+        ctx->cursor[call] = replay_count;
+        return (NULL);
+    }
+
+    ctx->cursor[call] = i + 1;
+    null_wait_ns(replay_events[i].duration);
+
+    return (&replay_events[i]);
+}
+
+/*
+ * Encoder
+ */
+
+static void
+null_hw_delay(struct null_ctx *ctx)
+{
+    if (ctx->hw_delay_us > 0)
+        usleep(ctx->hw_delay_us);
+}
+
+/* Random non-zero bytes, so no start code emulation is possible */
+static void
+null_enc_payload(struct null_ctx *ctx, uint8_t *out, size_t from, size_t to)
+{
+    for (size_t i = from; i < to; i++) {
+        ctx->seed = ctx->seed * 1103515245 + 12345;
+        out[i] = 1 + (ctx->seed >> 16) % 255;
+    }
+}
+
+/* Produce slice of the size rate control would give the frame */
+static void
+null_enc_frame(struct null_ctx *ctx)
+{
+    struct null_task *task = &ctx->task;
+    struct null_frame *frame = task->frame;
+    struct null_packet *packet = task->packet;
+    uint8_t *out;
+    int fps = ctx->rc.fps_out_num ? ctx->rc.fps_out_num : 30;
+    /* As in MPP gop 0 means only the first frame is IDR */
+    int gop = ctx->rc.gop;
+    size_t bytes = ctx->rc.bps_target / 8 / fps;
+    int idr;
+
+    packet->pos = packet->data;
+    packet->length = 0;
+    packet->eos = frame ? frame->eos : 1;
+    task->intra = 0;
+
+    if (packet->eos)
+        return;
+
+    idr = ctx->force_idr || ((gop > 0) ? (ctx->frame_num % gop == 0) : (ctx->frame_num == 0));
+    if (idr) {
+        bytes *= 4;
+        ctx->force_idr = 0;
+    }
+    if (bytes < 8)
+        bytes = 8;
+    if (bytes > packet->size)
+        bytes = packet->size;
+
+    out = packet->data;
+    out[0] = 0;
+    out[1] = 0;
+    out[2] = 0;
+    out[3] = 1;
+    if (ctx->coding == MPP_VIDEO_CodingHEVC) {
+        /* IDR_W_RADL or TRAIL_R, first_slice_segment_in_pic_flag = 1 */
+        out[4] = idr ? 0x26 : 0x02;
+        out[5] = 0x01;
+        out[6] = 0x80 | (ctx->frame_num & 0x7f);
+        null_enc_payload(ctx, out, 7, bytes);
+    }
+    else {
+        out[4] = idr ? 0x65 : 0x41;
+        /* first_mb_in_slice = 0, the rest is random non-zero bytes */
+        out[5] = 0x80 | (ctx->frame_num & 0x7f);
+        null_enc_payload(ctx, out, 6, bytes);
+    }
+
+    packet->length = bytes;
+    packet->pts = frame->pts;
+    task->intra = idr;
+    ctx->frame_num++;
+
+    null_hw_delay(ctx);
+}
+
+/*
+ * Decoder
+ */
+
+static void
+null_dec_apply_change(struct null_ctx *ctx)
+{
+    if ((ctx->nchanges == 0) || (ctx->changes[0].at > ctx->output))
+        return;
+
+    ctx->width = ctx->changes[0].width;
+    ctx->height = ctx->changes[0].height;
+    ctx->info_state = NULL_INFO_REPORT;
+    ctx->nchanges--;
+    memmove(&ctx->changes[0], &ctx->changes[1], ctx->nchanges * sizeof(ctx->changes[0]));
+}
+
+/* NAL unit being scanned is SPS */
+static int
+null_dec_in_sps(struct null_ctx *ctx)
+{
+    return (ctx->nal_type == ((ctx->coding == MPP_VIDEO_CodingHEVC) ? 33 : 7));
+}
+
+static void
+null_dec_sps_done(struct null_ctx *ctx)
+{
+    struct h264_sps sps;
+    int width, height, ret;
+
+    /* Drop zero bytes of the next start code */
+    while ((ctx->sps_len > 0) && (ctx->sps[ctx->sps_len - 1] == 0))
+        ctx->sps_len--;
+
+    if (ctx->coding == MPP_VIDEO_CodingHEVC)
+        ret = h265_parse_sps(ctx->sps, ctx->sps_len, &sps);
+    else
+        ret = h264_parse_sps(ctx->sps, ctx->sps_len, &sps);
+    if (ret)
+        return;
+
+    width = ctx->nchanges ? ctx->changes[ctx->nchanges - 1].width : ctx->width;
+    height = ctx->nchanges ? ctx->changes[ctx->nchanges - 1].height : ctx->height;
+    if (((sps.width == width) && (sps.height == height)) ||
+        (ctx->nchanges == NULL_DEC_CHANGES))
+        return;
+
+    ctx->changes[ctx->nchanges].width = sps.width;
+    ctx->changes[ctx->nchanges].height = sps.height;
+    ctx->changes[ctx->nchanges].at = ctx->pictures;
+    ctx->nchanges++;
+    null_dec_apply_change(ctx);
+}
+
+/*
+ * Scan bitstream for NAL units, count pictures and pick up SPS.
+ * H.265 NAL header is two bytes, slice payload follows it
+ */
+static void
+null_dec_scan(struct null_ctx *ctx, const uint8_t *data, size_t len)
+{
+    int hevc = (ctx->coding == MPP_VIDEO_CodingHEVC);
+    int header_len = hevc ? 2 : 1;
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t b = data[i];
+
+        if ((b == 1) && (ctx->zeros >= 2)) {
+            if (null_dec_in_sps(ctx))
+                null_dec_sps_done(ctx);
+            ctx->in_header = 1;
+            ctx->zeros = 0;
+            continue;
+        }
+        ctx->zeros = (b == 0) ? ctx->zeros + 1 : 0;
+
+        if (ctx->in_header) {
+            ctx->in_header = 0;
+            ctx->nal_type = hevc ? ((b >> 1) & 0x3f) : (b & 0x1f);
+            ctx->nal_pos = 0;
+            ctx->sps_len = 0;
+        }
+        /*
+         * Picture starts with a slice having first_mb_in_slice = 0
+         * (ue(v) 0 is a single 1 bit) or first_slice_segment_in_pic_flag
+         */
+        else if ((ctx->nal_pos == header_len) && (hevc ? (ctx->nal_type < 32) :
+                    ((ctx->nal_type == 1) || (ctx->nal_type == 5)))) {
+            if (b & 0x80) {
+                ctx->pending++;
+                ctx->pictures++;
+            }
+        }
+
+        if (null_dec_in_sps(ctx) && (ctx->sps_len < sizeof(ctx->sps)))
+            ctx->sps[ctx->sps_len++] = b;
+        ctx->nal_pos++;
+    }
+}
+
+static MPP_RET
+null_decode_put_packet(MppCtx ctx_, MppPacket packet)
+{
+    struct null_ctx *ctx = ctx_;
+    struct null_packet *p = packet;
+    const struct mpp_rec_event *ev = null_replay_next(ctx, MPP_REC_PUT_PACKET);
+
+    if (ev && (ev->ret != MPP_OK))
+        return (ev->ret);
+
+    if (ctx->pending >= NULL_DEC_QUEUE)
+        return (MPP_ERR_BUFFER_FULL);
+
+    null_dec_scan(ctx, p->pos, p->length);
+    p->pos = (uint8_t *)p->pos + p->length;
+    p->length = 0;
+
+    if (p->eos) {
+        if (null_dec_in_sps(ctx))
+            null_dec_sps_done(ctx);
+        ctx->eos = 1;
+    }
+
+    return (MPP_OK);
+}
+
+static MPP_RET
+null_decode_get_frame(MppCtx ctx_, MppFrame *frame)
+{
+    struct null_ctx *ctx = ctx_;
+    struct null_frame *f;
+    MppBuffer buffer;
+    int h_stride, v_stride;
+    const struct mpp_rec_event *ev = null_replay_next(ctx, MPP_REC_GET_FRAME);
+
+    *frame = NULL;
+
+    if (ev && ((ev->ret != MPP_OK) || (ev->flags & MPP_REC_NONE)))
+        return (ev->ret);
+
+    h_stride = NULL_DEC_ALIGN(ctx->width);
+    v_stride = NULL_DEC_ALIGN(ctx->height);
+
+    if (ctx->info_state == NULL_INFO_REPORT) {
+        if (mpp_frame_init(frame))
+            return (MPP_ERR_MALLOC);
+        f = *frame;
+        f->width = ctx->width;
+        f->height = ctx->height;
+        f->hor_stride = h_stride;
+        f->ver_stride = v_stride;
+        f->info_change = 1;
+        ctx->info_state = NULL_INFO_WAIT;
+        return (MPP_OK);
+    }
+
+    if ((ctx->pending > 0) && (ctx->info_state == NULL_INFO_READY)) {
+        size_t size = h_stride * v_stride * 3 / 2;
+
+        /* All buffers are held downstream, same as stalled hardware */
+        if (mpp_buffer_get(ctx->ext_group, &buffer, size))
+            return (MPP_OK);
+
+        if (mpp_frame_init(frame)) {
+            mpp_buffer_put(buffer);
+            return (MPP_ERR_MALLOC);
+        }
+        f = *frame;
+        f->width = ctx->width;
+        f->height = ctx->height;
+        f->hor_stride = h_stride;
+        f->ver_stride = v_stride;
+        f->fmt = MPP_FMT_YUV420SP;
+        f->pts = ctx->pts++;
+        /* Frame takes over the reference */
+        f->buffer = buffer;
+        ctx->pending--;
+        ctx->output++;
+        null_dec_apply_change(ctx);
+        if (ctx->eos && (ctx->pending == 0)) {
+            f->eos = 1;
+            ctx->eos = 0;
+        }
+        null_hw_delay(ctx);
+        return (MPP_OK);
+    }
+
+    /* Flushed: report EOS with an empty frame */
+    if (ctx->eos && ((ctx->pending == 0) || (ctx->info_state != NULL_INFO_READY))) {
+        if (mpp_frame_init(frame))
+            return (MPP_ERR_MALLOC);
+        ((struct null_frame *)*frame)->eos = 1;
+        ctx->eos = 0;
+        ctx->pending = 0;
+    }
+
+    return (MPP_OK);
+}
+
+/*
+ * Context
+ */
+
+static MPP_RET
+null_poll(MppCtx ctx_, MppPortType type, MppPollType timeout)
+{
+    const struct mpp_rec_event *ev = null_replay_next(ctx_, MPP_REC_POLL);
+
+    return (ev ? ev->ret : MPP_OK);
+}
+
+/* Give the encoded packet size it had on the device */
+static void
+null_replay_packet(struct null_ctx *ctx, const struct mpp_rec_event *ev)
+{
+    struct null_packet *packet = ctx->task.packet;
+    size_t size = ev->size;
+
+    if ((packet == NULL) || (packet->length == 0) || (size == 0))
+        return;
+
+    if (size > packet->size)
+        size = packet->size;
+    /* Keep start code, NAL header and first_mb_in_slice */
+    if (size < 6)
+        size = 6;
+    if (size > packet->length)
+        null_enc_payload(ctx, packet->data, packet->length, size);
+    packet->length = size;
+}
+
+static MPP_RET
+null_dequeue(MppCtx ctx_, MppPortType type, MppTask *task)
+{
+    struct null_ctx *ctx = ctx_;
+    const struct mpp_rec_event *ev = null_replay_next(ctx, MPP_REC_DEQUEUE);
+
+    *task = NULL;
+    if (ev && ((ev->ret != MPP_OK) || (ev->flags & MPP_REC_NONE)))
+        return (ev->ret);
+
+    if ((type == MPP_PORT_INPUT) && (ctx->task_state == NULL_TASK_IDLE)) {
+        memset(&ctx->task, 0, sizeof(ctx->task));
+        ctx->task_state = NULL_TASK_INPUT;
+        *task = &ctx->task;
+    }
+    else if ((type == MPP_PORT_OUTPUT) && (ctx->task_state == NULL_TASK_DONE)) {
+        ctx->task_state = NULL_TASK_OUTPUT;
+        *task = &ctx->task;
+        if (ev)
+            null_replay_packet(ctx, ev);
+    }
+
+    return (MPP_OK);
+}
+
+static MPP_RET
+null_enqueue(MppCtx ctx_, MppPortType type, MppTask task)
+{
+    struct null_ctx *ctx = ctx_;
+    const struct mpp_rec_event *ev = null_replay_next(ctx, MPP_REC_ENQUEUE);
+
+    if (ev && (ev->ret != MPP_OK))
+        return (ev->ret);
+
+    if (task != &ctx->task)
+        return (MPP_ERR_VALUE);
+
+    if ((type == MPP_PORT_INPUT) && (ctx->task_state == NULL_TASK_INPUT)) {
+        if (ctx->task.packet == NULL)
+            return (MPP_ERR_NULL_PTR);
+        null_enc_frame(ctx);
+        ctx->task_state = NULL_TASK_DONE;
+        return (MPP_OK);
+    }
+    if ((type == MPP_PORT_OUTPUT) && (ctx->task_state == NULL_TASK_OUTPUT)) {
+        ctx->task_state = NULL_TASK_IDLE;
+        return (MPP_OK);
+    }
+
+    return (MPP_NOK);
+}
+
+static MPP_RET
+null_reset(MppCtx ctx_)
+{
+    struct null_ctx *ctx = ctx_;
+
+    null_replay_next(ctx, MPP_REC_RESET);
+
+    ctx->pending = 0;
+    ctx->nchanges = 0;
+    ctx->output = ctx->pictures;
+    ctx->eos = 0;
+    ctx->zeros = 0;
+    ctx->in_header = 0;
+    ctx->nal_type = 0;
+    ctx->task_state = NULL_TASK_IDLE;
+
+    return (MPP_OK);
+}
+
+static MPP_RET
+null_control(MppCtx ctx_, MpiCmd cmd, MppParam param)
+{
+    struct null_ctx *ctx = ctx_;
+    const struct mpp_rec_event *ev = null_replay_next(ctx, MPP_REC_CONTROL);
+
+    if (ev && (ev->ret != MPP_OK))
+        return (ev->ret);
+
+    switch (cmd) {
+        case MPP_DEC_SET_EXT_BUF_GROUP:
+            ctx->ext_group = param;
+            break;
+        case MPP_DEC_SET_INFO_CHANGE_READY:
+            if (ctx->info_state == NULL_INFO_WAIT)
+                ctx->info_state = NULL_INFO_READY;
+            break;
+        case MPP_ENC_SET_PREP_CFG:
+            memcpy(&ctx->prep, param, sizeof(ctx->prep));
+            break;
+        case MPP_ENC_SET_RC_CFG:
+            memcpy(&ctx->rc, param, sizeof(ctx->rc));
+            break;
+        case MPP_ENC_SET_CODEC_CFG:
+            memcpy(&ctx->codec, param, sizeof(ctx->codec));
+            break;
+        case MPP_ENC_SET_IDR_FRAME:
+            ctx->force_idr = 1;
+            break;
+        case MPP_ENC_GET_EXTRA_INFO: {
+            size_t len = (ctx->coding == MPP_VIDEO_CodingHEVC) ?
+                null_enc_parameter_sets_hevc(ctx, ctx->extra_data, sizeof(ctx->extra_data)) :
+                null_enc_parameter_sets(ctx, ctx->extra_data, sizeof(ctx->extra_data));
+            if (ctx->extra == NULL && mpp_packet_init(&ctx->extra, ctx->extra_data, len))
+                return (MPP_ERR_MALLOC);
+            mpp_packet_set_pos(ctx->extra, ctx->extra_data);
+            mpp_packet_set_length(ctx->extra, len);
+            *(MppPacket *)param = ctx->extra;
+            break;
+        }
+        default:
+            /* Everything else is accepted and ignored */
+            break;
+    }
+
+    return (MPP_OK);
+}
+
+static MPP_RET
+null_unsupported(void)
+{
+    return (MPP_NOK);
+}
+
+static MppApi null_api = {
+    .size = sizeof(MppApi),
+    .version = 0,
+    .decode = (void *)null_unsupported,
+    .decode_put_packet = null_decode_put_packet,
+    .decode_get_frame = null_decode_get_frame,
+    .encode = (void *)null_unsupported,
+    .encode_put_frame = (void *)null_unsupported,
+    .encode_get_packet = (void *)null_unsupported,
+    .isp = (void *)null_unsupported,
+    .isp_put_frame = (void *)null_unsupported,
+    .isp_get_frame = (void *)null_unsupported,
+    .poll = null_poll,
+    .dequeue = null_dequeue,
+    .enqueue = null_enqueue,
+    .reset = null_reset,
+    .control = null_control,
+};
+
+static int
+null_env_int(const char *name)
+{
+    const char *value = getenv(name);
+
+    return (value ? atoi(value) : 0);
+}
+
+MPP_RET
+mpp_create(MppCtx *ctx, MppApi **mpi)
+{
+    struct null_ctx *c;
+
+    c = calloc(1, sizeof(*c));
+    if (c == NULL)
+        return (MPP_ERR_MALLOC);
+
+    pthread_once(&replay_once, null_replay_load);
+    c->id = __atomic_fetch_add(&null_contexts, 1, __ATOMIC_RELAXED);
+
+    *ctx = c;
+    *mpi = &null_api;
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_init(MppCtx ctx_, MppCtxType type, MppCodingType coding)
+{
+    struct null_ctx *ctx = ctx_;
+
+    if ((type != MPP_CTX_DEC) && (type != MPP_CTX_ENC))
+        return (MPP_NOK);
+    if (mpp_check_support_format(type, coding) != MPP_OK)
+        return (MPP_NOK);
+
+    ctx->type = type;
+    ctx->coding = coding;
+    ctx->seed = 1;
+    ctx->hw_delay_us = null_env_int((type == MPP_CTX_ENC) ? "MPP_NULL_ENC_US" : "MPP_NULL_DEC_US");
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_destroy(MppCtx ctx_)
+{
+    struct null_ctx *ctx = ctx_;
+
+    if (ctx == NULL)
+        return (MPP_ERR_NULL_PTR);
+    if (ctx->extra)
+        mpp_packet_deinit(&ctx->extra);
+    free(ctx);
+
+    return (MPP_OK);
+}
+
+MPP_RET
+mpp_check_support_format(MppCtxType type, MppCodingType coding)
+{
+    return (((coding == MPP_VIDEO_CodingAVC) || (coding == MPP_VIDEO_CodingHEVC)) ?
+        MPP_OK : MPP_NOK);
+}
@@ -0,0 +1,319 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Recording shim around MPP API. If MPP_RECORD environment variable names
+ * a file, every call the wrappers make through MppApi is timed and logged
+ * there together with its arguments, return code and packet/frame sizes.
+ * mpp_null.c can replay the log (MPP_NULL_REPLAY) to run the host-side
+ * code against the device behaviour off-target, mpprec summarizes it
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "rockchip/rk_mpi.h"
+#include "rockchip/mpp_buffer.h"
+#include "rockchip/mpp_frame.h"
+#include "rockchip/mpp_packet.h"
+
+#include "mpp_rec.h"
+#include "metrics.h"
+
+#define MPP_REC_MAX_CTX         256
+#define MPP_REC_BUFFER_SIZE     (1024*1024)
+
+struct rec_context {
+    MppCtx              ctx;
+    MppApi              *api;
+};
+
+static pthread_mutex_t rec_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t rec_once = PTHREAD_ONCE_INIT;
+static FILE *rec_file;
+static uint64_t rec_start;
+static struct rec_context rec_contexts[MPP_REC_MAX_CTX];
+static int rec_ncontexts;
+
+static void
+rec_close(void)
+{
+    pthread_mutex_lock(&rec_lock);
+    if (rec_file) {
+        fclose(rec_file);
+        rec_file = NULL;
+    }
+    pthread_mutex_unlock(&rec_lock);
+}
+
+static void
+rec_open(void)
+{
+    const char *path = getenv("MPP_RECORD");
+
+    if ((path == NULL) || (*path == 0))
+        return;
+
+    rec_file = fopen(path, "w");
+    if (rec_file == NULL) {
+        fprintf(stderr, "failed to open MPP record log %s: %s\n", path, strerror(errno));
+        return;
+    }
+    setvbuf(rec_file, NULL, _IOFBF, MPP_REC_BUFFER_SIZE);
+    fwrite(MPP_REC_MAGIC, 1, MPP_REC_MAGIC_SIZE, rec_file);
+    rec_start = metrics_now_ns();
+    atexit(rec_close);
+}
+
+static void
+rec_write(int ctx, int call, uint64_t begin, MPP_RET ret, uint32_t arg,
+    uint32_t size, uint32_t flags)
+{
+    struct mpp_rec_event event;
+    uint64_t duration = metrics_now_ns() - begin;
+
+    event.time = begin - rec_start;
+    event.duration = (duration > UINT32_MAX) ? UINT32_MAX : duration;
+    event.call = call;
+    event.ctx = ctx;
+    event.ret = ret;
+    event.arg = arg;
+    event.size = size;
+    event.flags = flags;
+
+    pthread_mutex_lock(&rec_lock);
+    if (rec_file)
+        fwrite(&event, sizeof(event), 1, rec_file);
+    pthread_mutex_unlock(&rec_lock);
+}
+
+/*
+ * Contexts are never removed, the newest entry wins if MPP reuses
+ * the address of destroyed context
+ */
+static int
+rec_lookup(MppCtx ctx, MppApi **api)
+{
+    int count = __atomic_load_n(&rec_ncontexts, __ATOMIC_ACQUIRE);
+
+    for (int i = count - 1; i >= 0; i--) {
+        if (rec_contexts[i].ctx == ctx) {
+            *api = rec_contexts[i].api;
+            return (i);
+        }
+    }
+
+    /* Can't happen, the proxy is only installed for known contexts */
+    abort();
+}
+
+static MPP_RET
+rec_decode_put_packet(MppCtx ctx, MppPacket packet)
+{
+    MppApi *api;
+    int id = rec_lookup(ctx, &api);
+    uint32_t size = mpp_packet_get_length(packet);
+    uint32_t flags = mpp_packet_get_eos(packet) ? MPP_REC_EOS : 0;
+    uint64_t begin = metrics_now_ns();
+    MPP_RET ret;
+
+    ret = api->decode_put_packet(ctx, packet);
+    rec_write(id, MPP_REC_PUT_PACKET, begin, ret, 0, size, flags);
+
+    return (ret);
+}
+
+static MPP_RET
+rec_decode_get_frame(MppCtx ctx, MppFrame *frame)
+{
+    MppApi *api;
+    int id = rec_lookup(ctx, &api);
+    uint64_t begin = metrics_now_ns();
+    uint32_t arg = 0, size = 0, flags = MPP_REC_NONE;
+    MPP_RET ret;
+
+    ret = api->decode_get_frame(ctx, frame);
+    if ((ret == MPP_OK) && *frame) {
+        MppBuffer buffer = mpp_frame_get_buffer(*frame);
+
+        flags = 0;
+        arg = (mpp_frame_get_width(*frame) << 16) | (mpp_frame_get_height(*frame) & 0xffff);
+        if (buffer)
+            size = mpp_buffer_get_size(buffer);
+        if (mpp_frame_get_eos(*frame))
+            flags |= MPP_REC_EOS;
+        if (mpp_frame_get_info_change(*frame))
+            flags |= MPP_REC_INFO_CHANGE;
+        if (mpp_frame_get_errinfo(*frame) || mpp_frame_get_discard(*frame))
+            flags |= MPP_REC_ERROR;
+    }
+    rec_write(id, MPP_REC_GET_FRAME, begin, ret, arg, size, flags);
+
+    return (ret);
+}
+
+static MPP_RET
+rec_poll(MppCtx ctx, MppPortType type, MppPollType timeout)
+{
+    MppApi *api;
+    int id = rec_lookup(ctx, &api);
+    uint64_t begin = metrics_now_ns();
+    MPP_RET ret;
+
+    ret = api->poll(ctx, type, timeout);
+    rec_write(id, MPP_REC_POLL, begin, ret, type, 0, 0);
+
+    return (ret);
+}
+
+static MPP_RET
+rec_dequeue(MppCtx ctx, MppPortType type, MppTask *task)
+{
+    MppApi *api;
+    int id = rec_lookup(ctx, &api);
+    uint64_t begin = metrics_now_ns();
+    uint32_t size = 0, flags = MPP_REC_NONE;
+    MPP_RET ret;
+
+    ret = api->dequeue(ctx, type, task);
+    if ((ret == MPP_OK) && *task) {
+        MppPacket packet = NULL;
+
+        flags = 0;
+        /* Encoded packet is ready when output task is dequeued */
+        if ((type == MPP_PORT_OUTPUT) &&
+            (mpp_task_meta_get_packet(*task, KEY_OUTPUT_PACKET, &packet) == MPP_OK) && packet) {
+            size = mpp_packet_get_length(packet);
+            if (mpp_packet_get_eos(packet))
+                flags |= MPP_REC_EOS;
+        }
+    }
+    rec_write(id, MPP_REC_DEQUEUE, begin, ret, type, size, flags);
+
+    return (ret);
+}
+
+static MPP_RET
+rec_enqueue(MppCtx ctx, MppPortType type, MppTask task)
+{
+    MppApi *api;
+    int id = rec_lookup(ctx, &api);
+    uint32_t size = 0, flags = 0;
+    uint64_t begin;
+    MPP_RET ret;
+
+    if (type == MPP_PORT_INPUT) {
+        MppFrame frame = NULL;
+
+        if ((mpp_task_meta_get_frame(task, KEY_INPUT_FRAME, &frame) == MPP_OK) && frame) {
+            MppBuffer buffer = mpp_frame_get_buffer(frame);
+
+            if (buffer)
+                size = mpp_buffer_get_size(buffer);
+            if (mpp_frame_get_eos(frame))
+                flags |= MPP_REC_EOS;
+        }
+    }
+
+    begin = metrics_now_ns();
+    ret = api->enqueue(ctx, type, task);
+    rec_write(id, MPP_REC_ENQUEUE, begin, ret, type, size, flags);
+
+    return (ret);
+}
+
+static MPP_RET
+rec_reset(MppCtx ctx)
+{
+    MppApi *api;
+    int id = rec_lookup(ctx, &api);
+    uint64_t begin = metrics_now_ns();
+    MPP_RET ret;
+
+    ret = api->reset(ctx);
+    rec_write(id, MPP_REC_RESET, begin, ret, 0, 0, 0);
+
+    return (ret);
+}
+
+static MPP_RET
+rec_control(MppCtx ctx, MpiCmd cmd, MppParam param)
+{
+    MppApi *api;
+    int id = rec_lookup(ctx, &api);
+    uint64_t begin = metrics_now_ns();
+    MPP_RET ret;
+
+    ret = api->control(ctx, cmd, param);
+    rec_write(id, MPP_REC_CONTROL, begin, ret, cmd, 0, 0);
+
+    return (ret);
+}
+
+/* Calls the wrappers don't use go straight to MPP */
+static MppApi rec_api;
+
+/*
+ * Replace @mpi of the freshly created context @ctx with recording proxy
+ * if MPP_RECORD is set
+ */
+void
+mpp_rec_wrap(MppCtx ctx, MppApi **mpi)
+{
+    int id;
+
+    pthread_once(&rec_once, rec_open);
+    if (rec_file == NULL)
+        return;
+
+    pthread_mutex_lock(&rec_lock);
+    if (rec_ncontexts == MPP_REC_MAX_CTX) {
+        pthread_mutex_unlock(&rec_lock);
+        fprintf(stderr, "too many MPP contexts, context %p is not recorded\n", ctx);
+        return;
+    }
+    if (rec_ncontexts == 0) {
+        rec_api = **mpi;
+        rec_api.decode_put_packet = rec_decode_put_packet;
+        rec_api.decode_get_frame = rec_decode_get_frame;
+        rec_api.poll = rec_poll;
+        rec_api.dequeue = rec_dequeue;
+        rec_api.enqueue = rec_enqueue;
+        rec_api.reset = rec_reset;
+        rec_api.control = rec_control;
+    }
+    id = rec_ncontexts;
+    rec_contexts[id].ctx = ctx;
+    rec_contexts[id].api = *mpi;
+    __atomic_store_n(&rec_ncontexts, id + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&rec_lock);
+
+    rec_write(id, MPP_REC_CREATE, metrics_now_ns(), MPP_OK, 0, 0, 0);
+    *mpi = &rec_api;
+}
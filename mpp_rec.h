@@ -0,0 +1,77 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __MPP_REC_H__
+#define __MPP_REC_H__
+
+/*
+ * Log of MPP calls: MPP_REC_MAGIC followed by fixed-size events in the
+ * order the calls returned. Host byte order, the log is meant to be
+ * replayed on the same architecture
+ */
+#define MPP_REC_MAGIC           "MPPREC01"
+#define MPP_REC_MAGIC_SIZE      8
+
+enum mpp_rec_call {
+    MPP_REC_CREATE,
+    MPP_REC_PUT_PACKET,
+    MPP_REC_GET_FRAME,
+    MPP_REC_POLL,
+    MPP_REC_DEQUEUE,
+    MPP_REC_ENQUEUE,
+    MPP_REC_RESET,
+    MPP_REC_CONTROL,
+    MPP_REC_CALLS
+};
+
+/* Event flags */
+#define MPP_REC_EOS             0x01
+/* No task or frame was returned */
+#define MPP_REC_NONE            0x02
+#define MPP_REC_INFO_CHANGE     0x04
+/* Frame with errinfo or discard set */
+#define MPP_REC_ERROR           0x08
+
+struct mpp_rec_event {
+    /* Start of the call, ns since recording started */
+    uint64_t            time;
+    /* Time spent in MPP, ns */
+    uint32_t            duration;
+    uint16_t            call;
+    /* Context, numbered in mpp_create order */
+    uint16_t            ctx;
+    int32_t             ret;
+    /* Port, command, or width << 16 | height of decoded frame */
+    uint32_t            arg;
+    /* Bytes of the packet or the frame buffer */
+    uint32_t            size;
+    uint32_t            flags;
+};
+
+void mpp_rec_wrap(MppCtx ctx, MppApi **mpi);
+const char *mpp_rec_call_name(int call);
+struct mpp_rec_event *mpp_rec_load(const char *path, size_t *count);
+
+#endif /* __MPP_REC_H__ */
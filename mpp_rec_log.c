@@ -0,0 +1,107 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Reading MPP record logs written by mpp_rec.c. Kept apart from the
+ * recorder so tools using it don't need MPP library
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "rockchip/rk_mpi.h"
+
+#include "mpp_rec.h"
+
+static const char *call_names[MPP_REC_CALLS] = {
+    [MPP_REC_CREATE] = "create",
+    [MPP_REC_PUT_PACKET] = "decode_put_packet",
+    [MPP_REC_GET_FRAME] = "decode_get_frame",
+    [MPP_REC_POLL] = "poll",
+    [MPP_REC_DEQUEUE] = "dequeue",
+    [MPP_REC_ENQUEUE] = "enqueue",
+    [MPP_REC_RESET] = "reset",
+    [MPP_REC_CONTROL] = "control",
+};
+
+const char *
+mpp_rec_call_name(int call)
+{
+    if ((call < 0) || (call >= MPP_REC_CALLS))
+        return ("unknown");
+
+    return (call_names[call]);
+}
+
+/*
+ * Read the whole log into memory. Returns NULL if the file can't be
+ * read or is not a log
+ */
+struct mpp_rec_event *
+mpp_rec_load(const char *path, size_t *count)
+{
+    struct mpp_rec_event *events = NULL;
+    char magic[MPP_REC_MAGIC_SIZE];
+    size_t allocated = 0;
+    FILE *f;
+
+    *count = 0;
+
+    f = fopen(path, "r");
+    if (f == NULL)
+        return (NULL);
+
+    if ((fread(magic, 1, sizeof(magic), f) != sizeof(magic)) ||
+        memcmp(magic, MPP_REC_MAGIC, sizeof(magic))) {
+        fprintf(stderr, "%s is not MPP record log\n", path);
+        fclose(f);
+        return (NULL);
+    }
+
+    for (;;) {
+        if (*count == allocated) {
+            struct mpp_rec_event *grown;
+
+            allocated = allocated ? allocated * 2 : 4096;
+            grown = realloc(events, allocated * sizeof(*events));
+            if (grown == NULL) {
+                free(events);
+                fclose(f);
+                *count = 0;
+                return (NULL);
+            }
+            events = grown;
+        }
+        if (fread(&events[*count], sizeof(*events), 1, f) != 1)
+            break;
+        (*count)++;
+    }
+
+    fclose(f);
+
+    return (events);
+}
@@ -0,0 +1,159 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Prints MPP record log (see mpp_rec.c): per-call statistics and,
+ * with -v, every recorded call
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdint.h>
+
+#include "rockchip/rk_mpi.h"
+
+#include "mpp_rec.h"
+
+static int
+compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x < y) ? -1 : (x > y);
+}
+
+static void
+print_event(const struct mpp_rec_event *ev)
+{
+    printf("%12.3f ctx %-3u %-18s ret %-6d arg 0x%08x size %-9u %8.1f us%s%s%s%s\n",
+        ev->time / 1e6, ev->ctx, mpp_rec_call_name(ev->call), ev->ret, ev->arg,
+        ev->size, ev->duration / 1e3,
+        (ev->flags & MPP_REC_EOS) ? " eos" : "",
+        (ev->flags & MPP_REC_NONE) ? " none" : "",
+        (ev->flags & MPP_REC_INFO_CHANGE) ? " info_change" : "",
+        (ev->flags & MPP_REC_ERROR) ? " error" : "");
+}
+
+static void
+print_summary(const struct mpp_rec_event *events, size_t count)
+{
+    uint32_t *durations;
+    int contexts = 0;
+
+    durations = malloc((count ? count : 1) * sizeof(uint32_t));
+    if (durations == NULL) {
+        fprintf(stderr, "failed to allocate %zu durations\n", count);
+        exit(1);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (events[i].ctx >= contexts)
+            contexts = events[i].ctx + 1;
+    }
+
+    printf("%zu calls, %d contexts, %.3f s\n", count, contexts,
+        count ? (events[count - 1].time + events[count - 1].duration) / 1e9 : 0.0);
+    printf("%-18s %9s %7s %7s %10s %10s %10s %10s\n", "call", "count", "failed", "none",
+        "mean us", "p50 us", "p99 us", "max us");
+
+    for (int call = 0; call < MPP_REC_CALLS; call++) {
+        size_t n = 0, failed = 0, none = 0;
+        double total = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            if (events[i].call != call)
+                continue;
+            durations[n++] = events[i].duration;
+            total += events[i].duration;
+            failed += (events[i].ret != MPP_OK);
+            none += ((events[i].flags & MPP_REC_NONE) != 0);
+        }
+        if ((n == 0) || (call == MPP_REC_CREATE))
+            continue;
+
+        qsort(durations, n, sizeof(uint32_t), compare_u32);
+        printf("%-18s %9zu %7zu %7zu %10.1f %10.1f %10.1f %10.1f\n", mpp_rec_call_name(call),
+            n, failed, none, total / n / 1e3, durations[(n - 1) / 2] / 1e3,
+            durations[(n * 99 + 99) / 100 - 1] / 1e3, durations[n - 1] / 1e3);
+    }
+
+    free(durations);
+}
+
+static void
+usage(const char *exe)
+{
+    fprintf(stderr, "Usage: %s [-v] record.log\n", exe);
+    exit(1);
+}
+
+int
+main(int argc, char * const *argv)
+{
+    struct mpp_rec_event *events;
+    const char *exe;
+    size_t count;
+    int verbose;
+    int ch;
+
+    exe = argv[0];
+    verbose = 0;
+
+    while ((ch = getopt(argc, argv, "v")) != -1) {
+        switch (ch) {
+            case 'v':
+                     verbose = 1;
+                     break;
+            case '?':
+            default:
+                     usage(exe);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1)
+        usage(exe);
+
+    events = mpp_rec_load(argv[0], &count);
+    if (events == NULL) {
+        fprintf(stderr, "failed to read %s\n", argv[0]);
+        exit(1);
+    }
+
+    if (verbose) {
+        for (size_t i = 0; i < count; i++)
+            print_event(&events[i]);
+    }
+
+    print_summary(events, count);
+    free(events);
+
+    return (0);
+}
@@ -0,0 +1,93 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pipe_io.h"
+
+/* Default pipe buffer, no point going below it */
+#define PIPE_MIN_SIZE       (64*1024)
+
+/*
+ * Default 64K pipe buffer holds a fraction of a frame, so the producer
+ * and the consumer keep waking each other up. Ask for a larger one;
+ * unprivileged processes are capped by /proc/sys/fs/pipe-max-size
+ */
+void
+pipe_io_grow(int fd)
+{
+    struct stat st;
+
+    if ((fstat(fd, &st) < 0) || !S_ISFIFO(st.st_mode))
+        return;
+
+    for (int size = PIPE_IO_BUFFER_SIZE; size > PIPE_MIN_SIZE; size /= 2) {
+        if (fcntl(fd, F_SETPIPE_SZ, size) >= 0)
+            return;
+    }
+}
+
+/*
+ * Opens @path for reading, "-" is stdin
+ */
+int
+pipe_io_open_input(const char *path)
+{
+    int fd;
+
+    if (strcmp(path, PIPE_IO_STDIO) == 0)
+        fd = STDIN_FILENO;
+    else
+        fd = open(path, O_RDONLY);
+
+    if (fd >= 0)
+        pipe_io_grow(fd);
+
+    return (fd);
+}
+
+/*
+ * Creates or truncates @path for writing, "-" is stdout
+ */
+int
+pipe_io_open_output(const char *path)
+{
+    int fd;
+
+    if (strcmp(path, PIPE_IO_STDIO) == 0)
+        fd = STDOUT_FILENO;
+    else
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd >= 0)
+        pipe_io_grow(fd);
+
+    return (fd);
+}
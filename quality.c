@@ -0,0 +1,415 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "yuv_ops.h"
+#include "quality.h"
+
+/* More bands than threads evens out the load at plane edges */
+#define BANDS_PER_THREAD    2
+
+/* SSIM stabilizing constants, scaled for sums over 8x8 window */
+#define SSIM_C1             (.01 * .01 * 255 * 255 * 64 * 64)
+#define SSIM_C2             (.03 * .03 * 255 * 255 * 64 * 64)
+
+struct band_result
+{
+    uint64_t            sse;
+    double              ssim;
+    int                 windows;
+};
+
+struct quality_worker
+{
+    struct quality      *q;
+    int                 index;
+    pthread_t           thread;
+};
+
+struct quality
+{
+    int                 width[QUALITY_PLANES];
+    int                 height[QUALITY_PLANES];
+    int                 threads;
+    int                 bands;
+    struct quality_worker *workers;
+
+    /*
+     * Batch being processed: job number encodes frame, plane and band.
+     * The caller works on jobs together with the workers
+     */
+    pthread_mutex_t     lock;
+    pthread_cond_t      start;
+    pthread_cond_t      done;
+    int                 shutdown;
+    int                 jobs;
+    int                 next_job;
+    int                 finished;
+    const uint8_t       *ref[QUALITY_MAX_BATCH][QUALITY_PLANES];
+    int                 ref_stride[QUALITY_MAX_BATCH][QUALITY_PLANES];
+    const uint8_t       *dist[QUALITY_MAX_BATCH][QUALITY_PLANES];
+    int                 dist_stride[QUALITY_MAX_BATCH][QUALITY_PLANES];
+    struct band_result  *results;
+
+    /* SSIM sums of two 4-row strips per thread */
+    int32_t             (*sums)[4];
+    int                 blocks;
+    /* Planar copy of NV12 chroma, allocated on first use */
+    uint8_t             *chroma[2][QUALITY_MAX_BATCH];
+
+    /* Totals over all compared frames */
+    uint64_t            sse_total[QUALITY_PLANES];
+    double              ssim_total[QUALITY_PLANES];
+    int                 frames;
+};
+
+static double
+ssim_window(const int32_t *s)
+{
+    double s1 = s[0], s2 = s[1], ss = s[2], s12 = s[3];
+    double vars = ss * 64 - s1 * s1 - s2 * s2;
+    double covar = s12 * 64 - s1 * s2;
+
+    return ((2 * s1 * s2 + SSIM_C1) * (2 * covar + SSIM_C2) /
+        ((s1 * s1 + s2 * s2 + SSIM_C1) * (vars + SSIM_C2)));
+}
+
+static void
+quality_run_job(struct quality *q, int job, int worker)
+{
+    int band = job % q->bands;
+    int plane = (job / q->bands) % QUALITY_PLANES;
+    int frame = job / q->bands / QUALITY_PLANES;
+    const uint8_t *a = q->ref[frame][plane];
+    const uint8_t *b = q->dist[frame][plane];
+    int a_stride = q->ref_stride[frame][plane];
+    int b_stride = q->dist_stride[frame][plane];
+    int width = q->width[plane];
+    int height = q->height[plane];
+    struct band_result *result = &q->results[job];
+    int32_t (*prev)[4] = q->sums + (size_t)worker * 2 * q->blocks;
+    int32_t (*cur)[4] = prev + q->blocks;
+    int blocks = width / 4;
+    int rows, first, last;
+
+    memset(result, 0, sizeof(*result));
+
+    first = height * band / q->bands;
+    last = height * (band + 1) / q->bands;
+    for (int y = first; y < last; y++)
+        result->sse += yuv_sse_row(a + (size_t)y * a_stride, b + (size_t)y * b_stride, width);
+
+    /* Windows overlap by half, row j covers strips j and j + 1 */
+    rows = height / 4 - 1;
+    if ((rows < 1) || (blocks < 2))
+        return;
+    first = rows * band / q->bands;
+    last = rows * (band + 1) / q->bands;
+    for (int j = first; j < last; j++) {
+        int32_t (*tmp)[4];
+
+        if (j == first)
+            yuv_ssim_sums4x4(a + (size_t)j * 4 * a_stride, a_stride,
+                b + (size_t)j * 4 * b_stride, b_stride, blocks, prev);
+        yuv_ssim_sums4x4(a + (size_t)(j + 1) * 4 * a_stride, a_stride,
+            b + (size_t)(j + 1) * 4 * b_stride, b_stride, blocks, cur);
+
+        for (int i = 0; i < blocks - 1; i++) {
+            int32_t s[4];
+
+            for (int n = 0; n < 4; n++)
+                s[n] = prev[i][n] + prev[i + 1][n] + cur[i][n] + cur[i + 1][n];
+            result->ssim += ssim_window(s);
+        }
+        result->windows += blocks - 1;
+
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+}
+
+/*
+ * Take jobs of the current batch until there are none left.
+ * Called with the lock held
+ */
+static void
+quality_run_batch(struct quality *q, int worker)
+{
+    while (q->next_job < q->jobs) {
+        int job = q->next_job++;
+
+        pthread_mutex_unlock(&q->lock);
+        quality_run_job(q, job, worker);
+        pthread_mutex_lock(&q->lock);
+
+        if (++q->finished == q->jobs)
+            pthread_cond_signal(&q->done);
+    }
+}
+
+static void *
+quality_worker_thread(void *arg)
+{
+    struct quality_worker *worker = (struct quality_worker *)arg;
+    struct quality *q = worker->q;
+
+    pthread_mutex_lock(&q->lock);
+    while (!q->shutdown) {
+        quality_run_batch(q, worker->index);
+        if (!q->shutdown)
+            pthread_cond_wait(&q->start, &q->lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return (NULL);
+}
+
+quality_t
+quality_create(int width, int height, int threads)
+{
+    quality_t q;
+
+    if ((width < 1) || (height < 1))
+        return (NULL);
+    if (threads < 1)
+        threads = 1;
+
+    q = calloc(1, sizeof(struct quality));
+    if (q == NULL)
+        return (NULL);
+
+    q->width[0] = width;
+    q->height[0] = height;
+    for (int p = 1; p < QUALITY_PLANES; p++) {
+        q->width[p] = (width + 1) / 2;
+        q->height[p] = (height + 1) / 2;
+    }
+    q->threads = threads;
+    q->bands = (threads > 1) ? threads * BANDS_PER_THREAD : 1;
+    q->blocks = width / 4 + 1;
+
+    q->results = calloc((size_t)QUALITY_MAX_BATCH * QUALITY_PLANES * q->bands,
+        sizeof(struct band_result));
+    q->sums = calloc((size_t)threads * 2 * q->blocks, sizeof(*q->sums));
+    q->workers = calloc(threads, sizeof(struct quality_worker));
+    if ((q->results == NULL) || (q->sums == NULL) || (q->workers == NULL)) {
+        free(q->results);
+        free(q->sums);
+        free(q->workers);
+        free(q);
+        return (NULL);
+    }
+
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->start, NULL);
+    pthread_cond_init(&q->done, NULL);
+
+    /* Worker 0 is the caller of quality_compare */
+    for (int i = 1; i < threads; i++) {
+        q->workers[i].q = q;
+        q->workers[i].index = i;
+        if (pthread_create(&q->workers[i].thread, NULL, quality_worker_thread, &q->workers[i])) {
+            fprintf(stderr, "failed to start quality worker thread\n");
+            q->threads = i;
+            quality_destroy(q);
+            return (NULL);
+        }
+    }
+
+    return (q);
+}
+
+/*
+ * Point batch slot at planes of @image, NV12 chroma is split into
+ * planar copy first
+ */
+static int
+quality_set_image(struct quality *q, const struct quality_image *image, int side, int slot)
+{
+    const uint8_t **planes = side ? q->dist[slot] : q->ref[slot];
+    int *strides = side ? q->dist_stride[slot] : q->ref_stride[slot];
+    int width = q->width[1], height = q->height[1];
+    uint8_t *u, *v;
+
+    planes[0] = image->plane[0];
+    strides[0] = image->stride[0];
+
+    if (image->format == QUALITY_I420) {
+        for (int p = 1; p < QUALITY_PLANES; p++) {
+            planes[p] = image->plane[p];
+            strides[p] = image->stride[p];
+        }
+        return (0);
+    }
+
+    if (q->chroma[side][slot] == NULL) {
+        q->chroma[side][slot] = malloc((size_t)width * height * 2);
+        if (q->chroma[side][slot] == NULL)
+            return (-1);
+    }
+    u = q->chroma[side][slot];
+    v = u + (size_t)width * height;
+    for (int y = 0; y < height; y++)
+        yuv_split_uv(u + (size_t)y * width, v + (size_t)y * width,
+            image->plane[1] + (size_t)y * image->stride[1], width);
+    planes[1] = u;
+    planes[2] = v;
+    strides[1] = strides[2] = width;
+
+    return (0);
+}
+
+static double
+quality_psnr(uint64_t sse, uint64_t samples)
+{
+    double psnr;
+
+    if (sse == 0)
+        return (QUALITY_PSNR_MAX);
+
+    psnr = 10 * log10(255.0 * 255.0 * samples / sse);
+
+    return (psnr > QUALITY_PSNR_MAX ? QUALITY_PSNR_MAX : psnr);
+}
+
+static void
+quality_fill_score(struct quality *q, const uint64_t *sse, const double *ssim, int frames,
+    struct quality_score *score)
+{
+    uint64_t sse_all = 0, samples_all = 0;
+    double ssim_all = 0;
+
+    for (int p = 0; p < QUALITY_PLANES; p++) {
+        uint64_t samples = (uint64_t)q->width[p] * q->height[p] * frames;
+
+        score->psnr[p] = quality_psnr(sse[p], samples);
+        score->ssim[p] = ssim[p] / frames;
+        sse_all += sse[p];
+        samples_all += samples;
+        ssim_all += score->ssim[p] * q->width[p] * q->height[p];
+    }
+    score->psnr_all = quality_psnr(sse_all, samples_all);
+    score->ssim_all = ssim_all * frames / samples_all;
+}
+
+/*
+ * Compare @count frame pairs, scores are stored per frame and added
+ * to the totals
+ */
+int
+quality_compare(quality_t q, const struct quality_image *ref,
+    const struct quality_image *dist, int count, struct quality_score *scores)
+{
+    if ((count < 1) || (count > QUALITY_MAX_BATCH))
+        return (-1);
+
+    for (int f = 0; f < count; f++) {
+        if (quality_set_image(q, &ref[f], 0, f) || quality_set_image(q, &dist[f], 1, f))
+            return (-1);
+    }
+
+    pthread_mutex_lock(&q->lock);
+    q->jobs = count * QUALITY_PLANES * q->bands;
+    q->next_job = 0;
+    q->finished = 0;
+    pthread_cond_broadcast(&q->start);
+    quality_run_batch(q, 0);
+    while (q->finished < q->jobs)
+        pthread_cond_wait(&q->done, &q->lock);
+    pthread_mutex_unlock(&q->lock);
+
+    for (int f = 0; f < count; f++) {
+        uint64_t sse[QUALITY_PLANES];
+        double ssim[QUALITY_PLANES];
+
+        for (int p = 0; p < QUALITY_PLANES; p++) {
+            struct band_result *result = &q->results[(f * QUALITY_PLANES + p) * q->bands];
+            int windows = 0;
+
+            sse[p] = 0;
+            ssim[p] = 0;
+            for (int band = 0; band < q->bands; band++) {
+                sse[p] += result[band].sse;
+                ssim[p] += result[band].ssim;
+                windows += result[band].windows;
+            }
+            /* Plane too small for a single window */
+            ssim[p] = windows ? ssim[p] / windows : 1.0;
+
+            q->sse_total[p] += sse[p];
+            q->ssim_total[p] += ssim[p];
+        }
+        quality_fill_score(q, sse, ssim, 1, &scores[f]);
+        q->frames++;
+    }
+
+    return (0);
+}
+
+/*
+ * PSNR of all compared frames (from total squared error) and mean SSIM,
+ * returns number of frames
+ */
+int
+quality_summary(quality_t q, struct quality_score *total)
+{
+    memset(total, 0, sizeof(*total));
+    if (q->frames > 0)
+        quality_fill_score(q, q->sse_total, q->ssim_total, q->frames, total);
+
+    return (q->frames);
+}
+
+void
+quality_destroy(quality_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->shutdown = 1;
+    pthread_cond_broadcast(&q->start);
+    pthread_mutex_unlock(&q->lock);
+
+    for (int i = 1; i < q->threads; i++)
+        pthread_join(q->workers[i].thread, NULL);
+
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->start);
+    pthread_cond_destroy(&q->done);
+
+    for (int f = 0; f < QUALITY_MAX_BATCH; f++) {
+        free(q->chroma[0][f]);
+        free(q->chroma[1][f]);
+    }
+    free(q->results);
+    free(q->sums);
+    free(q->workers);
+    free(q);
+}
@@ -0,0 +1,74 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __QUALITY_H__
+#define __QUALITY_H__
+
+/*
+ * Objective quality of distorted frames against reference: PSNR and SSIM
+ * (8x8 windows stepped by 4 pixels) per plane. Work is split into row
+ * bands of every plane of every frame in the batch and spread over
+ * worker threads
+ */
+
+#define QUALITY_PLANES      3
+/* Most frames compared in one call */
+#define QUALITY_MAX_BATCH   8
+/* Reported for identical planes instead of infinity */
+#define QUALITY_PSNR_MAX    100.0
+
+enum quality_format {
+    QUALITY_I420,
+    /* Interleaved chroma in plane[1] */
+    QUALITY_NV12,
+};
+
+/* 8-bit 4:2:0 frame, chroma is (width+1)/2 x (height+1)/2 */
+struct quality_image
+{
+    enum quality_format format;
+    const uint8_t       *plane[QUALITY_PLANES];
+    int                 stride[QUALITY_PLANES];
+};
+
+struct quality_score
+{
+    double              psnr[QUALITY_PLANES];
+    double              ssim[QUALITY_PLANES];
+    /* Planes weighted by number of samples */
+    double              psnr_all;
+    double              ssim_all;
+};
+
+struct quality;
+typedef struct quality * quality_t;
+
+quality_t quality_create(int width, int height, int threads);
+int quality_compare(quality_t q, const struct quality_image *ref,
+    const struct quality_image *dist, int count, struct quality_score *scores);
+int quality_summary(quality_t q, struct quality_score *total);
+void quality_destroy(quality_t q);
+
+#endif /* __QUALITY_H__ */
@@ -0,0 +1,126 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Example consumer of decoder -O shm: maps the frame ring and writes
+ * frames out as NV12 file and/or prints CRC32C of every frame, same as
+ * decoder -O hash does
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "frame_ring.h"
+#include "frame_writer.h"
+
+static void
+usage(const char *exe)
+{
+    fprintf(stderr, "Usage: %s [-H] socket [out.nv12]\n", exe);
+    fprintf(stderr, "  -H  print CRC32C of every frame\n");
+    exit(1);
+}
+
+int
+main(int argc, char * const *argv)
+{
+    const struct frame_ring_slot *slot;
+    frame_ring_t ring;
+    struct timespec start, end;
+    const char *exe;
+    uint8_t *data;
+    int fd, hash, frames;
+    int ch;
+
+    exe = argv[0];
+    hash = 0;
+
+    while ((ch = getopt(argc, argv, "H")) != -1) {
+        switch (ch) {
+            case 'H':
+                     hash = 1;
+                     break;
+            case '?':
+            default:
+                     usage(exe);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if ((argc < 1) || (argc > 2))
+        usage(exe);
+
+    fd = -1;
+    if (argc > 1) {
+        fd = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "failed to open '%s' for writing: %s\n", argv[1], strerror(errno));
+            exit(1);
+        }
+    }
+
+    ring = frame_ring_connect(argv[0]);
+    if (ring == NULL)
+        exit(1);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    frames = 0;
+    while ((slot = frame_ring_acquire(ring, &data)) != NULL) {
+        if (slot->seq != (uint64_t)frames)
+            fprintf(stderr, "frame %d: unexpected sequence number %llu\n", frames,
+                (unsigned long long)slot->seq);
+
+        if (hash)
+            printf("%d %ux%u %08x\n", frames, slot->width, slot->height,
+                frame_hash_nv12(0, data, data + slot->uv_offset, slot->width, slot->height,
+                    slot->stride));
+        if (fd >= 0)
+            frame_write_nv12(fd, data, data + slot->uv_offset, slot->width, slot->height,
+                slot->stride);
+
+        frame_ring_release(ring);
+        frames++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stderr, "%d frames received in %.2f s\n", frames,
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    frame_ring_close(ring);
+    if (fd >= 0)
+        close(fd);
+
+    return (0);
+}
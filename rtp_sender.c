@@ -0,0 +1,388 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "video_codec.h"
+#include "h264_reader.h"
+#include "metrics.h"
+#include "rtp_sender.h"
+
+#define RTP_HEADER_SIZE     12
+/* IPv4 and UDP headers */
+#define UDP_OVERHEAD        28
+/* Packets sent by single sendmmsg(2) */
+#define RTP_BATCH           64
+/* Most NAL units aggregated in one STAP-A packet */
+#define RTP_STAP_MAX        16
+
+#define NAL_STAP_A          24
+#define NAL_FU_A            28
+#define FU_START            0x80
+#define FU_END              0x40
+#define RTP_MARKER          0x80
+
+/*
+ * Headers are built in @prefix, payload is referenced from the encoder
+ * packet without copying. STAP-A needs a size field before every NAL,
+ * hence two iovecs per aggregated NAL
+ */
+struct rtp_packet
+{
+    uint8_t             prefix[RTP_HEADER_SIZE + 1 + 2 * RTP_STAP_MAX];
+    struct iovec        iov[2 * RTP_STAP_MAX];
+};
+
+struct rtp_sender
+{
+    int                 fd;
+    /* Largest RTP payload that keeps packets within MTU */
+    size_t              max_payload;
+    uint16_t            seq;
+    uint32_t            ssrc;
+    uint32_t            timestamp;
+
+    /* Batch of packets waiting for sendmmsg */
+    struct rtp_packet   packets[RTP_BATCH];
+    struct mmsghdr      msgs[RTP_BATCH];
+    int                 count;
+
+    /* Small NAL units waiting to be aggregated */
+    uint8_t             *pending[RTP_STAP_MAX];
+    size_t              pending_len[RTP_STAP_MAX];
+    int                 npending;
+    size_t              pending_size;
+
+    uint64_t            packets_sent;
+    uint64_t            bytes_sent;
+};
+
+rtp_sender_t
+rtp_sender_open(const char *dest, int mtu)
+{
+    struct addrinfo hints, *res;
+    rtp_sender_t sender;
+    char host[256];
+    const char *port;
+    int err;
+
+    port = strrchr(dest, ':');
+    if ((port == NULL) || (port == dest) || (port - dest >= (int)sizeof(host))) {
+        fprintf(stderr, "destination should be host:port, got %s\n", dest);
+        return (NULL);
+    }
+    /* [addr]:port for IPv6 */
+    if ((dest[0] == '[') && (port[-1] == ']')) {
+        memcpy(host, dest + 1, port - dest - 2);
+        host[port - dest - 2] = '\0';
+    }
+    else {
+        memcpy(host, dest, port - dest);
+        host[port - dest] = '\0';
+    }
+    port++;
+
+    if (mtu <= UDP_OVERHEAD + RTP_HEADER_SIZE + 2) {
+        fprintf(stderr, "MTU %d is too small\n", mtu);
+        return (NULL);
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    err = getaddrinfo(host, port, &hints, &res);
+    if (err) {
+        fprintf(stderr, "failed to resolve %s: %s\n", dest, gai_strerror(err));
+        return (NULL);
+    }
+
+    sender = calloc(1, sizeof(struct rtp_sender));
+    if (sender == NULL) {
+        freeaddrinfo(res);
+        return (NULL);
+    }
+
+    sender->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if ((sender->fd < 0) || (connect(sender->fd, res->ai_addr, res->ai_addrlen) < 0)) {
+        fprintf(stderr, "failed to connect to %s: %s\n", dest, strerror(errno));
+        if (sender->fd >= 0)
+            close(sender->fd);
+        freeaddrinfo(res);
+        free(sender);
+        return (NULL);
+    }
+    freeaddrinfo(res);
+
+    sender->max_payload = mtu - UDP_OVERHEAD - RTP_HEADER_SIZE;
+    srand(time(NULL) ^ getpid());
+    sender->seq = rand();
+    sender->ssrc = rand();
+
+    for (int i = 0; i < RTP_BATCH; i++)
+        sender->msgs[i].msg_hdr.msg_iov = sender->packets[i].iov;
+
+    return (sender);
+}
+
+/* RTP timestamp (90 kHz) for the packets of the next access unit */
+void
+rtp_sender_set_timestamp(rtp_sender_t sender, uint32_t timestamp)
+{
+    sender->timestamp = timestamp;
+}
+
+static void
+rtp_flush(rtp_sender_t sender)
+{
+    int sent = 0;
+    uint64_t bytes = 0;
+    uint64_t begin = metrics_stage_begin();
+
+    while (sent < sender->count) {
+        int ret = sendmmsg(sender->fd, sender->msgs + sent, sender->count - sent, 0);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            /* Nobody listens on loopback or the link is congested, drop */
+            metrics_count(METRIC_EAGAIN, 1);
+            break;
+        }
+        for (int i = sent; i < sent + ret; i++)
+            bytes += sender->msgs[i].msg_len;
+        sent += ret;
+    }
+
+    metrics_stage_end(METRIC_STAGE_WRITE, begin);
+    metrics_count(METRIC_BYTES_WRITTEN, bytes);
+    sender->bytes_sent += bytes;
+    sender->packets_sent += sent;
+    sender->count = 0;
+}
+
+/*
+ * Start next packet of the batch with RTP header, returns it with
+ * the header in iov[0]
+ */
+static struct rtp_packet *
+rtp_packet_new(rtp_sender_t sender)
+{
+    struct rtp_packet *packet;
+    uint8_t *h;
+
+    if (sender->count == RTP_BATCH)
+        rtp_flush(sender);
+
+    packet = &sender->packets[sender->count];
+    h = packet->prefix;
+    h[0] = 0x80;
+    h[1] = RTP_PAYLOAD_TYPE;
+    h[2] = sender->seq >> 8;
+    h[3] = sender->seq;
+    h[4] = sender->timestamp >> 24;
+    h[5] = sender->timestamp >> 16;
+    h[6] = sender->timestamp >> 8;
+    h[7] = sender->timestamp;
+    h[8] = sender->ssrc >> 24;
+    h[9] = sender->ssrc >> 16;
+    h[10] = sender->ssrc >> 8;
+    h[11] = sender->ssrc;
+    sender->seq++;
+
+    packet->iov[0].iov_base = h;
+    packet->iov[0].iov_len = RTP_HEADER_SIZE;
+
+    return (packet);
+}
+
+static void
+rtp_packet_done(rtp_sender_t sender, int iovs)
+{
+    sender->msgs[sender->count].msg_hdr.msg_iovlen = iovs;
+    sender->count++;
+}
+
+/*
+ * Send NAL units waiting for aggregation: single NAL packet if there is
+ * only one, STAP-A otherwise
+ */
+static void
+rtp_send_pending(rtp_sender_t sender)
+{
+    struct rtp_packet *packet;
+    uint8_t *stap;
+    uint8_t nri = 0;
+    int iovs;
+
+    if (sender->npending == 0)
+        return;
+
+    packet = rtp_packet_new(sender);
+
+    if (sender->npending == 1) {
+        packet->iov[1].iov_base = sender->pending[0];
+        packet->iov[1].iov_len = sender->pending_len[0];
+        rtp_packet_done(sender, 2);
+        sender->npending = 0;
+        return;
+    }
+
+    /* STAP-A indicator and first size go right after RTP header */
+    stap = packet->prefix + RTP_HEADER_SIZE;
+    packet->iov[0].iov_len += 1;
+    iovs = 1;
+    for (int i = 0; i < sender->npending; i++) {
+        uint8_t *size = stap + 1 + 2 * i;
+
+        size[0] = sender->pending_len[i] >> 8;
+        size[1] = sender->pending_len[i];
+        if (i == 0)
+            packet->iov[0].iov_len += 2;
+        else {
+            packet->iov[iovs].iov_base = size;
+            packet->iov[iovs].iov_len = 2;
+            iovs++;
+        }
+        packet->iov[iovs].iov_base = sender->pending[i];
+        packet->iov[iovs].iov_len = sender->pending_len[i];
+        iovs++;
+
+        if ((sender->pending[i][0] & 0x60) > nri)
+            nri = sender->pending[i][0] & 0x60;
+    }
+    stap[0] = nri | NAL_STAP_A;
+    rtp_packet_done(sender, iovs);
+
+    sender->npending = 0;
+}
+
+/* Split NAL unit too big for single packet into FU-A fragments */
+static void
+rtp_send_fragmented(rtp_sender_t sender, uint8_t *nal, size_t len)
+{
+    size_t chunk = sender->max_payload - 2;
+    uint8_t header = nal[0];
+    size_t pos = 1;
+
+    while (pos < len) {
+        struct rtp_packet *packet = rtp_packet_new(sender);
+        uint8_t *fu = packet->prefix + RTP_HEADER_SIZE;
+        size_t n = (len - pos > chunk) ? chunk : len - pos;
+
+        fu[0] = (header & 0xe0) | NAL_FU_A;
+        fu[1] = header & 0x1f;
+        if (pos == 1)
+            fu[1] |= FU_START;
+        if (pos + n == len)
+            fu[1] |= FU_END;
+
+        packet->iov[0].iov_len += 2;
+        packet->iov[1].iov_base = nal + pos;
+        packet->iov[1].iov_len = n;
+        rtp_packet_done(sender, 2);
+        pos += n;
+    }
+}
+
+static void
+rtp_send_nal(rtp_sender_t sender, uint8_t *nal, size_t len)
+{
+    if (len == 0)
+        return;
+
+    if (len > sender->max_payload) {
+        rtp_send_pending(sender);
+        rtp_send_fragmented(sender, nal, len);
+        return;
+    }
+
+    /* STAP-A indicator, then 2-byte size before every NAL */
+    if ((sender->npending == RTP_STAP_MAX) ||
+        ((sender->npending > 0) && (sender->pending_size + 2 + len > sender->max_payload)))
+        rtp_send_pending(sender);
+
+    if (sender->npending == 0)
+        sender->pending_size = 1;
+    sender->pending[sender->npending] = nal;
+    sender->pending_len[sender->npending] = len;
+    sender->npending++;
+    sender->pending_size += 2 + len;
+}
+
+/*
+ * Encoder callback: @data is Annex B, either parameter sets or complete
+ * access unit. Everything is sent before returning since @data belongs
+ * to the encoder
+ */
+void
+rtp_sender_callback(void *arg, uint8_t *data, ssize_t len)
+{
+    rtp_sender_t sender = (rtp_sender_t)arg;
+    ssize_t pos, next;
+    int vcl = 0;
+
+    pos = h264_find_start_code(data, len);
+    while (pos >= 0) {
+        uint8_t *nal = data + pos + 4;
+
+        next = h264_find_start_code(nal, data + len - nal);
+        if ((nal < data + len) && (((nal[0] & 0x1f) >= 1) && ((nal[0] & 0x1f) <= 5)))
+            vcl = 1;
+        rtp_send_nal(sender, nal, (next >= 0) ? next : data + len - nal);
+        pos = (next >= 0) ? nal - data + next : -1;
+    }
+    rtp_send_pending(sender);
+
+    /* Marker bit ends the access unit */
+    if (vcl && (sender->count > 0))
+        sender->packets[sender->count - 1].prefix[1] |= RTP_MARKER;
+
+    rtp_flush(sender);
+}
+
+void
+rtp_sender_stats(rtp_sender_t sender, uint64_t *packets, uint64_t *bytes)
+{
+    *packets = sender->packets_sent;
+    *bytes = sender->bytes_sent;
+}
+
+void
+rtp_sender_close(rtp_sender_t sender)
+{
+    close(sender->fd);
+    free(sender);
+}
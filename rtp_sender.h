@@ -0,0 +1,48 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __RTP_SENDER_H__
+#define __RTP_SENDER_H__
+
+/*
+ * Sends encoded H264 over RTP/UDP (RFC 6184, packetization-mode=1):
+ * NAL units that fit in the MTU go as is or aggregated into STAP-A,
+ * larger ones are split into FU-A fragments
+ */
+
+#define RTP_DEFAULT_MTU     1400
+#define RTP_CLOCK_RATE      90000
+#define RTP_PAYLOAD_TYPE    96
+
+struct rtp_sender;
+typedef struct rtp_sender * rtp_sender_t;
+
+rtp_sender_t rtp_sender_open(const char *dest, int mtu);
+void rtp_sender_set_timestamp(rtp_sender_t sender, uint32_t timestamp);
+void rtp_sender_callback(void *arg, uint8_t *data, ssize_t len);
+void rtp_sender_stats(rtp_sender_t sender, uint64_t *packets, uint64_t *bytes);
+void rtp_sender_close(rtp_sender_t sender);
+
+#endif /* __RTP_SENDER_H__ */
@@ -0,0 +1,275 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Receives H264 RTP stream (single NAL, STAP-A, FU-A) on UDP port and
+ * writes it out as Annex B, e.g. to check rtp_sender over loopback.
+ * Stops when no packets arrive for -t ms after the first one
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdint.h>
+
+#define RECV_BATCH          64
+#define RECV_PACKET_SIZE    9000
+#define RECV_SOCKET_BUFFER  (4*1024*1024)
+
+#define RTP_HEADER_SIZE     12
+#define NAL_STAP_A          24
+#define NAL_FU_A            28
+#define FU_START            0x80
+#define FU_END              0x40
+
+struct receiver
+{
+    FILE                *out;
+    int                 have_seq;
+    uint16_t            seq;
+    /* Fragmented NAL is being reassembled */
+    int                 in_fu;
+
+    uint64_t            packets;
+    uint64_t            bytes;
+    uint64_t            nals;
+    uint64_t            lost;
+    uint64_t            access_units;
+};
+
+static const uint8_t start_code[4] = { 0, 0, 0, 1 };
+static volatile sig_atomic_t stop;
+
+static void
+usage(const char *exe)
+{
+    fprintf(stderr, "Usage: %s [-t idle_ms] port out.h264\n", exe);
+    exit(1);
+}
+
+static void
+on_signal(int sig)
+{
+    stop = 1;
+}
+
+static void
+write_nal(struct receiver *rx, const uint8_t *nal, size_t len)
+{
+    fwrite(start_code, 1, sizeof(start_code), rx->out);
+    fwrite(nal, 1, len, rx->out);
+    rx->nals++;
+}
+
+static void
+handle_packet(struct receiver *rx, const uint8_t *data, size_t len)
+{
+    size_t offset = RTP_HEADER_SIZE;
+    uint16_t seq;
+
+    if ((len < RTP_HEADER_SIZE) || ((data[0] >> 6) != 2))
+        return;
+
+    offset += (data[0] & 0x0f) * 4;
+    /* Header extension */
+    if ((data[0] & 0x10) && (len >= offset + 4))
+        offset += 4 + ((data[offset + 2] << 8) | data[offset + 3]) * 4;
+    /* Padding */
+    if ((data[0] & 0x20) && (len > offset))
+        len -= data[len - 1];
+    if (len <= offset)
+        return;
+
+    rx->packets++;
+    rx->bytes += len;
+
+    seq = (data[2] << 8) | data[3];
+    if (rx->have_seq && (seq != rx->seq)) {
+        uint16_t gap = seq - rx->seq;
+
+        /* Late or duplicate packet, too late to use it */
+        if (gap >= 0x8000)
+            return;
+        rx->lost += gap;
+        rx->in_fu = 0;
+    }
+    rx->have_seq = 1;
+    rx->seq = seq + 1;
+
+    if (data[1] & 0x80)
+        rx->access_units++;
+
+    data += offset;
+    len -= offset;
+
+    switch (data[0] & 0x1f) {
+        case NAL_STAP_A:
+            for (size_t pos = 1; pos + 2 <= len; ) {
+                size_t size = (data[pos] << 8) | data[pos + 1];
+
+                pos += 2;
+                if (pos + size > len)
+                    break;
+                write_nal(rx, data + pos, size);
+                pos += size;
+            }
+            break;
+        case NAL_FU_A:
+            if (len < 2)
+                break;
+            if (data[1] & FU_START) {
+                uint8_t header = (data[0] & 0xe0) | (data[1] & 0x1f);
+
+                fwrite(start_code, 1, sizeof(start_code), rx->out);
+                fwrite(&header, 1, 1, rx->out);
+                rx->in_fu = 1;
+                rx->nals++;
+            }
+            /* Fragments after a loss are useless */
+            if (rx->in_fu)
+                fwrite(data + 2, 1, len - 2, rx->out);
+            if (data[1] & FU_END)
+                rx->in_fu = 0;
+            break;
+        default:
+            if ((data[0] & 0x1f) < NAL_STAP_A)
+                write_nal(rx, data, len);
+            break;
+    }
+}
+
+int
+main(int argc, char * const *argv)
+{
+    struct receiver rx;
+    struct sockaddr_in6 addr;
+    struct mmsghdr msgs[RECV_BATCH];
+    struct iovec iov[RECV_BATCH];
+    struct pollfd pfd;
+    uint8_t *buffers;
+    const char *exe;
+    int fd, idle_ms, bufsize, off;
+    int ch;
+
+    exe = argv[0];
+    idle_ms = 2000;
+
+    while ((ch = getopt(argc, argv, "t:")) != -1) {
+        switch (ch) {
+            case 't':
+                     idle_ms = atoi(optarg);
+                     break;
+            case '?':
+            default:
+                     usage(exe);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if ((argc != 2) || (idle_ms <= 0))
+        usage(exe);
+
+    memset(&rx, 0, sizeof(rx));
+    rx.out = fopen(argv[1], "w");
+    if (rx.out == NULL) {
+        fprintf(stderr, "failed to open '%s' for writing: %s\n", argv[1], strerror(errno));
+        exit(1);
+    }
+
+    /* Dual-stack socket takes both IPv4 and IPv6 senders */
+    fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "failed to create socket: %s\n", strerror(errno));
+        exit(1);
+    }
+    off = 0;
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    /* Keyframes arrive as bursts of hundreds of packets */
+    bufsize = RECV_SOCKET_BUFFER;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(atoi(argv[0]));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "failed to bind to port %s: %s\n", argv[0], strerror(errno));
+        exit(1);
+    }
+
+    buffers = malloc((size_t)RECV_BATCH * RECV_PACKET_SIZE);
+    if (buffers == NULL) {
+        fprintf(stderr, "failed to allocate packet buffers\n");
+        exit(1);
+    }
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < RECV_BATCH; i++) {
+        iov[i].iov_base = buffers + (size_t)i * RECV_PACKET_SIZE;
+        iov[i].iov_len = RECV_PACKET_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (!stop) {
+        int n = poll(&pfd, 1, rx.packets ? idle_ms : -1);
+
+        if (n <= 0) {
+            if ((n < 0) && (errno == EINTR))
+                continue;
+            break;
+        }
+
+        n = recvmmsg(fd, msgs, RECV_BATCH, MSG_DONTWAIT, NULL);
+        for (int i = 0; i < n; i++)
+            handle_packet(&rx, iov[i].iov_base, msgs[i].msg_len);
+    }
+
+    fclose(rx.out);
+    close(fd);
+    free(buffers);
+
+    fprintf(stderr, "%llu packets, %llu bytes, %llu NAL units, %llu access units, %llu lost\n",
+        (unsigned long long)rx.packets, (unsigned long long)rx.bytes,
+        (unsigned long long)rx.nals, (unsigned long long)rx.access_units,
+        (unsigned long long)rx.lost);
+
+    return (0);
+}
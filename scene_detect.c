@@ -0,0 +1,173 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "yuv_reader.h"
+#include "yuv_ops.h"
+#include "scene_detect.h"
+
+#define DOWNSCALE       8
+#define HIST_BINS       32
+/* Weight of the new frame in the running average of differences */
+#define AVERAGE_WEIGHT  0.2
+
+struct scene_detect {
+    int                 width;
+    int                 height;
+    /* Downscaled luma of the current and the previous frame */
+    int                 small_width;
+    int                 small_height;
+    uint8_t             *small[2];
+    uint32_t            hist[2][HIST_BINS];
+    int                 current;
+    int                 frames;
+    double              average;
+    /* average holds a difference within a scene */
+    int                 seeded;
+
+    uint16_t            *sums;
+    uint32_t            *sad;
+};
+
+scene_detect_t
+scene_detect_create(int width, int height)
+{
+    scene_detect_t sd = calloc(1, sizeof(struct scene_detect));
+    size_t size;
+
+    if (sd == NULL)
+        return (NULL);
+
+    sd->width = width;
+    sd->height = height;
+    /* Partial blocks at the right and bottom edges are left out */
+    sd->small_width = width / DOWNSCALE;
+    sd->small_height = height / DOWNSCALE;
+    if ((sd->small_width == 0) || (sd->small_height == 0)) {
+        free(sd);
+        return (NULL);
+    }
+
+    size = (size_t)sd->small_width * sd->small_height;
+    sd->small[0] = malloc(size);
+    sd->small[1] = malloc(size);
+    sd->sums = malloc(sizeof(uint16_t) * sd->small_width);
+    sd->sad = malloc(sizeof(uint32_t) * ((sd->small_width + 15) / 16));
+    if ((sd->small[0] == NULL) || (sd->small[1] == NULL) || (sd->sums == NULL) ||
+            (sd->sad == NULL)) {
+        scene_detect_destroy(sd);
+        return (NULL);
+    }
+
+    return (sd);
+}
+
+/* 8x8 box downscale of luma into @small and its histogram */
+static void
+downscale(scene_detect_t sd, yuv_frame_t frame, uint8_t *small, uint32_t *hist)
+{
+    memset(hist, 0, sizeof(uint32_t) * HIST_BINS);
+    for (int y = 0; y < sd->small_height; y++) {
+        const uint8_t *src = frame->Y + (size_t)y * DOWNSCALE * frame->width;
+        uint8_t *dst = small + (size_t)y * sd->small_width;
+
+        memset(sd->sums, 0, sizeof(uint16_t) * sd->small_width);
+        for (int i = 0; i < DOWNSCALE; i++)
+            yuv_sum8_row(src + (size_t)i * frame->width, sd->small_width, sd->sums);
+        for (int x = 0; x < sd->small_width; x++) {
+            dst[x] = (sd->sums[x] + DOWNSCALE * DOWNSCALE / 2) / (DOWNSCALE * DOWNSCALE);
+            hist[dst[x] * HIST_BINS / 256]++;
+        }
+    }
+}
+
+/*
+ * Feed the next frame, returns 1 if it starts a new scene. Scores of
+ * the frame against the previous one go to @score if it is not NULL
+ */
+int
+scene_detect_frame(scene_detect_t sd, yuv_frame_t frame, struct scene_score *score)
+{
+    int cur = sd->current, prev = !sd->current;
+    size_t pixels = (size_t)sd->small_width * sd->small_height;
+    int blocks = (sd->small_width + 15) / 16;
+    uint64_t sad = 0, hist = 0;
+    double mad, hist_diff;
+    int cut;
+
+    downscale(sd, frame, sd->small[cur], sd->hist[cur]);
+    sd->current = prev;
+    if (sd->frames++ == 0) {
+        if (score)
+            memset(score, 0, sizeof(*score));
+        return (0);
+    }
+
+    for (int y = 0; y < sd->small_height; y++) {
+        size_t off = (size_t)y * sd->small_width;
+
+        memset(sd->sad, 0, sizeof(uint32_t) * blocks);
+        yuv_sad_blocks16(sd->small[cur] + off, sd->small[prev] + off, sd->small_width, sd->sad);
+        for (int b = 0; b < blocks; b++)
+            sad += sd->sad[b];
+    }
+    for (int i = 0; i < HIST_BINS; i++)
+        hist += abs((int)sd->hist[cur][i] - (int)sd->hist[prev][i]);
+
+    mad = (double)sad / pixels;
+    /* Every moved pixel is counted in two bins */
+    hist_diff = (double)hist / (2 * pixels);
+    if (score) {
+        score->mad = mad;
+        score->hist = hist_diff;
+    }
+
+    cut = (mad >= SCENE_MAD_MIN) && (hist_diff >= SCENE_HIST_MIN) &&
+        (!sd->seeded || (mad >= SCENE_MAD_RATIO * sd->average));
+
+    /* The jump at a cut is not representative of either scene */
+    if (cut)
+        return (cut);
+    if (!sd->seeded) {
+        sd->average = mad;
+        sd->seeded = 1;
+    } else
+        sd->average += (mad - sd->average) * AVERAGE_WEIGHT;
+
+    return (cut);
+}
+
+void
+scene_detect_destroy(scene_detect_t sd)
+{
+    free(sd->small[0]);
+    free(sd->small[1]);
+    free(sd->sums);
+    free(sd->sad);
+    free(sd);
+}
@@ -0,0 +1,55 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __SCENE_DETECT_H__
+#define __SCENE_DETECT_H__
+
+/*
+ * Scene cut detection on luma downscaled 8x8. A frame starts a new scene
+ * when both its mean absolute difference from the previous frame jumps
+ * well above the recent average and the luma histograms differ: motion
+ * alone changes the former, fades and flashes mostly the latter
+ */
+
+/* Cut needs mean absolute difference of at least that, 0-255 */
+#define SCENE_MAD_MIN           10.0
+/* ... that many times the average of the recent frames */
+#define SCENE_MAD_RATIO         3.0
+/* ... and at least that share of pixels in different histogram bins */
+#define SCENE_HIST_MIN          0.25
+
+struct scene_score {
+    double              mad;
+    double              hist;
+};
+
+struct scene_detect;
+typedef struct scene_detect * scene_detect_t;
+
+scene_detect_t scene_detect_create(int width, int height);
+int scene_detect_frame(scene_detect_t sd, yuv_frame_t frame, struct scene_score *score);
+void scene_detect_destroy(scene_detect_t sd);
+
+#endif /* __SCENE_DETECT_H__ */
@@ -0,0 +1,383 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "metrics.h"
+#include "video_codec.h"
+#include "h264_reader.h"
+#include "segment_writer.h"
+
+/* SPS and PPS emitted by the encoder at start */
+#define PARAM_SETS_MAX      1024
+
+struct segment_writer
+{
+    enum video_codec    codec;
+    char                *pattern;
+    char                *playlist;
+    /* Target segment duration, seconds */
+    double              target;
+    int                 fps;
+    size_t              prealloc;
+
+    uint8_t             param_sets[PARAM_SETS_MAX];
+    size_t              param_sets_len;
+
+    /* Segment being written, under temporary name */
+    int                 fd;
+    char                path[PATH_MAX];
+    char                tmp_path[PATH_MAX + 8];
+    off_t               written;
+    off_t               synced;
+    uint64_t            first_frame;
+
+    /* Input frame index of the packet being written */
+    uint64_t            frame;
+
+    /* Durations of completed segments for the playlist */
+    double              *durations;
+    int                 count;
+    int                 capacity;
+    double              max_duration;
+
+    /* Set by the first failure, no segments are written after it */
+    int                 error;
+};
+
+/*
+ * Pattern is used as printf format, allow only one integer conversion
+ */
+static int
+check_pattern(const char *pattern)
+{
+    int conversions = 0;
+
+    for (const char *p = pattern; *p; p++) {
+        if (*p != '%')
+            continue;
+        if (p[1] == '%') {
+            p++;
+            continue;
+        }
+        p++;
+        while ((*p >= '0') && (*p <= '9'))
+            p++;
+        if (*p != 'd')
+            return (-1);
+        conversions++;
+    }
+
+    return (conversions == 1 ? 0 : -1);
+}
+
+segment_writer_t
+segment_writer_open(const char *pattern, const char *playlist, enum video_codec codec,
+    double duration, int fps, size_t prealloc)
+{
+    segment_writer_t writer;
+
+    if (check_pattern(pattern) < 0) {
+        fprintf(stderr, "segment name pattern should have one %%d, got %s\n", pattern);
+        return (NULL);
+    }
+    if ((duration <= 0) || (fps <= 0))
+        return (NULL);
+
+    writer = calloc(1, sizeof(struct segment_writer));
+    if (writer == NULL)
+        return (NULL);
+
+    writer->codec = codec;
+    writer->pattern = strdup(pattern);
+    writer->playlist = playlist ? strdup(playlist) : NULL;
+    writer->target = duration;
+    writer->fps = fps;
+    writer->prealloc = prealloc;
+    writer->fd = -1;
+
+    return (writer);
+}
+
+/* Input frame index of the next packet, durations are derived from it */
+void
+segment_writer_set_frame(segment_writer_t writer, uint64_t index)
+{
+    writer->frame = index;
+}
+
+static int
+write_all(segment_writer_t writer, const uint8_t *data, size_t len)
+{
+    size_t total = 0;
+
+    while (total < len) {
+        ssize_t bytes = write(writer->fd, data + total, len - total);
+
+        if (bytes < 0) {
+            if ((errno == EINTR) || (errno == EAGAIN)) {
+                metrics_count(METRIC_EAGAIN, 1);
+                continue;
+            }
+            fprintf(stderr, "failed to write %s: %s\n", writer->tmp_path, strerror(errno));
+            return (-1);
+        }
+        total += bytes;
+    }
+
+    writer->written += total;
+    metrics_count(METRIC_BYTES_WRITTEN, total);
+
+    return (0);
+}
+
+static int
+write_playlist(segment_writer_t writer, int final)
+{
+    char tmp_path[PATH_MAX + 8];
+    FILE *f;
+
+    if (writer->playlist == NULL)
+        return (0);
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", writer->playlist);
+    f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "failed to open '%s' for writing: %s\n", tmp_path, strerror(errno));
+        return (-1);
+    }
+
+    fprintf(f, "#EXTM3U\n");
+    fprintf(f, "#EXT-X-VERSION:3\n");
+    fprintf(f, "#EXT-X-TARGETDURATION:%d\n", (int)ceil(writer->max_duration));
+    fprintf(f, "#EXT-X-MEDIA-SEQUENCE:0\n");
+    for (int i = 0; i < writer->count; i++) {
+        char path[PATH_MAX];
+        const char *name;
+
+        snprintf(path, sizeof(path), writer->pattern, i);
+        name = strrchr(path, '/');
+        fprintf(f, "#EXTINF:%.3f,\n%s\n", writer->durations[i], name ? name + 1 : path);
+    }
+    if (final)
+        fprintf(f, "#EXT-X-ENDLIST\n");
+
+    if (fclose(f) != 0)
+        return (-1);
+
+    /* Readers see either old or new playlist, never partial one */
+    return (rename(tmp_path, writer->playlist));
+}
+
+/*
+ * Complete current segment: drop unused preallocation, give it the final
+ * name and list it in the playlist
+ */
+static int
+finish_segment(segment_writer_t writer, uint64_t end_frame)
+{
+    double duration = (double)(end_frame - writer->first_frame) / writer->fps;
+    int ret = 0;
+
+    if (writer->fd < 0)
+        return (0);
+
+    if (ftruncate(writer->fd, writer->written) < 0)
+        ret = -1;
+    close(writer->fd);
+    writer->fd = -1;
+
+    if (rename(writer->tmp_path, writer->path) < 0) {
+        fprintf(stderr, "failed to rename %s: %s\n", writer->tmp_path, strerror(errno));
+        return (-1);
+    }
+
+    if (writer->count == writer->capacity) {
+        int capacity = writer->capacity ? writer->capacity * 2 : 64;
+        double *durations = realloc(writer->durations, capacity * sizeof(double));
+
+        if (durations == NULL)
+            return (-1);
+        writer->durations = durations;
+        writer->capacity = capacity;
+    }
+    writer->durations[writer->count++] = duration;
+    if (duration > writer->max_duration)
+        writer->max_duration = duration;
+
+    return (ret);
+}
+
+/*
+ * Drop incomplete segment after an error, so it never shows up under
+ * its final name
+ */
+static void
+fail_segment(segment_writer_t writer)
+{
+    writer->error = 1;
+    if (writer->fd < 0)
+        return;
+
+    close(writer->fd);
+    writer->fd = -1;
+    unlink(writer->tmp_path);
+}
+
+static int
+start_segment(segment_writer_t writer, int has_param_sets)
+{
+    snprintf(writer->path, sizeof(writer->path), writer->pattern, writer->count);
+    snprintf(writer->tmp_path, sizeof(writer->tmp_path), "%s.tmp", writer->path);
+
+    writer->fd = open(writer->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer->fd < 0) {
+        fprintf(stderr, "failed to open '%s' for writing: %s\n", writer->tmp_path, strerror(errno));
+        return (-1);
+    }
+
+    /* Contiguous blocks for the expected size, trimmed when segment is done */
+    if (writer->prealloc)
+        fallocate(writer->fd, FALLOC_FL_KEEP_SIZE, 0, writer->prealloc);
+
+    writer->written = 0;
+    writer->synced = 0;
+    writer->first_frame = writer->frame;
+
+    /* Every segment has to be decodable on its own */
+    if (!has_param_sets && writer->param_sets_len)
+        return (write_all(writer, writer->param_sets, writer->param_sets_len));
+
+    return (0);
+}
+
+/*
+ * Encoder callback: @data is parameter sets or complete access unit
+ */
+void
+segment_writer_callback(void *arg, uint8_t *data, ssize_t len)
+{
+    segment_writer_t writer = (segment_writer_t)arg;
+    uint64_t begin = metrics_stage_begin();
+    ssize_t pos;
+    int vcl = 0, idr = 0, sps = 0;
+
+    if (writer->error)
+        goto out;
+
+    for (pos = h264_find_start_code(data, len); pos >= 0; ) {
+        ssize_t next;
+
+        if (pos + 4 >= len)
+            break;
+        switch (h264_nal_kind(writer->codec, data + pos + 4, len - pos - 4)) {
+            case NAL_KIND_KEYFRAME:
+                idr = 1;
+                /* FALLTHROUGH */
+            case NAL_KIND_SLICE:
+                vcl = 1;
+                break;
+            case NAL_KIND_SPS:
+                sps = 1;
+                break;
+            default:
+                break;
+        }
+
+        next = h264_find_start_code(data + pos + 4, len - pos - 4);
+        pos = (next >= 0) ? pos + 4 + next : -1;
+    }
+
+    if (!vcl) {
+        /* Parameter sets go in front of every segment */
+        if (len <= PARAM_SETS_MAX) {
+            memcpy(writer->param_sets, data, len);
+            writer->param_sets_len = len;
+        }
+        if ((writer->fd >= 0) && (write_all(writer, data, len) < 0))
+            fail_segment(writer);
+        goto out;
+    }
+
+    if ((writer->fd >= 0) && idr &&
+            ((double)(writer->frame - writer->first_frame) / writer->fps >= writer->target)) {
+        if (finish_segment(writer, writer->frame) < 0) {
+            writer->error = 1;
+            goto out;
+        }
+        write_playlist(writer, 0);
+    }
+
+    if ((writer->fd < 0) && (start_segment(writer, sps) < 0)) {
+        fail_segment(writer);
+        goto out;
+    }
+
+    if (write_all(writer, data, len) < 0) {
+        fail_segment(writer);
+        goto out;
+    }
+
+    /* Start writeback now, don't wait for it */
+    sync_file_range(writer->fd, writer->synced, writer->written - writer->synced,
+        SYNC_FILE_RANGE_WRITE);
+    writer->synced = writer->written;
+
+out:
+    metrics_stage_end(METRIC_STAGE_WRITE, begin);
+}
+
+/*
+ * Finish the last segment, which ends after @frames input frames (skipped
+ * ones included), and mark the playlist complete. After a write error
+ * playlist is left listing the segments completed before it
+ */
+int
+segment_writer_close(segment_writer_t writer, uint64_t frames)
+{
+    int ret = -1;
+
+    if (!writer->error) {
+        ret = finish_segment(writer, frames);
+        if (write_playlist(writer, 1) < 0)
+            ret = -1;
+    }
+
+    free(writer->durations);
+    free(writer->pattern);
+    free(writer->playlist);
+    free(writer);
+
+    return (ret);
+}
@@ -0,0 +1,45 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __SEGMENT_WRITER_H__
+#define __SEGMENT_WRITER_H__
+
+/*
+ * Encoder output split into independently decodable segments: a new
+ * segment starts at the first IDR after the target duration and gets
+ * parameter sets in front. Segment files appear under their final name only
+ * when complete, playlist (M3U8 index) is updated at the same time
+ */
+
+struct segment_writer;
+typedef struct segment_writer * segment_writer_t;
+
+segment_writer_t segment_writer_open(const char *pattern, const char *playlist,
+    enum video_codec codec, double duration, int fps, size_t prealloc);
+void segment_writer_set_frame(segment_writer_t writer, uint64_t index);
+void segment_writer_callback(void *arg, uint8_t *data, ssize_t len);
+int segment_writer_close(segment_writer_t writer, uint64_t frames);
+
+#endif /* __SEGMENT_WRITER_H__ */
@@ -0,0 +1,98 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "yuv_reader.h"
+#include "synth.h"
+
+/* Size of checkerboard squares, log2 */
+#define SQUARE_SHIFT    5
+
+static void
+synth_luma(uint8_t *y, int width, int height, int stride, int index, int motion)
+{
+    int dx = index * motion;
+    int dy = index * motion / 2;
+
+    for (int row = 0; row < height; row++) {
+        uint8_t *p = y + (size_t)row * stride;
+        int sy = (row + dy) >> SQUARE_SHIFT;
+
+        for (int col = 0; col < width; col++) {
+            int square = (((col + dx) >> SQUARE_SHIFT) ^ sy) & 1;
+            p[col] = (square ? 180 : 40) + ((col + row) >> 4 & 31);
+        }
+    }
+}
+
+/* Chroma sample of the pixel (2*col, 2*row) */
+static inline uint8_t
+synth_u(int col, int index, int motion)
+{
+    return (96 + ((col * 2 + index * motion) >> 4 & 63));
+}
+
+static inline uint8_t
+synth_v(int row)
+{
+    return (96 + (row >> 3 & 63));
+}
+
+void
+synth_fill_i420(yuv_frame_t frame, int index, int motion)
+{
+    int cw = frame->width / 2;
+    int ch = frame->height / 2;
+
+    synth_luma(frame->Y, frame->width, frame->height, frame->width, index, motion);
+
+    for (int row = 0; row < ch; row++) {
+        uint8_t *u = frame->U + (size_t)row * cw;
+        uint8_t *v = frame->V + (size_t)row * cw;
+
+        for (int col = 0; col < cw; col++) {
+            u[col] = synth_u(col, index, motion);
+            v[col] = synth_v(row);
+        }
+    }
+}
+
+void
+synth_fill_nv12(uint8_t *y, uint8_t *uv, int width, int height,
+    int stride, int index, int motion)
+{
+    synth_luma(y, width, height, stride, index, motion);
+
+    for (int row = 0; row < height / 2; row++) {
+        uint8_t *p = uv + (size_t)row * stride;
+
+        for (int col = 0; col < width / 2; col++) {
+            p[col * 2] = synth_u(col, index, motion);
+            p[col * 2 + 1] = synth_v(row);
+        }
+    }
+}
@@ -0,0 +1,183 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/errno.h>
+#include <sys/syscall.h>
+
+#include "metrics.h"
+#include "trace.h"
+
+/* Events kept per thread, older ones are overwritten */
+#define TRACE_RING_EVENTS   (64*1024)
+
+struct trace_event {
+    /* Has to be a string literal, only the pointer is stored */
+    const char          *name;
+    uint64_t            ts_ns;
+    uint64_t            dur_ns;
+};
+
+struct trace_ring {
+    struct trace_ring   *next;
+    long                tid;
+    /* Total number of events written, only the owner thread updates it */
+    uint64_t            head;
+    struct trace_event  events[TRACE_RING_EVENTS];
+};
+
+static int enabled;
+static char *trace_path;
+/* Lock-free list of all rings, threads only push to it */
+static struct trace_ring *rings;
+static __thread struct trace_ring *thread_ring;
+
+static void
+trace_atexit(void)
+{
+    trace_flush();
+}
+
+/*
+ * Start recording events, they are written to @path at exit
+ */
+int
+trace_enable(const char *path)
+{
+    if (enabled)
+        return (-1);
+
+    trace_path = strdup(path);
+    if (trace_path == NULL)
+        return (-1);
+
+    atexit(trace_atexit);
+    __atomic_store_n(&enabled, 1, __ATOMIC_RELEASE);
+
+    return (0);
+}
+
+uint64_t
+trace_begin(void)
+{
+    if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED))
+        return (0);
+
+    return metrics_now_ns();
+}
+
+static struct trace_ring *
+trace_ring_create(void)
+{
+    struct trace_ring *ring = calloc(1, sizeof(struct trace_ring));
+
+    if (ring == NULL)
+        return (NULL);
+
+    ring->tid = syscall(SYS_gettid);
+    ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+    return (ring);
+}
+
+/*
+ * Record event @name that started at @begin (value of trace_begin)
+ * and ends now
+ */
+void
+trace_end(const char *name, uint64_t begin)
+{
+    struct trace_ring *ring = thread_ring;
+    struct trace_event *event;
+    uint64_t head;
+
+    if (begin == 0)
+        return;
+
+    if (ring == NULL) {
+        ring = thread_ring = trace_ring_create();
+        if (ring == NULL)
+            return;
+    }
+
+    head = ring->head;
+    event = &ring->events[head % TRACE_RING_EVENTS];
+    event->name = name;
+    event->ts_ns = begin;
+    event->dur_ns = metrics_now_ns() - begin;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Write all recorded events to the trace file. Called at exit, after
+ * pipeline threads are done
+ */
+int
+trace_flush(void)
+{
+    struct trace_ring *ring;
+    const char *sep = "";
+    pid_t pid = getpid();
+    FILE *f;
+    int ret;
+
+    if (!__atomic_exchange_n(&enabled, 0, __ATOMIC_ACQ_REL))
+        return (0);
+
+    f = fopen(trace_path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "failed to open '%s' for writing: %s\n", trace_path, strerror(errno));
+        return (-1);
+    }
+
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t first = (head > TRACE_RING_EVENTS) ? head - TRACE_RING_EVENTS : 0;
+
+        for (uint64_t i = first; i < head; i++) {
+            struct trace_event *event = &ring->events[i % TRACE_RING_EVENTS];
+
+            fprintf(f, "%s{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+                "\"pid\": %d, \"tid\": %ld}", sep, event->name, event->ts_ns / 1000.0,
+                event->dur_ns / 1000.0, (int)pid, ring->tid);
+            sep = ",\n";
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    ret = ferror(f) ? -1 : 0;
+    if (fclose(f))
+        ret = -1;
+
+    return (ret);
+}
@@ -0,0 +1,282 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdint.h>
+
+#include "yuv_reader.h"
+#include "video_codec.h"
+#include "h264_decoder_mpp.h"
+#include "h264_encoder_mpp.h"
+
+/* Give up flushing if decoder produced nothing for ~1 second */
+#define DRAIN_IDLE_POLLS    300
+
+/*
+ * Context shared by decoder and encoder callbacks
+ */
+struct transcoder
+{
+    int fd;
+    int bps;
+    int gop;
+    int failed;
+    int frames;
+    struct h264_encoder_mpp *encoder;
+    /* Layout of the frames the encoder was created for */
+    int width;
+    int height;
+    int h_stride;
+    int v_stride;
+};
+
+/*
+ * Called for every encoded packet. Writes h264 bitstream
+ * to the output file
+ */
+static void
+h264_writer_callback(void *ptr, uint8_t *data, ssize_t len)
+{
+    struct transcoder *transcoder = (struct transcoder *)ptr;
+    ssize_t bytes, total;
+
+    total = bytes = 0;
+    while (total < len) {
+        bytes = write(transcoder->fd, data + total, len - total);
+        if (bytes < 0) {
+            if (errno != EAGAIN) {
+                fprintf(stderr, "failed to write bitstream: %s\n", strerror(errno));
+                transcoder->failed = 1;
+                break;
+            }
+        }
+        else
+            total += bytes;
+    }
+}
+
+/*
+ * Called for every decoded frame. Hands the decoder buffer over to
+ * the encoder as is, pixels never leave MPP buffers
+ */
+static void
+frame_transcode_callback(void *ptr, void *buffer, int width, int height,
+    int h_stride, int v_stride)
+{
+    struct transcoder *transcoder = (struct transcoder *)ptr;
+    struct h264_encoder_params params;
+
+    if (transcoder->failed)
+        return;
+
+    /*
+     * Input switched resolution: finish the current encoder, the new one
+     * starts with its own SPS/PPS and IDR right after in the same output
+     */
+    if (transcoder->encoder && ((width != transcoder->width) ||
+        (height != transcoder->height) || (h_stride != transcoder->h_stride) ||
+        (v_stride != transcoder->v_stride))) {
+        h264_mpp_encoder_submit_buffer(transcoder->encoder, NULL, 1);
+        h264_mpp_encoder_destroy(transcoder->encoder);
+        transcoder->encoder = NULL;
+    }
+
+    /*
+     * Encoder is created lazily: frame dimensions and strides
+     * are known only after the first frame is decoded
+     */
+    if (transcoder->encoder == NULL) {
+        fprintf(stderr, "Input resolution: %dx%d (stride %dx%d)\n",
+            width, height, h_stride, v_stride);
+
+        h264_mpp_encoder_default_params(&params, width, height);
+        params.h_stride = h_stride;
+        params.v_stride = v_stride;
+        params.input = H264_ENCODER_INPUT_NV12;
+        params.bps = transcoder->bps;
+        params.gop = transcoder->gop;
+
+        transcoder->encoder = h264_mpp_encoder_create_with_params(&params,
+            h264_writer_callback, transcoder);
+        if (transcoder->encoder == NULL) {
+            fprintf(stderr, "failed to create H264 encoder\n");
+            transcoder->failed = 1;
+            return;
+        }
+        transcoder->width = width;
+        transcoder->height = height;
+        transcoder->h_stride = h_stride;
+        transcoder->v_stride = v_stride;
+    }
+
+    if (h264_mpp_encoder_submit_buffer(transcoder->encoder, buffer, 0) < 0) {
+        fprintf(stderr, "failed to encode frame %d\n", transcoder->frames);
+        transcoder->failed = 1;
+        return;
+    }
+
+    transcoder->frames++;
+}
+
+static void
+usage(const char *exe)
+{
+    fprintf(stderr, "Usage: %s [-b kbps] [-g gop] in.h264 out.h264\n", exe);
+    exit(1);
+}
+
+int
+main(int argc, char * const *argv)
+{
+    struct h264_decoder_mpp *decoder;
+    struct transcoder *transcoder;
+    const char *exe;
+    uint8_t *buf;
+    int buf_size;
+    ssize_t bytes;
+    int fd, ch, ret, idle;
+
+    exe = argv[0];
+
+    transcoder = (struct transcoder *)calloc(1, sizeof(struct transcoder));
+    if (transcoder == NULL) {
+        fprintf(stderr, "failed to allocate transcoder context\n");
+        exit(1);
+    }
+
+    /* Half of the encoder default: the point is to reduce bitrate */
+    transcoder->bps = 512*1024;
+    transcoder->gop = 30;
+
+    while ((ch = getopt(argc, argv, "b:g:")) != -1) {
+        switch (ch) {
+            case 'b':
+                     transcoder->bps = atoi(optarg) * 1024;
+                     break;
+            case 'g':
+                     transcoder->gop = atoi(optarg);
+                     break;
+            case '?':
+            default:
+                     usage(exe);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if ((argc != 2) || (transcoder->bps <= 0) || (transcoder->gop <= 0))
+        usage(exe);
+
+    fd = open(argv[0], O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "failed to open input file %s: %s\n", argv[0], strerror(errno));
+        exit(1);
+    }
+
+    transcoder->fd = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (transcoder->fd < 0) {
+        fprintf(stderr, "failed to open '%s' for writing: %s\n", argv[1], strerror(errno));
+        exit(1);
+    }
+
+    decoder = h264_mpp_decoder_create(NULL, NULL);
+    if (decoder == NULL) {
+        fprintf(stderr, "failed to create H264 decoder\n");
+        exit(1);
+    }
+    h264_decoder_mpp_set_buffer_callback(decoder, frame_transcode_callback, transcoder);
+
+    buf_size = 4*1024;
+    buf = malloc(buf_size);
+    if (buf == NULL) {
+        fprintf(stderr, "failed to allocate bitstream buffer\n");
+        exit(1);
+    }
+
+    int ready_for_new_buffer = 1;
+    bytes = 0;
+    while (!transcoder->failed) {
+        if (ready_for_new_buffer) {
+            bytes = read(fd, buf, buf_size);
+            if (bytes <= 0)
+                break;
+        } else
+            usleep(3000);
+
+        if (h264_decoder_mpp_submit_packet(decoder, buf, bytes) == EAGAIN)
+            ready_for_new_buffer = 0;
+        else
+            ready_for_new_buffer = 1;
+
+        h264_decoder_mpp_get_frame(decoder);
+    }
+
+    /*
+     * Flush frames still held by the decoder
+     */
+    while (!transcoder->failed && (h264_decoder_mpp_submit_eos(decoder) == EAGAIN)) {
+        h264_decoder_mpp_get_frame(decoder);
+        usleep(3000);
+    }
+
+    idle = 0;
+    while (!transcoder->failed && (idle < DRAIN_IDLE_POLLS)) {
+        int frames = transcoder->frames;
+
+        ret = h264_decoder_mpp_get_frame(decoder);
+        if ((ret == 1) || (ret < 0))
+            break;
+        if (transcoder->frames == frames) {
+            idle++;
+            usleep(3000);
+        }
+        else
+            idle = 0;
+    }
+
+    /* Generate EOS packet */
+    if (transcoder->encoder) {
+        h264_mpp_encoder_submit_buffer(transcoder->encoder, NULL, 1);
+        h264_mpp_encoder_destroy(transcoder->encoder);
+    }
+
+    fprintf(stderr, "%d frames transcoded\n", transcoder->frames);
+
+    h264_decoder_mpp_destroy(decoder);
+    free(buf);
+    close(fd);
+    close(transcoder->fd);
+    ret = transcoder->failed;
+    free(transcoder);
+
+    return (ret ? 1 : 0);
+}
@@ -0,0 +1,305 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * PSNR/SSIM of distorted video (e.g. decoder output) against reference
+ * (encoder input). Both files are raw 4:2:0, frames are read in batches
+ * and compared on all CPUs
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "quality.h"
+
+struct input
+{
+    const char          *path;
+    int                 fd;
+    enum quality_format format;
+    uint8_t             *frames[QUALITY_MAX_BATCH];
+};
+
+static size_t frame_size;
+
+static void
+usage(const char *exe)
+{
+    fprintf(stderr, "Usage: %s [-w width] [-h height] [-r i420|nv12] [-d i420|nv12] [-j threads]\n"
+        "    [-q] [-o report.json] reference.yuv distorted.yuv\n"
+        "  -r, -d  reference (i420) and distorted (nv12) file formats\n"
+        "  -j  worker threads, all online CPUs by default\n"
+        "  -q  don't print per-frame scores\n", exe);
+    exit(1);
+}
+
+static int
+parse_format(const char *name, enum quality_format *format)
+{
+    if (strcmp(name, "i420") == 0)
+        *format = QUALITY_I420;
+    else if (strcmp(name, "nv12") == 0)
+        *format = QUALITY_NV12;
+    else
+        return (-1);
+
+    return (0);
+}
+
+/*
+ * Returns 0 if the whole frame was read, 1 on EOF, -1 on error
+ */
+static int
+read_frame(struct input *input, uint8_t *buf)
+{
+    size_t done = 0;
+
+    while (done < frame_size) {
+        ssize_t bytes = read(input->fd, buf + done, frame_size - done);
+
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "failed to read %s: %s\n", input->path, strerror(errno));
+            return (-1);
+        }
+        if (bytes == 0) {
+            if (done > 0)
+                fprintf(stderr, "%s: incomplete frame at the end ignored\n", input->path);
+            return (1);
+        }
+        done += bytes;
+    }
+
+    return (0);
+}
+
+static void
+setup_image(struct quality_image *image, enum quality_format format, uint8_t *buf,
+    int width, int height)
+{
+    int cwidth = (width + 1) / 2, cheight = (height + 1) / 2;
+
+    image->format = format;
+    image->plane[0] = buf;
+    image->stride[0] = width;
+    image->plane[1] = buf + (size_t)width * height;
+    if (format == QUALITY_NV12) {
+        image->stride[1] = cwidth * 2;
+        image->plane[2] = NULL;
+        image->stride[2] = 0;
+    }
+    else {
+        image->stride[1] = cwidth;
+        image->plane[2] = image->plane[1] + (size_t)cwidth * cheight;
+        image->stride[2] = cwidth;
+    }
+}
+
+static void
+print_score(FILE *out, const char *label, const struct quality_score *score)
+{
+    fprintf(out, "%s PSNR Y %.3f U %.3f V %.3f all %.3f  SSIM Y %.5f U %.5f V %.5f all %.5f\n",
+        label, score->psnr[0], score->psnr[1], score->psnr[2], score->psnr_all,
+        score->ssim[0], score->ssim[1], score->ssim[2], score->ssim_all);
+}
+
+static void
+report_score(FILE *out, const char *indent, const struct quality_score *score)
+{
+    fprintf(out, "%s\"psnr\": {\"y\": %.4f, \"u\": %.4f, \"v\": %.4f, \"all\": %.4f},\n",
+        indent, score->psnr[0], score->psnr[1], score->psnr[2], score->psnr_all);
+    fprintf(out, "%s\"ssim\": {\"y\": %.6f, \"u\": %.6f, \"v\": %.6f, \"all\": %.6f}",
+        indent, score->ssim[0], score->ssim[1], score->ssim[2], score->ssim_all);
+}
+
+int
+main(int argc, char * const *argv)
+{
+    struct input inputs[2];
+    struct quality_image ref[QUALITY_MAX_BATCH], dist[QUALITY_MAX_BATCH];
+    struct quality_score scores[QUALITY_MAX_BATCH], total;
+    struct timespec start, end;
+    quality_t q;
+    const char *exe, *report = NULL;
+    FILE *out = NULL;
+    char label[32];
+    int width, height, threads, quiet, frames;
+    int ch, ret;
+
+    exe = argv[0];
+    memset(inputs, 0, sizeof(inputs));
+    inputs[0].format = QUALITY_I420;
+    inputs[1].format = QUALITY_NV12;
+    width = 1920;
+    height = 1080;
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    quiet = 0;
+
+    while ((ch = getopt(argc, argv, "d:h:j:o:qr:w:")) != -1) {
+        switch (ch) {
+            case 'd':
+                     if (parse_format(optarg, &inputs[1].format) < 0)
+                         usage(exe);
+                     break;
+            case 'h':
+                     height = atoi(optarg);
+                     break;
+            case 'j':
+                     threads = atoi(optarg);
+                     break;
+            case 'o':
+                     report = optarg;
+                     break;
+            case 'q':
+                     quiet = 1;
+                     break;
+            case 'r':
+                     if (parse_format(optarg, &inputs[0].format) < 0)
+                         usage(exe);
+                     break;
+            case 'w':
+                     width = atoi(optarg);
+                     break;
+            case '?':
+            default:
+                     usage(exe);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if ((argc != 2) || (width <= 0) || (height <= 0) || (threads < 1))
+        usage(exe);
+
+    frame_size = (size_t)width * height + (size_t)((width + 1) / 2) * ((height + 1) / 2) * 2;
+
+    for (int i = 0; i < 2; i++) {
+        inputs[i].path = argv[i];
+        inputs[i].fd = open(argv[i], O_RDONLY);
+        if (inputs[i].fd < 0) {
+            fprintf(stderr, "failed to open input file %s: %s\n", argv[i], strerror(errno));
+            exit(1);
+        }
+        for (int f = 0; f < QUALITY_MAX_BATCH; f++) {
+            inputs[i].frames[f] = malloc(frame_size);
+            if (inputs[i].frames[f] == NULL) {
+                fprintf(stderr, "failed to allocate frame buffers\n");
+                exit(1);
+            }
+            setup_image(i ? &dist[f] : &ref[f], inputs[i].format, inputs[i].frames[f],
+                width, height);
+        }
+    }
+
+    q = quality_create(width, height, threads);
+    if (q == NULL) {
+        fprintf(stderr, "failed to create quality context\n");
+        exit(1);
+    }
+
+    if (report) {
+        out = fopen(report, "w");
+        if (out == NULL) {
+            fprintf(stderr, "failed to open '%s' for writing: %s\n", report, strerror(errno));
+            exit(1);
+        }
+        fprintf(out, "{\n");
+        fprintf(out, "  \"width\": %d,\n", width);
+        fprintf(out, "  \"height\": %d,\n", height);
+        fprintf(out, "  \"per_frame\": [");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    frames = 0;
+    ret = 0;
+    while (ret == 0) {
+        int count;
+
+        /* Stop at the end of the shorter file */
+        for (count = 0; count < QUALITY_MAX_BATCH; count++) {
+            ret = read_frame(&inputs[0], inputs[0].frames[count]);
+            if (ret == 0)
+                ret = read_frame(&inputs[1], inputs[1].frames[count]);
+            if (ret != 0)
+                break;
+        }
+
+        if (count == 0)
+            break;
+
+        if (quality_compare(q, ref, dist, count, scores) < 0) {
+            fprintf(stderr, "failed to compare frames\n");
+            ret = -1;
+            break;
+        }
+
+        for (int f = 0; f < count; f++, frames++) {
+            if (!quiet) {
+                snprintf(label, sizeof(label), "frame %d:", frames);
+                print_score(stdout, label, &scores[f]);
+            }
+            if (out) {
+                fprintf(out, "%s\n    {\n", frames ? "," : "");
+                report_score(out, "      ", &scores[f]);
+                fprintf(out, "\n    }");
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    quality_summary(q, &total);
+    snprintf(label, sizeof(label), "%d frames:", frames);
+    print_score(stdout, label, &total);
+    fprintf(stderr, "%d frames compared in %.2f s\n", frames,
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    if (out) {
+        fprintf(out, "\n  ],\n");
+        fprintf(out, "  \"frames\": %d,\n", frames);
+        report_score(out, "  ", &total);
+        fprintf(out, "\n}\n");
+        fclose(out);
+    }
+
+    quality_destroy(q);
+    for (int i = 0; i < 2; i++) {
+        close(inputs[i].fd);
+        for (int f = 0; f < QUALITY_MAX_BATCH; f++)
+            free(inputs[i].frames[f]);
+    }
+
+    return (ret < 0 ? 1 : 0);
+}
@@ -0,0 +1,509 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define YUV_OPS_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define YUV_OPS_SSE2
+#endif
+
+#include "yuv_ops.h"
+
+/*
+ * Copy @height rows of @width bytes between buffers with different strides
+ */
+void
+yuv_copy_plane(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+    int width, int height)
+{
+    /* Common case, both planes are tightly packed */
+    if ((dst_stride == width) && (src_stride == width)) {
+        memcpy(dst, src, (size_t)width * height);
+        return;
+    }
+
+    for (int i = 0; i < height; i++)
+        memcpy(dst + (size_t)i * dst_stride, src + (size_t)i * src_stride, width);
+}
+
+/*
+ * dst = (a * (128 - weight) + b * weight) / 128, rounded
+ */
+void
+yuv_blend_rows(uint8_t *dst, const uint8_t *a, const uint8_t *b, int len, int weight)
+{
+    int i = 0;
+
+    if (weight == 0) {
+        memcpy(dst, a, len);
+        return;
+    }
+
+    if (weight == YUV_BLEND_ONE) {
+        memcpy(dst, b, len);
+        return;
+    }
+
+#if defined(YUV_OPS_NEON)
+    uint8x8_t wa = vdup_n_u8(YUV_BLEND_ONE - weight);
+    uint8x8_t wb = vdup_n_u8(weight);
+
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t va = vld1q_u8(a + i);
+        uint8x16_t vb = vld1q_u8(b + i);
+        uint16x8_t lo = vmull_u8(vget_low_u8(va), wa);
+        uint16x8_t hi = vmull_u8(vget_high_u8(va), wa);
+        lo = vmlal_u8(lo, vget_low_u8(vb), wb);
+        hi = vmlal_u8(hi, vget_high_u8(vb), wb);
+        vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, YUV_BLEND_SHIFT),
+            vrshrn_n_u16(hi, YUV_BLEND_SHIFT)));
+    }
+#elif defined(YUV_OPS_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    __m128i wa = _mm_set1_epi16(YUV_BLEND_ONE - weight);
+    __m128i wb = _mm_set1_epi16(weight);
+    __m128i round = _mm_set1_epi16(YUV_BLEND_ONE / 2);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+            _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+            _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, round), YUV_BLEND_SHIFT);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, round), YUV_BLEND_SHIFT);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; i < len; i++)
+        dst[i] = (a[i] * (YUV_BLEND_ONE - weight) + b[i] * weight
+            + YUV_BLEND_ONE / 2) >> YUV_BLEND_SHIFT;
+}
+
+/*
+ * Horizontal linear interpolation, tables split into blocks of 16 output
+ * pixels. On AArch64 a block whose source pairs fit in a 64-byte window
+ * (downscale by up to ~3.9) is done with two table lookups into the
+ * window. SSE2 has no byte shuffle, gathering pairs with scalar loads
+ * for a vector blend measured slower than the plain loop, so x86 and
+ * 32-bit ARM use the latter
+ */
+#define HSCALE_BLOCK        16
+#define HSCALE_WINDOW       64
+
+struct yuv_hscale {
+    int                 len;
+    int                 *off;
+    uint8_t             *weight;
+    /* Per block: start of the source window, -1 if the block doesn't fit one */
+    int                 *base;
+    /* Offsets of the first samples of pairs within the window */
+    uint8_t             *index;
+};
+
+/*
+ * Output pixel x blends src[@off[x]] and src[@off[x] + 1] by @weight[x].
+ * Rows passed to yuv_hscale_row have @src_len readable bytes
+ */
+struct yuv_hscale *
+yuv_hscale_create(const int *off, const uint8_t *weight, int len, int src_len)
+{
+    struct yuv_hscale *hs;
+    int blocks = len / HSCALE_BLOCK;
+
+    hs = calloc(1, sizeof(struct yuv_hscale));
+    if (hs == NULL)
+        return (NULL);
+
+    hs->len = len;
+    hs->off = malloc(sizeof(int) * len);
+    hs->weight = malloc(len);
+    hs->base = malloc(sizeof(int) * (blocks + 1));
+    hs->index = malloc((size_t)blocks * HSCALE_BLOCK + 1);
+    if (!hs->off || !hs->weight || !hs->base || !hs->index) {
+        yuv_hscale_destroy(hs);
+        return (NULL);
+    }
+
+    memcpy(hs->off, off, sizeof(int) * len);
+    memcpy(hs->weight, weight, len);
+
+    for (int b = 0; b < blocks; b++) {
+        const int *o = off + b * HSCALE_BLOCK;
+
+        /* Offsets never decrease, the last pair bounds the window */
+        hs->base[b] = o[0];
+        if ((o[HSCALE_BLOCK - 1] + 1 - o[0] >= HSCALE_WINDOW) ||
+                (o[0] + HSCALE_WINDOW > src_len)) {
+            hs->base[b] = -1;
+            continue;
+        }
+        for (int i = 0; i < HSCALE_BLOCK; i++)
+            hs->index[b * HSCALE_BLOCK + i] = o[i] - o[0];
+    }
+
+    return (hs);
+}
+
+void
+yuv_hscale_destroy(struct yuv_hscale *hs)
+{
+    if (hs == NULL)
+        return;
+
+    free(hs->off);
+    free(hs->weight);
+    free(hs->base);
+    free(hs->index);
+    free(hs);
+}
+
+static inline void
+hscale_c(const struct yuv_hscale *hs, uint8_t *dst, const uint8_t *src, int first, int last)
+{
+    for (int x = first; x < last; x++) {
+        int off = hs->off[x];
+        int w = hs->weight[x];
+
+        dst[x] = (src[off] * (YUV_BLEND_ONE - w) + src[off + 1] * w
+            + YUV_BLEND_ONE / 2) >> YUV_BLEND_SHIFT;
+    }
+}
+
+void
+yuv_hscale_row(const struct yuv_hscale *hs, uint8_t *dst, const uint8_t *src)
+{
+    int x = 0;
+
+#if defined(YUV_OPS_NEON) && defined(__aarch64__)
+    uint8x16_t one = vdupq_n_u8(1);
+    uint8x16_t full = vdupq_n_u8(YUV_BLEND_ONE);
+
+    for (; x + HSCALE_BLOCK <= hs->len; x += HSCALE_BLOCK) {
+        int base = hs->base[x / HSCALE_BLOCK];
+        uint8x16x4_t window;
+        uint8x16_t ia, va, vb, wa, wb;
+        uint16x8_t lo, hi;
+
+        if (base < 0) {
+            hscale_c(hs, dst, src, x, x + HSCALE_BLOCK);
+            continue;
+        }
+
+        window.val[0] = vld1q_u8(src + base);
+        window.val[1] = vld1q_u8(src + base + 16);
+        window.val[2] = vld1q_u8(src + base + 32);
+        window.val[3] = vld1q_u8(src + base + 48);
+        ia = vld1q_u8(hs->index + x);
+        va = vqtbl4q_u8(window, ia);
+        vb = vqtbl4q_u8(window, vaddq_u8(ia, one));
+        wb = vld1q_u8(hs->weight + x);
+        wa = vsubq_u8(full, wb);
+
+        lo = vmull_u8(vget_low_u8(va), vget_low_u8(wa));
+        hi = vmull_u8(vget_high_u8(va), vget_high_u8(wa));
+        lo = vmlal_u8(lo, vget_low_u8(vb), vget_low_u8(wb));
+        hi = vmlal_u8(hi, vget_high_u8(vb), vget_high_u8(wb));
+        vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(lo, YUV_BLEND_SHIFT),
+            vrshrn_n_u16(hi, YUV_BLEND_SHIFT)));
+    }
+#endif
+
+    hscale_c(hs, dst, src, x, hs->len);
+}
+
+/*
+ * Box downscale by integer @factor. Plane consists of @dst_width pixels
+ * per row, @channels interleaved samples each (2 for NV12 UV plane)
+ */
+void
+yuv_decimate_plane(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+    int dst_width, int dst_height, int factor, int channels)
+{
+    int area = factor * factor;
+
+    for (int y = 0; y < dst_height; y++) {
+        const uint8_t *block_row = src + (size_t)y * factor * src_stride;
+        uint8_t *out = dst + (size_t)y * dst_stride;
+
+        for (int x = 0; x < dst_width; x++) {
+            for (int c = 0; c < channels; c++) {
+                const uint8_t *p = block_row + (x * factor) * channels + c;
+                unsigned int sum = 0;
+
+                for (int i = 0; i < factor; i++) {
+                    for (int j = 0; j < factor; j++)
+                        sum += p[j * channels];
+                    p += src_stride;
+                }
+                out[x * channels + c] = (sum + area / 2) / area;
+            }
+        }
+    }
+}
+
+/*
+ * Sum of absolute differences of every 16-byte chunk of rows @a and @b,
+ * accumulated into @acc[chunk]. The last chunk may be partial
+ */
+void
+yuv_sad_blocks16(const uint8_t *a, const uint8_t *b, int len, uint32_t *acc)
+{
+    int i = 0;
+
+#if defined(YUV_OPS_NEON)
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+#if defined(__aarch64__)
+        acc[i / 16] += vaddlvq_u8(d);
+#else
+        uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(d)));
+        acc[i / 16] += vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1);
+#endif
+    }
+#elif defined(YUV_OPS_SSE2)
+    for (; i + 16 <= len; i += 16) {
+        __m128i s = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(a + i)),
+            _mm_loadu_si128((const __m128i *)(b + i)));
+        acc[i / 16] += _mm_cvtsi128_si32(s) + _mm_extract_epi16(s, 4);
+    }
+#endif
+
+    for (; i < len; i++)
+        acc[i / 16] += abs(a[i] - b[i]);
+}
+
+/*
+ * Sum of squared differences of rows @a and @b
+ */
+uint64_t
+yuv_sse_row(const uint8_t *a, const uint8_t *b, int len)
+{
+    uint64_t sse = 0;
+    int i = 0;
+
+#if defined(YUV_OPS_NEON)
+    uint64x2_t acc = vdupq_n_u64(0);
+
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        uint32x4_t s = vpaddlq_u16(vmull_u8(vget_low_u8(d), vget_low_u8(d)));
+        s = vpadalq_u16(s, vmull_u8(vget_high_u8(d), vget_high_u8(d)));
+        acc = vpadalq_u32(acc, s);
+    }
+    sse = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#elif defined(YUV_OPS_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    uint64_t lanes[2];
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        __m128i lo = _mm_unpacklo_epi8(d, zero);
+        __m128i hi = _mm_unpackhi_epi8(d, zero);
+        __m128i s = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+        acc = _mm_add_epi64(acc, _mm_add_epi64(_mm_unpacklo_epi32(s, zero),
+            _mm_unpackhi_epi32(s, zero)));
+    }
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    sse = lanes[0] + lanes[1];
+#endif
+
+    for (; i < len; i++)
+        sse += (a[i] - b[i]) * (a[i] - b[i]);
+
+    return (sse);
+}
+
+/*
+ * SSIM statistics of @blocks 4x4 blocks in 4-row strips of @a and @b:
+ * sum of a, sum of b, sum of a^2 + b^2 and sum of a*b per block
+ */
+void
+yuv_ssim_sums4x4(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+    int blocks, int32_t (*sums)[4])
+{
+    int x = 0;
+
+#if defined(YUV_OPS_NEON)
+    /* Two blocks at a time */
+    for (; x + 2 <= blocks; x += 2) {
+        uint16x8_t sa = vdupq_n_u16(0), sb = vdupq_n_u16(0);
+        uint32x4_t ss = vdupq_n_u32(0), sab = vdupq_n_u32(0);
+
+        for (int r = 0; r < 4; r++) {
+            uint8x8_t va = vld1_u8(a + r * a_stride + x * 4);
+            uint8x8_t vb = vld1_u8(b + r * b_stride + x * 4);
+            sa = vaddw_u8(sa, va);
+            sb = vaddw_u8(sb, vb);
+            ss = vpadalq_u16(ss, vmull_u8(va, va));
+            ss = vpadalq_u16(ss, vmull_u8(vb, vb));
+            sab = vpadalq_u16(sab, vmull_u8(va, vb));
+        }
+
+        /* 32-bit lanes 0-1 belong to the first block, 2-3 to the second */
+        uint32x4_t ta = vpaddlq_u16(sa), tb = vpaddlq_u16(sb);
+        uint32x2_t s1 = vpadd_u32(vget_low_u32(ta), vget_high_u32(ta));
+        uint32x2_t s2 = vpadd_u32(vget_low_u32(tb), vget_high_u32(tb));
+        uint32x2_t s3 = vpadd_u32(vget_low_u32(ss), vget_high_u32(ss));
+        uint32x2_t s4 = vpadd_u32(vget_low_u32(sab), vget_high_u32(sab));
+        uint32_t out[4][2];
+
+        vst1_u32(out[0], s1);
+        vst1_u32(out[1], s2);
+        vst1_u32(out[2], s3);
+        vst1_u32(out[3], s4);
+        for (int n = 0; n < 4; n++) {
+            sums[x][n] = out[n][0];
+            sums[x + 1][n] = out[n][1];
+        }
+    }
+#elif defined(YUV_OPS_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    __m128i ones = _mm_set1_epi16(1);
+
+    /* Two blocks at a time */
+    for (; x + 2 <= blocks; x += 2) {
+        __m128i sa = zero, sb = zero, ss = zero, sab = zero;
+        __m128i v[4];
+
+        for (int r = 0; r < 4; r++) {
+            __m128i va = _mm_unpacklo_epi8(_mm_loadl_epi64(
+                (const __m128i *)(a + r * a_stride + x * 4)), zero);
+            __m128i vb = _mm_unpacklo_epi8(_mm_loadl_epi64(
+                (const __m128i *)(b + r * b_stride + x * 4)), zero);
+            sa = _mm_add_epi16(sa, va);
+            sb = _mm_add_epi16(sb, vb);
+            ss = _mm_add_epi32(ss, _mm_add_epi32(_mm_madd_epi16(va, va),
+                _mm_madd_epi16(vb, vb)));
+            sab = _mm_add_epi32(sab, _mm_madd_epi16(va, vb));
+        }
+
+        /* 32-bit lanes 0-1 belong to the first block, 2-3 to the second */
+        v[0] = _mm_madd_epi16(sa, ones);
+        v[1] = _mm_madd_epi16(sb, ones);
+        v[2] = ss;
+        v[3] = sab;
+        for (int n = 0; n < 4; n++) {
+            __m128i s = _mm_add_epi32(v[n], _mm_shuffle_epi32(v[n], _MM_SHUFFLE(2, 3, 0, 1)));
+            sums[x][n] = _mm_cvtsi128_si32(s);
+            sums[x + 1][n] = _mm_cvtsi128_si32(_mm_srli_si128(s, 8));
+        }
+    }
+#endif
+
+    for (; x < blocks; x++) {
+        int32_t s1 = 0, s2 = 0, ss = 0, s12 = 0;
+
+        for (int r = 0; r < 4; r++) {
+            for (int i = 0; i < 4; i++) {
+                int pa = a[r * a_stride + x * 4 + i];
+                int pb = b[r * b_stride + x * 4 + i];
+                s1 += pa;
+                s2 += pb;
+                ss += pa * pa + pb * pb;
+                s12 += pa * pb;
+            }
+        }
+        sums[x][0] = s1;
+        sums[x][1] = s2;
+        sums[x][2] = ss;
+        sums[x][3] = s12;
+    }
+}
+
+/*
+ * Split @len interleaved UV pairs (NV12 chroma row) into @u and @v rows
+ */
+void
+yuv_split_uv(uint8_t *u, uint8_t *v, const uint8_t *uv, int len)
+{
+    int i = 0;
+
+#if defined(YUV_OPS_NEON)
+    for (; i + 16 <= len; i += 16) {
+        uint8x16x2_t p = vld2q_u8(uv + 2 * i);
+        vst1q_u8(u + i, p.val[0]);
+        vst1q_u8(v + i, p.val[1]);
+    }
+#elif defined(YUV_OPS_SSE2)
+    __m128i mask = _mm_set1_epi16(0xff);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(uv + 2 * i));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(uv + 2 * i + 16));
+        _mm_storeu_si128((__m128i *)(u + i), _mm_packus_epi16(_mm_and_si128(lo, mask),
+            _mm_and_si128(hi, mask)));
+        _mm_storeu_si128((__m128i *)(v + i), _mm_packus_epi16(_mm_srli_epi16(lo, 8),
+            _mm_srli_epi16(hi, 8)));
+    }
+#endif
+
+    for (; i < len; i++) {
+        u[i] = uv[2 * i];
+        v[i] = uv[2 * i + 1];
+    }
+}
+
+/*
+ * Sums of @blocks consecutive groups of 8 pixels of row @src, added to
+ * @acc[group]. Eight rows of sums make 8x8 box downscale
+ */
+void
+yuv_sum8_row(const uint8_t *src, int blocks, uint16_t *acc)
+{
+    int i = 0;
+
+#if defined(YUV_OPS_NEON)
+    for (; i + 2 <= blocks; i += 2) {
+        uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vld1q_u8(src + i * 8))));
+        acc[i] += vgetq_lane_u64(s, 0);
+        acc[i + 1] += vgetq_lane_u64(s, 1);
+    }
+#elif defined(YUV_OPS_SSE2)
+    __m128i zero = _mm_setzero_si128();
+
+    for (; i + 2 <= blocks; i += 2) {
+        __m128i s = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(src + i * 8)), zero);
+        acc[i] += _mm_cvtsi128_si32(s);
+        acc[i + 1] += _mm_extract_epi16(s, 4);
+    }
+#endif
+
+    for (; i < blocks; i++) {
+        for (int j = 0; j < 8; j++)
+            acc[i] += src[i * 8 + j];
+    }
+}
@@ -0,0 +1,55 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __YUV_OPS_H__
+#define __YUV_OPS_H__
+
+/*
+ * Pixel processing kernels. NEON on ARM, SSE2 on x86, plain C elsewhere
+ */
+
+/* Blend weights are 7-bit: 0 selects @a, 128 selects @b */
+#define YUV_BLEND_SHIFT     7
+#define YUV_BLEND_ONE       (1 << YUV_BLEND_SHIFT)
+
+/* Precomputed horizontal interpolation of rows, see yuv_hscale_create */
+struct yuv_hscale;
+
+void yuv_copy_plane(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+    int width, int height);
+void yuv_blend_rows(uint8_t *dst, const uint8_t *a, const uint8_t *b, int len, int weight);
+struct yuv_hscale * yuv_hscale_create(const int *off, const uint8_t *weight, int len, int src_len);
+void yuv_hscale_row(const struct yuv_hscale *hs, uint8_t *dst, const uint8_t *src);
+void yuv_hscale_destroy(struct yuv_hscale *hs);
+void yuv_decimate_plane(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+    int dst_width, int dst_height, int factor, int channels);
+void yuv_sad_blocks16(const uint8_t *a, const uint8_t *b, int len, uint32_t *acc);
+uint64_t yuv_sse_row(const uint8_t *a, const uint8_t *b, int len);
+void yuv_ssim_sums4x4(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride,
+    int blocks, int32_t (*sums)[4]);
+void yuv_split_uv(uint8_t *u, uint8_t *v, const uint8_t *uv, int len);
+void yuv_sum8_row(const uint8_t *src, int blocks, uint16_t *acc);
+
+#endif /* __YUV_OPS_H__ */
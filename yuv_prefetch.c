@@ -0,0 +1,297 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "yuv_reader.h"
+#include "frame_pool.h"
+#include "yuv_prefetch.h"
+#include "cpu_affinity.h"
+#include "metrics.h"
+#include "trace.h"
+
+/*
+ * Single-producer/single-consumer ring of frame pointers. Capacity is
+ * the number of frames in the pool, so push never has to wait
+ */
+struct frame_queue
+{
+    yuv_frame_t         *slots;
+    int                 size;
+    /* Written by producer only */
+    uint64_t            head;
+    /* Written by consumer only */
+    uint64_t            tail;
+    /* Consumer is about to sleep on the eventfd */
+    int                 waiting;
+    int                 fd;
+};
+
+struct yuv_prefetch
+{
+    yuv_reader_t        reader;
+    frame_pool_t        pool;
+    int                 threaded;
+
+    /* Reader to consumer, NULL frame marks end of input */
+    struct frame_queue  ready;
+    /* Consumer to reader, NULL frame asks reader to quit */
+    struct frame_queue  free;
+
+    pthread_t           thread;
+    int                 done;
+    uint64_t            stalls;
+};
+
+static int
+queue_init(struct frame_queue *q, int size)
+{
+    memset(q, 0, sizeof(*q));
+    q->slots = calloc(size, sizeof(yuv_frame_t));
+    if (q->slots == NULL)
+        return (-1);
+    q->size = size;
+    q->fd = eventfd(0, EFD_CLOEXEC);
+    if (q->fd < 0) {
+        free(q->slots);
+        return (-1);
+    }
+
+    return (0);
+}
+
+static void
+queue_destroy(struct frame_queue *q)
+{
+    close(q->fd);
+    free(q->slots);
+}
+
+static void
+queue_push(struct frame_queue *q, yuv_frame_t frame)
+{
+    uint64_t head = q->head;
+
+    q->slots[head % q->size] = frame;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->waiting, __ATOMIC_SEQ_CST))
+        eventfd_write(q->fd, 1);
+}
+
+/* Frames in the queue, either side may ask */
+static int
+queue_length(struct frame_queue *q)
+{
+    return (__atomic_load_n(&q->head, __ATOMIC_SEQ_CST) - __atomic_load_n(&q->tail, __ATOMIC_SEQ_CST));
+}
+
+/*
+ * Take the next frame, sleeping while the queue is empty. Returns 1
+ * in @waited if it had to
+ */
+static yuv_frame_t
+queue_pop(struct frame_queue *q, int *waited)
+{
+    uint64_t tail = q->tail;
+    yuv_frame_t frame;
+    eventfd_t value;
+
+    *waited = 0;
+    while (__atomic_load_n(&q->head, __ATOMIC_SEQ_CST) == tail) {
+        *waited = 1;
+        __atomic_store_n(&q->waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&q->head, __ATOMIC_SEQ_CST) == tail)
+            eventfd_read(q->fd, &value);
+        __atomic_store_n(&q->waiting, 0, __ATOMIC_SEQ_CST);
+    }
+
+    frame = q->slots[tail % q->size];
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+    return (frame);
+}
+
+static void *
+prefetch_thread(void *arg)
+{
+    struct yuv_prefetch *prefetch = arg;
+    yuv_frame_t frame;
+    uint64_t tr;
+    int waited;
+
+    cpu_affinity_apply(CPU_ROLE_READER);
+
+    while ((frame = queue_pop(&prefetch->free, &waited)) != NULL) {
+        tr = trace_begin();
+        if (yuv_read_frame(prefetch->reader, frame) != 0) {
+            queue_push(&prefetch->ready, NULL);
+            break;
+        }
+        trace_end("prefetch_read", tr);
+        queue_push(&prefetch->ready, frame);
+        metrics_gauge(METRIC_PREFETCH_QUEUE, queue_length(&prefetch->ready));
+    }
+
+    return (NULL);
+}
+
+/*
+ * Start reading frames of @reader ahead, up to @depth of them beyond
+ * @held (at least 1) the consumer keeps at once. Frames come from a pool
+ * created with @pool_flags
+ */
+yuv_prefetch_t
+yuv_prefetch_start(yuv_reader_t reader, int depth, int held, int pool_flags)
+{
+    struct yuv_prefetch *prefetch;
+    int frames;
+
+    if ((depth < 0) || (held < 1))
+        return (NULL);
+
+    prefetch = calloc(1, sizeof(struct yuv_prefetch));
+    if (prefetch == NULL)
+        return (NULL);
+    prefetch->reader = reader;
+    prefetch->threaded = (depth > 0);
+
+    frames = depth + held;
+    prefetch->pool = frame_pool_create(reader->width, reader->height, frames, 0, pool_flags);
+    if (prefetch->pool == NULL) {
+        free(prefetch);
+        return (NULL);
+    }
+
+    if (!prefetch->threaded)
+        return (prefetch);
+
+    /* Room for all frames and the end marker */
+    if (queue_init(&prefetch->ready, frames + 1) < 0)
+        goto fail_pool;
+    if (queue_init(&prefetch->free, frames + 1) < 0)
+        goto fail_ready;
+    for (int i = 0; i < frames; i++)
+        queue_push(&prefetch->free, frame_pool_get(prefetch->pool));
+
+    if (pthread_create(&prefetch->thread, NULL, prefetch_thread, prefetch)) {
+        fprintf(stderr, "failed to start prefetch thread\n");
+        goto fail_free;
+    }
+
+    return (prefetch);
+
+fail_free:
+    queue_destroy(&prefetch->free);
+fail_ready:
+    queue_destroy(&prefetch->ready);
+fail_pool:
+    frame_pool_destroy(prefetch->pool);
+    free(prefetch);
+    return (NULL);
+}
+
+/*
+ * Next frame of the input, NULL at the end of it (or on read error).
+ * The frame belongs to the caller until yuv_prefetch_release
+ */
+yuv_frame_t
+yuv_prefetch_next(yuv_prefetch_t prefetch)
+{
+    yuv_frame_t frame;
+    int waited;
+
+    if (prefetch->done)
+        return (NULL);
+
+    if (!prefetch->threaded) {
+        frame = frame_pool_get(prefetch->pool);
+        if (frame == NULL) {
+            fprintf(stderr, "consumer holds more frames than it asked for\n");
+            prefetch->done = 1;
+            return (NULL);
+        }
+        if (yuv_read_frame(prefetch->reader, frame) == 0)
+            return (frame);
+        frame_pool_put(prefetch->pool, frame);
+        prefetch->done = 1;
+        return (NULL);
+    }
+
+    frame = queue_pop(&prefetch->ready, &waited);
+    if (frame == NULL)
+        prefetch->done = 1;
+    else if (waited)
+        prefetch->stalls++;
+    metrics_gauge(METRIC_PREFETCH_QUEUE, queue_length(&prefetch->ready));
+
+    return (frame);
+}
+
+void
+yuv_prefetch_release(yuv_prefetch_t prefetch, yuv_frame_t frame)
+{
+    if (prefetch->threaded)
+        queue_push(&prefetch->free, frame);
+    else
+        frame_pool_put(prefetch->pool, frame);
+}
+
+/*
+ * Times the consumer found no frame ready, i.e. input could not keep up
+ */
+uint64_t
+yuv_prefetch_stalls(yuv_prefetch_t prefetch)
+{
+    return (prefetch->stalls);
+}
+
+frame_pool_t
+yuv_prefetch_pool(yuv_prefetch_t prefetch)
+{
+    return (prefetch->pool);
+}
+
+/*
+ * Stop the reader (it may be ahead of the consumer), frames of the
+ * pool are invalid after this
+ */
+void
+yuv_prefetch_stop(yuv_prefetch_t prefetch)
+{
+    if (prefetch->threaded) {
+        queue_push(&prefetch->free, NULL);
+        pthread_join(prefetch->thread, NULL);
+        queue_destroy(&prefetch->ready);
+        queue_destroy(&prefetch->free);
+    }
+    frame_pool_destroy(prefetch->pool);
+    free(prefetch);
+}
@@ -0,0 +1,51 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __YUV_PREFETCH_H__
+#define __YUV_PREFETCH_H__
+
+/*
+ * Read-ahead of raw input on a background thread. Reader fills up to
+ * depth frames ahead of the consumer, frames go to the consumer over
+ * one single-producer/single-consumer ring and come back for reuse
+ * over another, so the steady state has no locks, allocations or
+ * syscalls. A side only sleeps (on eventfd) when its ring is empty.
+ * Depth 0 reads on the caller's thread. The consumer may hold several
+ * frames at once (e.g. for lookahead), reading ahead goes on beyond them
+ */
+
+#define YUV_PREFETCH_DEPTH      4
+
+struct yuv_prefetch;
+typedef struct yuv_prefetch * yuv_prefetch_t;
+
+yuv_prefetch_t yuv_prefetch_start(yuv_reader_t reader, int depth, int held, int pool_flags);
+yuv_frame_t yuv_prefetch_next(yuv_prefetch_t prefetch);
+void yuv_prefetch_release(yuv_prefetch_t prefetch, yuv_frame_t frame);
+uint64_t yuv_prefetch_stalls(yuv_prefetch_t prefetch);
+frame_pool_t yuv_prefetch_pool(yuv_prefetch_t prefetch);
+void yuv_prefetch_stop(yuv_prefetch_t prefetch);
+
+#endif /* __YUV_PREFETCH_H__ */
@@ -23,6 +23,7 @@
  * SUCH DAMAGE.
  */
 
+#include <stdio.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,16 +32,136 @@
 #include <stdint.h>
 
 #include "yuv_reader.h"
+#include "pipe_io.h"
+#include "metrics.h"
+#include "trace.h"
 
-#define DEFAULT_PLANE_ALIGNMENT	16
-#define ALIGN_TO(ptr, alignment) (((intptr_t)(ptr) + (alignment) - 1) & ~((alignment) - 1))
+/* Cache line, also enough for any SIMD loads */
+#define DEFAULT_PLANE_ALIGNMENT	64
+#define ALIGN_TO(x, alignment) (((x) + (alignment) - 1) & ~((alignment) - 1))
 
+/* Stream header line, parameters are short */
+#define Y4M_HEADER_MAX      256
+/* Frame header without parameters */
+#define Y4M_FRAME           "FRAME"
+#define Y4M_FRAME_LEN       5
+
+/*
+ * Reads exactly @len bytes, bytes kept from the signature check go first.
+ * Pipes return whatever is there, so one read(2) is not enough.
+ * Returns 0 on success, -1 on EOF or error
+ */
+static int
+read_full(yuv_reader_t reader, uint8_t *buf, size_t len)
+{
+    size_t total;
+    ssize_t bytes;
+
+    total = (len < reader->npending) ? len : reader->npending;
+    if (total) {
+        memcpy(buf, reader->pending, total);
+        memmove(reader->pending, reader->pending + total, reader->npending - total);
+        reader->npending -= total;
+    }
+
+    while (total < len) {
+        bytes = read(reader->fd, buf + total, len - total);
+        if ((bytes < 0) && (errno == EINTR))
+            continue;
+        if (bytes <= 0)
+            return (-1);
+        total += bytes;
+    }
+
+    return (0);
+}
+
+/*
+ * Reads the rest of the header line into @line without newline
+ */
+static int
+read_line(yuv_reader_t reader, char *line, size_t size)
+{
+    size_t len = 0;
+    uint8_t c;
+
+    while (1) {
+        if (read_full(reader, &c, 1) < 0)
+            return (-1);
+        if (c == '\n')
+            break;
+        if (len + 1 >= size)
+            return (-1);
+        line[len++] = c;
+    }
+    line[len] = '\0';
+
+    return (0);
+}
+
+/*
+ * Parses parameters of Y4M stream header: W<width> H<height>
+ * F<num>:<den> C<colorspace>, interlacing, aspect and comments
+ * do not change the frame layout
+ */
+static int
+parse_y4m_header(yuv_reader_t reader, char *line)
+{
+    char *token, *last;
+    int num, den;
+
+    for (token = strtok_r(line, " ", &last); token; token = strtok_r(NULL, " ", &last)) {
+        switch (token[0]) {
+            case 'W':
+                reader->width = atoi(token + 1);
+                break;
+            case 'H':
+                reader->height = atoi(token + 1);
+                break;
+            case 'F':
+                if ((sscanf(token + 1, "%d:%d", &num, &den) == 2) && (num > 0) && (den > 0)) {
+                    reader->fps_num = num;
+                    reader->fps_den = den;
+                }
+                break;
+            case 'C':
+                /* 8-bit 4:2:0 only, chroma siting does not matter here */
+                if ((strcmp(token + 1, "420") != 0) && (strcmp(token + 1, "420jpeg") != 0)
+                        && (strcmp(token + 1, "420paldv") != 0)
+                        && (strcmp(token + 1, "420mpeg2") != 0)) {
+                    fprintf(stderr, "unsupported Y4M colorspace %s\n", token + 1);
+                    return (-1);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    if ((reader->width <= 0) || (reader->height <= 0)
+            || (reader->width % 2) || (reader->height % 2)) {
+        fprintf(stderr, "unsupported Y4M frame size %dx%d\n", reader->width, reader->height);
+        return (-1);
+    }
+
+    return (0);
+}
+
+/*
+ * Opens I420 input at @path, "-" is stdin. Y4M stream is recognized by
+ * its header, which overrides @width and @height; anything else is
+ * raw frames of @width x @height
+ */
 yuv_reader_t
 yuv_reader_open(const char *path, int width, int height)
 {
-    yuv_reader_t reader = malloc(sizeof(struct yuv_reader));
+    yuv_reader_t reader = calloc(1, sizeof(struct yuv_reader));
+    char line[Y4M_HEADER_MAX];
 
-    reader->fd = open(path, O_RDONLY);
+    if (reader == NULL)
+        return (NULL);
+
+    reader->fd = pipe_io_open_input(path);
     if (reader->fd < 0) {
         free(reader);
         return (NULL);
@@ -49,75 +170,132 @@ yuv_reader_open(const char *path, int width, int height)
     reader->width = width;
     reader->height = height;
 
+    /* Input can be a pipe, so there is no peeking: keep what was read */
+    if (read_full(reader, reader->pending, Y4M_MAGIC_LEN) < 0)
+        return (reader);
+
+    if (memcmp(reader->pending, Y4M_MAGIC, Y4M_MAGIC_LEN) != 0) {
+        reader->npending = Y4M_MAGIC_LEN;
+        return (reader);
+    }
+
+    reader->y4m = 1;
+    if ((read_line(reader, line, sizeof(line)) < 0) || (parse_y4m_header(reader, line) < 0)) {
+        fprintf(stderr, "bad Y4M header in %s\n", path);
+        close(reader->fd);
+        free(reader);
+        return (NULL);
+    }
+
     return (reader);
 }
 
+/*
+ * Skips FRAME line in front of Y4M frame
+ */
+static int
+read_frame_header(yuv_reader_t reader)
+{
+    char header[Y4M_FRAME_LEN + 1];
+    char line[Y4M_HEADER_MAX];
+
+    if (read_full(reader, (uint8_t *)header, sizeof(header)) < 0)
+        return (-1);
+    if (memcmp(header, Y4M_FRAME, Y4M_FRAME_LEN) != 0) {
+        fprintf(stderr, "Y4M frame header is missing\n");
+        return (-1);
+    }
+
+    /* Frame parameters are rare, skip them */
+    if (header[Y4M_FRAME_LEN] != '\n')
+        return (read_line(reader, line, sizeof(line)));
+
+    return (0);
+}
+
 int
 yuv_read_frame(yuv_reader_t reader, yuv_frame_t frame)
 {
-    ssize_t bytes;
+    uint64_t begin = metrics_stage_begin();
+    uint64_t tr = trace_begin();
 
-    /*
-     * This is not very robust but good enough for demo
-     */
-    bytes = read(reader->fd, frame->Y, frame->Ysize);
-    if (bytes <= 0)
-        return (-1);
-    bytes = read(reader->fd, frame->U, frame->Usize);
-    if (bytes <= 0)
+    if (reader->y4m && (read_frame_header(reader) < 0))
         return (-1);
-    bytes = read(reader->fd, frame->V, frame->Vsize);
-    if (bytes <= 0)
+
+    if ((read_full(reader, frame->Y, frame->Ysize) < 0)
+            || (read_full(reader, frame->U, frame->Usize) < 0)
+            || (read_full(reader, frame->V, frame->Vsize) < 0))
         return (-1);
 
+    trace_end("yuv_read_frame", tr);
+    metrics_stage_end(METRIC_STAGE_READ, begin);
+    metrics_count(METRIC_FRAMES_READ, 1);
+    metrics_count(METRIC_BYTES_READ, frame->Ysize + frame->Usize + frame->Vsize);
+
     return (0);
 }
 
 yuv_frame_t
 yuv_alloc_frame(yuv_reader_t reader)
+{
+	return yuv_alloc_frame_size(reader->width, reader->height);
+}
+
+/*
+ * Lay out I420 planes of @width x @height frame in memory at @base
+ * (aligned to @alignment), every plane starting at @alignment boundary.
+ * Returns number of bytes the planes take, @frame may be NULL to only
+ * get the size
+ */
+size_t
+yuv_frame_layout(yuv_frame_t frame, uint8_t *base, int width, int height, size_t alignment)
+{
+	size_t Ysize = (size_t)width*height;
+	size_t UVsize = (size_t)width*height/4;
+	size_t Uoffset = ALIGN_TO(Ysize, alignment);
+	size_t Voffset = ALIGN_TO(Uoffset + UVsize, alignment);
+
+	if (frame) {
+		frame->width = width;
+		frame->height = height;
+		frame->Y = base;
+		frame->U = base + Uoffset;
+		frame->V = base + Voffset;
+		frame->Ysize = Ysize;
+		frame->Usize = UVsize;
+		frame->Vsize = UVsize;
+		frame->mem = NULL;
+	}
+
+	return (Voffset + UVsize);
+}
+
+/*
+ * Allocate I420 frame of arbitrary dimensions, e.g. scaler output.
+ * All three planes share one allocation
+ */
+yuv_frame_t
+yuv_alloc_frame_size(int width, int height)
 {
 	yuv_frame_t frame = malloc(sizeof(struct yuv_frame));
-	size_t Ysize = reader->width*reader->height;
-	size_t UVsize = reader->width*reader->height/4;
-
-	/*
-	 * Encoder might have alignment requirements for memory addresses
-	 * use default one for now
-	 */
-	frame->Yptr = (uint8_t*)malloc(Ysize + DEFAULT_PLANE_ALIGNMENT);
-	if (!frame->Yptr) {
-        free(frame);
-        return (NULL);
-    }
-	frame->Y = (uint8_t*)ALIGN_TO(frame->Yptr, DEFAULT_PLANE_ALIGNMENT);
-	frame->Ysize = Ysize;
+	size_t size = yuv_frame_layout(NULL, NULL, width, height, DEFAULT_PLANE_ALIGNMENT);
+	void *mem;
 
-	frame->Uptr = (uint8_t*)malloc(UVsize + DEFAULT_PLANE_ALIGNMENT);
-	if (!frame->Uptr) {
-        free(frame->Yptr);
-        free(frame);
-        return (NULL);
-    }
-	frame->Usize = UVsize;
-	frame->U = (uint8_t*)ALIGN_TO(frame->Uptr, DEFAULT_PLANE_ALIGNMENT);
-
-	frame->Vptr = (uint8_t*)malloc(UVsize + DEFAULT_PLANE_ALIGNMENT);
-	if (!frame->Vptr) {
-        free(frame->Yptr);
-        free(frame->Vptr);
-        free(frame);
-        return (NULL);
-    }
-	frame->Vsize = UVsize;
-	frame->V = (uint8_t*)ALIGN_TO(frame->Vptr, DEFAULT_PLANE_ALIGNMENT);
+	if (!frame)
+		return (NULL);
+
+	if (posix_memalign(&mem, DEFAULT_PLANE_ALIGNMENT, size)) {
+		free(frame);
+		return (NULL);
+	}
+	yuv_frame_layout(frame, mem, width, height, DEFAULT_PLANE_ALIGNMENT);
+	frame->mem = mem;
 
 	return (frame);
 }
 
 void yuv_free_frame(yuv_frame_t frame)
 {
-	free(frame->Yptr);
-	free(frame->Uptr);
-	free(frame->Vptr);
+	free(frame->mem);
 	free(frame);
 }
@@ -41,17 +41,27 @@ struct yuv_frame
     size_t              Usize;
     size_t              Vsize;
 
-    /* Original pointers to use in free() */
-    uint8_t             *Yptr;
-    uint8_t             *Uptr;
-    uint8_t             *Vptr;
+    /* Single allocation holding all planes, NULL for frames of a pool */
+    uint8_t             *mem;
 };
 
+/* Signature of Y4M stream header */
+#define Y4M_MAGIC           "YUV4MPEG2"
+#define Y4M_MAGIC_LEN       9
+
 struct yuv_reader
 {
     int                 width;
     int                 height;
     int                 fd;
+    /* Y4M stream, every frame is preceded by FRAME line */
+    int                 y4m;
+    /* Frame rate from Y4M header, 0 if unknown */
+    int                 fps_num;
+    int                 fps_den;
+    /* Bytes read looking for Y4M signature in raw stream */
+    uint8_t             pending[Y4M_MAGIC_LEN];
+    size_t              npending;
 };
 
 typedef struct yuv_reader * yuv_reader_t;
@@ -60,6 +70,8 @@ typedef struct yuv_frame * yuv_frame_t;
 yuv_reader_t yuv_reader_open(const char *path, int width, int height);
 int yuv_read_frame(yuv_reader_t reader, yuv_frame_t framep);
 yuv_frame_t yuv_alloc_frame(yuv_reader_t reader);
+yuv_frame_t yuv_alloc_frame_size(int width, int height);
+size_t yuv_frame_layout(yuv_frame_t frame, uint8_t *base, int width, int height, size_t alignment);
 void yuv_free_frame(yuv_frame_t frame);
 
 #endif /* __YUV_READER_H__ */
@@ -0,0 +1,317 @@
+/*-
+ * Copyright (c) 2018 Oleksandr Tymoshenko <gonzo@bluezbox.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "yuv_reader.h"
+#include "yuv_ops.h"
+#include "yuv_scaler.h"
+
+#define MAX_SCALER_THREADS  16
+
+/*
+ * Precomputed source positions for one plane: for every destination
+ * row index of the first source row and the weight of the second,
+ * columns are in the same form inside @hscale
+ */
+struct scale_plane {
+    int                 src_width;
+    int                 src_height;
+    int                 dst_width;
+    int                 dst_height;
+    struct yuv_hscale   *hscale;
+    int                 *yoff;
+    uint8_t             *yweight;
+};
+
+struct scaler_worker {
+    struct yuv_scaler   *scaler;
+    int                 index;
+    pthread_t           thread;
+    /* Vertically interpolated source row */
+    uint8_t             *row;
+};
+
+struct yuv_scaler {
+    struct scale_plane  luma;
+    struct scale_plane  chroma;
+
+    int                 nthreads;
+    struct scaler_worker workers[MAX_SCALER_THREADS];
+
+    pthread_mutex_t     lock;
+    pthread_cond_t      start;
+    pthread_cond_t      done;
+    /* Incremented for every frame, workers wait for it to change */
+    unsigned int        generation;
+    int                 pending;
+    int                 quit;
+
+    yuv_frame_t         src;
+    yuv_frame_t         dst;
+};
+
+/*
+ * Fill positions/weights for scaling @src_len samples into @dst_len,
+ * sample centers are aligned
+ */
+static int
+scale_table(int src_len, int dst_len, int **offp, uint8_t **weightp)
+{
+    int *off = malloc(sizeof(int) * dst_len);
+    uint8_t *weight = malloc(dst_len);
+
+    if ((off == NULL) || (weight == NULL)) {
+        free(off);
+        free(weight);
+        return (-1);
+    }
+
+    for (int i = 0; i < dst_len; i++) {
+        /* 16.16 fixed point source coordinate */
+        int64_t pos = (((int64_t)(2*i + 1) * src_len << 16) / (2 * dst_len)) - (1 << 15);
+        if (pos < 0)
+            pos = 0;
+        off[i] = pos >> 16;
+        weight[i] = ((pos & 0xffff) + (1 << (15 - YUV_BLEND_SHIFT))) >> (16 - YUV_BLEND_SHIFT);
+        if (off[i] >= src_len - 1) {
+            off[i] = src_len - 1;
+            weight[i] = 0;
+        }
+    }
+
+    *offp = off;
+    *weightp = weight;
+
+    return (0);
+}
+
+static int
+scale_plane_init(struct scale_plane *plane, int sw, int sh, int dw, int dh)
+{
+    int *xoff;
+    uint8_t *xweight;
+
+    plane->src_width = sw;
+    plane->src_height = sh;
+    plane->dst_width = dw;
+    plane->dst_height = dh;
+
+    if (scale_table(sw, dw, &xoff, &xweight) < 0)
+        return (-1);
+    /* Interpolated rows have the last sample duplicated */
+    plane->hscale = yuv_hscale_create(xoff, xweight, dw, sw + 1);
+    free(xoff);
+    free(xweight);
+    if (plane->hscale == NULL)
+        return (-1);
+    if (scale_table(sh, dh, &plane->yoff, &plane->yweight) < 0)
+        return (-1);
+
+    return (0);
+}
+
+static void
+scale_plane_free(struct scale_plane *plane)
+{
+    yuv_hscale_destroy(plane->hscale);
+    free(plane->yoff);
+    free(plane->yweight);
+}
+
+/*
+ * Scale rows [@first, @last) of destination plane: blend two source rows,
+ * then interpolate the result horizontally, both with yuv_ops kernels
+ */
+static void
+scale_plane_band(struct scale_plane *plane, const uint8_t *src, uint8_t *dst,
+    uint8_t *row, int first, int last)
+{
+    int sw = plane->src_width;
+    int dw = plane->dst_width;
+
+    for (int y = first; y < last; y++) {
+        const uint8_t *a = src + (size_t)plane->yoff[y] * sw;
+        const uint8_t *b = (plane->yoff[y] < plane->src_height - 1) ? a + sw : a;
+        uint8_t *out = dst + (size_t)y * dw;
+
+        yuv_blend_rows(row, a, b, sw, plane->yweight[y]);
+        /* Duplicate last sample so x+1 is always valid */
+        row[sw] = row[sw - 1];
+
+        yuv_hscale_row(plane->hscale, out, row);
+    }
+}
+
+static void
+scaler_do_band(struct yuv_scaler *scaler, struct scaler_worker *worker)
+{
+    int n = scaler->nthreads;
+    int i = worker->index;
+    int lh = scaler->luma.dst_height;
+    int ch = scaler->chroma.dst_height;
+
+    scale_plane_band(&scaler->luma, scaler->src->Y, scaler->dst->Y, worker->row,
+        lh * i / n, lh * (i + 1) / n);
+    scale_plane_band(&scaler->chroma, scaler->src->U, scaler->dst->U, worker->row,
+        ch * i / n, ch * (i + 1) / n);
+    scale_plane_band(&scaler->chroma, scaler->src->V, scaler->dst->V, worker->row,
+        ch * i / n, ch * (i + 1) / n);
+}
+
+static void *
+scaler_thread(void *arg)
+{
+    struct scaler_worker *worker = arg;
+    struct yuv_scaler *scaler = worker->scaler;
+    unsigned int generation = 0;
+
+    pthread_mutex_lock(&scaler->lock);
+    while (1) {
+        while (!scaler->quit && (scaler->generation == generation))
+            pthread_cond_wait(&scaler->start, &scaler->lock);
+        if (scaler->quit)
+            break;
+        generation = scaler->generation;
+        pthread_mutex_unlock(&scaler->lock);
+
+        scaler_do_band(scaler, worker);
+
+        pthread_mutex_lock(&scaler->lock);
+        if (--scaler->pending == 0)
+            pthread_cond_signal(&scaler->done);
+    }
+    pthread_mutex_unlock(&scaler->lock);
+
+    return (NULL);
+}
+
+yuv_scaler_t
+yuv_scaler_create(int src_width, int src_height, int dst_width, int dst_height, int nthreads)
+{
+    struct yuv_scaler *scaler;
+
+    if ((src_width & 1) || (src_height & 1) || (dst_width & 1) || (dst_height & 1)) {
+        fprintf(stderr, "scaler: I420 dimensions must be even\n");
+        return (NULL);
+    }
+
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > MAX_SCALER_THREADS)
+        nthreads = MAX_SCALER_THREADS;
+
+    scaler = calloc(1, sizeof(struct yuv_scaler));
+    if (scaler == NULL)
+        return (NULL);
+
+    if ((scale_plane_init(&scaler->luma, src_width, src_height, dst_width, dst_height) < 0) ||
+        (scale_plane_init(&scaler->chroma, src_width/2, src_height/2, dst_width/2, dst_height/2) < 0)) {
+        scale_plane_free(&scaler->luma);
+        scale_plane_free(&scaler->chroma);
+        free(scaler);
+        return (NULL);
+    }
+
+    pthread_mutex_init(&scaler->lock, NULL);
+    pthread_cond_init(&scaler->start, NULL);
+    pthread_cond_init(&scaler->done, NULL);
+
+    /* Worker 0 is the caller of yuv_scaler_run */
+    scaler->nthreads = 0;
+    for (int i = 0; i < nthreads; i++) {
+        struct scaler_worker *worker = &scaler->workers[i];
+
+        worker->scaler = scaler;
+        worker->index = i;
+        worker->row = malloc(src_width + 1);
+        if (worker->row == NULL)
+            break;
+        if ((i > 0) && pthread_create(&worker->thread, NULL, scaler_thread, worker)) {
+            free(worker->row);
+            break;
+        }
+        scaler->nthreads++;
+    }
+
+    if (scaler->nthreads == 0) {
+        yuv_scaler_destroy(scaler);
+        return (NULL);
+    }
+
+    return (scaler);
+}
+
+int
+yuv_scaler_run(yuv_scaler_t scaler, yuv_frame_t src, yuv_frame_t dst)
+{
+    if ((src->width != scaler->luma.src_width) || (src->height != scaler->luma.src_height) ||
+        (dst->width != scaler->luma.dst_width) || (dst->height != scaler->luma.dst_height))
+        return (-1);
+
+    pthread_mutex_lock(&scaler->lock);
+    scaler->src = src;
+    scaler->dst = dst;
+    scaler->pending = scaler->nthreads - 1;
+    scaler->generation++;
+    pthread_cond_broadcast(&scaler->start);
+    pthread_mutex_unlock(&scaler->lock);
+
+    scaler_do_band(scaler, &scaler->workers[0]);
+
+    pthread_mutex_lock(&scaler->lock);
+    while (scaler->pending > 0)
+        pthread_cond_wait(&scaler->done, &scaler->lock);
+    pthread_mutex_unlock(&scaler->lock);
+
+    return (0);
+}
+
+void
+yuv_scaler_destroy(yuv_scaler_t scaler)
+{
+    pthread_mutex_lock(&scaler->lock);
+    scaler->quit = 1;
+    pthread_cond_broadcast(&scaler->start);
+    pthread_mutex_unlock(&scaler->lock);
+
+    for (int i = 0; i < scaler->nthreads; i++) {
+        if (i > 0)
+            pthread_join(scaler->workers[i].thread, NULL);
+        free(scaler->workers[i].row);
+    }
+
+    pthread_mutex_destroy(&scaler->lock);
+    pthread_cond_destroy(&scaler->start);
+    pthread_cond_destroy(&scaler->done);
+
+    scale_plane_free(&scaler->luma);
+    scale_plane_free(&scaler->chroma);
+    free(scaler);
+}